@@ -0,0 +1,136 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/alloc_counter.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+namespace cola {
+
+#ifdef COLA_ALLOC_COUNTER
+
+namespace {
+
+static thread_local AllocStats thread_stats = {0, 0};
+
+void* Allocate(size_t size) {
+  ++thread_stats.count;
+  thread_stats.bytes += size;
+  return ::malloc(size ? size : 1);
+}
+
+void* AllocateAligned(size_t size, std::align_val_t align) {
+  ++thread_stats.count;
+  thread_stats.bytes += size;
+  // aligned_alloc takes a multiple of the alignment.
+  const size_t alignment = static_cast<size_t>(align);
+  size = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+  return ::aligned_alloc(alignment, size);
+}
+
+}  // namespace
+
+AllocStats ThreadAllocStats() { return thread_stats; }
+
+bool AllocCounting() { return true; }
+
+}  // namespace cola
+
+void* operator new(size_t size) {
+  void* p = cola::Allocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return cola::Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return cola::Allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+  void* p = cola::AllocateAligned(size, align);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+
+void* operator new(size_t size, std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+  return cola::AllocateAligned(size, align);
+}
+
+void* operator new[](size_t size, std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  return cola::AllocateAligned(size, align);
+}
+
+void operator delete(void* p) noexcept { ::free(p); }
+
+void operator delete[](void* p) noexcept { ::free(p); }
+
+void operator delete(void* p, size_t) noexcept { ::free(p); }
+
+void operator delete[](void* p, size_t) noexcept { ::free(p); }
+
+void operator delete(void* p, const std::nothrow_t&) noexcept { ::free(p); }
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept { ::free(p); }
+
+void operator delete(void* p, std::align_val_t) noexcept { ::free(p); }
+
+void operator delete[](void* p, std::align_val_t) noexcept { ::free(p); }
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  ::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  ::free(p);
+}
+
+void operator delete(void* p, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  ::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  ::free(p);
+}
+
+#else
+
+AllocStats ThreadAllocStats() { return {0, 0}; }
+
+bool AllocCounting() { return false; }
+
+}  // namespace cola
+
+#endif  // COLA_ALLOC_COUNTER
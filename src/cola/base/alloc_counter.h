@@ -0,0 +1,59 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_BASE_ALLOC_COUNTER_H_
+#define COLA_BASE_ALLOC_COUNTER_H_
+
+#include <stddef.h>
+
+namespace cola {
+
+// Heap allocations made by the calling thread, counted by the global
+// operator new replacements in alloc_counter.cc. They are an instrumentation
+// mode, only compiled into builds defining COLA_ALLOC_COUNTER, the stats of
+// other builds staying zero.
+struct AllocStats {
+  size_t count;
+  size_t bytes;
+};
+
+AllocStats ThreadAllocStats();
+
+// Whether this build counts allocations.
+bool AllocCounting();
+
+// Measures the allocations made by the current thread since construction:
+//
+//   AllocCounter counter;
+//   network.Forward(ctx, input, &output);
+//   CHECK_EQ(counter.Delta().count, 0);
+class AllocCounter {
+ public:
+  AllocCounter() : start_(ThreadAllocStats()) {}
+
+  AllocStats Delta() const {
+    AllocStats now = ThreadAllocStats();
+    return {now.count - start_.count, now.bytes - start_.bytes};
+  }
+
+  void Reset() { start_ = ThreadAllocStats(); }
+
+ private:
+  AllocStats start_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_BASE_ALLOC_COUNTER_H_
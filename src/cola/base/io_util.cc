@@ -15,6 +15,8 @@
 
 #include "cola/base/io_util.h"
 
+#include <errno.h>
+
 #include <filesystem>
 #include <fstream>
 
@@ -33,6 +35,23 @@ bool ReadFile(const std::string& path, std::string* data) {
   return true;
 }
 
+bool ReadFileAt(int fd, uint64_t offset, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = ::pread(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
 bool ReadProtoTxt(const std::string& filename, pb::Message* proto) {
   int fd = ::open(filename.c_str(), O_RDONLY);
   if (fd == -1) {
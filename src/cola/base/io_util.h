@@ -28,6 +28,9 @@ namespace cola {
 
 bool ReadFile(const std::string& path, std::string* data);
 
+// Reads `size` bytes at `offset` of `fd`, retrying short reads.
+bool ReadFileAt(int fd, uint64_t offset, void* data, size_t size);
+
 bool ReadProtoTxt(const std::string& filename,
                   ::google::protobuf::Message* proto);
 }  // namespace cola
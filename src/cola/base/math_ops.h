@@ -21,21 +21,27 @@
 #include <algorithm>
 #include <functional>
 
+#include "cola/base/thread_pool.h"
+
 namespace cola {
 
 namespace details {
 template <typename T, typename Op>
 inline void Calculate(const T* a, const T* b, const size_t n, T* c, Op op) {
-  for (size_t i = 0; i < n; ++i) {
-    c[i] = op(a[i], b[i]);
-  }
+  ParallelFor(0, n, GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      c[i] = op(a[i], b[i]);
+    }
+  });
 }
 
 template <typename T, typename Op>
 inline void Calculate(const T* a, const T& b, const size_t n, T* c, Op op) {
-  for (size_t i = 0; i < n; ++i) {
-    c[i] = op(a[i], b);
-  }
+  ParallelFor(0, n, GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      c[i] = op(a[i], b);
+    }
+  });
 }
 
 template <typename R>
@@ -101,84 +107,119 @@ void Divides(const T* a, const T* b, const size_t n, T* c) {
 
 enum TransType { kNoTrans = 0, kTransA = 1, kTransB = 2, kTransAB = 3 };
 
+// Adds the product to `c` instead of overwriting it if `accumulate`.
 template <typename T>
 void MatrixMultiply(const T* a, const T* b, TransType t, const size_t M,
-                    const size_t N, const size_t K, T* c) {
+                    const size_t N, const size_t K, T* c,
+                    bool accumulate = false) {
+  // Rows of the output are independent, split them among threads.
+  const size_t grain = GrainSize(N * K);
   if (t == kNoTrans) {
     // (M x K) * (K x N)
-    const size_t r1 = M;
     const size_t c1 = K;
     const size_t r2 = K;
     const size_t c2 = N;
-    for (size_t i = 0; i < r1; ++i) {
-      for (size_t j = 0; j < c2; ++j) {
-        T dp(0);
-        for (size_t k = 0; k < r2; ++k) {
-          dp += a[i * c1 + k] * b[k * c2 + j];
+    ParallelFor(0, M, grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < c2; ++j) {
+          T dp(0);
+          for (size_t k = 0; k < r2; ++k) {
+            dp += a[i * c1 + k] * b[k * c2 + j];
+          }
+          c[i * c2 + j] = accumulate ? c[i * c2 + j] + dp : dp;
         }
-        c[i * c2 + j] = dp;
       }
-    }
+    });
   } else if (t == kTransB) {
     // (M x K) * (N x K)
-    const size_t r1 = M;
     const size_t c1 = K;
     const size_t r2 = N;
     const size_t c2 = K;
-    for (size_t i = 0; i < r1; ++i) {
-      for (size_t j = 0; j < r2; ++j) {
-        T dp(0);
-        for (size_t k = 0; k < c2; ++k) {
-          dp += a[i * c1 + k] * b[j * c2 + k];
+    ParallelFor(0, M, grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < r2; ++j) {
+          T dp(0);
+          for (size_t k = 0; k < c2; ++k) {
+            dp += a[i * c1 + k] * b[j * c2 + k];
+          }
+          c[i * r2 + j] = accumulate ? c[i * r2 + j] + dp : dp;
         }
-        c[i * r2 + j] = dp;
       }
-    }
+    });
   } else if (t == kTransA) {
     // (K x M) * (K x N)
-    // const size_t r1 = K;
     const size_t c1 = M;
     const size_t r2 = K;
     const size_t c2 = N;
-    for (size_t i = 0; i < c1; ++i) {
-      for (size_t j = 0; j < c2; ++j) {
-        T dp(0);
-        for (size_t k = 0; k < r2; ++k) {
-          dp += a[k * c1 + i] * b[k * c2 + j];
+    ParallelFor(0, M, grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        for (size_t j = 0; j < c2; ++j) {
+          T dp(0);
+          for (size_t k = 0; k < r2; ++k) {
+            dp += a[k * c1 + i] * b[k * c2 + j];
+          }
+          c[i * c2 + j] = accumulate ? c[i * c2 + j] + dp : dp;
         }
-        c[i * c2 + j] = dp;
       }
-    }
+    });
   }
 }
 
+// Multiplies the rows [offsets[g], offsets[g + 1]) of `a` (M x K) by the
+// g-th of the `groups` stacked K x N matrices of `b`, into the same rows of
+// `c` (M x N). The rows of all groups share one parallel loop, every range
+// of it runs MatrixMultiply on the rows of each group it covers.
 template <typename T>
-void MatrixSum(const T* a, const size_t R, const size_t C, const size_t axis,
-               T* c) {
-  if (axis == -1) {
-    T s(0);
-    for (size_t i = 0; i < R; ++i) {
-      for (size_t j = 0; j < C; ++j) {
-        s += a[i * C + j];
-      }
+void GroupedMatrixMultiply(const T* a, const T* b, const size_t* offsets,
+                           const size_t groups, const size_t N,
+                           const size_t K, T* c) {
+  const size_t M = offsets[groups];
+  ParallelFor(0, M, GrainSize(N * K), [&](size_t begin, size_t end) {
+    size_t g = std::upper_bound(offsets, offsets + groups + 1, begin) -
+               offsets - 1;
+    for (size_t i = begin; i < end; ++g) {
+      const size_t rows = std::min(end, offsets[g + 1]) - i;
+      MatrixMultiply(a + i * K, b + g * K * N, kNoTrans, rows, N, K,
+                     c + i * N);
+      i += rows;
     }
-    *c = s;
+  });
+}
+
+template <typename T>
+void MatrixSum(const T* a, const size_t R, const size_t C, const size_t axis,
+               T* c, bool accumulate = false) {
+  if (axis == static_cast<size_t>(-1)) {
+    *c = (accumulate ? *c : T(0)) + ParallelReduce(
+        0, R * C, GrainSize(1), T(0),
+        [&](size_t begin, size_t end) {
+          T s(0);
+          for (size_t i = begin; i < end; ++i) {
+            s += a[i];
+          }
+          return s;
+        },
+        std::plus<T>());
   } else if (axis == 0) {
-    for (size_t i = 0; i < C; ++i) {
-      T s(0);
-      for (size_t j = 0; j < R; ++j) {
-        s += a[j * C + i];
+    ParallelFor(0, C, GrainSize(R), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        T s(0);
+        for (size_t j = 0; j < R; ++j) {
+          s += a[j * C + i];
+        }
+        c[i] = accumulate ? c[i] + s : s;
       }
-      c[i] = s;
-    }
+    });
   } else if (axis == 1) {
-    for (size_t i = 0; i < R; ++i) {
-      T s(0);
-      for (size_t j = 0; j < C; ++j) {
-        s += a[i * C + j];
+    ParallelFor(0, R, GrainSize(C), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        T s(0);
+        for (size_t j = 0; j < C; ++j) {
+          s += a[i * C + j];
+        }
+        c[i] = accumulate ? c[i] + s : s;
       }
-      c[i] = s;
-    }
+    });
   }
 }
 
@@ -198,35 +239,48 @@ void Softmax(const T* a, T* b, size_t n) {
 
 template <typename T>
 void Softmax(const T* a, T* b, const size_t batch_size, const size_t n) {
-  for (size_t i = 0; i < batch_size; ++i) {
-    Softmax(a + i * n, b + i * n, n);
-  }
+  ParallelFor(0, batch_size, GrainSize(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Softmax(a + i * n, b + i * n, n);
+    }
+  });
 }
 
 template <typename T>
 void Sigmoid(const T* a, T* b, const size_t n) {
   T one(1.0);
-  for (size_t i = 0; i < n; ++i) {
-    b[i] = one / (one + details::FloatingPoint<T>::Exp(-a[i]));
-  }
+  ParallelFor(0, n, GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      b[i] = one / (one + details::FloatingPoint<T>::Exp(-a[i]));
+    }
+  });
 }
 
 template <typename T>
 void Sqrt(const T* a, T* b, const size_t n) {
-  for (size_t i = 0; i < n; ++i) {
-    b[i] = details::FloatingPoint<T>::Sqrt(a[i]);
-  }
+  ParallelFor(0, n, GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      b[i] = details::FloatingPoint<T>::Sqrt(a[i]);
+    }
+  });
 }
 
 template <typename T>
 T CrossEntropyError(const T* y, const T* t, const size_t batch_size,
                     const size_t n) {
-  T s = T(0);
-  for (size_t i = 0; i < batch_size; ++i) {
-    size_t idx = std::max_element(t + i * n, t + (i + 1) * n) - (t + i * n);
-    assert(idx < n);
-    s += details::FloatingPoint<T>::Log(y[i * n + idx] + 1e-7);
-  }
+  T s = ParallelReduce(
+      0, batch_size, GrainSize(n), T(0),
+      [&](size_t begin, size_t end) {
+        T s(0);
+        for (size_t i = begin; i < end; ++i) {
+          size_t idx =
+              std::max_element(t + i * n, t + (i + 1) * n) - (t + i * n);
+          assert(idx < n);
+          s += details::FloatingPoint<T>::Log(y[i * n + idx] + 1e-7);
+        }
+        return s;
+      },
+      std::plus<T>());
   return -s / T(batch_size);
 }
 
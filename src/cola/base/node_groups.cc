@@ -0,0 +1,96 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/node_groups.h"
+
+#include "cola/base/logging.h"
+#include "cola/base/numa.h"
+
+namespace cola {
+
+NodeGroups::NodeGroups()
+    : n_(0),
+      call_(nullptr),
+      arg_(nullptr),
+      generation_(0),
+      pending_(0),
+      stop_(false) {
+  const auto& nodes = numa::Nodes();
+  const size_t num_threads =
+      std::max<size_t>(1, ThreadPool::Default()->size() / nodes.size());
+  for (const auto& node : nodes) {
+    groups_.emplace_back(new Group{node.id, {}});
+  }
+  for (size_t g = 0; g < groups_.size(); ++g) {
+    groups_[g]->thread = std::thread(&NodeGroups::Loop, this, g, num_threads);
+  }
+  LOG(INFO) << "[NodeGroups] groups: " << groups_.size()
+            << ", threads per group: " << num_threads;
+}
+
+NodeGroups::~NodeGroups() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& group : groups_) {
+    group->thread.join();
+  }
+}
+
+NodeGroups* NodeGroups::Default() {
+  static NodeGroups groups;
+  return &groups;
+}
+
+void NodeGroups::Run(size_t n, void (*call)(void*, size_t), void* arg) {
+  std::unique_lock<std::mutex> run(run_mutex_);
+  std::unique_lock<std::mutex> guard(mutex_);
+  n_ = n;
+  call_ = call;
+  arg_ = arg;
+  pending_ = groups_.size();
+  ++generation_;
+  cv_.notify_all();
+  cv_.wait(guard, [&] { return pending_ == 0; });
+}
+
+void NodeGroups::Loop(size_t g, size_t num_threads) {
+  const int node = groups_[g]->node;
+  numa::BindThread(node);
+  // Created here, so that its slots are local to the node as well.
+  ThreadPool pool(num_threads, node);
+  ThreadPool::SetLocal(&pool);
+  size_t seen = 0;
+  while (true) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    cv_.wait(guard, [&] { return stop_ || generation_ != seen; });
+    if (stop_) {
+      return;
+    }
+    seen = generation_;
+    guard.unlock();
+    for (size_t s = g; s < n_; s += groups_.size()) {
+      call_(arg_, s);
+    }
+    guard.lock();
+    if (--pending_ == 0) {
+      cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace cola
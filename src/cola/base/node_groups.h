@@ -0,0 +1,84 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_BASE_NODE_GROUPS_H_
+#define COLA_BASE_NODE_GROUPS_H_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+// One group of threads per NUMA node for the shards of tensor-parallel
+// layers. The leader of a group is bound to its node and the loops it
+// issues run on a pool of threads of the same node, so a shard computes
+// where its weights live. Each group has a pool of its own, the size of the
+// default pool divided by the number of nodes, whose threads run besides
+// those of the default pool: while shards run, the default pool idles.
+class NodeGroups {
+ public:
+  NodeGroups();
+  ~NodeGroups();
+
+  // The process-wide groups, created on first use.
+  static NodeGroups* Default();
+
+  size_t size() const { return groups_.size(); }
+
+  // The node of the group running shard `s`.
+  int node(size_t s) const { return groups_[s % groups_.size()]->node; }
+
+  // Calls fn(s) for every shard in [0, n) on group s % size() and waits for
+  // all of them. Calls from several threads run one after the other.
+  template <typename Fn>
+  void Run(size_t n, Fn&& fn) {
+    using F = typename std::remove_reference<Fn>::type;
+    auto call = [](void* arg, size_t s) { (*static_cast<F*>(arg))(s); };
+    Run(n, call, const_cast<void*>(static_cast<const void*>(&fn)));
+  }
+
+ private:
+  struct Group {
+    int node;
+    std::thread thread;
+  };
+
+  void Run(size_t n, void (*call)(void*, size_t), void* arg);
+
+  void Loop(size_t g, size_t num_threads);
+
+  std::vector<std::unique_ptr<Group>> groups_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t n_;
+  void (*call_)(void*, size_t);
+  void* arg_;
+  size_t generation_;
+  size_t pending_;
+  bool stop_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_BASE_NODE_GROUPS_H_
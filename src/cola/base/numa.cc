@@ -0,0 +1,263 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/numa.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "cola/base/logging.h"
+
+namespace cola {
+namespace numa {
+
+namespace {
+
+static const size_t kMaxNodes = 64;
+
+struct State {
+  NumaConfig conf;
+  std::vector<Node> nodes;
+  std::vector<int> cpu_nodes;
+};
+
+static State& GetState() {
+  static State state;
+  return state;
+}
+
+static thread_local int thread_node = -1;
+
+// Parses a sysfs cpu list such as "0-3,8-11".
+static std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::istringstream iss(list);
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    size_t dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+static std::vector<Node> ReadNodes() {
+  std::vector<Node> nodes;
+  for (size_t i = 0; i < kMaxNodes; ++i) {
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(i) +
+                      "/cpulist");
+    std::string list;
+    if (!ifs || !std::getline(ifs, list) || list.empty()) {
+      continue;
+    }
+    nodes.push_back({static_cast<int>(i), ParseCpuList(list)});
+  }
+  if (nodes.empty()) {  // No NUMA support, treat the machine as one node.
+    Node node{0, {}};
+    for (int cpu = 0; cpu < ::sysconf(_SC_NPROCESSORS_ONLN); ++cpu) {
+      node.cpus.push_back(cpu);
+    }
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+static unsigned long AllNodesMask() {
+  unsigned long mask = 0;
+  for (const Node& node : Nodes()) {
+    mask |= 1ul << node.id;
+  }
+  return mask;
+}
+
+static size_t PageSize() {
+  static const size_t page = ::sysconf(_SC_PAGESIZE);
+  return page;
+}
+
+static bool Mbind(void* addr, size_t size, int mode, unsigned long mask) {
+  if (size == 0) {
+    return true;
+  }
+  if (reinterpret_cast<uintptr_t>(addr) % PageSize() != 0) {
+    LOG(ERROR) << "[Numa] buffer at " << addr << " does not start a page";
+    return false;
+  }
+  // The kernel rounds the length up to the end of the last page.
+  return ::syscall(SYS_mbind, addr, size, mode, &mask, kMaxNodes,
+                   MPOL_MF_MOVE) == 0;
+}
+
+static void FreeFloats(Float* addr) { FreePages(addr); }
+
+}  // namespace
+
+bool Init(const NumaConfig& conf) {
+  if (conf.affinity() != "none" && conf.affinity() != "core" &&
+      conf.affinity() != "node") {
+    LOG(ERROR) << "[Numa] unknown affinity: " << conf.affinity();
+    return false;
+  }
+  if (conf.memory() != "first_touch" && conf.memory() != "interleave") {
+    LOG(ERROR) << "[Numa] unknown memory policy: " << conf.memory();
+    return false;
+  }
+  State& state = GetState();
+  state.conf = conf;
+  state.nodes = ReadNodes();
+  for (const Node& node : state.nodes) {
+    for (int cpu : node.cpus) {
+      if (cpu >= (int)state.cpu_nodes.size()) {
+        state.cpu_nodes.resize(cpu + 1, 0);
+      }
+      state.cpu_nodes[cpu] = node.id;
+    }
+  }
+  LOG(INFO) << "[Numa] " << ToString();
+  return true;
+}
+
+const NumaConfig& config() { return GetState().conf; }
+
+const std::vector<Node>& Nodes() {
+  State& state = GetState();
+  if (state.nodes.empty()) {
+    state.nodes = ReadNodes();
+  }
+  return state.nodes;
+}
+
+int CurrentNode() {
+  if (thread_node >= 0) {
+    return thread_node;
+  }
+  const std::vector<int>& cpu_nodes = GetState().cpu_nodes;
+  int cpu = ::sched_getcpu();
+  return cpu >= 0 && cpu < (int)cpu_nodes.size() ? cpu_nodes[cpu] : 0;
+}
+
+void InitThread(size_t index) {
+  const NumaConfig& conf = config();
+  const std::vector<Node>& nodes = Nodes();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (conf.affinity() == "core") {
+    // Fills the cores of the first node before moving on to the next one.
+    size_t total = 0;
+    for (const Node& node : nodes) {
+      total += node.cpus.size();
+    }
+    size_t k = index % total;
+    for (const Node& node : nodes) {
+      if (k < node.cpus.size()) {
+        CPU_SET(node.cpus[k], &set);
+        thread_node = node.id;
+        break;
+      }
+      k -= node.cpus.size();
+    }
+  } else if (conf.affinity() == "node") {
+    const Node& node = nodes[index % nodes.size()];
+    for (int cpu : node.cpus) {
+      CPU_SET(cpu, &set);
+    }
+    thread_node = node.id;
+  }
+  if (CPU_COUNT(&set) != 0 &&
+      ::sched_setaffinity(0, sizeof(set), &set) != 0) {
+    LOG(WARNING) << "[Numa] failed to pin thread " << index;
+  }
+  if (conf.memory() == "interleave") {
+    unsigned long mask = AllNodesMask();
+    ::syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &mask, kMaxNodes);
+  }
+}
+
+void BindThread(int node) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const Node& n : Nodes()) {
+    if (n.id == node) {
+      for (int cpu : n.cpus) {
+        CPU_SET(cpu, &set);
+      }
+    }
+  }
+  if (CPU_COUNT(&set) != 0 &&
+      ::sched_setaffinity(0, sizeof(set), &set) != 0) {
+    LOG(WARNING) << "[Numa] failed to bind thread to node " << node;
+  }
+  thread_node = node;
+}
+
+bool BindMemory(void* addr, size_t size, int node) {
+  return Mbind(addr, size, MPOL_BIND, 1ul << node);
+}
+
+bool InterleaveMemory(void* addr, size_t size) {
+  return Mbind(addr, size, MPOL_INTERLEAVE, AllNodesMask());
+}
+
+void* AllocatePages(size_t size) {
+  const size_t page = PageSize();
+  const size_t pages = (std::max<size_t>(size, 1) + page - 1) / page;
+  void* addr = ::aligned_alloc(page, pages * page);
+  CHECK(addr);
+  return addr;
+}
+
+void FreePages(void* addr) { ::free(addr); }
+
+Tensor<Float> CreatePlaced(const Shape& shape, int node) {
+  const size_t bytes = shape.count() * sizeof(Float);
+  Float* data = static_cast<Float*>(AllocatePages(bytes));
+  if (node >= 0) {
+    BindMemory(data, bytes, node);
+  } else {
+    InterleaveMemory(data, bytes);
+  }
+  std::fill(data, data + shape.count(), Float(0));
+  return Tensor<Float>::Create(data, shape, FreeFloats);
+}
+
+std::string ToString() {
+  const NumaConfig& conf = config();
+  std::string res("nodes: ");
+  for (const Node& node : Nodes()) {
+    res += std::to_string(node.id);
+    res += "(";
+    res += std::to_string(node.cpus.size());
+    res += " cpus) ";
+  }
+  res += "affinity: " + conf.affinity();
+  res += ", memory: " + conf.memory();
+  res += ", replicate_weights: ";
+  res += conf.replicate_weights() ? "true" : "false";
+  return res;
+}
+
+}  // namespace numa
+}  // namespace cola
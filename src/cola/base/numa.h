@@ -0,0 +1,80 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_BASE_NUMA_H_
+#define COLA_BASE_NUMA_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "cola/base/tensor.h"
+#include "cola/base/types.h"
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+namespace numa {
+
+struct Node {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Reads the topology from sysfs and remembers the placement policy of
+// `conf`, which applies to every thread set up by InitThread afterwards.
+// Logs and returns false if the policy is unknown.
+bool Init(const NumaConfig& conf);
+
+const NumaConfig& config();
+
+const std::vector<Node>& Nodes();
+
+// Returns the node the calling thread runs on.
+int CurrentNode();
+
+// Pins the calling thread, the `index`-th worker of the process, according
+// to the affinity policy and applies the memory policy to it.
+void InitThread(size_t index);
+
+// Pins the calling thread to the cpus of `node`, whatever the affinity
+// policy.
+void BindThread(int node);
+
+// Moves the pages of [addr, addr + size) to `node`, pages not touched yet
+// will be allocated there. The buffer must own whole pages, as those of
+// AllocatePages, not to move the pages of other objects, else it logs and
+// returns false.
+bool BindMemory(void* addr, size_t size, int node);
+
+// Spreads the pages of [addr, addr + size) round-robin over all nodes, the
+// buffer owning whole pages as for BindMemory.
+bool InterleaveMemory(void* addr, size_t size);
+
+// Page-aligned memory of `size` bytes rounded up to whole pages, released by
+// FreePages.
+void* AllocatePages(size_t size);
+void FreePages(void* addr);
+
+// A zeroed tensor of `shape` in pages bound to `node`, or interleaved over
+// all nodes if `node` is negative, before anything touches them.
+Tensor<Float> CreatePlaced(const Shape& shape, int node);
+
+std::string ToString();
+
+}  // namespace numa
+}  // namespace cola
+
+#endif  // COLA_BASE_NUMA_H_
@@ -16,6 +16,10 @@
 #ifndef COLA_BASE_RANDOM_H_
 #define COLA_BASE_RANDOM_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <random>
 
 namespace cola {
@@ -78,6 +82,67 @@ Unifom(I a, I b, unsigned seed = 5489u) {
   return {std::mt19937(seed), std::uniform_int_distribution<I>(a, b)};
 }
 
+// Philox4x32-10 of Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3": the block of 4 words of a 128-bit counter is a bijection of the
+// counter under the key, so blocks are computed in any order and on any
+// thread without state, and unrelated counters give independent streams.
+class Philox {
+ public:
+  // Blocks computed side by side by Generate, on which the rounds are
+  // plain lane-wise loops the compiler vectorizes.
+  static const size_t kLanes = 8;
+
+  explicit Philox(uint64_t key) : key_{uint32_t(key), uint32_t(key >> 32)} {}
+
+  // Writes the blocks of counters {first + i, high} for i < n to `out`,
+  // block i at out[4 * i] to out[4 * i + 3].
+  void Generate(uint64_t first, uint64_t high, size_t n, uint32_t* out) const {
+    uint32_t c0[kLanes], c1[kLanes], c2[kLanes], c3[kLanes];
+    for (size_t i = 0; i < n; i += kLanes) {
+      for (size_t l = 0; l < kLanes; ++l) {
+        const uint64_t low = first + i + l;
+        c0[l] = uint32_t(low);
+        c1[l] = uint32_t(low >> 32);
+        c2[l] = uint32_t(high);
+        c3[l] = uint32_t(high >> 32);
+      }
+      uint32_t k0 = key_[0];
+      uint32_t k1 = key_[1];
+      for (int round = 0; round < 10; ++round) {
+        for (size_t l = 0; l < kLanes; ++l) {
+          const uint64_t p0 = uint64_t(kM0) * c0[l];
+          const uint64_t p1 = uint64_t(kM1) * c2[l];
+          const uint32_t x1 = c1[l];
+          const uint32_t x3 = c3[l];
+          c0[l] = uint32_t(p1 >> 32) ^ x1 ^ k0;
+          c1[l] = uint32_t(p1);
+          c2[l] = uint32_t(p0 >> 32) ^ x3 ^ k1;
+          c3[l] = uint32_t(p0);
+        }
+        k0 += kW0;
+        k1 += kW1;
+      }
+      uint32_t block[4 * kLanes];
+      for (size_t l = 0; l < kLanes; ++l) {
+        block[4 * l] = c0[l];
+        block[4 * l + 1] = c1[l];
+        block[4 * l + 2] = c2[l];
+        block[4 * l + 3] = c3[l];
+      }
+      const size_t blocks = n - i < kLanes ? n - i : kLanes;
+      memcpy(out + 4 * i, block, 4 * blocks * sizeof(uint32_t));
+    }
+  }
+
+ private:
+  static const uint32_t kM0 = 0xD2511F53;
+  static const uint32_t kM1 = 0xCD9E8D57;
+  static const uint32_t kW0 = 0x9E3779B9;
+  static const uint32_t kW1 = 0xBB67AE85;
+
+  uint32_t key_[2];
+};
+
 namespace {
 class Range {
  public:
@@ -121,6 +186,13 @@ std::vector<T> Samples(T start, T end, T n, unsigned seed = 0) {
   return indices;
 }
 
+template <typename T, typename Engine>
+void Samples(T start, T end, T n, Engine* engine, std::vector<T>* indices) {
+  indices->resize(n);
+  Range range(start, end);
+  std::sample(range.begin(), range.end(), indices->begin(), n, *engine);
+}
+
 }  // namespace random
 }  // namespace cola
 
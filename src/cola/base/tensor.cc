@@ -24,6 +24,7 @@
 #include "cola/base/math_ops.h"
 #include "cola/base/random.h"
 #include "cola/base/shape.h"
+#include "cola/base/thread_pool.h"
 
 namespace cola {
 
@@ -43,10 +44,13 @@ void Broadcast(T* that, const T& other, Op op) {
     block *= that->shape()[i];
     CHECK_EQ(that->shape()[i], other.shape()[j]);
   }
-  for (size_t i = 0; i < that->shape().count() / block; ++i) {
-    op(that->data() + i * block, other.data(), block,
-       that->mutable_data() + i * block);
-  }
+  const size_t rows = that->shape().count() / block;
+  ParallelFor(0, rows, GrainSize(block), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      op(that->data() + i * block, other.data(), block,
+         that->mutable_data() + i * block);
+    }
+  });
 }
 
 std::string ToArrayString(std::vector<size_t> shape,
@@ -80,11 +84,14 @@ std::string ToArrayString(std::vector<size_t> shape,
 }  // namespace
 
 template <typename T>
-Tensor<T>::Tensor() : data_(nullptr), delete_(nullptr) {}
+Tensor<T>::Tensor() : data_(nullptr), capacity_(0), delete_(nullptr) {}
 
 template <typename T>
 Tensor<T>::Tensor(T* data, Shape&& shape, void (*deleter)(T*))
-    : data_(data), shape_(std::move(shape)), delete_(deleter) {}
+    : data_(data),
+      shape_(std::move(shape)),
+      capacity_(shape_.count()),
+      delete_(deleter) {}
 
 template <typename T>
 Tensor<T>::~Tensor() {
@@ -97,14 +104,19 @@ template <typename T>
 Tensor<T>::Tensor(Tensor&& tensor)
     : data_(tensor.data_),
       shape_(std::move(tensor.shape_)),
+      capacity_(tensor.capacity_),
       delete_(tensor.delete_) {
   tensor.data_ = nullptr;
+  tensor.capacity_ = 0;
   tensor.delete_ = nullptr;
 }
 
 template <typename T>
 Tensor<T>::Tensor(const Tensor& tensor)
-    : data_(tensor.data_), shape_(tensor.shape()), delete_(default_deleter) {
+    : data_(tensor.data_),
+      shape_(tensor.shape()),
+      capacity_(tensor.shape_.count()),
+      delete_(default_deleter) {
   if (tensor.data_) {
     data_ = new T[tensor.shape_.count()];
     memcpy(data_, tensor.data_, tensor.shape_.count() * sizeof(T));
@@ -121,7 +133,7 @@ template <typename T>
 void Tensor<T>::operator=(const Tensor& tensor) {
   if (shape_ == tensor.shape()) {
     memcpy(data_, tensor.data_, tensor.shape().count() * sizeof(T));
-  } else if (shape_.count() >= tensor.shape().count()) {
+  } else if (capacity_ >= tensor.shape().count()) {
     shape_ = tensor.shape();
     memcpy(data_, tensor.data_, tensor.shape().count() * sizeof(T));
   } else {
@@ -187,7 +199,10 @@ bool Tensor<T>::Reshape(Shape shape) {
 
 template <typename T>
 void Tensor<T>::Resize(Shape shape, T v) {
-  if (shape_.count() >= shape.count()) {
+  if (capacity_ >= shape.count()) {
+    if (shape_.count() < shape.count()) {
+      std::fill(data_ + shape_.count(), data_ + shape.count(), v);
+    }
     if (shape_ != shape) {
       shape_ = shape;
     }
@@ -201,6 +216,19 @@ void Tensor<T>::Resize(Shape shape, T v) {
   }
 }
 
+template <typename T>
+void Tensor<T>::Reserve(size_t n) {
+  if (capacity_ >= n) {
+    return;
+  }
+  T* t = new T[n];
+  memcpy(t, data_, shape_.count() * sizeof(T));
+  Shape shape = shape_;
+  this->~Tensor();
+  new (this) Tensor(t, std::move(shape), default_deleter);
+  capacity_ = n;
+}
+
 template <typename T>
 void Tensor<T>::Transpose(std::vector<size_t> new_indices) {
   Shape new_shape = shape_;
@@ -86,10 +86,21 @@ class Tensor {
 
   bool empty() const { return shape_.count() == 0; }
 
+  // Number of elements the tensor holds without reallocating.
+  size_t capacity() const { return capacity_; }
+
+  // False for views of the data of others, see Create(T*, Shape).
+  bool owned() const { return delete_ != nullptr; }
+
   bool Reshape(Shape shape);
 
+  // Reallocates only when `shape` exceeds the capacity, new elements are set
+  // to `v`.
   void Resize(Shape shape, T v = T());
 
+  // Grows the capacity to `n` elements, keeping the data and the shape.
+  void Reserve(size_t n);
+
   void Transpose(std::vector<size_t> new_indices);
 
   void operator+=(const T& v);
@@ -110,6 +121,7 @@ class Tensor {
 
   T* data_;
   Shape shape_;
+  size_t capacity_;
   void (*delete_)(T*);
 };
 
@@ -0,0 +1,181 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/thread_pool.h"
+
+#include "cola/base/logging.h"
+#include "cola/base/numa.h"
+
+namespace cola {
+
+namespace {
+
+// Set on threads currently running chunks of a loop.
+static thread_local bool in_loop = false;
+
+static thread_local ThreadPool* local_pool = nullptr;
+
+static std::mutex default_mutex;
+static std::unique_ptr<ThreadPool> default_pool;
+static std::atomic<ThreadPool*> default_ptr(nullptr);
+
+}  // namespace
+
+// Stands in for the process-wide pool before Init, built with the program
+// so that Default() never allocates.
+static ThreadPool serial_pool(1);
+
+ThreadPool::ThreadPool(size_t num_threads, int node)
+    : node_(node), job_(nullptr), generation_(0), stop_(false), active_(0) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    slots_.emplace_back(new Slot);
+  }
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::Loop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Init(size_t num_threads) {
+  std::unique_lock<std::mutex> guard(default_mutex);
+  if (default_pool) {
+    if (num_threads != 0 && num_threads != default_pool->size()) {
+      LOG(WARNING) << "[ThreadPool] already created, ignore num_threads: "
+                   << num_threads;
+    }
+    return;
+  }
+  default_pool.reset(new ThreadPool(num_threads));
+  default_ptr.store(default_pool.get(), std::memory_order_release);
+  LOG(INFO) << "[ThreadPool] threads: " << default_pool->size();
+}
+
+ThreadPool* ThreadPool::Default() {
+  if (local_pool) {
+    return local_pool;
+  }
+  ThreadPool* pool = default_ptr.load(std::memory_order_acquire);
+  return pool ? pool : &serial_pool;
+}
+
+void ThreadPool::SetLocal(ThreadPool* pool) { local_pool = pool; }
+
+bool ThreadPool::Parallel() const { return slots_.size() > 1 && !in_loop; }
+
+void ThreadPool::Run(size_t begin, size_t end, size_t grain,
+                     void (*call)(void*, size_t, size_t), void* arg) {
+  std::unique_lock<std::mutex> run(run_mutex_, std::try_to_lock);
+  if (!run) {  // Another thread owns the pool.
+    call(arg, begin, end);
+    return;
+  }
+  Job job;
+  job.begin = begin;
+  job.end = end;
+  job.grain = grain;
+  job.call = call;
+  job.arg = arg;
+  const size_t chunks = (end - begin + grain - 1) / grain;
+  job.pending = chunks;
+  const size_t n = slots_.size();
+  for (size_t i = 0; i < n; ++i) {
+    std::unique_lock<std::mutex> guard(slots_[i]->mutex);
+    slots_[i]->lo = chunks * i / n;
+    slots_[i]->hi = chunks * (i + 1) / n;
+  }
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    job_ = &job;
+    ++generation_;
+  }
+  cv_.notify_all();
+
+  in_loop = true;
+  Work(&job, 0);
+  in_loop = false;
+  while (job.pending.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    job_ = nullptr;
+  }
+  // `job` lives on this stack, wait for late joiners to leave.
+  while (active_.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+}
+
+void ThreadPool::Work(Job* job, size_t index) {
+  const size_t n = slots_.size();
+  while (true) {
+    size_t chunk = -1;
+    for (size_t k = 0; k < n && chunk == size_t(-1); ++k) {
+      Slot* slot = slots_[(index + k) % n].get();
+      std::unique_lock<std::mutex> guard(slot->mutex);
+      if (slot->lo < slot->hi) {
+        // The owner takes from the front, thieves from the back.
+        chunk = k == 0 ? slot->lo++ : --slot->hi;
+      }
+    }
+    if (chunk == size_t(-1)) {
+      return;
+    }
+    size_t b = job->begin + chunk * job->grain;
+    size_t e = std::min(job->end, b + job->grain);
+    job->call(job->arg, b, e);
+    job->pending.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void ThreadPool::Loop(size_t index) {
+  if (node_ >= 0) {
+    numa::BindThread(node_);
+  } else {
+    numa::InitThread(index);
+  }
+  in_loop = true;
+  size_t seen = 0;
+  while (true) {
+    Job* job = nullptr;
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      cv_.wait(guard, [&] { return stop_ || (job_ && generation_ != seen); });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      job = job_;
+      active_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Work(job, index);
+    active_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+}  // namespace cola
@@ -0,0 +1,172 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_BASE_THREAD_POOL_H_
+#define COLA_BASE_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cola {
+
+// Minimum number of scalar operations worth handing to another thread.
+static const size_t kMinParallelWork = 1 << 14;
+
+// Returns how many items of `cost` operations each make one task.
+inline size_t GrainSize(size_t cost) {
+  return std::max<size_t>(1, kMinParallelWork / std::max<size_t>(1, cost));
+}
+
+// A work-stealing pool of threads for intra-op parallelism. A parallel loop
+// is cut into chunks of `grain` items, every thread (the caller included)
+// starts on its own contiguous share of the chunks and steals from the back
+// of the others' shares once its own is drained.
+//
+// Loops issued from inside a loop, or while another thread owns the pool,
+// run inline on the calling thread, so running a loop neither allocates nor
+// creates threads.
+class ThreadPool {
+ public:
+  // `num_threads` includes the calling thread, 0 means one per online cpu.
+  // The workers are bound to `node` if given, else placed by the affinity
+  // policy.
+  explicit ThreadPool(size_t num_threads, int node = -1);
+
+  ~ThreadPool();
+
+  // Creates the process-wide pool and its threads, only the first call
+  // takes effect. Called at load time so that no step pays for it.
+  static void Init(size_t num_threads);
+
+  // Returns the pool of the calling thread, else the process-wide one. Until
+  // Init is called this is a pool without workers, loops run inline.
+  static ThreadPool* Default();
+
+  // Makes Default() return `pool` on the calling thread, e.g. for the
+  // threads of a NUMA node running their own pool.
+  static void SetLocal(ThreadPool* pool);
+
+  size_t size() const { return slots_.size(); }
+
+  // Calls fn(b, e) over disjoint sub-ranges covering [begin, end).
+  template <typename Fn>
+  void ParallelFor(size_t begin, size_t end, size_t grain, Fn&& fn) {
+    if (end <= begin) {
+      return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    if (end - begin <= grain || !Parallel()) {
+      fn(begin, end);
+      return;
+    }
+    using F = typename std::remove_reference<Fn>::type;
+    auto call = [](void* arg, size_t b, size_t e) {
+      (*static_cast<F*>(arg))(b, e);
+    };
+    auto* arg = const_cast<void*>(static_cast<const void*>(&fn));
+    Run(begin, end, grain, call, arg);
+  }
+
+  // Combines map(b, e) of the sub-ranges of [begin, end) with reduce(),
+  // always in the order of the sub-ranges, so results are deterministic.
+  template <typename T, typename Map, typename Reduce>
+  T ParallelReduce(size_t begin, size_t end, size_t grain, T init, Map&& map,
+                   Reduce&& reduce) {
+    if (end <= begin) {
+      return init;
+    }
+    grain = std::max<size_t>(grain, 1);
+    if (end - begin <= grain || !Parallel()) {
+      return reduce(init, map(begin, end));
+    }
+    const size_t chunks = (end - begin + grain - 1) / grain;
+    // Workers must see the caller's buffer, not their own thread_local one.
+    static thread_local std::vector<T> buffer;
+    std::vector<T>& partials = buffer;
+    partials.resize(chunks);
+    ParallelFor(0, chunks, 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; ++c) {
+        size_t b0 = begin + c * grain;
+        partials[c] = map(b0, std::min(end, b0 + grain));
+      }
+    });
+    for (size_t c = 0; c < chunks; ++c) {
+      init = reduce(init, partials[c]);
+    }
+    return init;
+  }
+
+ private:
+  struct Slot {
+    std::mutex mutex;
+    size_t lo;
+    size_t hi;
+  };
+
+  struct Job {
+    size_t begin;
+    size_t end;
+    size_t grain;
+    void (*call)(void*, size_t, size_t);
+    void* arg;
+    std::atomic<size_t> pending;
+  };
+
+  bool Parallel() const;
+
+  void Run(size_t begin, size_t end, size_t grain,
+           void (*call)(void*, size_t, size_t), void* arg);
+
+  // Runs chunks of `job` from the slot `index` first, then steals.
+  void Work(Job* job, size_t index);
+
+  void Loop(size_t index);
+
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::vector<std::thread> threads_;
+  int node_;
+
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  Job* job_;
+  size_t generation_;
+  bool stop_;
+  std::atomic<size_t> active_;
+};
+
+template <typename Fn>
+inline void ParallelFor(size_t begin, size_t end, size_t grain, Fn&& fn) {
+  ThreadPool::Default()->ParallelFor(begin, end, grain, std::forward<Fn>(fn));
+}
+
+template <typename T, typename Map, typename Reduce>
+inline T ParallelReduce(size_t begin, size_t end, size_t grain, T init,
+                        Map&& map, Reduce&& reduce) {
+  return ThreadPool::Default()->ParallelReduce(begin, end, grain, init,
+                                               std::forward<Map>(map),
+                                               std::forward<Reduce>(reduce));
+}
+
+}  // namespace cola
+
+#endif  // COLA_BASE_THREAD_POOL_H_
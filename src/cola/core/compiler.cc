@@ -0,0 +1,213 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/compiler.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "cola/base/logging.h"
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+
+namespace {
+
+const char* kFloat = sizeof(Float) == sizeof(float) ? "float" : "double";
+
+static std::string Identifier(const std::string& name) {
+  std::string id;
+  for (char c : name) {
+    id += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  return id;
+}
+
+// Hexadecimal literals keep the weights exact.
+static void EmitArray(const std::string& name, const Tensor<Float>& t,
+                      std::ostream* os) {
+  *os << "alignas(64) const " << kFloat << " " << name << "[" << t.size()
+      << "] = {";
+  char buf[64];
+  for (size_t i = 0; i < t.size(); ++i) {
+    snprintf(buf, sizeof(buf), "%a%s", static_cast<double>(t.data()[i]),
+             sizeof(Float) == sizeof(float) ? "f" : "");
+    *os << (i % 6 == 0 ? "\n    " : " ") << buf << ",";
+  }
+  *os << "\n};\n\n";
+}
+
+static std::string Loop(size_t n, const std::string& body) {
+  return "for (size_t j = 0; j < " + std::to_string(n) + "; ++j) " + body +
+         "\n";
+}
+
+}  // namespace
+
+bool Compiler::Load(const std::string& model) {
+  NetworkConfig conf;
+  std::ifstream ifs(model, std::ios::binary);
+  if (!conf.ParseFromIstream(&ifs)) {
+    LOG(ERROR) << "[Compiler] bad model: " << model;
+    return false;
+  }
+  return Load(std::move(conf));
+}
+
+bool Compiler::Load(NetworkConfig conf) {
+  conf.set_phase("infer");
+  // The generated code runs on one thread.
+  for (auto& layer : *conf.mutable_layer()) {
+    if (layer.has_affine()) {
+      layer.mutable_affine()->clear_shards();
+    }
+  }
+  return network_.Load(conf);
+}
+
+bool Compiler::Emit(const std::string& name_space, std::ostream* os) const {
+  const Network::Plan& plan = network_.plans_[kInfer];
+  if (plan.shapes.empty()) {
+    LOG(ERROR) << "[Compiler] the input size of the model is unknown";
+    return false;
+  }
+  const size_t sink = plan.steps.size();
+  // Aliases name the buffer they share.
+  std::vector<std::string> names(plan.num_vars);
+  names[0] = "x";
+  names[sink] = "y";
+  for (size_t i = 1; i < sink; ++i) {
+    names[i] = "v" + std::to_string(i);
+  }
+  for (size_t i : plan.input_aliases) {
+    names[i] = names[0];
+  }
+  for (const auto& step : plan.steps) {
+    for (size_t i : step.aliases) {
+      names[i] = names[step.output];
+    }
+  }
+  auto width = [&](size_t i) { return plan.shapes[i].count(1); };
+
+  std::string weights;
+  std::string body;
+  for (size_t i = 1; i < sink; ++i) {
+    body += "    alignas(64) " + std::string(kFloat) + " " + names[i] + "[" +
+            std::to_string(width(i)) + "];\n";
+  }
+  std::ostringstream arrays;
+  for (const auto& step : plan.steps) {
+    const auto& config = step.layer->layer_config();
+    const std::string& type = config.type();
+    const std::string out = names[step.output];
+    const std::string in = names[step.inputs[0]];
+    const size_t n = width(step.output);
+    const size_t m = width(step.inputs[0]);
+    std::string code = "// " + config.name() + ": " + type + "\n";
+    if (type == "Affine" || type == "FusedAffine") {
+      const std::string id = Identifier(config.name());
+      auto ws = const_cast<Layer*>(step.layer)->GetWeights();
+      EmitArray("w_" + id, ws[0]->data(), &arrays);
+      EmitArray("b_" + id, ws[1]->data(), &arrays);
+      code += Loop(n, out + "[j] = b_" + id + "[j];");
+      code += "for (size_t k = 0; k < " + std::to_string(m) + "; ++k) {\n";
+      code += "  const " + std::string(kFloat) + " a = " + in + "[k];\n";
+      code += "  const " + std::string(kFloat) + "* w = w_" + id + " + k * " +
+              std::to_string(n) + ";\n";
+      code += "  " + Loop(n, out + "[j] += a * w[j];");
+      code += "}\n";
+      const std::string& activation = config.affine().activation();
+      if (type == "FusedAffine" && activation == "relu") {
+        code += Loop(n, out + "[j] = " + out + "[j] > 0 ? " + out +
+                            "[j] : 0;");
+      } else if (type == "FusedAffine") {
+        code += Loop(n, out + "[j] = 1 / (1 + std::exp(-" + out + "[j]));");
+      }
+    } else if (type == "Relu") {
+      code += Loop(n, out + "[j] = " + in + "[j] > 0 ? " + in + "[j] : 0;");
+    } else if (type == "Sigmoid") {
+      code += Loop(n, out + "[j] = 1 / (1 + std::exp(-" + in + "[j]));");
+    } else if (type == "Softmax") {
+      code += "{\n";
+      code += "  " + std::string(kFloat) + " max = " + in + "[0];\n";
+      code += "  " + Loop(m, "max = " + in + "[j] > max ? " + in +
+                                 "[j] : max;");
+      code += "  " + std::string(kFloat) + " sum = 0;\n";
+      code += "  " + Loop(n, "sum += " + out + "[j] = std::exp(" + in +
+                                 "[j] - max);");
+      code += "  " + Loop(n, out + "[j] /= sum;");
+      code += "}\n";
+    } else if (type == "Argmax") {
+      code += "{\n";
+      code += "  size_t a = 0;\n";
+      code += "  " + Loop(m, "a = " + in + "[j] > " + in + "[a] ? j : a;");
+      code += "  " + out + "[0] = a;\n";
+      code += "}\n";
+    } else if (type == "Identity" || type == "Dropout" ||
+               type == "ExitHead") {
+      // Compiled models always run to the output, and never train.
+      code += Loop(n, out + "[j] = " + in + "[j];");
+    } else if (type == "Add") {
+      std::string sum = in + "[j]";
+      for (size_t j = 1; j < step.inputs.size(); ++j) {
+        sum += " + " + names[step.inputs[j]] + "[j]";
+      }
+      code += Loop(n, out + "[j] = " + sum + ";");
+    } else if (type == "Concat") {
+      size_t offset = 0;
+      for (size_t i : step.inputs) {
+        code += Loop(width(i), out + "[" + std::to_string(offset) + " + j] = " +
+                                   names[i] + "[j];");
+        offset += width(i);
+      }
+    } else {
+      LOG(ERROR) << "[Compiler] unsupported layer: " << config.name() << " ("
+                 << type << ")";
+      return false;
+    }
+    // Indents the code into the loop over the rows.
+    size_t start = 0;
+    while (start < code.size()) {
+      size_t end = code.find('\n', start);
+      body += "    " + code.substr(start, end - start + 1);
+      start = end + 1;
+    }
+  }
+
+  *os << "// Generated by cola, do not edit.\n\n"
+      << "#include <stddef.h>\n\n"
+      << "#include <cmath>\n\n"
+      << "namespace " << name_space << " {\n\n"
+      << "extern const size_t kInputSize = " << width(0) << ";\n"
+      << "extern const size_t kOutputSize = " << width(sink) << ";\n\n"
+      << "namespace {\n\n"
+      << arrays.str() << "}  // namespace\n\n"
+      << "void Infer(const " << kFloat << "* input, size_t batch, " << kFloat
+      << "* output) {\n"
+      << "  for (size_t n = 0; n < batch; ++n) {\n"
+      << "    const " << kFloat << "* x = input + n * kInputSize;\n"
+      << "    " << kFloat << "* y = output + n * kOutputSize;\n"
+      << body << "  }\n"
+      << "}\n\n"
+      << "}  // namespace " << name_space << "\n";
+  return true;
+}
+
+}  // namespace cola
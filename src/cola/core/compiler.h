@@ -0,0 +1,49 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_COMPILER_H_
+#define COLA_CORE_COMPILER_H_
+
+#include <ostream>
+#include <string>
+
+#include "cola/core/network.h"
+
+namespace cola {
+
+// Translates a trained model into a standalone C++17 source file, which
+// depends on neither cola nor protobuf. The file defines in namespace
+// `name_space`:
+//
+//   extern const size_t kInputSize, kOutputSize;
+//   void Infer(const float* input, size_t batch, float* output);
+//
+// The weights are aligned constant arrays and the layers of every row run
+// as fused loops on buffers of the baked-in widths.
+class Compiler {
+ public:
+  bool Load(const std::string& model);
+
+  bool Load(NetworkConfig conf);
+
+  bool Emit(const std::string& name_space, std::ostream* os) const;
+
+ private:
+  Network network_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_COMPILER_H_
@@ -17,7 +17,8 @@
 
 namespace cola {
 
-Session::Session() : loss_(0), batch_size_(0) {}
+Session::Session()
+    : loss_(0), loss_scale_(1), batch_size_(0), phase_(kInfer), step_(0) {}
 Session::~Session() {}
 
 Context::Context() : session_(new Session) {}
@@ -16,6 +16,12 @@
 #ifndef COLA_CORE_CONTEXT_H_
 #define COLA_CORE_CONTEXT_H_
 
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "cola/base/slice.h"
 #include "cola/base/tensor.h"
 #include "cola/base/types.h"
@@ -39,21 +45,88 @@ class Session {
   }
   Slice data() const { return data_; }
 
+  // Returns a buffer of at least `size` bytes owned by the session, which is
+  // reused across batches so that steady-state iterations do not allocate.
+  char* mutable_buffer(size_t size) {
+    if (buffer_.size() < size) {
+      buffer_.resize(size);
+    }
+    return &buffer_[0];
+  }
+
   Session& set_loss(Float loss) {
     loss_ = loss;
     return *this;
   }
 
+  // Factor of the loss gradient, 1 / N when N micro-batches are summed.
+  Session& set_loss_scale(Float loss_scale) {
+    loss_scale_ = loss_scale;
+    return *this;
+  }
+  Float loss_scale() const { return loss_scale_; }
+
   Session& set_batch_size(size_t batch_size) {
     batch_size_ = batch_size;
     return *this;
   }
 
+  // Rows [groups[g], groups[g + 1]) of the batch belong to model g of a
+  // ModelGroup.
+  std::vector<size_t>* mutable_groups() { return &groups_; }
+  const std::vector<size_t>& groups() const { return groups_; }
+
+  // Named by an ExitHead confident about every row of the batch, the infer
+  // phase then stops and outputs exit_output(). Empty otherwise.
+  void set_exit(const std::string& layer) { exit_ = layer; }
+  const std::string& exit() const { return exit_; }
+
+  Tensor<Float>* mutable_exit_output() { return &exit_output_; }
+  const Tensor<Float>& exit_output() const { return exit_output_; }
+
+  // Set by a layer or the weight stream failing on the batch, Forward then
+  // stops and returns false. Layers of the same level may fail together,
+  // the first error is kept. Empty otherwise.
+  void set_error(const std::string& error) {
+    std::lock_guard<std::mutex> lock(error_mutex_);
+    if (error_.empty()) {
+      error_ = error;
+    }
+  }
+  void clear_error() { error_.clear(); }
+  const std::string& error() const { return error_; }
+
+  // The phase of the plan running, set by Network. BatchNorm normalizes by
+  // the batch in the train phase only.
+  Session& set_phase(Phase phase) {
+    phase_ = phase;
+    return *this;
+  }
+  Phase phase() const { return phase_; }
+
+  // Numbers the train step of the batch, set by the Trainer or Pipeline
+  // driving the session. Dropout draws its masks from it, so that layers
+  // running on other sessions at the same time share no counter.
+  Session& set_step(uint64_t step) {
+    step_ = step;
+    return *this;
+  }
+  uint64_t step() const { return step_; }
+
  private:
   Slice data_;
+  std::string buffer_;
   Tensor<Float> label_;
   Float loss_;
+  Float loss_scale_;
   size_t batch_size_;
+  std::vector<size_t> groups_;
+  std::string exit_;
+  Tensor<Float> exit_output_;
+  std::mutex error_mutex_;
+  std::string error_;
+  Phase phase_;
+  uint64_t step_;
 
   friend class Context;
 };
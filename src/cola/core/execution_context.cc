@@ -0,0 +1,73 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/execution_context.h"
+
+#include "cola/base/logging.h"
+#include "cola/core/network.h"
+
+namespace cola {
+
+ExecutionContext::ExecutionContext(const Network* network)
+    : network_(network) {}
+
+ExecutionContext::~ExecutionContext() {}
+
+size_t ExecutionContext::bytes() const {
+  size_t n = 0;
+  for (const auto& var : vars_) {
+    for (const auto* t : {&var->data(), &var->grad()}) {
+      n += t->owned() ? t->capacity() * sizeof(Float) : 0;
+    }
+  }
+  return n;
+}
+
+void ExecutionContext::Shrink() {
+  for (auto& var : vars_) {
+    var.reset(new Variable);
+  }
+}
+
+ExecutionContextPool::ExecutionContextPool(const Network* network,
+                                           size_t capacity)
+    : network_(network), capacity_(capacity) {}
+
+std::unique_ptr<ExecutionContext> ExecutionContextPool::Acquire() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (!idle_.empty()) {
+      auto context = std::move(idle_.back());
+      idle_.pop_back();
+      return context;
+    }
+  }
+  return network_->CreateExecutionContext();
+}
+
+void ExecutionContextPool::Release(std::unique_ptr<ExecutionContext> context) {
+  CHECK_EQ(context->network(), network_);
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (idle_.size() < capacity_) {
+    idle_.push_back(std::move(context));
+  }
+}
+
+size_t ExecutionContextPool::idle() const {
+  std::unique_lock<std::mutex> guard(mutex_);
+  return idle_.size();
+}
+
+}  // namespace cola
@@ -0,0 +1,82 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_EXECUTION_CONTEXT_H_
+#define COLA_CORE_EXECUTION_CONTEXT_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cola/core/variable.h"
+
+namespace cola {
+
+class Network;
+
+// The activations of one request to a network, created by
+// Network::CreateExecutionContext. A context is reused by the following
+// requests, so that they do not allocate, but must not be shared by
+// concurrent ones.
+class ExecutionContext {
+ public:
+  ~ExecutionContext();
+
+  const Network* network() const { return network_; }
+
+  // Bytes allocated by the activations and their gradients, whatever the
+  // size of the last batch. Views of other buffers are not counted.
+  size_t bytes() const;
+
+  // Frees the buffers of the activations, they grow again on the next run.
+  void Shrink();
+
+ private:
+  explicit ExecutionContext(const Network* network);
+
+  const Network* network_;
+  std::vector<std::unique_ptr<Variable>> vars_;
+  // Input lists handed to the layers, one per step.
+  std::vector<std::vector<const Variable*>> inputs_;
+  std::vector<std::vector<Variable*>> grads_;
+  // Views of the rows of a tile.
+  Variable tile_input_;
+  Variable tile_output_;
+
+  friend class Network;
+};
+
+// Hands out execution contexts of one network to concurrent requests. At
+// most `capacity` idle contexts are kept, the others are freed on release.
+class ExecutionContextPool {
+ public:
+  ExecutionContextPool(const Network* network, size_t capacity);
+
+  std::unique_ptr<ExecutionContext> Acquire();
+
+  void Release(std::unique_ptr<ExecutionContext> context);
+
+  size_t idle() const;
+
+ private:
+  const Network* network_;
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ExecutionContext>> idle_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_EXECUTION_CONTEXT_H_
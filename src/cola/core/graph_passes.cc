@@ -0,0 +1,552 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/graph_passes.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "cola/base/logging.h"
+#include "cola/base/types.h"
+
+namespace cola {
+
+namespace {
+
+using Names = std::vector<std::string>;
+
+static std::vector<std::string> Phases(const NetworkConfig& conf) {
+  if (conf.phase() == "train") {
+    return {"train", "infer"};
+  }
+  return {"infer"};
+}
+
+static bool InPhase(const LayerConfig& layer, const std::string& phase) {
+  const auto& phases = layer.phases();
+  return std::find(phases.begin(), phases.end(), phase) != phases.end();
+}
+
+static bool Contains(const Names& names, const std::string& name) {
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+static Names Outputs(const LayerConfig& layer) {
+  Names names(layer.outputs().begin(), layer.outputs().end());
+  if (!layer.output().empty()) {
+    names.insert(names.begin(), layer.output());
+  }
+  return names;
+}
+
+static void SetOutputs(const Names& names, LayerConfig* layer) {
+  layer->clear_output();
+  layer->clear_outputs();
+  for (const auto& name : names) {
+    if (layer->output().empty()) {
+      layer->set_output(name);
+    } else {
+      layer->add_outputs(name);
+    }
+  }
+}
+
+static Names Inputs(const LayerConfig& layer) {
+  return Names(layer.inputs().begin(), layer.inputs().end());
+}
+
+static void SetInputs(const Names& names, LayerConfig* layer) {
+  layer->clear_inputs();
+  for (const auto& name : names) {
+    layer->add_inputs(name);
+  }
+}
+
+// Layers linked to layer `i` within `phase`, either way the link is written.
+static std::vector<int> Consumers(const NetworkConfig& conf, int i,
+                                  const std::string& phase) {
+  std::vector<int> res;
+  const auto& from = conf.layer(i);
+  Names outputs = Outputs(from);
+  for (int j = 0; j < conf.layer_size(); ++j) {
+    const auto& to = conf.layer(j);
+    if (j != i && InPhase(to, phase) &&
+        (Contains(outputs, to.name()) || Contains(Inputs(to), from.name()))) {
+      res.push_back(j);
+    }
+  }
+  return res;
+}
+
+static std::vector<int> Producers(const NetworkConfig& conf, int i,
+                                  const std::string& phase) {
+  std::vector<int> res;
+  const auto& to = conf.layer(i);
+  Names inputs = Inputs(to);
+  for (int j = 0; j < conf.layer_size(); ++j) {
+    const auto& from = conf.layer(j);
+    if (j != i && InPhase(from, phase) &&
+        (Contains(inputs, from.name()) || Contains(Outputs(from), to.name()))) {
+      res.push_back(j);
+    }
+  }
+  return res;
+}
+
+// Replaces `from` by `to` in the outputs and inputs of every layer, an empty
+// `to` drops the reference.
+static void Relink(const std::string& from, const Names& outputs,
+                   const std::string& input, NetworkConfig* conf) {
+  for (auto& layer : *conf->mutable_layer()) {
+    Names names;
+    for (const auto& name : Outputs(layer)) {
+      if (name != from) {
+        names.push_back(name);
+        continue;
+      }
+      for (const auto& to : outputs) {
+        if (!Contains(names, to) && to != layer.name()) {
+          names.push_back(to);
+        }
+      }
+    }
+    SetOutputs(names, &layer);
+    names.clear();
+    for (const auto& name : Inputs(layer)) {
+      if (name != from) {
+        names.push_back(name);
+      } else if (!input.empty()) {
+        names.push_back(input);
+      }
+    }
+    SetInputs(names, &layer);
+  }
+}
+
+static bool HasLayer(const NetworkConfig& conf, const std::string& name) {
+  for (const auto& layer : conf.layer()) {
+    if (layer.name() == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void RemoveLayer(int i, NetworkConfig* conf) {
+  conf->mutable_layer()->DeleteSubrange(i, 1);
+}
+
+// Outputs plain Softmax, or Argmax on request, in the infer phase instead of
+// the loss, which needs labels and computes an unused loss.
+static void SimplifyForInference(NetworkConfig* conf) {
+  const bool argmax = conf->infer_output() == "argmax";
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    auto* layer = conf->mutable_layer(i);
+    const std::string type = layer->type();
+    if (!InPhase(*layer, "infer") ||
+        (type != "SoftmaxWithLoss" && !(argmax && type == "Softmax"))) {
+      continue;
+    }
+    LayerConfig infer = *layer;
+    infer.clear_phases();
+    infer.add_phases("infer");
+    infer.set_type(argmax ? "Argmax" : "Softmax");
+    if (layer->phases_size() == 1) {
+      *layer = infer;
+    } else {  // Shared with the train phase, split it.
+      Names phases;
+      for (const auto& phase : layer->phases()) {
+        if (phase != "infer") {
+          phases.push_back(phase);
+        }
+      }
+      layer->clear_phases();
+      for (const auto& phase : phases) {
+        layer->add_phases(phase);
+      }
+      *conf->add_layer() = infer;
+    }
+    LOG(INFO) << "[GraphPass:simplify] " << infer.name() << ": " << type
+              << " -> " << infer.type() << " at infer phase";
+  }
+}
+
+// Dropout only acts in the train phase.
+static bool IsIdentity(const NetworkConfig& conf, const LayerConfig& layer) {
+  return layer.type() == "Identity" ||
+         (layer.type() == "Dropout" && conf.phase() != "train");
+}
+
+static void EliminateIdentity(NetworkConfig* conf) {
+  for (int i = 0; i < conf->layer_size();) {
+    const auto& layer = conf->layer(i);
+    std::vector<int> producers;
+    bool removable = IsIdentity(*conf, layer);
+    for (const auto& phase : layer.phases()) {
+      auto p = Producers(*conf, i, phase);
+      removable = removable && p.size() == 1 &&
+                  (producers.empty() || producers == p);
+      producers = p;
+    }
+    if (!removable) {
+      ++i;
+      continue;
+    }
+    const std::string name = layer.name();
+    const std::string input = conf->layer(producers[0]).name();
+    Names outputs = Outputs(layer);
+    for (const auto& phase : layer.phases()) {
+      for (int j : Consumers(*conf, i, phase)) {
+        if (!Contains(outputs, conf->layer(j).name())) {
+          outputs.push_back(conf->layer(j).name());
+        }
+      }
+    }
+    RemoveLayer(i, conf);
+    Relink(name, outputs, input, conf);
+    LOG(INFO) << "[GraphPass:identity] removed " << name;
+  }
+}
+
+// Removes the layers of `phase` not leading to layer `output` from the phase,
+// layers left without phases are removed from `conf`.
+static void RemoveUnused(const std::string& pass, const std::string& phase,
+                         int output, NetworkConfig* conf) {
+  std::vector<int> members;
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    if (InPhase(conf->layer(i), phase)) {
+      members.push_back(i);
+    }
+  }
+  // Peels layers whose consumers are all dead, layers on a cycle are kept
+  // for the network to reject.
+  std::vector<bool> dead(conf->layer_size(), false);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i : members) {
+      if (dead[i] || i == output) {
+        continue;
+      }
+      bool unused = true;
+      for (int j : Consumers(*conf, i, phase)) {
+        unused = unused && dead[j];
+      }
+      if (unused) {
+        dead[i] = true;
+        changed = true;
+      }
+    }
+  }
+  for (int i : members) {
+    if (!dead[i]) {
+      continue;
+    }
+    auto* layer = conf->mutable_layer(i);
+    Names phases;
+    for (const auto& p : layer->phases()) {
+      if (p != phase) {
+        phases.push_back(p);
+      }
+    }
+    layer->clear_phases();
+    for (const auto& p : phases) {
+      layer->add_phases(p);
+    }
+    LOG(INFO) << "[GraphPass:" << pass << "] removed " << layer->name()
+              << " at " << phase << " phase";
+  }
+  for (int i = conf->layer_size() - 1; i >= 0; --i) {
+    if (conf->layer(i).phases_size() == 0) {
+      const std::string name = conf->layer(i).name();
+      RemoveLayer(i, conf);
+      if (!HasLayer(*conf, name)) {
+        Relink(name, {}, "", conf);
+      }
+    }
+  }
+}
+
+static void EliminateDead(NetworkConfig* conf) {
+  for (const auto& phase : Phases(*conf)) {
+    int output = -1;
+    for (int i = 0; i < conf->layer_size(); ++i) {
+      if (InPhase(conf->layer(i), phase) &&
+          Consumers(*conf, i, phase).empty()) {
+        output = i;
+      }
+    }
+    if (output >= 0) {
+      RemoveUnused("dead", phase, output, conf);
+    }
+  }
+}
+
+static void FuseActivations(NetworkConfig* conf) {
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    const auto& affine = conf->layer(i);
+    // Sharded layers gather their output across nodes first.
+    if (affine.type() != "Affine" || affine.phases_size() == 0 ||
+        affine.affine().shards() > 1) {
+      continue;
+    }
+    int next = -1;
+    bool fusable = true;
+    for (const auto& phase : affine.phases()) {
+      auto consumers = Consumers(*conf, i, phase);
+      fusable = fusable && consumers.size() == 1 &&
+                (next < 0 || next == consumers[0]);
+      next = consumers.empty() ? -1 : consumers[0];
+    }
+    if (!fusable || next < 0) {
+      continue;
+    }
+    const auto& act = conf->layer(next);
+    Names phases(act.phases().begin(), act.phases().end());
+    Names affine_phases(affine.phases().begin(), affine.phases().end());
+    std::sort(phases.begin(), phases.end());
+    std::sort(affine_phases.begin(), affine_phases.end());
+    if ((act.type() != "Relu" && act.type() != "Sigmoid") ||
+        phases != affine_phases) {
+      continue;
+    }
+    bool single = true;
+    for (const auto& phase : phases) {
+      single = single && Producers(*conf, next, phase).size() == 1;
+    }
+    if (!single) {
+      continue;
+    }
+    const std::string name = act.name();
+    const std::string type = act.type();
+    Names outputs = Outputs(act);
+    for (const auto& phase : phases) {
+      for (int j : Consumers(*conf, next, phase)) {
+        if (!Contains(outputs, conf->layer(j).name())) {
+          outputs.push_back(conf->layer(j).name());
+        }
+      }
+    }
+    auto* fused = conf->mutable_layer(i);
+    fused->set_type("FusedAffine");
+    fused->mutable_affine()->set_activation(type == "Relu" ? "relu"
+                                                           : "sigmoid");
+    SetOutputs(outputs, fused);
+    const std::string fused_name = fused->name();
+    RemoveLayer(next, conf);
+    Relink(name, {}, fused_name, conf);
+    LOG(INFO) << "[GraphPass:fuse] " << fused_name << " + " << name << " -> "
+              << fused_name << " (FusedAffine)";
+    if (next < i) {
+      --i;
+    }
+  }
+}
+
+// The `size` values of `wc` if the config carries them, unset fillers give
+// `fallback`.
+static bool Values(const WeightConfig& wc, size_t size, Float fallback,
+                   std::vector<Float>* values) {
+  if (wc.filler().empty() || wc.filler() == "zero" || wc.filler() == "one") {
+    values->assign(size, wc.filler().empty() ? fallback
+                                             : Float(wc.filler() == "one"));
+    return true;
+  }
+  if (wc.filler() != "data" || wc.data().size() != size * sizeof(Float)) {
+    return false;
+  }
+  values->resize(size);
+  memcpy(values->data(), wc.data().data(), wc.data().size());
+  return true;
+}
+
+static void SetValues(const std::vector<Float>& values, WeightConfig* wc) {
+  wc->set_filler("data");
+  wc->set_data(values.data(), values.size() * sizeof(Float));
+}
+
+// Scales the columns of the weight of `affine` and shifts its bias as the
+// running statistics of `bn` do, false if either layer does not carry its
+// values.
+static bool Fold(const LayerConfig& bn, LayerConfig* affine) {
+  const size_t k = affine->input_size();
+  const size_t n = affine->output_size();
+  const auto& norm = bn.batch_norm();
+  const size_t channels = norm.channels() ? norm.channels() : n;
+  std::vector<Float> w, b, scale, shift, mean, variance;
+  if (!k || channels != n || affine->affine().weight().filler() != "data" ||
+      !Values(affine->affine().weight(), k * n, 0, &w) ||
+      !Values(affine->affine().bias(), n, 0, &b) ||
+      !Values(norm.scale(), n, 1, &scale) ||
+      !Values(norm.shift(), n, 0, &shift) ||
+      !Values(norm.mean(), n, 0, &mean) ||
+      !Values(norm.variance(), n, 1, &variance)) {
+    return false;
+  }
+  for (size_t j = 0; j < n; ++j) {
+    const Float factor = scale[j] / sqrt(variance[j] + norm.epsilon());
+    for (size_t i = 0; i < k; ++i) {
+      w[i * n + j] *= factor;
+    }
+    b[j] = (b[j] - mean[j]) * factor + shift[j];
+  }
+  auto* config = affine->mutable_affine();
+  SetValues(w, config->mutable_weight());
+  SetValues(b, config->mutable_bias());
+  config->mutable_bias()->mutable_shape()->clear_dims();
+  config->mutable_bias()->mutable_shape()->add_dims(n);
+  return true;
+}
+
+static bool IsBlockable(const LayerConfig& layer) {
+  return layer.type() == "Conv2D" && InPhase(layer, "infer") &&
+         (layer.conv().algorithm() == "direct" ||
+          layer.conv().algorithm() == "winograd");
+}
+
+// Picks the kernels of the convolutions of an infer network, and keeps the
+// output of one channel-blocked up to the next one through elementwise
+// layers, the layout then only changes at the ends of such chains.
+static void BlockConvolutions(NetworkConfig* conf) {
+  if (conf->phase() == "train") {
+    return;
+  }
+  for (auto& layer : *conf->mutable_layer()) {
+    auto* conv = layer.mutable_conv();
+    if (layer.type() != "Conv2D" || !InPhase(layer, "infer") ||
+        conv->algorithm() != "auto") {
+      continue;
+    }
+    // Their weights are laid out the same.
+    if (conv->groups() > 1 && conv->groups() == conv->channels()) {
+      layer.set_type("DepthwiseConv2D");
+    } else if (conv->groups() == 1 && conv->kernel() == 1 &&
+               conv->stride() == 1 && conv->padding() == 0) {
+      layer.set_type("PointwiseConv2D");
+    } else if (conv->groups() == 1) {
+      const bool winograd =
+          conv->kernel() == 3 && conv->stride() == 1 && conv->dilation() == 1;
+      conv->set_algorithm(winograd ? "winograd" : "direct");
+    } else {
+      continue;
+    }
+    LOG(INFO) << "[GraphPass:conv] " << layer.name() << ": "
+              << (layer.type() == "Conv2D" ? conv->algorithm() : layer.type());
+  }
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    if (!IsBlockable(conf->layer(i))) {
+      continue;
+    }
+    // Follows the only consumer through Relu and Sigmoid.
+    int j = i;
+    while (true) {
+      auto consumers = Consumers(*conf, j, "infer");
+      if (consumers.size() != 1 ||
+          Producers(*conf, consumers[0], "infer").size() != 1) {
+        j = -1;
+        break;
+      }
+      j = consumers[0];
+      const std::string& type = conf->layer(j).type();
+      if (type != "Relu" && type != "Sigmoid") {
+        break;
+      }
+    }
+    if (j < 0 || !IsBlockable(conf->layer(j))) {
+      continue;
+    }
+    conf->mutable_layer(i)->mutable_conv()->set_blocked_output(true);
+    conf->mutable_layer(j)->mutable_conv()->set_blocked_input(true);
+    // Declared sizes are those of plain images, the blocked ones are
+    // inferred from the convolutions.
+    conf->mutable_layer(i)->clear_output_size();
+    for (int k = i; k != j;) {
+      k = Consumers(*conf, k, "infer")[0];
+      conf->mutable_layer(k)->clear_input_size();
+      if (k != j) {
+        conf->mutable_layer(k)->clear_output_size();
+      }
+    }
+    LOG(INFO) << "[GraphPass:conv] " << conf->layer(i).name() << " -> "
+              << conf->layer(j).name() << " channel-blocked";
+  }
+}
+
+}  // namespace
+
+bool TruncateGraph(const std::string& name, NetworkConfig* conf) {
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    if (conf->layer(i).name() == name && InPhase(conf->layer(i), "infer")) {
+      RemoveUnused("truncate", "infer", i, conf);
+      return true;
+    }
+  }
+  LOG(ERROR) << "[GraphPass:truncate] no layer " << name << " at infer phase";
+  return false;
+}
+
+void FoldBatchNorm(NetworkConfig* conf) {
+  if (conf->phase() == "train") {
+    return;
+  }
+  for (int i = 0; i < conf->layer_size(); ++i) {
+    if (conf->layer(i).type() != "Affine" ||
+        !InPhase(conf->layer(i), "infer")) {
+      continue;
+    }
+    auto consumers = Consumers(*conf, i, "infer");
+    if (consumers.size() != 1) {
+      continue;
+    }
+    const int next = consumers[0];
+    const auto& bn = conf->layer(next);
+    if (bn.type() != "BatchNorm" ||
+        Producers(*conf, next, "infer").size() != 1 ||
+        !Fold(bn, conf->mutable_layer(i))) {
+      continue;
+    }
+    const std::string name = bn.name();
+    Names outputs = Outputs(bn);
+    for (int j : Consumers(*conf, next, "infer")) {
+      if (!Contains(outputs, conf->layer(j).name())) {
+        outputs.push_back(conf->layer(j).name());
+      }
+    }
+    auto* affine = conf->mutable_layer(i);
+    SetOutputs(outputs, affine);
+    const std::string affine_name = affine->name();
+    RemoveLayer(next, conf);
+    Relink(name, {}, affine_name, conf);
+    LOG(INFO) << "[GraphPass:fold] " << affine_name << " + " << name << " -> "
+              << affine_name;
+    if (next < i) {
+      --i;
+    }
+  }
+}
+
+void OptimizeGraph(NetworkConfig* conf) {
+  SimplifyForInference(conf);
+  EliminateIdentity(conf);
+  EliminateDead(conf);
+  FoldBatchNorm(conf);
+  FuseActivations(conf);
+  BlockConvolutions(conf);
+}
+
+}  // namespace cola
@@ -0,0 +1,51 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_GRAPH_PASSES_H_
+#define COLA_CORE_GRAPH_PASSES_H_
+
+#include <string>
+
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+
+// Rewrites the layers of `conf` before they are created, each pass logs the
+// layers it changed:
+// - simplify: the infer phase outputs Softmax or Argmax instead of the loss
+// - identity: layers passing their input through are removed, Dropout too
+//   outside of train networks
+// - dead: layers not leading to the output of a phase are removed, the
+//   output being the last layer of the phase nothing consumes
+// - fold: BatchNorm after Affine is merged into its weights at inference
+// - fuse: Affine followed by Relu or Sigmoid becomes one FusedAffine
+// - conv: Conv2D layers of an infer network become DepthwiseConv2D when
+//   every group has one channel, PointwiseConv2D when 1 x 1, and use the
+//   direct or Winograd kernel otherwise, consecutive ones pass
+//   channel-blocked outputs to each other
+void OptimizeGraph(NetworkConfig* conf);
+
+// Stops the infer phase at the output of layer `name`, the layers not leading
+// to it are removed from the phase. Logs and returns false if the phase has
+// no such layer.
+bool TruncateGraph(const std::string& name, NetworkConfig* conf);
+
+// The fold pass alone, for networks not of the train phase whose Affine and
+// BatchNorm layers carry their values as data, e.g. snapshots.
+void FoldBatchNorm(NetworkConfig* conf);
+
+}  // namespace cola
+
+#endif  // COLA_CORE_GRAPH_PASSES_H_
@@ -0,0 +1,197 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/model_group.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cola/base/io_util.h"
+#include "cola/base/logging.h"
+#include "cola/core/graph_passes.h"
+
+namespace cola {
+
+static bool IsAffine(const LayerConfig& layer) {
+  return layer.type() == "Affine" || layer.type() == "FusedAffine";
+}
+
+// Appends the values of `wc` to `out`.
+static bool AppendWeight(const std::string& name, const WeightConfig& wc,
+                         size_t count, std::vector<Float>* out) {
+  const size_t offset = out->size();
+  out->resize(offset + count);
+  const size_t bytes = count * sizeof(Float);
+  if (wc.filler() == "data") {
+    if (wc.data().size() != bytes) {
+      LOG(ERROR) << "[ModelGroup] " << name << " has " << wc.data().size()
+                 << " bytes of weights, expected " << bytes;
+      return false;
+    }
+    memcpy(out->data() + offset, wc.data().data(), bytes);
+    return true;
+  }
+  if (wc.filler() == "file") {
+    int fd = open(wc.file().c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(ERROR) << "[ModelGroup] failed to open " << wc.file();
+      return false;
+    }
+    const bool ok = ReadFileAt(fd, wc.offset(), out->data() + offset, bytes);
+    close(fd);
+    return ok;
+  }
+  LOG(ERROR) << "[ModelGroup] " << name << " has no trained weights";
+  return false;
+}
+
+static void ClearWeight(WeightConfig* wc) {
+  wc->clear_filler();
+  wc->clear_data();
+  wc->clear_file();
+  wc->clear_offset();
+}
+
+bool ModelGroup::Load(const std::vector<NetworkConfig>& models) {
+  if (models.empty()) {
+    LOG(ERROR) << "[ModelGroup] no models";
+    return false;
+  }
+  num_models_ = models.size();
+  // The graph passes run once on every model, the grouped layers are
+  // neither fused nor tiled.
+  std::vector<NetworkConfig> confs(models);
+  for (auto& conf : confs) {
+    conf.set_phase("infer");
+    if (conf.optimize()) {
+      OptimizeGraph(&conf);
+      conf.set_optimize(false);
+    }
+    conf.set_tiling(false);
+    conf.set_stream_weights(false);
+  }
+  auto topology = [](NetworkConfig conf) {
+    conf.clear_name();
+    for (auto& layer : *conf.mutable_layer()) {
+      if (IsAffine(layer)) {
+        ClearWeight(layer.mutable_affine()->mutable_weight());
+        ClearWeight(layer.mutable_affine()->mutable_bias());
+      }
+    }
+    return conf.SerializeAsString();
+  };
+  const std::string expected = topology(confs[0]);
+  for (size_t i = 1; i < num_models_; ++i) {
+    if (topology(confs[i]) != expected) {
+      LOG(ERROR) << "[ModelGroup] model " << i << " (" << confs[i].name()
+                 << ") differs from model 0 in more than its weights";
+      return false;
+    }
+  }
+
+  NetworkConfig conf = confs[0];
+  for (int l = 0; l < conf.layer_size(); ++l) {
+    auto* layer = conf.mutable_layer(l);
+    if (!IsAffine(*layer)) {
+      continue;
+    }
+    const size_t k = layer->input_size();
+    const size_t n = layer->output_size();
+    std::vector<Float> w;
+    std::vector<Float> b;
+    w.reserve(num_models_ * k * n);
+    b.reserve(num_models_ * n);
+    for (const auto& model : confs) {
+      const auto& affine = model.layer(l).affine();
+      if (!AppendWeight(layer->name(), affine.weight(), k * n, &w) ||
+          !AppendWeight(layer->name(), affine.bias(), n, &b)) {
+        return false;
+      }
+    }
+    layer->set_type("GroupedAffine");
+    auto set_data = [](const std::vector<Float>& data,
+                       const std::vector<size_t>& dims, WeightConfig* wc) {
+      ClearWeight(wc);
+      wc->clear_shape();
+      for (size_t dim : dims) {
+        wc->mutable_shape()->add_dims(dim);
+      }
+      wc->set_filler("data");
+      wc->set_data(data.data(), data.size() * sizeof(Float));
+    };
+    set_data(w, {num_models_, k, n}, layer->mutable_affine()->mutable_weight());
+    set_data(b, {num_models_, n}, layer->mutable_affine()->mutable_bias());
+    LOG(INFO) << "[ModelGroup] " << layer->name() << " grouped over "
+              << num_models_ << " models";
+  }
+  return network_.Load(conf);
+}
+
+bool ModelGroup::Predict(const Tensor<Float>& input,
+                         const std::vector<size_t>& models,
+                         Tensor<Float>* output) {
+  const size_t m = input.shape(0);
+  const size_t k = input.count(1);
+  if (models.size() != m) {
+    LOG(ERROR) << "[ModelGroup] " << models.size() << " models for " << m
+               << " rows";
+    return false;
+  }
+  for (size_t model : models) {
+    if (model >= num_models_) {
+      LOG(ERROR) << "[ModelGroup] model " << model << " out of "
+                 << num_models_;
+      return false;
+    }
+  }
+
+  // Counting sort of the rows by model.
+  auto* groups = ctx_.session()->mutable_groups();
+  groups->assign(num_models_ + 1, 0);
+  for (size_t model : models) {
+    ++(*groups)[model + 1];
+  }
+  for (size_t g = 0; g < num_models_; ++g) {
+    (*groups)[g + 1] += (*groups)[g];
+  }
+  order_.resize(m);
+  next_.assign(groups->begin(), groups->end() - 1);
+  for (size_t i = 0; i < m; ++i) {
+    order_[next_[models[i]]++] = i;
+  }
+
+  auto* x = input_.mutable_data();
+  x->Resize(input.shape());
+  for (size_t r = 0; r < m; ++r) {
+    memcpy(x->mutable_data() + r * k, input.data() + order_[r] * k,
+           k * sizeof(Float));
+  }
+  if (!network_.Forward(ctx_, input_, &output_)) {
+    LOG(ERROR) << "[ModelGroup] " << ctx_.session()->error();
+    return false;
+  }
+
+  const auto& y = output_.data();
+  const size_t n = y.count(1);
+  output->Resize(y.shape());
+  for (size_t r = 0; r < m; ++r) {
+    memcpy(output->mutable_data() + order_[r] * n, y.data() + r * n,
+           n * sizeof(Float));
+  }
+  return true;
+}
+
+}  // namespace cola
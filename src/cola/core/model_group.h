@@ -0,0 +1,60 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_MODEL_GROUP_H_
+#define COLA_CORE_MODEL_GROUP_H_
+
+#include <string>
+#include <vector>
+
+#include "cola/base/tensor.h"
+#include "cola/base/types.h"
+#include "cola/core/network.h"
+
+namespace cola {
+
+// Serves many small networks of the same topology, e.g. one per tenant, as a
+// single infer network. The Affine layers become GroupedAffine layers holding
+// the weights of all the models, the rows of a batch are grouped by model so
+// that every layer runs once for the whole batch instead of once per model.
+class ModelGroup {
+ public:
+  // Logs and returns false unless the models only differ in their weights,
+  // which are read from the models or their weight files.
+  bool Load(const std::vector<NetworkConfig>& models);
+
+  size_t size() const { return num_models_; }
+
+  // Runs row i of `input` through model `models[i]`, into row i of `output`.
+  // One caller at a time. Logs and returns false if a model is out of range
+  // or the network failed on the batch.
+  bool Predict(const Tensor<Float>& input, const std::vector<size_t>& models,
+               Tensor<Float>* output);
+
+ private:
+  size_t num_models_ = 0;
+  Context ctx_;
+  Network network_;
+  // Workspaces of Predict, the rows in model order.
+  std::vector<size_t> order_;
+  // The next position of the rows of every model.
+  std::vector<size_t> next_;
+  Variable input_;
+  Variable output_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_MODEL_GROUP_H_
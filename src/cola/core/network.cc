@@ -15,229 +15,826 @@
 
 #include "cola/core/network.h"
 
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <map>
-#include <numeric>
+#include <unordered_map>
 
 #include "cola/base/logging.h"
+#include "cola/base/numa.h"
 #include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+#include "cola/core/graph_passes.h"
+#include "cola/core/weight_stream.h"
 
 namespace cola {
 
-namespace {
+Network::Network() : phase_(Phase::kTrain) {}
 
-static const size_t kMaxNetworkNums = 256;
+Network::~Network() {
+  for (auto* layer : all_layers_) {
+    delete layer;
+  }
+}
 
-struct TlsData {
-  std::vector<Variable*>* variables;
-  TlsData* next;
-};
+std::vector<Weight*> Network::GetWeights() const {
+  std::vector<Weight*> weights;
+  for (auto* layer : layers_[kTrain]) {
+    if (!layer->trainable()) {
+      continue;
+    }
+    auto ws = layer->GetWeights();
+    std::copy(ws.begin(), ws.end(), std::back_inserter(weights));
+  }
+  return weights;
+}
+
+bool Network::Load(const NetworkConfig& network_conf) {
+  // One thread per cpu unless the Trainer or Predictor sized it first.
+  ThreadPool::Init(0);
+  phase_ = network_conf.phase() == "train" ? kTrain : kInfer;
+  NetworkConfig conf = network_conf;
+  if (phase_ == kInfer) {
+    auto* layers = conf.mutable_layer();
+    layers->erase(std::remove_if(layers->begin(), layers->end(),
+                                 [](const LayerConfig& layer) {
+                                   return layer.type() == "Data";
+                                 }),
+                  layers->end());
+  }
+  if (!conf.output_layer().empty() &&
+      !TruncateGraph(conf.output_layer(), &conf)) {
+    return false;
+  }
+  if (conf.optimize()) {
+    OptimizeGraph(&conf);
+  }
+  std::vector<Layer*> phase_layers[kNums];
+  for (const auto& layer_conf : conf.layer()) {
+    if (layer_conf.type() == "Data") {
+      CHECK(layer_conf.phases_size() == 1);
+    }
+    Layer* layer = Registry::Create(layer_conf.type());
+    CHECK(layer);
+    CHECK(layer->Load(layer_conf));
+    for (auto phase : layer_conf.phases()) {
+      if (phase == "train") {
+        phase_layers[kTrain].push_back(layer);
+      } else if (phase == "infer") {
+        phase_layers[kInfer].push_back(layer);
+      } else {
+        CHECK(false);
+      }
+    }
+    all_layers_.push_back(layer);
+    // Weights kept in files are read now unless they are streamed.
+    for (auto* weight : layer->GetWeights()) {
+      if (weight->external() && !conf.stream_weights() && !weight->Fetch()) {
+        return false;
+      }
+    }
+  }
 
-static thread_local TlsData tls_data[kMaxNetworkNums];
-static TlsData* tls_datas[kMaxNetworkNums];
+  CHECK(!all_layers_.empty());
+  if (conf.stream_weights() && phase_ != kInfer) {
+    LOG(ERROR) << "[Network] weights are only streamed at inference";
+    return false;
+  }
+  // Without a declared batch, shapes are only checked.
+  const size_t batch_size = conf.max_batch_size();
+  if (phase_ == kTrain &&
+      !(Build("train", phase_layers[kTrain], &plans_[kTrain]) &&
+        InferShapes("train", batch_size, &plans_[kTrain]))) {
+    return false;
+  }
+  if (!(Build("infer", phase_layers[kInfer], &plans_[kInfer]) &&
+        InferShapes("infer", batch_size, &plans_[kInfer]))) {
+    return false;
+  }
+  if (conf.tiling()) {
+    Tile("infer", conf.tile_rows(), &plans_[kInfer]);
+  }
+  Prune(phase_ == kTrain ? "train" : "infer", &plans_[phase_]);
+  if (phase_ == kTrain) {
+    for (const auto& step : plans_[kTrain].steps) {
+      if (step.backward && !step.layer->has_gradient()) {
+        LOG(ERROR) << "[Network] " << step.layer->layer_config().name()
+                   << " has no gradient, it can not be trained through";
+        return false;
+      }
+    }
+  }
+  // Set by the simplify pass on request of `infer_output`.
+  const auto& infer_steps = plans_[kInfer].steps;
+  argmax_output_ =
+      !infer_steps.empty() &&
+      infer_steps.back().layer->layer_config().type() == "Argmax";
+  plans_[kInfer].var_offset = plans_[kTrain].num_vars;
+  plans_[kInfer].step_offset = plans_[kTrain].steps.size();
+  for (size_t i = 0; i < kNums; ++i) {
+    for (const auto& step : plans_[i].steps) {
+      layers_[i].push_back(step.layer);
+    }
+  }
+  exec_ = CreateExecutionContext();
+  return true;
+}
 
-static std::mutex mutex;
+// Builds the graph of `layers` from the output and input fields of their
+// configs and sorts it topologically, ties are broken by config order.
+bool Network::Build(const std::string& name, const std::vector<Layer*>& layers,
+                    Plan* plan) {
+  const size_t n = layers.size();
+  std::unordered_map<std::string, size_t> index;
+  for (size_t i = 0; i < n; ++i) {
+    CHECK(index.emplace(layers[i]->layer_config().name(), i).second);
+  }
+  std::unordered_map<std::string, Layer*> all;
+  for (auto* layer : all_layers_) {
+    all.emplace(layer->layer_config().name(), layer);
+  }
+  // Layers outside of this phase are skipped, unknown names are errors.
+  bool unknown = false;
+  auto find = [&](const std::string& layer, size_t* i) {
+    if (all.find(layer) == all.end()) {
+      LOG(ERROR) << "[Network:" << name << "] unknown layer: " << layer;
+      unknown = true;
+      return false;
+    }
+    auto found = index.find(layer);
+    if (found == index.end()) {
+      return false;
+    }
+    *i = found->second;
+    return true;
+  };
 
-static std::vector<size_t>& GetFreeSlots() {
-  auto create_slots = [](size_t n) {
-    std::vector<size_t> slots(n);
-    std::iota(slots.begin(), slots.end(), 0);
-    return slots;
+  std::vector<std::vector<size_t>> producers(n);
+  auto add_edge = [&](size_t from, size_t to) {
+    auto& p = producers[to];
+    if (std::find(p.begin(), p.end(), from) == p.end()) {
+      p.push_back(from);
+    }
   };
-  static std::vector<size_t> slots = create_slots(kMaxNetworkNums);
-  return slots;
+  for (size_t i = 0; i < n; ++i) {
+    const auto& config = layers[i]->layer_config();
+    // Explicit inputs come first and keep their order.
+    for (const auto& input : config.inputs()) {
+      size_t j;
+      if (find(input, &j)) {
+        add_edge(j, i);
+      }
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const auto& config = layers[i]->layer_config();
+    size_t j;
+    if (!config.output().empty() && find(config.output(), &j)) {
+      add_edge(i, j);
+    }
+    for (const auto& output : config.outputs()) {
+      if (find(output, &j)) {
+        add_edge(i, j);
+      }
+    }
+  }
+  if (unknown) {
+    return false;
+  }
+
+  // Kahn's algorithm.
+  std::vector<std::vector<size_t>> consumers(n);
+  std::vector<size_t> degrees(n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t p : producers[i]) {
+      consumers[p].push_back(i);
+    }
+    degrees[i] = producers[i].size();
+  }
+  std::vector<size_t> order;
+  std::vector<size_t> depths(n, 0);
+  std::vector<bool> done(n, false);
+  while (order.size() < n) {
+    size_t next = n;
+    for (size_t i = 0; i < n; ++i) {
+      if (!done[i] && degrees[i] == 0) {
+        next = i;
+        break;
+      }
+    }
+    if (next == n) {
+      LOG(ERROR) << "[Network:" << name << "] graph has a cycle";
+      return false;
+    }
+    done[next] = true;
+    order.push_back(next);
+    for (size_t c : consumers[next]) {
+      --degrees[c];
+      depths[c] = std::max(depths[c], depths[next] + 1);
+    }
+  }
+  size_t sinks = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sinks += consumers[i].empty();
+  }
+  if (sinks != 1) {
+    LOG(ERROR) << "[Network:" << name << "] requires one output layer, got "
+               << sinks;
+    return false;
+  }
+
+  // Variable 0 is the network input, i + 1 the output of step i, aliases
+  // of variables read by several layers follow.
+  std::vector<size_t> position(n);
+  for (size_t i = 0; i < n; ++i) {
+    position[order[i]] = i;
+  }
+  plan->steps.resize(n);
+  size_t num_vars = n + 1;
+  size_t sources = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sources += producers[i].empty();
+  }
+  for (size_t k = 0; k < n; ++k) {
+    size_t i = order[k];
+    Step& step = plan->steps[k];
+    step.layer = layers[i];
+    step.output = k + 1;
+    if (producers[i].empty()) {
+      if (sources > 1) {
+        plan->input_aliases.push_back(num_vars);
+        step.inputs.push_back(num_vars++);
+      } else {
+        step.inputs.push_back(0);
+      }
+    }
+    for (size_t p : producers[i]) {
+      Step& from = plan->steps[position[p]];
+      if (consumers[p].size() > 1) {
+        from.aliases.push_back(num_vars);
+        step.inputs.push_back(num_vars++);
+      } else {
+        step.inputs.push_back(from.output);
+      }
+    }
+  }
+  plan->num_vars = num_vars;
+  plan->var_offset = 0;
+  plan->step_offset = 0;
+
+  std::string log("[Network:");
+  log += name;
+  log += "] ";
+  for (size_t k = 0; k < n; ++k) {
+    size_t depth = depths[order[k]];
+    if (depth == plan->levels.size()) {
+      plan->levels.emplace_back();
+    }
+    plan->levels[depth].push_back(k);
+  }
+  for (size_t d = 0; d < plan->levels.size(); ++d) {
+    const auto& level = plan->levels[d];
+    log += d == 0 ? "" : " -> ";
+    log += level.size() > 1 ? "{" : "";
+    for (size_t j = 0; j < level.size(); ++j) {
+      log += j == 0 ? "" : ", ";
+      log += plan->steps[level[j]].layer->layer_config().name();
+    }
+    log += level.size() > 1 ? "}" : "";
+  }
+  LOG(INFO) << log;
+  return true;
 }
 
-static size_t CreateSlot() {
-  std::unique_lock<std::mutex> guard(mutex);
-  std::vector<size_t>& slots = GetFreeSlots();
-  CHECK_NE(slots.size(), 0);
-  size_t slot_id = slots.back();
-  slots.pop_back();
-  return slot_id;
+// Propagates the shapes from the input of the network, whose size is
+// declared by the layers reading it, and checks that the layers fit.
+bool Network::InferShapes(const std::string& name, size_t batch_size,
+                          Plan* plan) {
+  auto reads_input = [&](const Step& step) {
+    for (size_t i : step.inputs) {
+      if (i == 0 || std::find(plan->input_aliases.begin(),
+                              plan->input_aliases.end(),
+                              i) != plan->input_aliases.end()) {
+        return true;
+      }
+    }
+    return false;
+  };
+  Shape input;
+  for (const Step& step : plan->steps) {
+    const auto& config = step.layer->layer_config();
+    if (!reads_input(step) || config.type() == "Data") {
+      continue;
+    }
+    if (config.input_size() == 0) {
+      LOG(INFO) << "[Network:" << name << "] input size of " << config.name()
+                << " unknown, shapes are found at run time";
+      return true;
+    }
+    if (input.size() != 0 && input.count(1) != config.input_size()) {
+      LOG(ERROR) << "[Network:" << name << "] input sizes differ: "
+                 << config.name() << " expects " << config.input_size();
+      return false;
+    }
+    input = {batch_size, size_t(config.input_size())};
+  }
+
+  std::vector<Shape> shapes(plan->num_vars);
+  shapes[0] = input;
+  for (size_t i : plan->input_aliases) {
+    shapes[i] = input;
+  }
+  size_t count = 0;
+  for (Step& step : plan->steps) {
+    std::vector<Shape> inputs;
+    for (size_t i : step.inputs) {
+      inputs.push_back(shapes[i]);
+    }
+    Shape& output = shapes[step.output];
+    if (!step.layer->InferShape(inputs, &output)) {
+      LOG(ERROR) << "[Network:" << name << "] bad shapes at "
+                 << step.layer->layer_config().name();
+      return false;
+    }
+    for (size_t i : step.aliases) {
+      shapes[i] = output;
+    }
+    step.layer->Reserve(inputs, output);
+    count += output.count();
+  }
+  LOG(INFO) << "[Network:" << name << "] output: "
+            << shapes[plan->steps.size()].ToString() << ", activations: "
+            << count * sizeof(Float) << " bytes";
+  plan->shapes = std::move(shapes);
+  return true;
 }
 
-static void DestroySlot(size_t slot_id) {
-  std::unique_lock<std::mutex> guard(mutex);
-  CHECK_LT(slot_id, kMaxNetworkNums);
-  GetFreeSlots().push_back(slot_id);
+// Finds the chains of row-wise layers, each reading the output of the one
+// before only, and sizes their tiles to fit half of the L2 cache.
+void Network::Tile(const std::string& name, size_t tile_rows, Plan* plan) {
+  if (plan->shapes.empty()) {
+    LOG(INFO) << "[Network:" << name << "] shapes unknown, tiling disabled";
+    return;
+  }
+  long cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (cache_size <= 0) {
+    cache_size = 256 << 10;
+  }
+  auto single = [&](size_t d) -> const Step* {
+    if (d >= plan->levels.size() || plan->levels[d].size() != 1) {
+      return nullptr;
+    }
+    const Step& step = plan->steps[plan->levels[d][0]];
+    if (!step.layer->row_wise() || step.inputs.size() != 1) {
+      return nullptr;
+    }
+    return &step;
+  };
+  for (size_t d = 0; d < plan->levels.size();) {
+    const Step* step = single(d);
+    if (!step) {
+      ++d;
+      continue;
+    }
+    size_t widths = plan->shapes[step->inputs[0]].count(1);
+    std::string log = step->layer->layer_config().name();
+    size_t end = d + 1;
+    for (;; ++end) {
+      widths += plan->shapes[step->output].count(1);
+      const Step* next = single(end);
+      if (!step->aliases.empty() || !next ||
+          next->inputs[0] != step->output) {
+        break;
+      }
+      step = next;
+      log += " -> ";
+      log += step->layer->layer_config().name();
+    }
+    if (end - d > 1) {
+      size_t rows = tile_rows;
+      if (rows == 0) {
+        rows = cache_size / 2 / (widths * sizeof(Float)) / 8 * 8;
+        rows = std::max<size_t>(rows, 8);
+      }
+      plan->segments.push_back({d, end, rows});
+      LOG(INFO) << "[Network:" << name << "] tiles of " << rows
+                << " rows: " << log;
+    }
+    d = end;
+  }
 }
 
-static std::vector<Variable*>* GetThreadVariables(size_t slot_id, size_t n) {
-  if (tls_data[slot_id].variables) {
-    return tls_data[slot_id].variables;
+// Marks the variables whose gradient is needed, those depending on a
+// trainable layer with weights, and skips the rest of the backward pass.
+void Network::Prune(const std::string& name, Plan* plan) {
+  std::vector<bool> needed(plan->num_vars, false);
+  needed[0] = phase_ == kInfer;
+  for (size_t i : plan->input_aliases) {
+    needed[i] = needed[0];
+  }
+  std::string skipped;
+  for (Step& step : plan->steps) {
+    Layer* layer = step.layer;
+    std::vector<bool> propagate_down;
+    bool flows = false;
+    for (size_t i : step.inputs) {
+      propagate_down.push_back(needed[i]);
+      flows = flows || needed[i];
+    }
+    const bool learns = layer->trainable() && !layer->GetWeights().empty();
+    // Data layers start the graph whatever they read.
+    if (layer->layer_config().type() == "Data") {
+      flows = false;
+    }
+    step.backward = flows || learns;
+    needed[step.output] = step.backward;
+    for (size_t i : step.aliases) {
+      needed[i] = step.backward;
+    }
+    layer->set_propagate_down(std::move(propagate_down));
+    if (!step.backward) {
+      skipped += skipped.empty() ? "" : ", ";
+      skipped += layer->layer_config().name();
+    }
   }
-  tls_data[slot_id].variables = new std::vector<Variable*>(n);
-  for (auto& var : *tls_data[slot_id].variables) {
-    var = new Variable;
+  if (!skipped.empty()) {
+    LOG(INFO) << "[Network:" << name << "] no backward: " << skipped;
   }
-  std::unique_lock<std::mutex> guard(mutex);
-  tls_data[slot_id].next = tls_datas[slot_id];
-  tls_datas[slot_id] = &tls_data[slot_id];
-  return tls_data[slot_id].variables;
 }
 
-static void DestroyAllVariables() {
-  for (size_t i = 0; i < kMaxNetworkNums; ++i) {
-    for (TlsData* tls = tls_datas[i]; tls; tls = tls->next) {
-      for (auto* var : *tls->variables) {
-        delete var;
+std::unique_ptr<ExecutionContext> Network::CreateExecutionContext() const {
+  std::unique_ptr<ExecutionContext> exec(new ExecutionContext(this));
+  for (const Plan& plan : plans_) {
+    // Aliases share the data of their source, only gradients of the own
+    // phase are computed.
+    std::vector<bool> aliases(plan.num_vars, false);
+    for (size_t i : plan.input_aliases) {
+      aliases[i] = true;
+    }
+    for (const Step& step : plan.steps) {
+      for (size_t i : step.aliases) {
+        aliases[i] = true;
       }
-      delete tls->variables;
+    }
+    const bool grads = &plan == &plans_[phase_];
+    for (size_t i = 0; i < plan.num_vars; ++i) {
+      exec->vars_.emplace_back(new Variable);
+      // The input is owned by the caller.
+      if (i == 0 || plan.shapes.empty()) {
+        continue;
+      }
+      Variable* var = exec->vars_.back().get();
+      if (!aliases[i]) {
+        var->mutable_data()->Reserve(plan.shapes[i].count());
+      }
+      if (grads) {
+        var->mutable_grad()->Reserve(plan.shapes[i].count());
+      }
+    }
+    for (const Step& step : plan.steps) {
+      exec->inputs_.emplace_back(step.inputs.size());
+      exec->grads_.emplace_back(step.inputs.size());
+      if (plan.shapes.empty()) {
+        continue;
+      }
+      std::vector<Shape> inputs;
+      for (size_t i : step.inputs) {
+        inputs.push_back(plan.shapes[i]);
+      }
+      const size_t bytes =
+          step.layer->StateSize(inputs, plan.shapes[step.output]);
+      exec->vars_[plan.var_offset + step.output]->mutable_state()->reserve(
+          bytes);
     }
   }
+  return exec;
 }
 
-struct TlsDataGuard {
-  TlsDataGuard() {}
-  ~TlsDataGuard() { DestroyAllVariables(); }
-};
+Variable* Network::Var(const Plan& plan, ExecutionContext* exec, size_t i,
+                       const Variable* input, const Variable* output) const {
+  if (i == 0 && input) {
+    return const_cast<Variable*>(input);
+  }
+  if (i == plan.steps.size() && output) {
+    return const_cast<Variable*>(output);
+  }
+  return exec->vars_[plan.var_offset + i].get();
+}
 
-static TlsDataGuard tls_data_guard;
+static void Alias(const Variable& from, Variable* to) {
+  auto* data = const_cast<Float*>(from.data().data());
+  *to->mutable_data() = Tensor<Float>::Create(data, from.data().shape());
+}
 
-}  // namespace
+void Network::ForwardStep(const Context& ctx, const Plan& plan,
+                          ExecutionContext* exec, size_t k,
+                          const Variable* input, Variable* output) const {
+  const Step& step = plan.steps[k];
+  auto& inputs = exec->inputs_[plan.step_offset + k];
+  for (size_t j = 0; j < step.inputs.size(); ++j) {
+    inputs[j] = Var(plan, exec, step.inputs[j], input, output);
+  }
+  Variable* out = Var(plan, exec, step.output, input, output);
+  step.layer->Forward(ctx, inputs, out);
+  for (size_t i : step.aliases) {
+    Alias(*out, Var(plan, exec, i, input, output));
+  }
+}
 
-Network::Network() : net_id_(CreateSlot()), phase_(Phase::kTrain) {}
+void Network::BackwardStep(const Context& ctx, const Plan& plan,
+                           ExecutionContext* exec, size_t k,
+                           const Variable* output, Variable* input) {
+  const Step& step = plan.steps[k];
+  if (!step.backward) {
+    return;
+  }
+  Variable* out = Var(plan, exec, step.output, input, output);
+  if (!step.aliases.empty()) {
+    SumGrads(plan, exec, step.aliases, out);
+  }
+  auto& grads = exec->grads_[plan.step_offset + k];
+  for (size_t j = 0; j < step.inputs.size(); ++j) {
+    grads[j] = Var(plan, exec, step.inputs[j], input, output);
+  }
+  step.layer->Backward(ctx, *out, grads);
+}
 
-Network::~Network() {
-  for (auto* layer : all_layers_) {
-    delete layer;
+void Network::SumGrads(const Plan& plan, ExecutionContext* exec,
+                       const std::vector<size_t>& aliases,
+                       Variable* to) const {
+  auto* grad = to->mutable_grad();
+  *grad = Var(plan, exec, aliases[0], nullptr, nullptr)->grad();
+  for (size_t j = 1; j < aliases.size(); ++j) {
+    *grad += Var(plan, exec, aliases[j], nullptr, nullptr)->grad();
   }
-  DestroySlot(net_id_);
 }
 
-std::vector<Weight*> Network::GetWeights() const {
-  std::vector<Weight*> weights;
-  for (auto* layer : layers_[kTrain]) {
-    auto ws = layer->GetWeights();
-    std::copy(ws.begin(), ws.end(), std::back_inserter(weights));
+bool Network::ForwardSteps(const Context& ctx, ExecutionContext* exec,
+                           size_t begin, size_t end) const {
+  CHECK_EQ(exec->network(), this);
+  const Plan& plan = plans_[phase_];
+  auto* session = ctx.session();
+  session->set_phase(phase_);
+  if (begin == 0) {
+    session->clear_error();
+    for (size_t i : plan.input_aliases) {
+      Alias(*Var(plan, exec, 0, nullptr, nullptr),
+            Var(plan, exec, i, nullptr, nullptr));
+    }
   }
-  return weights;
+  for (size_t k = begin; k < end && session->error().empty(); ++k) {
+    ForwardStep(ctx, plan, exec, k, nullptr, nullptr);
+  }
+  return session->error().empty();
 }
 
-bool Network::Load(const NetworkConfig& conf) {
-  using Dict = std::unordered_map<std::string, Layer*>;
+void Network::BackwardSteps(const Context& ctx, ExecutionContext* exec,
+                            size_t begin, size_t end) {
+  CHECK_EQ(exec->network(), this);
+  CHECK_EQ(phase_, kTrain);
+  for (size_t k = end; k-- > begin;) {
+    BackwardStep(ctx, plans_[phase_], exec, k, nullptr, nullptr);
+  }
+}
 
-  phase_ = conf.phase() == "train" ? kTrain : kInfer;
-  Dict train_dict;
-  Dict infer_dict;
-  for (const auto& layer_conf : conf.layer()) {
-    Layer* layer = Registry::Create(layer_conf.type());
-    CHECK(layer);
-    CHECK(layer->Load(layer_conf));
-    if (layer_conf.type() == "Data") {
-      if (phase_ == kInfer) {
-        continue;
+bool Network::RunForward(const Context& ctx, const Plan& plan,
+                         ExecutionContext* exec, const Variable* input,
+                         Variable* output) const {
+  ctx.session()->set_phase(&plan == &plans_[kTrain] ? kTrain : kInfer);
+  auto var = [&](size_t i) { return Var(plan, exec, i, input, output); };
+  auto alias = [&](const Variable* from, size_t i) { Alias(*from, var(i)); };
+  auto run = [&](size_t k) {
+    ForwardStep(ctx, plan, exec, k, input, output);
+  };
+
+  // Pushes every tile of rows through the layers of the segment, the
+  // outputs in between only hold one tile.
+  auto run_tiles = [&](const Plan::Segment& segment) {
+    const Step& first = plan.steps[plan.levels[segment.first_level][0]];
+    const Step& last = plan.steps[plan.levels[segment.last_level - 1][0]];
+    const Variable* in = var(first.inputs[0]);
+    Variable* out = var(last.output);
+    const size_t rows = in->data().shape(0);
+    const size_t m = in->data().count(1);
+    const size_t n = plan.shapes[last.output].count(1);
+    out->mutable_data()->Resize({rows, n});
+    for (size_t begin = 0; begin < rows; begin += segment.tile_rows) {
+      const size_t r = std::min(segment.tile_rows, rows - begin);
+      auto* x = const_cast<Float*>(in->data().data()) + begin * m;
+      *exec->tile_input_.mutable_data() = Tensor<Float>::Create(x, {r, m});
+      Float* y = out->mutable_data()->mutable_data() + begin * n;
+      *exec->tile_output_.mutable_data() = Tensor<Float>::Create(y, {r, n});
+      const Variable* from = &exec->tile_input_;
+      for (size_t d = segment.first_level; d < segment.last_level; ++d) {
+        const Step& step = plan.steps[plan.levels[d][0]];
+        Variable* to = &step == &last ? &exec->tile_output_ : var(step.output);
+        step.layer->Forward(ctx, *from, to);
+        from = to;
       }
-      CHECK(layer_conf.phases_size() == 1);
-      if (layer_conf.phases(0) == "train") {
-        layers_[kTrain].push_back(layer);
-      } else if (layer_conf.phases(0) == "infer") {
-        layers_[kInfer].push_back(layer);
-      } else {
-        CHECK(false);
+      // A pass-through layer rebinds the tile output to its input.
+      const Float* result = exec->tile_output_.data().data();
+      if (result != y) {
+        memcpy(y, result, r * n * sizeof(Float));
       }
     }
-    for (auto phase : layer_conf.phases()) {
-      if (phase == "train") {
-        CHECK(train_dict.emplace(layer_conf.name(), layer).second);
-      } else {
-        CHECK(infer_dict.emplace(layer_conf.name(), layer).second);
+    for (size_t i : last.aliases) {
+      alias(out, i);
+    }
+  };
+
+  for (size_t i : plan.input_aliases) {
+    alias(input, i);
+  }
+  const bool tiled = &plan == &plans_[kInfer];
+  // An ExitHead confident about the batch ends the infer phase with its
+  // probabilities, or their argmax as the network would output.
+  auto* session = ctx.session();
+  if (tiled) {
+    session->set_exit("");
+  }
+  session->clear_error();
+  auto failed = [&]() { return !session->error().empty(); };
+  auto exited = [&]() {
+    if (!tiled || session->exit().empty()) {
+      return false;
+    }
+    auto* out = var(plan.steps.size())->mutable_data();
+    const auto& probs = session->exit_output();
+    if (!argmax_output_) {
+      *out = probs;
+      return true;
+    }
+    const size_t m = probs.shape(0);
+    const size_t n = probs.count(1);
+    out->Resize({m, 1});
+    for (size_t i = 0; i < m; ++i) {
+      const Float* row = probs.data() + i * n;
+      out->mutable_data()[i] = std::max_element(row, row + n) - row;
+    }
+    return true;
+  };
+  if (tiled && weight_stream_) {
+    // The weights of the next steps are read meanwhile. Past an exit they
+    // are still cycled through, the stream reads them in order.
+    bool done = false;
+    for (size_t k = 0; k < plan.steps.size(); ++k) {
+      if (!weight_stream_->Acquire(k) && !done) {
+        session->set_error("[WeightStream] weights of " +
+                           plan.steps[k].layer->layer_config().name() +
+                           " not read");
+        done = true;
+      }
+      if (!done) {
+        run(k);
+        done = failed() || exited();
       }
+      weight_stream_->Release(k);
     }
-    all_layers_.push_back(layer);
+    return !failed();
   }
-
-  auto build = [](std::string name, std::vector<Layer*>* layers,
-                  const Dict& dict) {
-    std::string log("[Network:");
-    log += name;
-    log += "] ";
-    log += layers->back()->layer_config().name();
-    do {
-      name = layers->back()->layer_config().output();
-      if (name.empty()) {
-        break;
+  auto segment = plan.segments.begin();
+  for (size_t d = 0; d < plan.levels.size(); ++d) {
+    if (tiled && segment != plan.segments.end() &&
+        segment->first_level == d) {
+      run_tiles(*segment);
+      d = segment->last_level - 1;
+      ++segment;
+      if (failed()) {
+        return false;
       }
-      log += " -> ";
-      log += name;
-      auto found = dict.find(name);
-      CHECK(found != dict.end());
-      layers->push_back(found->second);
-    } while (true);
-    LOG(INFO) << log;
-  };
-  CHECK_GT(all_layers_.size(), 2);
-  if (phase_ == kTrain) {
-    CHECK_NE(layers_[kTrain].size(), 0);
-    CHECK_NE(layers_[kInfer].size(), 0);
-    build("train", &layers_[kTrain], train_dict);
-  } else {
-    layers_[kInfer].push_back(all_layers_.front());
+      continue;
+    }
+    const auto& level = plan.levels[d];
+    if (level.size() == 1) {
+      run(level[0]);
+    } else {
+      ParallelFor(0, level.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+          run(level[j]);
+        }
+      });
+    }
+    if (failed()) {
+      return false;
+    }
+    if (exited()) {
+      return true;
+    }
   }
-  build("infer", &layers_[kInfer], train_dict);
   return true;
 }
 
-// var0         var1        var2
-//   |--layer0--| |--layer1--| ...
-void Network::Forward(const Context& ctx, const Variable& input,
-                      Variable* output) const {
-  const std::vector<Layer*>& layers = layers_[phase_];
-  std::vector<Variable*>* variables =
-      GetThreadVariables(net_id_, layers.size() + 1);
-  Variable* last = variables->back();
-  variables->back() = output;
-  for (size_t i = 0; i < layers.size(); ++i) {
-    layers[i]->Forward(ctx, i == 0 ? input : *(*variables)[i],
-                       (*variables)[i + 1]);
+void Network::RunBackward(const Context& ctx, const Plan& plan,
+                          ExecutionContext* exec, const Variable* output,
+                          Variable* input) {
+  auto run = [&](size_t k) {
+    BackwardStep(ctx, plan, exec, k, output, input);
+  };
+
+  for (size_t d = plan.levels.size(); d-- > 0;) {
+    const auto& level = plan.levels[d];
+    if (level.size() == 1) {
+      run(level[0]);
+      continue;
+    }
+    ParallelFor(0, level.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t j = begin; j < end; ++j) {
+        run(level[j]);
+      }
+    });
+  }
+  if (!plan.input_aliases.empty() && phase_ == kInfer) {
+    SumGrads(plan, exec, plan.input_aliases, input);
+  }
+}
+
+void Network::Place(const NumaConfig& conf) {
+  for (auto* layer : all_layers_) {
+    for (auto* weight : layer->GetWeights()) {
+      auto* data = weight->mutable_data();
+      if (data->size() == 0 || weight->node() >= 0) {
+        continue;  // Streamed or bound to a node.
+      }
+      if (conf.memory() == "interleave") {
+        // Moved to pages of its own, interleaved before the copy.
+        Tensor<Float> placed = numa::CreatePlaced(data->shape(), -1);
+        memcpy(placed.mutable_data(), data->data(),
+               data->size() * sizeof(Float));
+        *data = std::move(placed);
+      }
+      if (conf.replicate_weights() && phase_ == kInfer) {
+        weight->Replicate();
+      }
+    }
   }
-  variables->back() = last;
 }
 
-// var2         var1        var0
-//   |--layer1--| |--layer0--| ...
+bool Network::Forward(const Context& ctx, ExecutionContext* exec,
+                      const Variable& input, Variable* output) const {
+  CHECK_EQ(exec->network(), this);
+  return RunForward(ctx, plans_[phase_], exec, &input, output);
+}
+
+void Network::Backward(const Context& ctx, ExecutionContext* exec,
+                       const Variable& output, Variable* input) {
+  CHECK_EQ(exec->network(), this);
+  // Tiled runs do not keep the activations.
+  CHECK(phase_ == kTrain || plans_[kInfer].segments.empty());
+  RunBackward(ctx, plans_[phase_], exec, &output, input);
+}
+
+bool Network::Forward(const Context& ctx, const Variable& input,
+                      Variable* output) const {
+  return Forward(ctx, exec_.get(), input, output);
+}
+
 void Network::Backward(const Context& ctx, const Variable& output,
                        Variable* input) {
-  std::vector<Layer*>& layers = layers_[phase_];
-  std::vector<Variable*>* variables =
-      GetThreadVariables(net_id_, layers.size() + 1);
-  Variable* first = variables->front();
-  variables->front() = input;
-  for (int i = (int)layers.size() - 1; i >= 0; --i) {
-    layers[i]->Backward(
-        ctx, i == (int)layers.size() - 1 ? output : *(*variables)[i + 1],
-        (*variables)[i]);
+  Backward(ctx, exec_.get(), output, input);
+}
+
+size_t Network::input_size() const {
+  for (const auto& step : plans_[kInfer].steps) {
+    const auto& inputs = step.inputs;
+    if (std::find(inputs.begin(), inputs.end(), size_t(0)) != inputs.end() &&
+        step.layer->layer_config().input_size() > 0) {
+      return step.layer->layer_config().input_size();
+    }
   }
-  variables->front() = first;
+  return 0;
 }
 
 Float Network::Accuracy(const Context& ctx) {
   CHECK_EQ(phase_, kTrain);  // Infer phase is not allowd to calc accuray.
-  std::vector<Layer*>& layers = layers_[kInfer];
-  std::vector<Variable*>* variables =
-      GetThreadVariables(net_id_, layers.size() + 1);
-  for (size_t i = 0; i < layers.size(); ++i) {
-    layers[i]->Forward(ctx, *(*variables)[i], (*variables)[i + 1]);
+  const Plan& plan = plans_[kInfer];
+  ExecutionContext* exec = exec_.get();
+  Variable* input = exec->vars_[plan.var_offset].get();
+  if (!RunForward(ctx, plan, exec, input, nullptr)) {
+    LOG(ERROR) << ctx.session()->error();
+    return Float(0);
   }
 
+  // The output is either the probabilities or the index of the class.
   Float acc = Float(0);
-  const auto& out = variables->back()->data();
-  const auto& label = ctx.session()->label();
+  const auto& out =
+      exec->vars_[plan.var_offset + plan.steps.size()]->data();
+  const auto& label = ctx.session()->data();
+  const size_t n = out.count(1);
   for (size_t i = 0; i < ctx.batch_size(); ++i) {
-    const size_t n = label.shape(1);
     size_t a = 0;
-    size_t b = 0;
     const Float* y = out.data() + i * n;
-    const Float* l = label.data() + i * n;
-    for (size_t j = 0; j < n; ++j) {
-      if (y[j] >= y[a]) {
-        a = j;
-      }
-      if (l[j] >= l[b]) {
-        b = j;
+    if (argmax_output_) {
+      a = y[0];
+    } else {
+      for (size_t j = 0; j < n; ++j) {
+        if (y[j] >= y[a]) {
+          a = j;
+        }
       }
     }
-    acc += a == b;
+    acc += a == static_cast<Byte>(label.data()[i]);
   }
   return acc / ctx.batch_size();
 }
@@ -246,6 +843,8 @@ void Network::Snapshot(NetworkConfig* conf) {
   for (auto* layer : layers_[kInfer]) {
     layer->Snapshot(conf->add_layer());
   }
+  // The snapshot serves inference, it pays nothing for normalization.
+  FoldBatchNorm(conf);
 }
 
 }  // namespace cola
@@ -16,12 +16,19 @@
 #ifndef COLA_BASE_NETWORK_H_
 #define COLA_BASE_NETWORK_H_
 
+#include <string>
+#include <vector>
+
 #include "cola/base/logging.h"
 #include "cola/core/context.h"
+#include "cola/core/execution_context.h"
 #include "cola/layers/layer.h"
 #include "cola/optimizers/optimizer.h"
 
 namespace cola {
+
+class WeightStream;
+
 class Network {
  public:
   Network();
@@ -31,28 +38,150 @@ class Network {
 
   std::vector<Weight*> GetWeights() const;
 
-  // var0         var1        var2
-  //   |--layer0--| |--layer1--| ...
-  void Forward(const Context& ctx, const Variable& input,
-               Variable* output) const;
+  // Creates the activations of one request, see ExecutionContextPool for
+  // serving concurrent requests.
+  std::unique_ptr<ExecutionContext> CreateExecutionContext() const;
 
-  // var2         var1        var0
-  //   |--layer1--| |--layer0--| ...
+  // Layers run in topological order of the graph, independent layers of the
+  // same level run concurrently on the thread pool.
+  //
+  // input --layer0--> var1 --layer1--> var2 ...
+  //              \-----------layer2-----^
+  //
+  // Returns false if a layer or the weight stream failed on the batch, see
+  // Session::error(), the output is undefined then.
+  bool Forward(const Context& ctx, ExecutionContext* exec,
+               const Variable& input, Variable* output) const;
+
+  // Runs the layers in reverse order on the activations `exec` kept from
+  // Forward, the gradients of a variable consumed by several layers are
+  // summed. Layers below the lowest trainable one are skipped, the input of
+  // a train phase network is data and gets no gradient.
+  void Backward(const Context& ctx, ExecutionContext* exec,
+                const Variable& output, Variable* input);
+
+  // Same as above on the execution context owned by the network, for a
+  // single caller at a time.
+  bool Forward(const Context& ctx, const Variable& input,
+               Variable* output) const;
   void Backward(const Context& ctx, const Variable& output, Variable* input);
 
+  // Pipeline stages run ranges of the steps of the train phase, in
+  // topological order, on the activations of one micro-batch. The network
+  // input and output are kept in `exec`. The session error is cleared at
+  // step 0, ForwardSteps runs nothing once it is set and returns false then,
+  // the micro-batch having failed.
+  size_t num_steps() const { return plans_[phase_].steps.size(); }
+  const Layer* step_layer(size_t k) const {
+    return plans_[phase_].steps[k].layer;
+  }
+  bool ForwardSteps(const Context& ctx, ExecutionContext* exec, size_t begin,
+                    size_t end) const;
+  void BackwardSteps(const Context& ctx, ExecutionContext* exec,
+                     size_t begin, size_t end);
+
+  // Places the weights according to the memory policy of `conf`, read-only
+  // weights of the infer phase are copied to every node on request.
+  void Place(const NumaConfig& conf);
+
+  // Runs the steps of the infer phase one by one, paging in their weights
+  // through `stream`.
+  void set_weight_stream(WeightStream* stream) { weight_stream_ = stream; }
+
   Float Accuracy(const Context& ctx);
 
   Phase phase() const { return phase_; }
 
+  // Values per row of the input of the infer phase, 0 if the layers reading
+  // it do not declare their input size.
+  size_t input_size() const;
+
+  // Writes the layers of the infer phase with their weights, BatchNorm
+  // folded into the Affine layer before it.
   void Snapshot(NetworkConfig* conf);
- 
+
  private:
-  size_t net_id_;
+  // A layer and the variables it reads and writes. Variable 0 is the input
+  // of the network, variable i + 1 the output of step i. A variable read by
+  // several layers is handed to each of them as an alias sharing its data,
+  // so that their gradients can be summed afterwards.
+  struct Step {
+    Layer* layer;
+    std::vector<size_t> inputs;
+    size_t output;
+    std::vector<size_t> aliases;
+    // False if no gradient flows through the layer and it has no trainable
+    // weights.
+    bool backward = true;
+  };
+
+  struct Plan {
+    std::vector<Step> steps;
+    std::vector<size_t> input_aliases;
+    // Steps grouped by their depth, the steps of a level are independent.
+    std::vector<std::vector<size_t>> levels;
+    // Shapes of the variables at the largest batch, empty if the input size
+    // of the network is unknown.
+    std::vector<Shape> shapes;
+    // Chains of levels holding one row-wise layer each, run tile by tile.
+    struct Segment {
+      size_t first_level;
+      size_t last_level;
+      size_t tile_rows;
+    };
+    std::vector<Segment> segments;
+    size_t num_vars = 0;
+    // Offsets of the phase in the execution contexts.
+    size_t var_offset = 0;
+    size_t step_offset = 0;
+  };
+
+  bool Build(const std::string& name, const std::vector<Layer*>& layers,
+             Plan* plan);
+
+  bool InferShapes(const std::string& name, size_t batch_size, Plan* plan);
+
+  void Tile(const std::string& name, size_t tile_rows, Plan* plan);
+
+  void Prune(const std::string& name, Plan* plan);
+
+  // Returns variable `i` of `plan`, the input and output of the network are
+  // those of the caller if given.
+  Variable* Var(const Plan& plan, ExecutionContext* exec, size_t i,
+                const Variable* input, const Variable* output) const;
+
+  void ForwardStep(const Context& ctx, const Plan& plan,
+                   ExecutionContext* exec, size_t k, const Variable* input,
+                   Variable* output) const;
+
+  void BackwardStep(const Context& ctx, const Plan& plan,
+                    ExecutionContext* exec, size_t k, const Variable* output,
+                    Variable* input);
+
+  // Sums the gradients of the aliases of a variable into `to`.
+  void SumGrads(const Plan& plan, ExecutionContext* exec,
+                const std::vector<size_t>& aliases, Variable* to) const;
+
+  bool RunForward(const Context& ctx, const Plan& plan, ExecutionContext* exec,
+                  const Variable* input, Variable* output) const;
+
+  void RunBackward(const Context& ctx, const Plan& plan,
+                   ExecutionContext* exec, const Variable* output,
+                   Variable* input);
+
   Phase phase_;
+  // The infer phase outputs the index of the class instead of the
+  // probabilities.
+  bool argmax_output_ = false;
+  std::unique_ptr<ExecutionContext> exec_;
 
   std::vector<Layer*> layers_[kNums];
+  Plan plans_[kNums];
 
   std::vector<Layer*> all_layers_;
+  WeightStream* weight_stream_ = nullptr;
+
+  friend class Compiler;
 };
 
 }  // namespace cola
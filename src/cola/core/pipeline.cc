@@ -0,0 +1,284 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+
+#include "cola/base/logging.h"
+#include "cola/base/numa.h"
+
+namespace cola {
+
+Pipeline::Pipeline(Network* network)
+    : network_(network),
+      micro_batches_(0),
+      iteration_(0),
+      stop_(false),
+      finished_(0),
+      failed_(0) {}
+
+Pipeline::~Pipeline() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool Pipeline::Load(const PipelineConfig& conf, size_t micro_batches) {
+  const size_t n = network_->num_steps();
+  const size_t stages = conf.stages();
+  if (stages < 2 || stages > n) {
+    LOG(ERROR) << "[Pipeline] stages must be in [2, " << n << "], got "
+               << stages;
+    return false;
+  }
+  if (conf.schedule() != "gpipe" && conf.schedule() != "1f1b") {
+    LOG(ERROR) << "[Pipeline] unknown schedule: " << conf.schedule();
+    return false;
+  }
+  micro_batches_ = micro_batches;
+  // 1F1B keeps at most one micro-batch per stage in flight.
+  size_t slots = micro_batches;
+  if (conf.schedule() == "1f1b") {
+    slots = std::min(stages, micro_batches);
+  }
+  for (size_t i = 0; i < slots; ++i) {
+    execs_.push_back(network_->CreateExecutionContext());
+    contexts_.emplace_back(new Context);
+    contexts_.back()->session()->set_loss_scale(Float(1) / micro_batches);
+  }
+
+  bounds_ = {0};
+  if (conf.boundaries_size() > 0) {
+    if (static_cast<size_t>(conf.boundaries_size()) + 1 != stages) {
+      LOG(ERROR) << "[Pipeline] " << stages << " stages need "
+                 << stages - 1 << " boundaries";
+      return false;
+    }
+    for (const auto& name : conf.boundaries()) {
+      size_t k = bounds_.back() + 1;
+      while (k < n && network_->step_layer(k)->layer_config().name() != name) {
+        ++k;
+      }
+      if (k == n) {
+        LOG(ERROR) << "[Pipeline] boundary not found in order: " << name;
+        return false;
+      }
+      bounds_.push_back(k);
+    }
+    bounds_.push_back(n);
+  } else {
+    // Splits the costs into contiguous ranges minimizing the largest one.
+    std::vector<double> costs = Measure();
+    std::vector<double> prefix(n + 1, 0);
+    for (size_t k = 0; k < n; ++k) {
+      prefix[k + 1] = prefix[k] + costs[k];
+    }
+    const double inf = std::numeric_limits<double>::max();
+    // best[s][k]: the largest cost splitting the first k steps in s ranges.
+    std::vector<std::vector<double>> best(stages + 1,
+                                          std::vector<double>(n + 1, inf));
+    std::vector<std::vector<size_t>> from(stages + 1,
+                                          std::vector<size_t>(n + 1, 0));
+    best[0][0] = 0;
+    for (size_t s = 1; s <= stages; ++s) {
+      for (size_t k = s; k <= n; ++k) {
+        for (size_t j = s - 1; j < k; ++j) {
+          double cost = std::max(best[s - 1][j], prefix[k] - prefix[j]);
+          if (best[s - 1][j] < inf && cost < best[s][k]) {
+            best[s][k] = cost;
+            from[s][k] = j;
+          }
+        }
+      }
+    }
+    std::vector<size_t> bounds = {n};
+    for (size_t s = stages, k = n; s > 1; --s) {
+      k = from[s][k];
+      bounds.push_back(k);
+    }
+    bounds_.insert(bounds_.end(), bounds.rbegin(), bounds.rend());
+  }
+
+  for (size_t s = 0; s < stages; ++s) {
+    std::string log;
+    for (size_t k = bounds_[s]; k < bounds_[s + 1]; ++k) {
+      log += k == bounds_[s] ? "" : ", ";
+      log += network_->step_layer(k)->layer_config().name();
+    }
+    LOG(INFO) << "[Pipeline] stage " << s << ": " << log;
+  }
+  Schedule(conf.schedule());
+  forwarded_.resize(stages);
+  backwarded_.resize(stages);
+  for (size_t s = 1; s < stages; ++s) {
+    threads_.emplace_back(&Pipeline::Work, this, s);
+  }
+  return true;
+}
+
+// Times every step over a few forward and backward passes, the first one
+// being a warm-up. The gradients are cleared by the trainer before use.
+std::vector<double> Pipeline::Measure() {
+  const size_t n = network_->num_steps();
+  std::vector<double> costs(n, 0);
+  const Context& ctx = *contexts_[0];
+  ExecutionContext* exec = execs_[0].get();
+  using Clock = std::chrono::steady_clock;
+  for (int i = 0; i < 4; ++i) {
+    std::vector<double> times(n);
+    for (size_t k = 0; k < n; ++k) {
+      auto start = Clock::now();
+      network_->ForwardSteps(ctx, exec, k, k + 1);
+      times[k] = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    for (size_t k = n; k-- > 0;) {
+      auto start = Clock::now();
+      network_->BackwardSteps(ctx, exec, k, k + 1);
+      times[k] += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    for (size_t k = 0; i > 0 && k < n; ++k) {
+      costs[k] += times[k];
+    }
+  }
+  return costs;
+}
+
+// GPipe runs all forward passes then all backward passes in reverse. 1F1B
+// alternates them after a warm-up of one forward pass per later stage.
+// Every stage runs the backward passes in the same order, so that a pass
+// waits for the pass of the same rank in the next stage.
+void Pipeline::Schedule(const std::string& type) {
+  const size_t stages = bounds_.size() - 1;
+  const size_t m = micro_batches_;
+  schedules_.resize(stages);
+  for (size_t s = 0; s < stages; ++s) {
+    auto& tasks = schedules_[s];
+    if (type == "gpipe") {
+      for (size_t i = 0; i < m; ++i) {
+        tasks.push_back({true, i});
+      }
+      for (size_t i = m; i-- > 0;) {
+        tasks.push_back({false, i});
+      }
+      continue;
+    }
+    const size_t warmup = std::min(stages - s - 1, m);
+    for (size_t i = 0; i < warmup; ++i) {
+      tasks.push_back({true, i});
+    }
+    for (size_t i = warmup; i < m; ++i) {
+      tasks.push_back({true, i});
+      tasks.push_back({false, i - warmup});
+    }
+    for (size_t i = m - warmup; i < m; ++i) {
+      tasks.push_back({false, i});
+    }
+  }
+}
+
+void Pipeline::RunStage(size_t stage) {
+  const size_t last = bounds_.size() - 2;
+  size_t forwards = 0;
+  size_t backwards = 0;
+  for (const Task& task : schedules_[stage]) {
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      if (task.forward) {
+        cond_.wait(guard, [&] {
+          return stage == 0 || forwarded_[stage - 1] > task.micro_batch;
+        });
+      } else {
+        cond_.wait(guard, [&] {
+          return stage == last || backwarded_[stage + 1] > backwards;
+        });
+      }
+    }
+    const size_t slot = task.micro_batch % execs_.size();
+    const Context& ctx = *contexts_[slot];
+    ExecutionContext* exec = execs_[slot].get();
+    // The error of a failed micro-batch stays in its session until the
+    // first stage starts the next micro-batch of the slot.
+    if (task.forward) {
+      if (stage == 0) {
+        ctx.session()->set_step((iteration_ - 1) * micro_batches_ +
+                                task.micro_batch);
+      }
+      network_->ForwardSteps(ctx, exec, bounds_[stage], bounds_[stage + 1]);
+    } else if (ctx.session()->error().empty()) {
+      network_->BackwardSteps(ctx, exec, bounds_[stage], bounds_[stage + 1]);
+    } else if (stage == 0) {
+      LOG(ERROR) << "[Pipeline] micro-batch " << task.micro_batch << ": "
+                 << ctx.session()->error();
+      ++failed_;
+    }
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      if (task.forward) {
+        forwarded_[stage] = ++forwards;
+      } else {
+        backwarded_[stage] = ++backwards;
+      }
+    }
+    cond_.notify_all();
+  }
+}
+
+void Pipeline::Work(size_t stage) {
+  numa::InitThread(stage);
+  size_t iteration = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      cond_.wait(guard, [&] { return stop_ || iteration_ > iteration; });
+      if (stop_) {
+        return;
+      }
+      ++iteration;
+    }
+    RunStage(stage);
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      ++finished_;
+    }
+    cond_.notify_all();
+  }
+}
+
+bool Pipeline::Run() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    std::fill(forwarded_.begin(), forwarded_.end(), 0);
+    std::fill(backwarded_.begin(), backwarded_.end(), 0);
+    finished_ = 0;
+    ++iteration_;
+  }
+  failed_ = 0;
+  cond_.notify_all();
+  RunStage(0);
+  std::unique_lock<std::mutex> guard(mutex_);
+  cond_.wait(guard, [&] { return finished_ == threads_.size(); });
+  return failed_ == 0;
+}
+
+}  // namespace cola
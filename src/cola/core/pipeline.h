@@ -0,0 +1,87 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_PIPELINE_H_
+#define COLA_CORE_PIPELINE_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cola/core/context.h"
+#include "cola/core/network.h"
+
+namespace cola {
+
+// Trains a network split into stages of consecutive layers, each stage run
+// by its own thread. The micro-batches of an iteration stream through the
+// stages, and the weight gradients of every stage are summed over them
+// before the optimizer step.
+class Pipeline {
+ public:
+  explicit Pipeline(Network* network);
+  ~Pipeline();
+
+  // Splits the layers at `conf.boundaries`, or balances the cost of the
+  // layers measured over a few iterations.
+  bool Load(const PipelineConfig& conf, size_t micro_batches);
+
+  // Runs the forward and backward passes of all micro-batches. A
+  // micro-batch failing forward is logged and adds no gradient, returns
+  // false if any did.
+  bool Run();
+
+ private:
+  struct Task {
+    bool forward;
+    size_t micro_batch;
+  };
+
+  std::vector<double> Measure();
+
+  void Schedule(const std::string& type);
+
+  void RunStage(size_t stage);
+
+  void Work(size_t stage);
+
+  Network* network_;
+  size_t micro_batches_;
+  // Stage s runs the steps [bounds_[s], bounds_[s + 1]).
+  std::vector<size_t> bounds_;
+  std::vector<std::vector<Task>> schedules_;
+  // Activations and sessions of the micro-batches in flight.
+  std::vector<std::unique_ptr<ExecutionContext>> execs_;
+  std::vector<std::unique_ptr<Context>> contexts_;
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  size_t iteration_;
+  bool stop_;
+  // Passes done by each stage in the current iteration.
+  std::vector<size_t> forwarded_;
+  std::vector<size_t> backwarded_;
+  size_t finished_;
+  // Micro-batches of the current iteration that failed, counted by the
+  // first stage, which runs the last backward pass of each.
+  size_t failed_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_PIPELINE_H_
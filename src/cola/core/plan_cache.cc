@@ -0,0 +1,230 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/plan_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include "cola/base/logging.h"
+#include "cola/core/weight_stream.h"
+
+namespace cola {
+
+namespace {
+
+static const char kMagic[8] = {'C', 'O', 'L', 'A', 'P', 'L', 'A', 'N'};
+static const uint32_t kVersion = 1;
+static const uint64_t kPageSize = 4096;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t float_size;
+  uint64_t key;
+  uint64_t config_offset;
+  uint64_t config_size;
+};
+
+// FNV-1a over 8-byte words.
+static uint64_t Hash(const std::string& data, uint64_t h) {
+  const uint64_t kPrime = 0x100000001b3ull;
+  size_t i = 0;
+  for (; i + 8 <= data.size(); i += 8) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, 8);
+    h = (h ^ word) * kPrime;
+  }
+  for (; i < data.size(); ++i) {
+    h = (h ^ static_cast<uint8_t>(data[i])) * kPrime;
+  }
+  return h;
+}
+
+// Spreads the changes of any word over all bits of the hash.
+static uint64_t Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 33);
+}
+
+// The cpu model, its instruction set extensions and the cache size, which
+// the tiles are chosen from.
+static std::string CpuFeatures() {
+  std::ifstream ifs("/proc/cpuinfo");
+  std::string line;
+  std::string model;
+  std::string flags;
+  while ((model.empty() || flags.empty()) && std::getline(ifs, line)) {
+    if (model.empty() && line.compare(0, 10, "model name") == 0) {
+      model = line;
+    } else if (flags.empty() && line.compare(0, 5, "flags") == 0) {
+      flags = line;
+    }
+  }
+  return model + "\n" + flags + "\nl2: " +
+         std::to_string(sysconf(_SC_LEVEL2_CACHE_SIZE)) +
+         "\nfloat: " + std::to_string(sizeof(Float));
+}
+
+}  // namespace
+
+PlanCache::PlanCache(const std::string& dir)
+    : dir_(dir), key_(0), base_(nullptr), size_(0) {}
+
+PlanCache::~PlanCache() {
+  if (base_) {
+    munmap(base_, size_);
+  }
+}
+
+uint64_t PlanCache::Key(const std::string& model) {
+  uint64_t h = Hash(model, 0xcbf29ce484222325ull);
+  return Mix(Hash(CpuFeatures(), h));
+}
+
+bool PlanCache::Open(const std::string& model, NetworkConfig* conf) {
+  std::ifstream ifs(model, std::ios::binary);
+  if (!ifs) {
+    LOG(ERROR) << "[PlanCache] cannot open " << model;
+    return false;
+  }
+  ifs.seekg(0, std::ios::end);
+  std::string bytes(ifs.tellg(), '\0');
+  ifs.seekg(0);
+  ifs.read(&bytes[0], bytes.size());
+  key_ = Key(bytes);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.plan",
+           static_cast<unsigned long long>(key_));
+  path_ = dir_ + "/" + name;
+  if (Read(conf)) {
+    LOG(INFO) << "[PlanCache] hit: " << path_;
+    return true;
+  }
+  if (!conf->ParseFromString(bytes)) {
+    LOG(ERROR) << "[PlanCache] bad model: " << model;
+    return false;
+  }
+  header_ = *conf;
+  header_.clear_layer();
+  LOG(INFO) << "[PlanCache] miss: " << path_;
+  return true;
+}
+
+bool PlanCache::Read(NetworkConfig* conf) {
+  int fd = ::open(path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  // Private and writable, the weights are never written but tensors are.
+  void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  const auto* header = static_cast<const Header*>(p);
+  const char* base = static_cast<const char*>(p);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->float_size != sizeof(Float) ||
+      header->key != key_ ||
+      header->config_offset + header->config_size > size_t(st.st_size) ||
+      !conf->ParseFromArray(base + header->config_offset,
+                            header->config_size)) {
+    LOG(WARNING) << "[PlanCache] ignore bad cache file: " << path_;
+    munmap(p, st.st_size);
+    return false;
+  }
+  base_ = static_cast<char*>(p);
+  size_ = st.st_size;
+  return true;
+}
+
+void PlanCache::Map(Network* network) const {
+  CHECK(hit());
+  for (size_t k = 0; k < network->num_steps(); ++k) {
+    Layer* layer = const_cast<Layer*>(network->step_layer(k));
+    for (auto* weight : layer->GetWeights()) {
+      if (!weight->external() || weight->data().size() != 0) {
+        continue;
+      }
+      const size_t bytes = weight->shape().count() * sizeof(Float);
+      CHECK(weight->file() == path_);
+      CHECK_LE(weight->offset() + bytes, size_);
+      Float* data = reinterpret_cast<Float*>(base_ + weight->offset());
+      *weight->mutable_data() = Tensor<Float>::Create(data, weight->shape());
+    }
+  }
+}
+
+bool PlanCache::Insert(Network* network) const {
+  CHECK(!hit());
+  NetworkConfig prepared = header_;
+  prepared.set_phase("infer");
+  prepared.set_optimize(false);
+  network->Snapshot(&prepared);
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir_, ec);
+  // Written aside and renamed, so that concurrent readers never see a
+  // partial file.
+  const std::string tmp = path_ + ".tmp" + std::to_string(getpid());
+  std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+  if (!os) {
+    LOG(WARNING) << "[PlanCache] cannot create " << tmp;
+    return false;
+  }
+  os.write(std::string(kPageSize, '\0').data(), kPageSize);
+  uint64_t offset = kPageSize;
+  WeightStream::Externalize(path_, &prepared, &os, &offset);
+  std::string bytes;
+  prepared.SerializeToString(&bytes);
+  os.write(bytes.data(), bytes.size());
+
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.float_size = sizeof(Float);
+  header.key = key_;
+  header.config_offset = offset;
+  header.config_size = bytes.size();
+  os.seekp(0);
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.close();
+  if (!os || rename(tmp.c_str(), path_.c_str()) != 0) {
+    LOG(WARNING) << "[PlanCache] cannot write " << path_;
+    remove(tmp.c_str());
+    return false;
+  }
+  LOG(INFO) << "[PlanCache] wrote " << path_;
+  return true;
+}
+
+}  // namespace cola
@@ -0,0 +1,67 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_PLAN_CACHE_H_
+#define COLA_CORE_PLAN_CACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "cola/core/network.h"
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+
+// Caches the infer networks as prepared by Network::Load, i.e. rewritten by
+// the graph passes, in files of a directory keyed by the hash of the model
+// and the features of the cpu. A cache file holds the weights page aligned,
+// followed by the config of the prepared layers, and is mapped on a hit:
+// the network then skips the graph passes and uses the weights in place.
+// The mapping lives as long as the cache.
+class PlanCache {
+ public:
+  explicit PlanCache(const std::string& dir);
+  ~PlanCache();
+
+  // Fills `conf` from the cache file of `model` if any, else from `model`.
+  bool Open(const std::string& model, NetworkConfig* conf);
+
+  bool hit() const { return base_ != nullptr; }
+
+  // Points the weights of the network loaded after a hit at the mapping.
+  void Map(Network* network) const;
+
+  // Writes the network loaded after a miss to the cache.
+  bool Insert(Network* network) const;
+
+  // Hashes the model along with the cpu features the plan depends on.
+  static uint64_t Key(const std::string& model);
+
+ private:
+  bool Read(NetworkConfig* conf);
+
+  std::string dir_;
+  std::string path_;
+  uint64_t key_;
+  // The settings of the network besides its layers.
+  NetworkConfig header_;
+  char* base_;
+  size_t size_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_PLAN_CACHE_H_
@@ -16,6 +16,10 @@
 #ifndef COLA_CORE_VARIABLE_H_
 #define COLA_CORE_VARIABLE_H_
 
+#include <stdint.h>
+
+#include <vector>
+
 #include "cola/base/tensor.h"
 #include "cola/base/types.h"
 
@@ -35,9 +39,16 @@ class Variable {
 
   Tensor<Float>* mutable_grad() { return &grad_; }
 
+  // Bytes a layer keeps along with its output for Backward, e.g. where the
+  // maxima of MaxPool2D were. Their capacity is kept across batches.
+  const std::vector<uint8_t>& state() const { return state_; }
+
+  std::vector<uint8_t>* mutable_state() { return &state_; }
+
  protected:
   Tensor<Float> data_;
   Tensor<Float> grad_;
+  std::vector<uint8_t> state_;
 };
 
 }  // namespace cola
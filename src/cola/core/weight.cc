@@ -15,7 +15,14 @@
 
 #include "cola/core/weight.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "cola/base/io_util.h"
 #include "cola/base/logging.h"
+#include "cola/base/numa.h"
 
 namespace cola {
 
@@ -23,6 +30,146 @@ Weight::Weight() {}
 
 Weight::~Weight() {}
 
+void Weight::Replicate() {
+  const auto& nodes = numa::Nodes();
+  int max_id = 0;
+  for (const auto& node : nodes) {
+    max_id = std::max(max_id, node.id);
+  }
+  replicas_.clear();
+  replicas_.resize(max_id + 1);
+  for (const auto& node : nodes) {
+    // The pages are bound before the copy touches them.
+    auto& replica = replicas_[node.id];
+    replica = numa::CreatePlaced(data_.shape(), node.id);
+    memcpy(replica.mutable_data(), data_.data(), data_.size() * sizeof(Float));
+  }
+}
+
+const Tensor<Float>& Weight::local_data() const {
+  if (replicas_.empty()) {
+    return data_;
+  }
+  size_t node = numa::CurrentNode();
+  return node < replicas_.size() && replicas_[node] ? replicas_[node] : data_;
+}
+
+void Weight::Fill(const WeightConfig& config, const Shape& shape) {
+  if (config.filler() == "data") {
+    Shape dims(config.shape().dims().begin(), config.shape().dims().end());
+    data_.Resize(dims);
+    ResizeGrad(dims);
+    memcpy(data_.mutable_data(), config.data().data(), config.data().size());
+  } else if (config.filler() == "file") {
+    Shape dims(config.shape().dims().begin(), config.shape().dims().end());
+    set_source(config.file(), config.offset(), dims);
+  } else if (config.filler() == "normal") {
+    data_ = Tensor<Float>::Randn(shape);
+    data_ *= Float(0.01);
+    ResizeGrad(shape);
+  } else if (config.filler() == "zero") {
+    data_ = Tensor<Float>::Zeros(shape);
+    ResizeGrad(shape);
+  } else if (config.filler() == "one") {
+    data_ = Tensor<Float>::Ones(shape);
+    ResizeGrad(shape);
+  } else {
+    CHECK(false);
+  }
+}
+
+void Weight::SetData(const Tensor<Float>& data, WeightConfig* config) {
+  config->set_filler("data");
+  config->set_data(data.data(), data.size() * sizeof(Float));
+  auto* shape = config->mutable_shape();
+  shape->clear_dims();
+  for (size_t i = 0; i < data.shape().size(); ++i) {
+    shape->add_dims(data.shape(i));
+  }
+}
+
+void Weight::set_source(const std::string& file, uint64_t offset,
+                        const Shape& shape) {
+  file_ = file;
+  offset_ = offset;
+  shape_ = shape;
+}
+
+bool Weight::Fetch() {
+  int fd = ::open(file_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG(ERROR) << "[Weight] cannot open " << file_ << " for " << name_;
+    return false;
+  }
+  data_.Resize(shape_);
+  ResizeGrad(shape_);
+  bool success = ReadFileAt(fd, offset_, data_.mutable_data(),
+                            data_.size() * sizeof(Float));
+  ::close(fd);
+  if (!success) {
+    LOG(ERROR) << "[Weight] cannot read " << name_ << " from " << file_;
+  }
+  return success;
+}
+
+void Weight::ResizeGrad(const Shape& shape) {
+  if (sparse_grad_) {
+    // Grows with the rows touched instead.
+    grad_.Resize({0, shape.count(1)});
+  } else {
+    grad_.Resize(shape);
+  }
+}
+
+void Weight::AddSparseGrad(const std::vector<size_t>& rows,
+                           const Float* values) {
+  CHECK(sparse_grad_);
+  if (rows.empty()) {
+    return;
+  }
+  const size_t n = data_.count(1);
+  if (grad_rows_.empty()) {
+    grad_rows_ = rows;
+    grad_.Resize({rows.size(), n});
+    memcpy(grad_.mutable_data(), values, rows.size() * n * sizeof(Float));
+    return;
+  }
+  // Merges the two ascending lists, e.g. of accumulated micro-batches.
+  merged_rows_.clear();
+  merged_.Resize({grad_rows_.size() + rows.size(), n});
+  Float* dst = merged_.mutable_data();
+  const size_t end = std::numeric_limits<size_t>::max();
+  size_t i = 0;
+  size_t j = 0;
+  while (i < grad_rows_.size() || j < rows.size()) {
+    const size_t row = std::min(i < grad_rows_.size() ? grad_rows_[i] : end,
+                                j < rows.size() ? rows[j] : end);
+    std::fill(dst, dst + n, Float(0));
+    if (i < grad_rows_.size() && grad_rows_[i] == row) {
+      const Float* src = grad_.data() + i++ * n;
+      for (size_t k = 0; k < n; ++k) {
+        dst[k] += src[k];
+      }
+    }
+    if (j < rows.size() && rows[j] == row) {
+      const Float* src = values + j++ * n;
+      for (size_t k = 0; k < n; ++k) {
+        dst[k] += src[k];
+      }
+    }
+    merged_rows_.push_back(row);
+    dst += n;
+  }
+  merged_.Resize({merged_rows_.size(), n});
+  std::swap(grad_rows_, merged_rows_);
+  std::swap(grad_, merged_);
+}
+
+void Weight::ClearSparseGrad() {
+  grad_rows_.clear();
+  grad_.Resize({0, data_.count(1)});
+}
+
 // void Weight::Update() {
 //   CHECK(data_.shape() == grad_.shape());
 //   data_ -= grad_;
@@ -19,7 +19,11 @@
 
 #include <math.h>
 
+#include <string>
+#include <vector>
+
 #include "cola/core/variable.h"
+#include "cola/proto/cola.pb.h"
 
 namespace cola {
 
@@ -34,8 +38,65 @@ class Weight : public Variable {
 
   void set_name(const std::string& name) { name_ = name; }
 
+  // Initializes the weight as `config` says, the random fillers make it of
+  // `shape`, the others carry their own.
+  void Fill(const WeightConfig& config, const Shape& shape);
+
+  // Stores `data` in `config` as a data filler.
+  static void SetData(const Tensor<Float>& data, WeightConfig* config);
+
+  // Copies data() to every NUMA node, the weight must not change afterwards.
+  void Replicate();
+
+  // Returns the replica on the calling thread's node if any, else data().
+  const Tensor<Float>& local_data() const;
+
+  // Keeps the weight of `shape` in `file` at `offset` instead of data(), it
+  // is read by Fetch() or paged in by a WeightStream.
+  void set_source(const std::string& file, uint64_t offset,
+                  const Shape& shape);
+
+  bool external() const { return !file_.empty(); }
+  const std::string& file() const { return file_; }
+  uint64_t offset() const { return offset_; }
+  const Shape& shape() const { return shape_; }
+
+  // Reads the weight from its file into data().
+  bool Fetch();
+
+  // The node the weight is bound to, -1 if it follows the memory policy.
+  int node() const { return node_; }
+  void set_node(int node) { node_ = node; }
+
+  // Whether grad() is row-sparse: row i of grad() is the gradient of row
+  // grad_rows()[i] of data(), the rows not listed having none. Set before
+  // Fill by layers touching few rows of a large weight, whose gradient then
+  // never takes the shape of the data.
+  bool sparse_grad() const { return sparse_grad_; }
+  void set_sparse_grad(bool sparse_grad) { sparse_grad_ = sparse_grad; }
+  const std::vector<size_t>& grad_rows() const { return grad_rows_; }
+
+  // Adds `values`, a row of the data for each of `rows`, to the sparse
+  // gradient. The rows are ascending and unique.
+  void AddSparseGrad(const std::vector<size_t>& rows, const Float* values);
+
+  // Empties the sparse gradient.
+  void ClearSparseGrad();
+
  private:
+  void ResizeGrad(const Shape& shape);
+
   std::string name_;
+  std::string file_;
+  uint64_t offset_ = 0;
+  Shape shape_;
+  int node_ = -1;
+  std::vector<Tensor<Float>> replicas_;
+  bool sparse_grad_ = false;
+  std::vector<size_t> grad_rows_;
+  // The sparse gradient being merged into, swapped with the current one.
+  std::vector<size_t> merged_rows_;
+  Tensor<Float> merged_;
 };
 
 }  // namespace cola
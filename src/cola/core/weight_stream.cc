@@ -0,0 +1,284 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/weight_stream.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include "cola/base/io_util.h"
+#include "cola/base/logging.h"
+
+namespace cola {
+
+namespace pb = ::google::protobuf;
+
+using Clock = std::chrono::steady_clock;
+
+static const uint64_t kPageSize = 4096;
+
+// Keeps the weights in a buffer 64-byte aligned.
+static size_t Padded(size_t count) {
+  const size_t n = 64 / sizeof(Float);
+  return (count + n - 1) / n * n;
+}
+
+static double Seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+WeightStream::WeightStream()
+    : stop_(false), failed_(false), fetched_(0), released_(0) {}
+
+WeightStream::~WeightStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  for (const auto& it : fds_) {
+    ::close(it.second);
+  }
+  if (stats_.bytes != 0) {
+    Report();
+  }
+}
+
+bool WeightStream::Open(Network* network, size_t depth) {
+  CHECK(entries_.empty());
+  if (depth == 0) {
+    LOG(ERROR) << "[WeightStream] at least one buffer is needed";
+    return false;
+  }
+  entry_of_step_.assign(network->num_steps(), -1);
+  size_t size = 0;
+  for (size_t k = 0; k < network->num_steps(); ++k) {
+    Layer* layer = const_cast<Layer*>(network->step_layer(k));
+    Entry entry{k, {}};
+    size_t count = 0;
+    for (auto* weight : layer->GetWeights()) {
+      // Weights already in memory stay there.
+      if (!weight->external() || weight->data().size() != 0) {
+        continue;
+      }
+      auto it = fds_.find(weight->file());
+      if (it == fds_.end()) {
+        int fd = ::open(weight->file().c_str(), O_RDONLY);
+        if (fd == -1) {
+          LOG(ERROR) << "[WeightStream] cannot open " << weight->file();
+          return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        it = fds_.emplace(weight->file(), fd).first;
+      }
+      struct stat st;
+      const size_t bytes = weight->shape().count() * sizeof(Float);
+      if (fstat(it->second, &st) != 0 ||
+          uint64_t(st.st_size) < weight->offset() + bytes) {
+        LOG(ERROR) << "[WeightStream] " << weight->file()
+                   << " is too short for " << weight->name();
+        return false;
+      }
+      entry.weights.push_back(weight);
+      count += Padded(weight->shape().count());
+    }
+    if (!entry.weights.empty()) {
+      entry_of_step_[k] = entries_.size();
+      entries_.push_back(std::move(entry));
+      size = std::max(size, count);
+    }
+  }
+  if (entries_.empty()) {
+    LOG(WARNING) << "[WeightStream] no weights to stream";
+    return true;
+  }
+  for (size_t i = 0; i < depth; ++i) {
+    buffers_.push_back(Tensor<Float>::Create({size}));
+  }
+  LOG(INFO) << "[WeightStream] layers: " << entries_.size()
+            << ", buffers: " << depth << " x " << size * sizeof(Float)
+            << " bytes";
+  thread_ = std::thread(&WeightStream::Prefetch, this);
+  return true;
+}
+
+bool WeightStream::Acquire(size_t k) {
+  const int e = entry_of_step_[k];
+  if (e < 0) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  const size_t seq = released_;
+  CHECK_EQ(seq % entries_.size(), size_t(e));
+  if (fetched_ <= seq) {
+    auto start = Clock::now();
+    cond_.wait(lock, [&] { return fetched_ > seq || failed_; });
+    stats_.stall_seconds += Seconds(start);
+    if (fetched_ <= seq) {
+      return false;
+    }
+  }
+  lock.unlock();
+  Float* p = buffers_[seq % buffers_.size()].mutable_data();
+  for (auto* weight : entries_[e].weights) {
+    *weight->mutable_data() = Tensor<Float>::Create(p, weight->shape());
+    p += Padded(weight->shape().count());
+  }
+  return true;
+}
+
+void WeightStream::Release(size_t k) {
+  const int e = entry_of_step_[k];
+  if (e < 0) {
+    return;
+  }
+  for (auto* weight : entries_[e].weights) {
+    *weight->mutable_data() = Tensor<Float>();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++released_;
+  }
+  cond_.notify_all();
+}
+
+void WeightStream::Prefetch() {
+  for (size_t seq = 0;; ++seq) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [&] {
+        return stop_ || seq < released_ + buffers_.size();
+      });
+      if (stop_) {
+        return;
+      }
+    }
+    const Entry& entry = entries_[seq % entries_.size()];
+    Float* p = buffers_[seq % buffers_.size()].mutable_data();
+    size_t bytes = 0;
+    auto start = Clock::now();
+    for (const auto* weight : entry.weights) {
+      const size_t size = weight->shape().count() * sizeof(Float);
+      const int fd = fds_.at(weight->file());
+      if (!ReadFileAt(fd, weight->offset(), p, size)) {
+        LOG(ERROR) << "[WeightStream] failed to read " << size
+                   << " bytes of " << weight->file() << " at "
+                   << weight->offset();
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          failed_ = true;
+        }
+        cond_.notify_all();
+        return;
+      }
+      // The page cache would end up holding the whole model otherwise.
+      posix_fadvise(fd, weight->offset(), size, POSIX_FADV_DONTNEED);
+      p += Padded(weight->shape().count());
+      bytes += size;
+    }
+    const double seconds = Seconds(start);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fetched_ = seq + 1;
+      stats_.bytes += bytes;
+      stats_.read_seconds += seconds;
+    }
+    cond_.notify_all();
+  }
+}
+
+WeightStream::Stats WeightStream::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void WeightStream::Report() const {
+  const Stats s = stats();
+  const double mb = s.bytes / double(1 << 20);
+  LOG(INFO) << "[WeightStream] read " << mb << " MB in " << s.read_seconds
+            << " s, " << (s.read_seconds > 0 ? mb / s.read_seconds : 0)
+            << " MB/s, stalled " << s.stall_seconds << " s";
+}
+
+static void ExternalizeWeights(const std::string& path, pb::Message* message,
+                               std::ostream* os, uint64_t* offset) {
+  if (message->GetDescriptor() == WeightConfig::descriptor()) {
+    auto* wc = static_cast<WeightConfig*>(message);
+    if (wc->filler() == "data") {
+      os->write(wc->data().data(), wc->data().size());
+      wc->set_filler("file");
+      wc->set_file(path);
+      wc->set_offset(*offset);
+      *offset += wc->data().size();
+      wc->clear_data();
+      wc->clear_grad();
+    }
+    return;
+  }
+  // Finds the weights of any layer type.
+  const auto* reflection = message->GetReflection();
+  std::vector<const pb::FieldDescriptor*> fields;
+  reflection->ListFields(*message, &fields);
+  for (const auto* field : fields) {
+    if (field->cpp_type() != pb::FieldDescriptor::CPPTYPE_MESSAGE) {
+      continue;
+    }
+    if (field->is_repeated()) {
+      for (int i = 0; i < reflection->FieldSize(*message, field); ++i) {
+        ExternalizeWeights(
+            path, reflection->MutableRepeatedMessage(message, field, i), os,
+            offset);
+      }
+    } else {
+      ExternalizeWeights(path, reflection->MutableMessage(message, field), os,
+                         offset);
+    }
+  }
+}
+
+bool WeightStream::Externalize(const std::string& path, NetworkConfig* conf) {
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  if (!os) {
+    LOG(ERROR) << "[WeightStream] cannot create " << path;
+    return false;
+  }
+  uint64_t offset = 0;
+  Externalize(path, conf, &os, &offset);
+  if (!os) {
+    LOG(ERROR) << "[WeightStream] cannot write " << path;
+    return false;
+  }
+  return true;
+}
+
+void WeightStream::Externalize(const std::string& path, NetworkConfig* conf,
+                               std::ostream* os, uint64_t* offset) {
+  for (auto& layer : *conf->mutable_layer()) {
+    const uint64_t page = (*offset + kPageSize - 1) / kPageSize * kPageSize;
+    os->write(std::string(page - *offset, '\0').data(), page - *offset);
+    *offset = page;
+    ExternalizeWeights(path, &layer, os, offset);
+  }
+}
+
+}  // namespace cola
@@ -0,0 +1,101 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_CORE_WEIGHT_STREAM_H_
+#define COLA_CORE_WEIGHT_STREAM_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cola/core/network.h"
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+
+// Pages in the weights kept in files layer by layer, for models larger than
+// the memory. A prefetch thread reads the weights of the next layers into a
+// ring of buffers while the current one computes, every buffer is handed
+// back once its layer is done. The network runs one Forward at a time.
+class WeightStream {
+ public:
+  struct Stats {
+    size_t bytes = 0;
+    double read_seconds = 0;
+    // Time the network waited for weights not read yet.
+    double stall_seconds = 0;
+  };
+
+  WeightStream();
+  ~WeightStream();
+
+  // Streams the external weights of the infer phase of `network` through
+  // `depth` buffers, each holding the weights of one layer.
+  bool Open(Network* network, size_t depth);
+
+  // Blocks until the weights of step `k` are in memory and points them at
+  // the buffer. Returns false if they could not be read, the stream then
+  // stops reading.
+  bool Acquire(size_t k);
+  // Hands the buffer of step `k` back to the prefetch thread.
+  void Release(size_t k);
+
+  Stats stats() const;
+
+  // Logs the achieved bandwidth and the stall time.
+  void Report() const;
+
+  // Moves the data of the weights of `conf` to `path`, the weights of every
+  // layer are contiguous and start at a page boundary.
+  static bool Externalize(const std::string& path, NetworkConfig* conf);
+
+  // Writes the data to `os` from `offset` on instead, `path` names the file
+  // `os` ends up in.
+  static void Externalize(const std::string& path, NetworkConfig* conf,
+                          std::ostream* os, uint64_t* offset);
+
+ private:
+  struct Entry {
+    size_t step;
+    std::vector<Weight*> weights;
+  };
+
+  void Prefetch();
+
+  std::vector<Entry> entries_;
+  // Index of the entry of every step, -1 if the step streams nothing.
+  std::vector<int> entry_of_step_;
+  std::unordered_map<std::string, int> fds_;
+  std::vector<Tensor<Float>> buffers_;
+
+  std::thread thread_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_;
+  // Set by the prefetch thread failing to read an entry.
+  bool failed_;
+  // Entries read and released so far, counting on over the Forward calls.
+  size_t fetched_;
+  size_t released_;
+  Stats stats_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_CORE_WEIGHT_STREAM_H_
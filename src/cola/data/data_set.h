@@ -74,6 +74,10 @@ class DataSet {
     }
   }
 
+  void Read(size_t index, Slice* data, Slice* label) const {
+    reader_.Read(index, data, label);
+  }
+
   void Read(Slice* a, Slice* b) const { reader_.Read(a, b); }
 
   size_t batch_size() const { return batch_size_; }
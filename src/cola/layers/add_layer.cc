@@ -0,0 +1,57 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/add_layer.h"
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+
+namespace cola {
+
+void AddLayer::Forward(const Context& ctx,
+                       const std::vector<const Variable*>& inputs,
+                       Variable* output) const {
+  auto* out = output->mutable_data();
+  *out = inputs[0]->data();
+  for (size_t i = 1; i < inputs.size(); ++i) {
+    *out += inputs[i]->data();
+  }
+}
+
+void AddLayer::Backward(const Context& ctx, const Variable& output,
+                        const std::vector<Variable*>& inputs) {
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (propagate_down(i)) {
+      *inputs[i]->mutable_grad() = output.grad();
+    }
+  }
+}
+
+bool AddLayer::InferShape(const std::vector<Shape>& inputs,
+                          Shape* output) const {
+  for (const auto& input : inputs) {
+    if (input != inputs[0]) {
+      LOG(ERROR) << "[" << layer_config_.name() << "] shapes differ: "
+                 << input.ToString() << " and " << inputs[0].ToString();
+      return false;
+    }
+  }
+  *output = inputs[0];
+  return true;
+}
+
+REGISTER_LAYER(Add);
+
+}  // namespace cola
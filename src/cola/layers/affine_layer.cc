@@ -15,63 +15,295 @@
 
 #include "cola/layers/affine_layer.h"
 
+#include <string.h>
+
+#include <atomic>
+
 #include "cola/base/logging.h"
 #include "cola/base/math_ops.h"
+#include "cola/base/node_groups.h"
+#include "cola/base/numa.h"
 #include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
 
 namespace cola {
 
-static void FillData(const WeightConfig& wc, Weight* weight, Shape shape) {
-  if (wc.filler() == "data") {
-    Shape shape_(wc.shape().dims().begin(), wc.shape().dims().end());
-    weight->mutable_data()->Resize(shape_);
-    weight->mutable_grad()->Resize(shape_);
-    Float* d = weight->mutable_data()->mutable_data();
-    memcpy(d, wc.data().data(), wc.data().size());
-  } else if (wc.filler() == "normal") {
-    *weight->mutable_data() = Tensor<Float>::Randn(shape);
-    weight->mutable_data()->operator*=(Float(0.01));
-    weight->mutable_grad()->Resize(shape);
-  } else if (wc.filler() == "zero") {
-    *weight->mutable_data() = Tensor<Float>::Zeros(shape);
-    weight->mutable_grad()->Resize(shape);
-  } else if (wc.filler() == "one") {
-    *weight->mutable_data() = Tensor<Float>::Ones(shape);
-    weight->mutable_grad()->Resize(shape);
-  } else {
-    CHECK(false);
-  }
-}
-
 bool AffineLayer::Load(const LayerConfig& config) {
   const auto& affine = config.affine();
   const auto& weight_cfg = affine.weight();
   const auto& bias_cfg = affine.bias();
-  FillData(weight_cfg, &w_, {config.input_size(), config.output_size()});
-  FillData(bias_cfg, &b_, {config.output_size()});
+  w_.Fill(weight_cfg, {config.input_size(), config.output_size()});
+  b_.Fill(bias_cfg, {config.output_size()});
   w_.set_name(config.name() + "w");
   b_.set_name(config.name() + "b");
-  return Layer::Load(config);
+  if (affine.shards() > 1) {
+    if (affine.shard_axis() != "column" && affine.shard_axis() != "row") {
+      LOG(ERROR) << "[" << config.name()
+                 << "] unknown shard axis: " << affine.shard_axis();
+      return false;
+    }
+    by_rows_ = affine.shard_axis() == "row";
+    // Sharded weights are never streamed.
+    for (Weight* weight : {&w_, &b_}) {
+      if (weight->external() && !weight->Fetch()) {
+        return false;
+      }
+    }
+    if (!Split(config.name(), affine.shards())) {
+      return false;
+    }
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  // The weights hold the data from now on, Snapshot writes it back.
+  layer_config_.mutable_affine()->mutable_weight()->clear_data();
+  layer_config_.mutable_affine()->mutable_bias()->clear_data();
+  return true;
+}
+
+std::vector<Weight*> AffineLayer::GetWeights() {
+  if (shards_.empty()) {
+    return {&w_, &b_};
+  }
+  std::vector<Weight*> weights;
+  for (auto& shard : shards_) {
+    weights.push_back(&shard->w);
+    if (!by_rows_) {
+      weights.push_back(&shard->b);
+    }
+  }
+  if (by_rows_) {
+    weights.push_back(&b_);
+  }
+  return weights;
+}
+
+bool AffineLayer::Split(const std::string& name, size_t num_shards) {
+  const size_t k = w_.data().shape(0);
+  const size_t n = w_.data().shape(1);
+  const size_t total = by_rows_ ? k : n;
+  if (num_shards > total) {
+    LOG(ERROR) << "[" << name << "] " << num_shards << " shards of "
+               << total << (by_rows_ ? " rows" : " columns");
+    return false;
+  }
+  auto* groups = NodeGroups::Default();
+  const Float* w = w_.data().data();
+  for (size_t s = 0; s < num_shards; ++s) {
+    std::unique_ptr<Shard> shard(new Shard);
+    shard->begin = total * s / num_shards;
+    shard->end = total * (s + 1) / num_shards;
+    const size_t c = shard->end - shard->begin;
+    const int node = groups->node(s);
+    const Shape shape = by_rows_ ? Shape{c, n} : Shape{k, c};
+    *shard->w.mutable_data() = numa::CreatePlaced(shape, node);
+    *shard->w.mutable_grad() = numa::CreatePlaced(shape, node);
+    Float* p = shard->w.mutable_data()->mutable_data();
+    if (by_rows_) {
+      memcpy(p, w + shard->begin * n, c * n * sizeof(Float));
+    } else {
+      for (size_t i = 0; i < k; ++i) {
+        memcpy(p + i * c, w + i * n + shard->begin, c * sizeof(Float));
+      }
+      *shard->b.mutable_data() = numa::CreatePlaced({c}, node);
+      *shard->b.mutable_grad() = numa::CreatePlaced({c}, node);
+      memcpy(shard->b.mutable_data()->mutable_data(),
+             b_.data().data() + shard->begin, c * sizeof(Float));
+      shard->b.set_name(b_.name() + std::to_string(s));
+      shard->b.set_node(node);
+    }
+    shard->w.set_name(w_.name() + std::to_string(s));
+    shard->w.set_node(node);
+    shards_.push_back(std::move(shard));
+  }
+  // Only the shards hold the weight from now on.
+  *w_.mutable_data() = Tensor<Float>();
+  *w_.mutable_grad() = Tensor<Float>();
+  if (!by_rows_) {
+    *b_.mutable_data() = Tensor<Float>();
+    *b_.mutable_grad() = Tensor<Float>();
+  }
+  return true;
+}
+
+void AffineLayer::Merge(Tensor<Float>* w, Tensor<Float>* b) const {
+  const size_t k = layer_config_.input_size();
+  const size_t n = layer_config_.output_size();
+  *w = Tensor<Float>::Create({k, n});
+  if (by_rows_) {
+    *b = b_.data();
+  } else {
+    *b = Tensor<Float>::Create({n});
+  }
+  for (const auto& shard : shards_) {
+    const size_t c = shard->end - shard->begin;
+    const Float* p = shard->w.data().data();
+    if (by_rows_) {
+      memcpy(w->mutable_data() + shard->begin * n, p, c * n * sizeof(Float));
+      continue;
+    }
+    for (size_t i = 0; i < k; ++i) {
+      memcpy(w->mutable_data() + i * n + shard->begin, p + i * c,
+             c * sizeof(Float));
+    }
+    memcpy(b->mutable_data() + shard->begin, shard->b.data().data(),
+           c * sizeof(Float));
+  }
+}
+
+// Copies the columns [begin, begin + c) of the m x n matrix `a` to `b`.
+static void CopyColumns(const Float* a, size_t m, size_t n, size_t begin,
+                        size_t c, Float* b) {
+  ParallelFor(0, m, GrainSize(c), [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      memcpy(b + i * c, a + i * n + begin, c * sizeof(Float));
+    }
+  });
+}
+
+void AffineLayer::SumShards(Tensor<Float> Shard::*part, size_t m, size_t n,
+                            const Float* bias, Float* out) const {
+  ParallelFor(0, m, GrainSize(n * shards_.size()), [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        Float v = bias ? bias[j] : 0;
+        for (const auto& shard : shards_) {
+          v += ((*shard).*part).data()[i * n + j];
+        }
+        out[i * n + j] = v;
+      }
+    }
+  });
+}
+
+void AffineLayer::ShardedForward(const Tensor<Float>& x,
+                                 Tensor<Float>* y) const {
+  const size_t m = x.shape(0);
+  const size_t k = x.count(1);
+  const size_t n = layer_config_.output_size();
+  y->Resize({m, n});
+  Float* out = y->mutable_data();
+  // The last shard done sums the partial outputs, before NodeGroups lets
+  // another call reuse the workspaces.
+  std::atomic<size_t> done(0);
+  NodeGroups::Default()->Run(shards_.size(), [&](size_t s) {
+    Shard* shard = shards_[s].get();
+    const size_t c = shard->end - shard->begin;
+    const Float* w = shard->w.data().data();
+    if (by_rows_) {
+      shard->x.Resize({m, c});
+      CopyColumns(x.data(), m, k, shard->begin, c, shard->x.mutable_data());
+      shard->y.Resize({m, n});
+      MatrixMultiply(shard->x.data(), w, kNoTrans, m, n, c,
+                     shard->y.mutable_data());
+      if (done.fetch_add(1) + 1 == shards_.size()) {
+        SumShards(&Shard::y, m, n, b_.local_data().data(), out);
+      }
+      return;
+    }
+    shard->y.Resize({m, c});
+    MatrixMultiply(x.data(), w, kNoTrans, m, c, k, shard->y.mutable_data());
+    // Gathers the columns of the shard into the output.
+    const Float* ys = shard->y.data();
+    const Float* b = shard->b.data().data();
+    ParallelFor(0, m, GrainSize(c), [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; ++i) {
+        for (size_t j = 0; j < c; ++j) {
+          out[i * n + shard->begin + j] = ys[i * c + j] + b[j];
+        }
+      }
+    });
+  });
+}
+
+void AffineLayer::ShardedBackward(const Tensor<Float>& x,
+                                  const Tensor<Float>& dout,
+                                  Tensor<Float>* dx) {
+  const size_t m = dout.shape(0);
+  const size_t n = dout.count(1);
+  const size_t k = x.count(1);
+  const bool down = propagate_down(0);
+  if (down) {
+    dx->Resize({m, k});
+  }
+  Float* dxp = down ? dx->mutable_data() : nullptr;
+  // The last shard done sums the input gradients, see ShardedForward.
+  std::atomic<size_t> done(0);
+  NodeGroups::Default()->Run(shards_.size(), [&](size_t s) {
+    Shard* shard = shards_[s].get();
+    const size_t c = shard->end - shard->begin;
+    const Float* w = shard->w.data().data();
+    if (by_rows_) {
+      if (down) {
+        shard->dx.Resize({m, c});
+        MatrixMultiply(dout.data(), w, kTransB, m, c, n,
+                       shard->dx.mutable_data());
+        const Float* dxs = shard->dx.data();
+        ParallelFor(0, m, GrainSize(c), [&](size_t lo, size_t hi) {
+          for (size_t i = lo; i < hi; ++i) {
+            memcpy(dxp + i * k + shard->begin, dxs + i * c,
+                   c * sizeof(Float));
+          }
+        });
+      }
+      if (trainable()) {
+        // Forward passes of other batches may have run since.
+        shard->x.Resize({m, c});
+        CopyColumns(x.data(), m, k, shard->begin, c, shard->x.mutable_data());
+        MatrixMultiply(shard->x.data(), dout.data(), kTransA, c, n, m,
+                       shard->w.mutable_grad()->mutable_data(), true);
+      }
+      return;
+    }
+    shard->y.Resize({m, c});
+    CopyColumns(dout.data(), m, n, shard->begin, c, shard->y.mutable_data());
+    const Float* douts = shard->y.data();
+    if (down) {
+      shard->dx.Resize({m, k});
+      MatrixMultiply(douts, w, kTransB, m, k, c, shard->dx.mutable_data());
+    }
+    if (trainable()) {
+      MatrixMultiply(x.data(), douts, kTransA, k, c, m,
+                     shard->w.mutable_grad()->mutable_data(), true);
+      MatrixSum(douts, m, c, 0, shard->b.mutable_grad()->mutable_data(),
+                true);
+    }
+    if (down && done.fetch_add(1) + 1 == shards_.size()) {
+      SumShards(&Shard::dx, m, k, nullptr, dxp);
+    }
+  });
+  if (by_rows_ && trainable()) {
+    MatrixSum(dout.data(), m, n, 0, b_.mutable_grad()->mutable_data(), true);
+  }
 }
 
 void AffineLayer::Forward(const Context& ctx, const Variable& input,
                           Variable* output) const {
+  if (!shards_.empty()) {
+    ShardedForward(input.data(), output->mutable_data());
+    return;
+  }
   const auto& x = input.data();
+  const auto& w = w_.local_data();
   auto* y = output->mutable_data();
 
   size_t m = x.shape(0);
-  size_t n = w_.data().shape(1);
+  size_t n = w.shape(1);
   size_t k = x.count(1);
 
   y->Resize({m, n});
-  MatrixMultiply(x.data(), w_.data().data(), kNoTrans, m, n, k,
-                 y->mutable_data());
+  MatrixMultiply(x.data(), w.data(), kNoTrans, m, n, k, y->mutable_data());
 
-  (*y) += b_.data();
+  (*y) += b_.local_data();
 }
 
 void AffineLayer::Backward(const Context& ctx, const Variable& output,
                            Variable* input) {
+  if (!shards_.empty()) {
+    ShardedBackward(input->data(), output.grad(), input->mutable_grad());
+    return;
+  }
   const auto& x = input->data();
   const auto& dout = output.grad();  // 100 x 10
   auto* dx = input->mutable_grad();
@@ -82,36 +314,55 @@ void AffineLayer::Backward(const Context& ctx, const Variable& output,
   size_t n = w_.data().shape(0);
   size_t k = dout.count(1);
 
-  dx->Resize({m, n});
-  MatrixMultiply(dout.data(), w_.data().data(), kTransB, m, n, k,
-                 dx->mutable_data());
+  if (propagate_down(0)) {
+    dx->Resize({m, n});
+    MatrixMultiply(dout.data(), w_.data().data(), kTransB, m, n, k,
+                   dx->mutable_data());
+  }
+  if (!trainable()) {
+    return;
+  }
 
   m = x.count(1);
   n = dout.shape(1);
   k = x.shape(0);
 
+  // Weight gradients are summed until Optimizer::ZeroGrad.
   dw->Resize({m, n});  // TODO: do not need to Resize.
-  MatrixMultiply(x.data(), dout.data(), kTransA, m, n, k, dw->mutable_data());
-  MatrixSum(dout.data(), dout.shape(0), dout.count(1), 0, db->mutable_data());
+  MatrixMultiply(x.data(), dout.data(), kTransA, m, n, k, dw->mutable_data(),
+                 true);
+  MatrixSum(dout.data(), dout.shape(0), dout.count(1), 0, db->mutable_data(),
+            true);
+}
+
+bool AffineLayer::InferShape(const std::vector<Shape>& inputs,
+                             Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " inputs, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], size_t(layer_config_.output_size())};
+  return true;
 }
 
 void AffineLayer::Snapshot(LayerConfig* config) const {
   *config = layer_config_;
-  auto* affine = config->mutable_affine();
-  affine->mutable_weight()->set_filler("data");
-  affine->mutable_weight()->set_data(w_.data().data(),
-                                     w_.data().size() * sizeof(Float));
-  auto* wshape = affine->mutable_weight()->mutable_shape();
-  for (size_t i = 0; i < w_.data().shape().size(); ++i) {
-    wshape->add_dims(w_.data().shape(i));
-  }
-  affine->mutable_bias()->set_filler("data");
-  affine->mutable_bias()->set_data(b_.data().data(),
-                                   b_.data().size() * sizeof(Float));
-  auto* bshape = affine->mutable_bias()->mutable_shape();
-  for (size_t i = 0; i < b_.data().shape().size(); ++i) {
-    bshape->add_dims(b_.data().shape(i));
+  const Tensor<Float>* w = &w_.data();
+  const Tensor<Float>* b = &b_.data();
+  Tensor<Float> merged_w;
+  Tensor<Float> merged_b;
+  if (!shards_.empty()) {
+    Merge(&merged_w, &merged_b);
+    w = &merged_w;
+    b = &merged_b;
   }
+  Weight::SetData(*w, config->mutable_affine()->mutable_weight());
+  Weight::SetData(*b, config->mutable_affine()->mutable_bias());
 }
 REGISTER_LAYER(Affine);
 
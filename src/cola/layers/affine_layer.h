@@ -16,25 +16,67 @@
 #ifndef COLA_LAYERS_AFFINE_LAYER_H_
 #define COLA_LAYERS_AFFINE_LAYER_H_
 
+#include <memory>
+
 #include "cola/layers/layer.h"
 
 namespace cola {
 class AffineLayer : public Layer {
  public:
+  // Sharded layers stay out of tiles, every call crosses the nodes.
+  bool row_wise() const override { return shards_.empty(); }
+
   bool Load(const LayerConfig& config) override;
 
-  std::vector<Weight*> GetWeights() override { return {&w_, &b_}; }
+  std::vector<Weight*> GetWeights() override;
 
   void Forward(const Context& ctx, const Variable& input,
                Variable* output) const override;
   void Backward(const Context& ctx, const Variable& output,
                 Variable* input) override;
 
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
   void Snapshot(LayerConfig* config) const override;
 
- private:
+ protected:
   Weight w_;
   Weight b_;
+
+ private:
+  // The rows or columns [begin, end) of the weight, kept on the node of the
+  // group running the shard, see AffineConfig.shards.
+  struct Shard {
+    size_t begin;
+    size_t end;
+    Weight w;
+    // The slice of the bias if split by columns.
+    Weight b;
+    // Workspaces of the group, only used inside NodeGroups::Run, which runs
+    // one call at a time, so that concurrent Forward calls may share them.
+    Tensor<Float> x;
+    Tensor<Float> y;
+    Tensor<Float> dx;
+  };
+
+  bool Split(const std::string& name, size_t num_shards);
+
+  // Copies the shards back into a whole weight and bias.
+  void Merge(Tensor<Float>* w, Tensor<Float>* b) const;
+
+  // Sums the workspaces `part` of m x n of the shards, plus `bias` if given,
+  // into `out`.
+  void SumShards(Tensor<Float> Shard::*part, size_t m, size_t n,
+                 const Float* bias, Float* out) const;
+
+  void ShardedForward(const Tensor<Float>& x, Tensor<Float>* y) const;
+  void ShardedBackward(const Tensor<Float>& x, const Tensor<Float>& dout,
+                       Tensor<Float>* dx);
+
+  // Split by rows, i.e. by inputs, the bias then stays whole in b_.
+  bool by_rows_ = false;
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
 
 }  // namespace cola
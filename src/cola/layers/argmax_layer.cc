@@ -0,0 +1,59 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/argmax_layer.h"
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+
+namespace cola {
+
+void ArgmaxLayer::Forward(const Context& ctx, const Variable& input,
+                          Variable* output) const {
+  const auto& x = input.data();
+  auto* out = output->mutable_data();
+  const size_t m = x.shape(0);
+  const size_t n = x.count(1);
+  out->Resize({m, 1});
+  for (size_t i = 0; i < m; ++i) {
+    const Float* row = x.data() + i * n;
+    size_t a = 0;
+    for (size_t j = 1; j < n; ++j) {
+      if (row[j] > row[a]) {
+        a = j;
+      }
+    }
+    out->mutable_data()[i] = a;
+  }
+}
+
+void ArgmaxLayer::Backward(const Context& ctx, const Variable& output,
+                           Variable* input) {
+  LOG(ERROR) << "[Argmax] has no gradient";
+  CHECK(false);
+}
+
+bool ArgmaxLayer::InferShape(const std::vector<Shape>& inputs,
+                             Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  *output = {inputs[0][0], size_t(1)};
+  return true;
+}
+
+REGISTER_LAYER(Argmax);
+
+}  // namespace cola
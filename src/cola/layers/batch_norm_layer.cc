@@ -0,0 +1,264 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/batch_norm_layer.h"
+
+#include <math.h>
+
+#include <vector>
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool BatchNormLayer::Load(const LayerConfig& config) {
+  const auto& bn = config.batch_norm();
+  channels_ = bn.channels() ? bn.channels() : config.input_size();
+  momentum_ = bn.momentum();
+  epsilon_ = bn.epsilon();
+  if (!channels_ || momentum_ < 0 || momentum_ >= 1 || epsilon_ <= 0 ||
+      (config.input_size() && config.input_size() % channels_)) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad batch norm: " << bn.ShortDebugString();
+    return false;
+  }
+  auto fill = [&](const WeightConfig& wc, const char* filler,
+                  const std::string& suffix, Weight* weight) {
+    if (wc.filler().empty()) {
+      WeightConfig constant;
+      constant.set_filler(filler);
+      weight->Fill(constant, {channels_});
+    } else {
+      weight->Fill(wc, {channels_});
+    }
+    weight->set_name(config.name() + suffix);
+    return weight->external() || weight->data().size() == channels_;
+  };
+  if (!fill(bn.scale(), "one", "scale", &scale_) ||
+      !fill(bn.shift(), "zero", "shift", &shift_) ||
+      !fill(bn.mean(), "zero", "mean", &mean_) ||
+      !fill(bn.variance(), "one", "variance", &variance_)) {
+    LOG(ERROR) << "[" << config.name() << "] expects " << channels_
+               << " values per weight";
+    return false;
+  }
+  // A WeightStream only pages in trained weights.
+  for (auto* weight : {&mean_, &variance_}) {
+    if (weight->external() && !weight->Fetch()) {
+      return false;
+    }
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  auto* saved = layer_config_.mutable_batch_norm();
+  for (auto* wc : {saved->mutable_scale(), saved->mutable_shift(),
+                   saved->mutable_mean(), saved->mutable_variance()}) {
+    wc->clear_data();
+  }
+  return true;
+}
+
+void BatchNormLayer::Forward(const Context& ctx, const Variable& input,
+                             Variable* output) const {
+  if (ctx.session()->phase() == kTrain) {
+    NormalizeBatch(input.data(), output);
+  } else {
+    Normalize(input.data(), output);
+  }
+}
+
+size_t BatchNormLayer::StateSize(const std::vector<Shape>& inputs,
+                                 const Shape& output) const {
+  return 2 * channels_ * sizeof(Float);
+}
+
+void BatchNormLayer::Normalize(const Tensor<Float>& x,
+                               Variable* output) const {
+  const size_t m = x.shape(0);
+  const size_t n = x.count(1);
+  const size_t spatial = n / channels_;
+  const Float* gamma = scale_.local_data().data();
+  const Float* beta = shift_.local_data().data();
+  const Float* mean = mean_.data().data();
+  const Float* variance = variance_.data().data();
+  // The factors and offsets of the channels.
+  auto* state = output->mutable_state();
+  if (state->size() < 2 * channels_ * sizeof(Float)) {
+    state->resize(2 * channels_ * sizeof(Float));
+  }
+  Float* factors = reinterpret_cast<Float*>(state->data());
+  Float* offsets = factors + channels_;
+  for (size_t c = 0; c < channels_; ++c) {
+    factors[c] = gamma[c] / sqrt(variance[c] + epsilon_);
+    offsets[c] = beta[c] - mean[c] * factors[c];
+  }
+  auto* y = output->mutable_data();
+  y->Resize(x.shape());
+  ParallelFor(0, m, GrainSize(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* src = x.data() + i * n;
+      Float* dst = y->mutable_data() + i * n;
+      for (size_t c = 0; c < channels_; ++c) {
+        for (size_t s = c * spatial; s < (c + 1) * spatial; ++s) {
+          dst[s] = src[s] * factors[c] + offsets[c];
+        }
+      }
+    }
+  });
+}
+
+void BatchNormLayer::NormalizeBatch(const Tensor<Float>& x,
+                                    Variable* output) const {
+  const size_t m = x.shape(0);
+  const size_t n = x.count(1);
+  const size_t spatial = n / channels_;
+  const size_t count = m * spatial;
+  const Float* gamma = scale_.data().data();
+  const Float* beta = shift_.data().data();
+  Float* running_mean = mean_.mutable_data()->mutable_data();
+  Float* running_variance = variance_.mutable_data()->mutable_data();
+  auto* y = output->mutable_data();
+  y->Resize(x.shape());
+  // The mean and the reciprocal of the deviation of every channel.
+  auto* state = output->mutable_state();
+  if (state->size() < 2 * channels_ * sizeof(Float)) {
+    state->resize(2 * channels_ * sizeof(Float));
+  }
+  Float* stats = reinterpret_cast<Float*>(state->data());
+
+  ParallelFor(0, channels_, GrainSize(3 * count), [&](size_t begin,
+                                                      size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      Float sum = 0;
+      for (size_t i = 0; i < m; ++i) {
+        const Float* src = x.data() + i * n + c * spatial;
+        for (size_t s = 0; s < spatial; ++s) {
+          sum += src[s];
+        }
+      }
+      const Float mean = sum / count;
+      Float squares = 0;
+      for (size_t i = 0; i < m; ++i) {
+        const Float* src = x.data() + i * n + c * spatial;
+        for (size_t s = 0; s < spatial; ++s) {
+          squares += (src[s] - mean) * (src[s] - mean);
+        }
+      }
+      const Float variance = squares / count;
+      const Float rstd = 1 / sqrt(variance + epsilon_);
+      stats[c] = mean;
+      stats[channels_ + c] = rstd;
+      for (size_t i = 0; i < m; ++i) {
+        const Float* src = x.data() + i * n + c * spatial;
+        Float* dst = y->mutable_data() + i * n + c * spatial;
+        for (size_t s = 0; s < spatial; ++s) {
+          dst[s] = (src[s] - mean) * rstd * gamma[c] + beta[c];
+        }
+      }
+      // The running variance is unbiased.
+      const Float unbiased = count > 1 ? squares / (count - 1) : variance;
+      running_mean[c] = momentum_ * running_mean[c] + (1 - momentum_) * mean;
+      running_variance[c] =
+          momentum_ * running_variance[c] + (1 - momentum_) * unbiased;
+    }
+  });
+}
+
+void BatchNormLayer::Backward(const Context& ctx, const Variable& output,
+                              Variable* input) {
+  const auto& x = input->data();
+  const auto& dy = output.grad();
+  const size_t m = x.shape(0);
+  const size_t n = x.count(1);
+  const size_t spatial = n / channels_;
+  const size_t count = m * spatial;
+  CHECK(output.state().size() >= 2 * channels_ * sizeof(Float));
+  const Float* stats = reinterpret_cast<const Float*>(output.state().data());
+  const Float* gamma = scale_.data().data();
+  const bool down = propagate_down(0);
+  const bool learn = trainable();
+  auto* dx = input->mutable_grad();
+  if (down) {
+    dx->Resize(x.shape());
+  }
+  // Weight gradients are summed until Optimizer::ZeroGrad.
+  Float* dgamma = learn ? scale_.mutable_grad()->mutable_data() : nullptr;
+  Float* dbeta = learn ? shift_.mutable_grad()->mutable_data() : nullptr;
+
+  ParallelFor(0, channels_, GrainSize(2 * count), [&](size_t begin,
+                                                      size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      const Float mean = stats[c];
+      const Float rstd = stats[channels_ + c];
+      // Sums of dy and of dy times the normalized input.
+      Float sum = 0;
+      Float dot = 0;
+      for (size_t i = 0; i < m; ++i) {
+        const Float* src = x.data() + i * n + c * spatial;
+        const Float* dout = dy.data() + i * n + c * spatial;
+        for (size_t s = 0; s < spatial; ++s) {
+          sum += dout[s];
+          dot += dout[s] * (src[s] - mean) * rstd;
+        }
+      }
+      if (learn) {
+        dgamma[c] += dot;
+        dbeta[c] += sum;
+      }
+      if (!down) {
+        continue;
+      }
+      const Float factor = gamma[c] * rstd / count;
+      for (size_t i = 0; i < m; ++i) {
+        const Float* src = x.data() + i * n + c * spatial;
+        const Float* dout = dy.data() + i * n + c * spatial;
+        Float* din = dx->mutable_data() + i * n + c * spatial;
+        for (size_t s = 0; s < spatial; ++s) {
+          const Float normalized = (src[s] - mean) * rstd;
+          din[s] = factor * (count * dout[s] - sum - normalized * dot);
+        }
+      }
+    }
+  });
+}
+
+bool BatchNormLayer::InferShape(const std::vector<Shape>& inputs,
+                                Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  if (inputs[0].count(1) % channels_) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] " << channels_
+               << " channels do not split " << inputs[0].ToString();
+    return false;
+  }
+  return true;
+}
+
+void BatchNormLayer::Snapshot(LayerConfig* config) const {
+  *config = layer_config_;
+  auto* bn = config->mutable_batch_norm();
+  Weight::SetData(scale_.data(), bn->mutable_scale());
+  Weight::SetData(shift_.data(), bn->mutable_shift());
+  Weight::SetData(mean_.data(), bn->mutable_mean());
+  Weight::SetData(variance_.data(), bn->mutable_variance());
+}
+
+REGISTER_LAYER(BatchNorm);
+
+}  // namespace cola
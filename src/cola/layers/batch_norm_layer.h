@@ -0,0 +1,66 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_BATCH_NORM_LAYER_H_
+#define COLA_LAYERS_BATCH_NORM_LAYER_H_
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// See BatchNormConfig. In the train phase the statistics of the batch are
+// kept in the state of the output for Backward, and the running averages
+// are updated by Forward, which has a single caller at a time there.
+class BatchNormLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  // The scale and shift, the running averages are not trained.
+  std::vector<Weight*> GetWeights() override { return {&scale_, &shift_}; }
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  // The mean and deviation of the channels in training, their factors and
+  // offsets at inference.
+  size_t StateSize(const std::vector<Shape>& inputs,
+                   const Shape& output) const override;
+
+  // At inference only, see Session::phase().
+  bool row_wise() const override { return true; }
+
+  void Snapshot(LayerConfig* config) const override;
+
+ private:
+  void Normalize(const Tensor<Float>& x, Variable* output) const;
+  void NormalizeBatch(const Tensor<Float>& x, Variable* output) const;
+
+  size_t channels_;
+  Float momentum_;
+  Float epsilon_;
+  Weight scale_;
+  Weight shift_;
+  mutable Weight mean_;
+  mutable Weight variance_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_BATCH_NORM_LAYER_H_
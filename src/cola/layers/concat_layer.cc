@@ -0,0 +1,90 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/concat_layer.h"
+
+#include <string.h>
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+void ConcatLayer::Forward(const Context& ctx,
+                          const std::vector<const Variable*>& inputs,
+                          Variable* output) const {
+  const size_t m = inputs[0]->data().shape(0);
+  size_t n = 0;
+  for (const auto* input : inputs) {
+    n += input->data().count(1);
+  }
+  auto* out = output->mutable_data();
+  out->Resize({m, n});
+  ParallelFor(0, m, GrainSize(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Float* dst = out->mutable_data() + i * n;
+      for (const auto* input : inputs) {
+        const size_t k = input->data().count(1);
+        memcpy(dst, input->data().data() + i * k, k * sizeof(Float));
+        dst += k;
+      }
+    }
+  });
+}
+
+void ConcatLayer::Backward(const Context& ctx, const Variable& output,
+                           const std::vector<Variable*>& inputs) {
+  const auto& dout = output.grad();
+  const size_t m = dout.shape(0);
+  const size_t n = dout.count(1);
+  for (size_t j = 0; j < inputs.size(); ++j) {
+    if (propagate_down(j)) {
+      inputs[j]->mutable_grad()->Resize(inputs[j]->data().shape());
+    }
+  }
+  ParallelFor(0, m, GrainSize(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* src = dout.data() + i * n;
+      for (size_t j = 0; j < inputs.size(); ++j) {
+        const size_t k = inputs[j]->data().count(1);
+        if (propagate_down(j)) {
+          memcpy(inputs[j]->mutable_grad()->mutable_data() + i * k, src,
+                 k * sizeof(Float));
+        }
+        src += k;
+      }
+    }
+  });
+}
+
+bool ConcatLayer::InferShape(const std::vector<Shape>& inputs,
+                             Shape* output) const {
+  size_t n = 0;
+  for (const auto& input : inputs) {
+    if (input[0] != inputs[0][0]) {
+      LOG(ERROR) << "[" << layer_config_.name() << "] batch sizes differ: "
+                 << input.ToString() << " and " << inputs[0].ToString();
+      return false;
+    }
+    n += input.count(1);
+  }
+  *output = {inputs[0][0], n};
+  return true;
+}
+
+REGISTER_LAYER(Concat);
+
+}  // namespace cola
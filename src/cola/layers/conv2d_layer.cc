@@ -0,0 +1,628 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/conv2d_layer.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "cola/base/logging.h"
+#include "cola/base/math_ops.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+namespace {
+
+// Channels of a block of the channel-blocked layout.
+const size_t kBlock = 8;
+
+size_t Blocks(size_t channels) { return (channels + kBlock - 1) / kBlock; }
+
+// Offsets of the values of one image in the plain or channel-blocked
+// layout, see ConvConfig.blocked_input.
+struct Layout {
+  Layout(bool blocked, size_t channels, size_t pixels)
+      : blocked(blocked),
+        pixels(pixels),
+        size((blocked ? Blocks(channels) * kBlock : channels) * pixels) {}
+
+  // Of channel `c` at pixel `p`.
+  size_t at(size_t c, size_t p) const {
+    return blocked ? (c / kBlock * pixels + p) * kBlock + c % kBlock
+                   : c * pixels + p;
+  }
+
+  bool blocked;
+  size_t pixels;
+  size_t size;
+};
+
+}  // namespace
+
+// Parts of a loop over `tasks` of `cost` operations, one per thread at most,
+// each part running on one thread with a workspace of its own.
+static size_t Parts(size_t tasks, size_t cost) {
+  const size_t grain = GrainSize(cost);
+  return std::max<size_t>(
+      1, std::min(ThreadPool::Default()->size(), (tasks + grain - 1) / grain));
+}
+
+bool Conv2DLayer::Load(const LayerConfig& config) {
+  const auto& conv = config.conv();
+  channels_ = conv.channels();
+  height_ = conv.height();
+  width_ = conv.width();
+  filters_ = conv.filters();
+  kernel_ = conv.kernel();
+  stride_ = conv.stride();
+  padding_ = conv.padding();
+  dilation_ = conv.dilation();
+  groups_ = conv.groups();
+  if (!channels_ || !height_ || !width_ || !filters_ || !kernel_ ||
+      !stride_ || !dilation_ || !groups_ || channels_ % groups_ ||
+      filters_ % groups_) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad conv: " << conv.ShortDebugString();
+    return false;
+  }
+  const size_t extent = dilation_ * (kernel_ - 1) + 1;
+  if (height_ + 2 * padding_ < extent || width_ + 2 * padding_ < extent) {
+    LOG(ERROR) << "[" << config.name() << "] kernel of " << extent
+               << " pixels exceeds the padded image";
+    return false;
+  }
+  out_height_ = (height_ + 2 * padding_ - extent) / stride_ + 1;
+  out_width_ = (width_ + 2 * padding_ - extent) / stride_ + 1;
+  const std::string& algorithm = conv.algorithm();
+  if (algorithm == "auto" || algorithm == "im2col") {
+    algorithm_ = kIm2Col;
+  } else if (algorithm == "direct") {
+    algorithm_ = kDirect;
+  } else if (algorithm == "winograd") {
+    algorithm_ = kWinograd;
+  } else {
+    LOG(ERROR) << "[" << config.name() << "] unknown algorithm: " << algorithm;
+    return false;
+  }
+  blocked_input_ = conv.blocked_input();
+  blocked_output_ = conv.blocked_output();
+  if (algorithm_ != kIm2Col && groups_ != 1) {
+    LOG(ERROR) << "[" << config.name() << "] " << algorithm
+               << " takes no groups";
+    return false;
+  }
+  if (algorithm_ == kWinograd &&
+      (kernel_ != 3 || stride_ != 1 || dilation_ != 1)) {
+    LOG(ERROR) << "[" << config.name()
+               << "] winograd takes 3 x 3 kernels of stride and dilation 1";
+    return false;
+  }
+  if (algorithm_ == kIm2Col && (blocked_input_ || blocked_output_)) {
+    LOG(ERROR) << "[" << config.name() << "] im2col takes plain images";
+    return false;
+  }
+
+  const size_t cols = channels_ / groups_ * kernel_ * kernel_;
+  w_.Fill(conv.weight(), {filters_, cols});
+  b_.Fill(conv.bias(), {filters_});
+  w_.set_name(config.name() + "w");
+  b_.set_name(config.name() + "b");
+  if (!w_.external() && w_.data().size() != filters_ * cols) {
+    LOG(ERROR) << "[" << config.name() << "] expects " << filters_ * cols
+               << " weights, got " << w_.data().size();
+    return false;
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  const size_t input_size =
+      Layout(blocked_input_, channels_, height_ * width_).size;
+  const size_t output_size =
+      Layout(blocked_output_, filters_, out_height_ * out_width_).size;
+  if ((config.input_size() && config.input_size() != input_size) ||
+      (config.output_size() && config.output_size() != output_size)) {
+    LOG(ERROR) << "[" << config.name() << "] sizes differ from the conv: "
+               << input_size << " -> " << output_size;
+    return false;
+  }
+  layer_config_.set_input_size(input_size);
+  layer_config_.set_output_size(output_size);
+  layer_config_.mutable_conv()->mutable_weight()->clear_data();
+  layer_config_.mutable_conv()->mutable_bias()->clear_data();
+  if (algorithm_ != kIm2Col) {
+    // Repacked filters are never streamed.
+    if (w_.external() && !w_.Fetch()) {
+      return false;
+    }
+    PackFilters();
+  }
+
+  // A tile of patches and its outputs fill half of the L2 cache.
+  tile_pixels_ = conv.tile_pixels();
+  if (tile_pixels_ == 0) {
+    long cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (cache_size <= 0) {
+      cache_size = 256 << 10;
+    }
+    const size_t row = (cols + filters_ / groups_) * sizeof(Float);
+    tile_pixels_ = std::max<size_t>(cache_size / 2 / row / 8 * 8, 8);
+  }
+  tile_pixels_ = std::min(tile_pixels_, out_height_ * out_width_);
+  return true;
+}
+
+void Conv2DLayer::Im2Col(const Float* image, size_t g, size_t p0, size_t p1,
+                         Float* col) const {
+  const size_t cg = channels_ / groups_;
+  for (size_t p = p0; p < p1; ++p) {
+    const long top = long(p / out_width_ * stride_) - long(padding_);
+    const long left = long(p % out_width_ * stride_) - long(padding_);
+    for (size_t c = 0; c < cg; ++c) {
+      const Float* plane = image + (g * cg + c) * height_ * width_;
+      for (size_t ki = 0; ki < kernel_; ++ki) {
+        const long y = top + long(ki * dilation_);
+        const bool row = y >= 0 && y < long(height_);
+        for (size_t kj = 0; kj < kernel_; ++kj) {
+          const long x = left + long(kj * dilation_);
+          *col++ = row && x >= 0 && x < long(width_) ? plane[y * width_ + x]
+                                                     : Float(0);
+        }
+      }
+    }
+  }
+}
+
+void Conv2DLayer::Col2Im(const Float* col, size_t g, size_t p0, size_t p1,
+                         Float* image) const {
+  const size_t cg = channels_ / groups_;
+  for (size_t p = p0; p < p1; ++p) {
+    const long top = long(p / out_width_ * stride_) - long(padding_);
+    const long left = long(p % out_width_ * stride_) - long(padding_);
+    for (size_t c = 0; c < cg; ++c) {
+      Float* plane = image + (g * cg + c) * height_ * width_;
+      for (size_t ki = 0; ki < kernel_; ++ki) {
+        const long y = top + long(ki * dilation_);
+        const bool row = y >= 0 && y < long(height_);
+        for (size_t kj = 0; kj < kernel_; ++kj, ++col) {
+          const long x = left + long(kj * dilation_);
+          if (row && x >= 0 && x < long(width_)) {
+            plane[y * width_ + x] += *col;
+          }
+        }
+      }
+    }
+  }
+}
+
+size_t Conv2DLayer::Workspace(size_t parts) const {
+  if (algorithm_ == kDirect) {
+    return parts * out_width_ * kBlock;
+  }
+  const size_t tiles = (out_height_ + 1) / 2 * ((out_width_ + 1) / 2);
+  if (algorithm_ == kWinograd) {
+    return 16 * (channels_ + filters_) * tiles;
+  }
+  const size_t cols = channels_ / groups_ * kernel_ * kernel_;
+  return parts * tile_pixels_ * (cols + filters_ / groups_);
+}
+
+size_t Conv2DLayer::StateSize(const std::vector<Shape>& inputs,
+                              const Shape& output) const {
+  return Workspace(ThreadPool::Default()->size()) * sizeof(Float);
+}
+
+void Conv2DLayer::Forward(const Context& ctx, const Variable& input,
+                          Variable* output) const {
+  const auto& x = input.data();
+  const size_t m = x.shape(0);
+  auto* y = output->mutable_data();
+  y->Resize({m, size_t(layer_config_.output_size())});
+  // The workspace is kept in the state of the output, one part per thread.
+  auto* state = output->mutable_state();
+  const size_t parts = ThreadPool::Default()->size();
+  if (state->size() < Workspace(parts) * sizeof(Float)) {
+    state->resize(Workspace(parts) * sizeof(Float));
+  }
+  Float* workspace = reinterpret_cast<Float*>(state->data());
+  if (algorithm_ == kDirect) {
+    DirectForward(x.data(), m, workspace, y->mutable_data());
+  } else if (algorithm_ == kWinograd) {
+    WinogradForward(x.data(), m, workspace, y->mutable_data());
+  } else {
+    Im2ColForward(x.data(), m, workspace, y->mutable_data());
+  }
+}
+
+void Conv2DLayer::Im2ColForward(const Float* x, size_t m, Float* workspace,
+                                Float* out) const {
+  const size_t pixels = out_height_ * out_width_;
+  const size_t fg = filters_ / groups_;
+  const size_t cols = channels_ / groups_ * kernel_ * kernel_;
+  const size_t tiles = (pixels + tile_pixels_ - 1) / tile_pixels_;
+  const Float* w = w_.local_data().data();
+  const Float* b = b_.local_data().data();
+
+  const size_t tasks = m * groups_ * tiles;
+  const size_t parts = Parts(tasks, tile_pixels_ * cols * fg);
+  ParallelFor(0, parts, 1, [&](size_t begin, size_t end) {
+    // Parts of one call run on one thread, in the workspace of the first.
+    Float* col = workspace + begin * tile_pixels_ * (cols + fg);
+    Float* prod = col + tile_pixels_ * cols;
+    for (size_t task = tasks * begin / parts; task < tasks * end / parts;
+         ++task) {
+      const size_t n = task / (groups_ * tiles);
+      const size_t g = task / tiles % groups_;
+      const size_t p0 = task % tiles * tile_pixels_;
+      const size_t p1 = std::min(p0 + tile_pixels_, pixels);
+      const size_t t = p1 - p0;
+      Im2Col(x + n * channels_ * height_ * width_, g, p0, p1, col);
+      // (t x cols) * (fg x cols)^T, one row per pixel.
+      MatrixMultiply(col, w + g * fg * cols, kTransB, t, fg, cols, prod);
+      for (size_t f = 0; f < fg; ++f) {
+        const size_t filter = g * fg + f;
+        Float* dst = out + (n * filters_ + filter) * pixels + p0;
+        for (size_t i = 0; i < t; ++i) {
+          dst[i] = prod[i * fg + f] + b[filter];
+        }
+      }
+    }
+  });
+}
+
+void Conv2DLayer::PackFilters() {
+  const Float* w = w_.data().data();
+  const size_t kk = kernel_ * kernel_;
+  if (algorithm_ == kDirect) {
+    const size_t cb = Blocks(channels_);
+    const size_t fb = Blocks(filters_);
+    const size_t block = kk * kBlock * kBlock;
+    // The filters as [filter block][channel block][tap][channel][filter],
+    // padded with zeros.
+    packed_.Resize({fb * cb, block});
+    Float* packed = packed_.mutable_data();
+    ParallelFor(0, fb * cb, GrainSize(block), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const size_t f0 = i / cb * kBlock;
+        const size_t c0 = i % cb * kBlock;
+        Float* dst = packed + i * block;
+        for (size_t k = 0; k < kk; ++k) {
+          for (size_t c = c0; c < c0 + kBlock; ++c) {
+            for (size_t f = f0; f < f0 + kBlock; ++f) {
+              *dst++ = f < filters_ && c < channels_
+                           ? w[(f * channels_ + c) * kk + k]
+                           : Float(0);
+            }
+          }
+        }
+      }
+    });
+    return;
+  }
+  // The 16 values of G g G^T of every filter and channel, as 16 matrices of
+  // F x C.
+  const size_t FC = filters_ * channels_;
+  packed_.Resize({16, FC});
+  Float* u = packed_.mutable_data();
+  ParallelFor(0, FC, GrainSize(64), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* g = w + i * 9;
+      Float t[4][3];
+      for (size_t j = 0; j < 3; ++j) {
+        t[0][j] = g[j];
+        t[1][j] = (g[j] + g[3 + j] + g[6 + j]) / 2;
+        t[2][j] = (g[j] - g[3 + j] + g[6 + j]) / 2;
+        t[3][j] = g[6 + j];
+      }
+      for (size_t r = 0; r < 4; ++r) {
+        Float* dst = u + r * 4 * FC + i;
+        dst[0] = t[r][0];
+        dst[FC] = (t[r][0] + t[r][1] + t[r][2]) / 2;
+        dst[2 * FC] = (t[r][0] - t[r][1] + t[r][2]) / 2;
+        dst[3 * FC] = t[r][2];
+      }
+    }
+  });
+}
+
+void Conv2DLayer::DirectForward(const Float* x, size_t m, Float* workspace,
+                                Float* y) const {
+  const Layout in(blocked_input_, channels_, height_ * width_);
+  const Layout out(blocked_output_, filters_, out_height_ * out_width_);
+  const size_t cb = Blocks(channels_);
+  const size_t fb = Blocks(filters_);
+  const size_t kk = kernel_ * kernel_;
+  const size_t block = kk * kBlock * kBlock;
+  const Float* packed = packed_.data();
+  const Float* b = b_.local_data().data();
+
+  // One row of output pixels of a block of filters per task, the 8 sums of
+  // a pixel are updated together.
+  const size_t tasks = m * fb * out_height_;
+  const size_t parts = Parts(tasks, out_width_ * cb * block);
+  ParallelFor(0, parts, 1, [&](size_t begin, size_t end) {
+    Float* acc = workspace + begin * out_width_ * kBlock;
+    for (size_t task = tasks * begin / parts; task < tasks * end / parts;
+         ++task) {
+      const size_t n = task / (fb * out_height_);
+      const size_t f0 = task / out_height_ % fb * kBlock;
+      const size_t oh = task % out_height_;
+      for (size_t ow = 0; ow < out_width_; ++ow) {
+        for (size_t f = 0; f < kBlock; ++f) {
+          acc[ow * kBlock + f] = f0 + f < filters_ ? b[f0 + f] : Float(0);
+        }
+      }
+      const Float* image = x + n * in.size;
+      const long top = long(oh * stride_) - long(padding_);
+      for (size_t c0 = 0; c0 < channels_; c0 += kBlock) {
+        const size_t lanes = std::min(kBlock, channels_ - c0);
+        const Float* wb = packed + (f0 / kBlock * cb + c0 / kBlock) * block;
+        for (size_t ki = 0; ki < kernel_; ++ki) {
+          const long iy = top + long(ki * dilation_);
+          if (iy < 0 || iy >= long(height_)) {
+            continue;
+          }
+          for (size_t kj = 0; kj < kernel_; ++kj) {
+            const Float* wk = wb + (ki * kernel_ + kj) * kBlock * kBlock;
+            for (size_t ow = 0; ow < out_width_; ++ow) {
+              const long ix = long(ow * stride_ + kj * dilation_) -
+                              long(padding_);
+              if (ix < 0 || ix >= long(width_)) {
+                continue;
+              }
+              const size_t p = iy * width_ + ix;
+              Float* a = acc + ow * kBlock;
+              for (size_t c = 0; c < lanes; ++c) {
+                const Float v = image[in.at(c0 + c, p)];
+                const Float* wc = wk + c * kBlock;
+                for (size_t f = 0; f < kBlock; ++f) {
+                  a[f] += v * wc[f];
+                }
+              }
+            }
+          }
+        }
+      }
+      Float* dst = y + n * out.size;
+      const size_t p0 = oh * out_width_;
+      for (size_t ow = 0; ow < out_width_; ++ow) {
+        for (size_t f = 0; f < kBlock; ++f) {
+          if (out.blocked || f0 + f < filters_) {
+            dst[out.at(f0 + f, p0 + ow)] = acc[ow * kBlock + f];
+          }
+        }
+      }
+    }
+  });
+}
+
+void Conv2DLayer::WinogradForward(const Float* x, size_t m, Float* workspace,
+                                  Float* y) const {
+  const Layout in(blocked_input_, channels_, height_ * width_);
+  const Layout out(blocked_output_, filters_, out_height_ * out_width_);
+  const size_t C = channels_;
+  const size_t F = filters_;
+  const size_t tiles_w = (out_width_ + 1) / 2;
+  const size_t tiles = (out_height_ + 1) / 2 * tiles_w;
+  const Float* b = b_.local_data().data();
+
+  const Float* u = packed_.data();
+  Float* v = workspace;
+  Float* prod = workspace + 16 * C * tiles;
+  for (size_t n = 0; n < m; ++n) {
+    const Float* image = x + n * in.size;
+    Float* dst = y + n * out.size;
+    // B^T d B of the 4 x 4 input tile of every channel and 2 x 2 output tile,
+    // as 16 matrices of C x tiles.
+    ParallelFor(0, C * tiles, GrainSize(64), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const size_t c = i / tiles;
+        const size_t top = i % tiles / tiles_w * 2;
+        const size_t left = i % tiles % tiles_w * 2;
+        Float d[4][4];
+        for (size_t r = 0; r < 4; ++r) {
+          const long iy = long(top + r) - long(padding_);
+          for (size_t q = 0; q < 4; ++q) {
+            const long ix = long(left + q) - long(padding_);
+            d[r][q] = iy >= 0 && iy < long(height_) && ix >= 0 &&
+                              ix < long(width_)
+                          ? image[in.at(c, iy * width_ + ix)]
+                          : Float(0);
+          }
+        }
+        Float t[4][4];
+        for (size_t q = 0; q < 4; ++q) {
+          t[0][q] = d[0][q] - d[2][q];
+          t[1][q] = d[1][q] + d[2][q];
+          t[2][q] = d[2][q] - d[1][q];
+          t[3][q] = d[1][q] - d[3][q];
+        }
+        for (size_t r = 0; r < 4; ++r) {
+          Float* e = v + r * 4 * C * tiles + i;
+          e[0] = t[r][0] - t[r][2];
+          e[C * tiles] = t[r][1] + t[r][2];
+          e[2 * C * tiles] = t[r][2] - t[r][1];
+          e[3 * C * tiles] = t[r][1] - t[r][3];
+        }
+      }
+    });
+    for (size_t e = 0; e < 16; ++e) {
+      MatrixMultiply(u + e * F * C, v + e * C * tiles, kNoTrans, F, tiles, C,
+                     prod + e * F * tiles);
+    }
+    // A^T M A of every filter and output tile.
+    ParallelFor(0, F * tiles, GrainSize(64), [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        const size_t f = i / tiles;
+        const size_t top = i % tiles / tiles_w * 2;
+        const size_t left = i % tiles % tiles_w * 2;
+        Float t[2][4];
+        for (size_t q = 0; q < 4; ++q) {
+          const Float* e = prod + q * F * tiles + i;
+          const size_t row = 4 * F * tiles;
+          t[0][q] = e[0] + e[row] + e[2 * row];
+          t[1][q] = e[row] - e[2 * row] - e[3 * row];
+        }
+        for (size_t r = 0; r < 2 && top + r < out_height_; ++r) {
+          const Float s[2] = {t[r][0] + t[r][1] + t[r][2],
+                              t[r][1] - t[r][2] - t[r][3]};
+          for (size_t q = 0; q < 2 && left + q < out_width_; ++q) {
+            dst[out.at(f, (top + r) * out_width_ + left + q)] = s[q] + b[f];
+          }
+        }
+      }
+    });
+    // Padding channels of the last block stay zero.
+    if (out.blocked) {
+      for (size_t f = F; f < Blocks(F) * kBlock; ++f) {
+        for (size_t p = 0; p < out.pixels; ++p) {
+          dst[out.at(f, p)] = 0;
+        }
+      }
+    }
+  }
+}
+
+void Conv2DLayer::Backward(const Context& ctx, const Variable& output,
+                           Variable* input) {
+  // Network::Load keeps these out of the backward pass.
+  CHECK(has_gradient());
+  const auto& x = input->data();
+  const auto& dy = output.grad();
+  const size_t m = x.shape(0);
+  const size_t image = channels_ * height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t cg = channels_ / groups_;
+  const size_t fg = filters_ / groups_;
+  const size_t cols = cg * kernel_ * kernel_;
+  const bool down = propagate_down(0);
+  const bool learn = trainable();
+  auto* dx = input->mutable_grad();
+  if (down) {
+    dx->Resize(x.shape());
+  }
+  const Float* w = w_.data().data();
+
+  // Tiles of the same image and group overlap in the input, they run on one
+  // thread. Every part of the jobs sums its own weight gradients.
+  const size_t jobs = m * groups_;
+  const size_t parts = std::min(ThreadPool::Default()->size(), jobs);
+  const size_t stride = filters_ * cols + filters_;
+  if (learn) {
+    partials_.Resize({parts, stride});
+    Float* p = partials_.mutable_data();
+    std::fill(p, p + parts * stride, Float(0));
+  }
+  // The patches, output gradients and patch gradients of every part.
+  const size_t size = tile_pixels_ * (2 * cols + fg);
+  if (workspace_.size() < parts * size) {
+    workspace_.resize(parts * size);
+  }
+  ParallelFor(0, parts, 1, [&](size_t begin, size_t end) {
+    Float* col = workspace_.data() + begin * size;
+    Float* dout = col + tile_pixels_ * cols;
+    Float* dcol = dout + tile_pixels_ * fg;
+    for (size_t part = begin; part < end; ++part) {
+      Float* dw = learn ? partials_.mutable_data() + part * stride : nullptr;
+      for (size_t job = jobs * part / parts; job < jobs * (part + 1) / parts;
+           ++job) {
+        const size_t n = job / groups_;
+        const size_t g = job % groups_;
+        const Float* xn = x.data() + n * image;
+        Float* dxn = down ? dx->mutable_data() + n * image : nullptr;
+        if (down) {
+          std::fill(dxn + g * cg * height_ * width_,
+                    dxn + (g + 1) * cg * height_ * width_, Float(0));
+        }
+        for (size_t p0 = 0; p0 < pixels; p0 += tile_pixels_) {
+          const size_t p1 = std::min(p0 + tile_pixels_, pixels);
+          const size_t t = p1 - p0;
+          for (size_t f = 0; f < fg; ++f) {
+            const Float* src = dy.data() + (n * filters_ + g * fg + f) * pixels;
+            for (size_t i = 0; i < t; ++i) {
+              dout[i * fg + f] = src[p0 + i];
+            }
+          }
+          if (learn) {
+            Im2Col(xn, g, p0, p1, col);
+            // (t x fg)^T * (t x cols)
+            MatrixMultiply(dout, col, kTransA, fg, cols, t,
+                           dw + g * fg * cols, true);
+            Float* db = dw + filters_ * cols + g * fg;
+            for (size_t i = 0; i < t; ++i) {
+              for (size_t f = 0; f < fg; ++f) {
+                db[f] += dout[i * fg + f];
+              }
+            }
+          }
+          if (down) {
+            // (t x fg) * (fg x cols)
+            MatrixMultiply(dout, w + g * fg * cols, kNoTrans, t, cols, fg,
+                           dcol);
+            Col2Im(dcol, g, p0, p1, dxn);
+          }
+        }
+      }
+    }
+  });
+  if (!learn) {
+    return;
+  }
+  // Weight gradients are summed until Optimizer::ZeroGrad.
+  Float* dw = w_.mutable_grad()->mutable_data();
+  Float* db = b_.mutable_grad()->mutable_data();
+  const Float* partials = partials_.data();
+  ParallelFor(0, stride, GrainSize(parts), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Float v = 0;
+      for (size_t part = 0; part < parts; ++part) {
+        v += partials[part * stride + i];
+      }
+      if (i < filters_ * cols) {
+        dw[i] += v;
+      } else {
+        db[i - filters_ * cols] += v;
+      }
+    }
+  });
+}
+
+bool Conv2DLayer::InferShape(const std::vector<Shape>& inputs,
+                             Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " inputs, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], size_t(layer_config_.output_size())};
+  return true;
+}
+
+void Conv2DLayer::Snapshot(LayerConfig* config) const {
+  *config = layer_config_;
+  Weight::SetData(w_.data(), config->mutable_conv()->mutable_weight());
+  Weight::SetData(b_.data(), config->mutable_conv()->mutable_bias());
+}
+
+REGISTER_LAYER(Conv2D);
+
+}  // namespace cola
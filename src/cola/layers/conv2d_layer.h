@@ -0,0 +1,108 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_CONV2D_LAYER_H_
+#define COLA_LAYERS_CONV2D_LAYER_H_
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// See ConvConfig. The patches of a tile of output pixels are unrolled into
+// the rows of a matrix small enough to stay in cache (im2col), which is
+// multiplied by the filters of the group. The tiles of all images and groups
+// run in parallel.
+//
+// At inference the direct kernel instead sums the products of 8 input
+// channels with 8 filters at a time over a row of output pixels, and the
+// Winograd kernel computes 2 x 2 output pixels of a 3 x 3 kernel from 16
+// products instead of 36. Both read and write either layout, so that only
+// the first and last of a chain of them see plain images. Their filters are
+// repacked once at Load, they have no gradient.
+class Conv2DLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  std::vector<Weight*> GetWeights() override { return {&w_, &b_}; }
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  size_t StateSize(const std::vector<Shape>& inputs,
+                   const Shape& output) const override;
+
+  bool has_gradient() const override { return algorithm_ == kIm2Col; }
+
+  void Snapshot(LayerConfig* config) const override;
+
+ private:
+  // Writes the patches of the output pixels [p0, p1) over the channels of
+  // group `g` of `image` as the rows of `col`.
+  void Im2Col(const Float* image, size_t g, size_t p0, size_t p1,
+              Float* col) const;
+
+  // Adds the rows of `col` back to the pixels of `image` they were read from.
+  void Col2Im(const Float* col, size_t g, size_t p0, size_t p1,
+              Float* image) const;
+
+  // Fills packed_ from the filters for the direct or Winograd kernel.
+  void PackFilters();
+
+  // Values of the workspace of Forward for `parts` threads.
+  size_t Workspace(size_t parts) const;
+
+  void Im2ColForward(const Float* x, size_t m, Float* workspace,
+                     Float* y) const;
+  void DirectForward(const Float* x, size_t m, Float* workspace,
+                     Float* y) const;
+  void WinogradForward(const Float* x, size_t m, Float* workspace,
+                       Float* y) const;
+
+  enum Algorithm { kIm2Col, kDirect, kWinograd };
+
+  size_t channels_;
+  size_t height_;
+  size_t width_;
+  size_t filters_;
+  size_t kernel_;
+  size_t stride_;
+  size_t padding_;
+  size_t dilation_;
+  size_t groups_;
+  size_t out_height_;
+  size_t out_width_;
+  size_t tile_pixels_;
+  Algorithm algorithm_;
+  bool blocked_input_;
+  bool blocked_output_;
+
+  Weight w_;
+  Weight b_;
+  // The filters of the direct or Winograd kernel, see PackFilters().
+  Tensor<Float> packed_;
+  // Weight and bias gradients of the threads, summed after Backward.
+  Tensor<Float> partials_;
+  // The matrices of the threads in Backward.
+  std::vector<Float> workspace_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_CONV2D_LAYER_H_
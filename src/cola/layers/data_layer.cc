@@ -24,6 +24,8 @@
 namespace cola {
 
 bool DataLayer::Load(const LayerConfig& config) {
+  const uint32_t seed = config.data_set().seed();
+  engine_.seed(seed != 0 ? seed : std::random_device{}());
   return data_set_.Open(config.data_set()) && Layer::Load(config);
 }
 
@@ -31,24 +33,24 @@ void DataLayer::Forward(const Context& ctx, const Variable& input,
                         Variable* output) const {
   size_t batch_size = data_set_.batch_size();
   if (batch_size < data_set_.size()) {
-    std::vector<Slice> datas;
-    std::vector<Slice> labels;
-    auto indices = random::Samples<size_t>(0, data_set_.size(), batch_size);
-    data_set_.Read(indices, &datas, &labels);
+    random::Samples<size_t>(0, data_set_.size(), batch_size, &engine_,
+                            &indices_);
+    Slice data;
+    Slice label;
+    data_set_.Read(indices_[0], &data, &label);
     auto* mutable_data = output->mutable_data();
-    mutable_data->Resize({batch_size, datas[0].size()});
+    mutable_data->Resize({batch_size, data.size()});
     auto* p = mutable_data->mutable_data();
-    for (const Slice& d : datas) {
-      for (const Byte c : d) {
+    char* q = ctx.session()->mutable_buffer(batch_size * label.size());
+    ctx.session()->set_data(Slice(q, batch_size * label.size()));
+    ctx.session()->set_batch_size(batch_size);
+    for (size_t idx : indices_) {
+      data_set_.Read(idx, &data, &label);
+      for (const Byte c : data) {
         *p++ = Float(c) / 255;
       }
-    }
-    char* q = new char[batch_size];
-    ctx.session()->set_data(Slice(q, batch_size));
-    ctx.session()->set_batch_size(batch_size);
-    for (auto l : labels) {
-      memcpy(q, l.data(), l.size());
-      q += l.size();
+      memcpy(q, label.data(), label.size());
+      q += label.size();
     }
   } else {
     Slice data;
@@ -61,13 +63,20 @@ void DataLayer::Forward(const Context& ctx, const Variable& input,
     for (Byte c: data) {
       *p++ = Float(c) / 255;
     }
-    char* q = new char[label.size()];
+    char* q = ctx.session()->mutable_buffer(label.size());
     ctx.session()->set_data(Slice(q, label.size()));
     ctx.session()->set_batch_size(label.size());
     memcpy(q, label.data(), label.size());
   }
 }
 
+bool DataLayer::InferShape(const std::vector<Shape>& inputs,
+                           Shape* output) const {
+  size_t batch_size = std::min(data_set_.batch_size(), data_set_.size());
+  *output = {batch_size, layer_config_.data_set().data_block()};
+  return true;
+}
+
 REGISTER_LAYER(Data);
 
 }  // namespace cola
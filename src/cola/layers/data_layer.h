@@ -28,8 +28,17 @@ class DataLayer : public Layer {
   void Forward(const Context& ctx, const Variable& input,
                Variable* output) const override;
 
+  // The input is ignored, the batch is read from the data set.
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
  private:
   DataSet data_set_;
+
+  // Sampling state reused across batches, the data layer is only driven by
+  // the single training thread.
+  mutable std::mt19937 engine_;
+  mutable std::vector<size_t> indices_;
 };
 
 }  // namespace cola
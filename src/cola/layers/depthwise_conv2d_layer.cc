@@ -0,0 +1,233 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/depthwise_conv2d_layer.h"
+
+#include <algorithm>
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool DepthwiseConv2DLayer::Load(const LayerConfig& config) {
+  const auto& conv = config.conv();
+  channels_ = conv.channels();
+  height_ = conv.height();
+  width_ = conv.width();
+  filters_ = conv.filters();
+  kernel_ = conv.kernel();
+  stride_ = conv.stride();
+  padding_ = conv.padding();
+  dilation_ = conv.dilation();
+  if (!channels_ || !height_ || !width_ || !filters_ || !kernel_ ||
+      !stride_ || !dilation_ || filters_ % channels_ ||
+      (conv.groups() != 1 && conv.groups() != channels_)) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad depthwise conv: " << conv.ShortDebugString();
+    return false;
+  }
+  const size_t extent = dilation_ * (kernel_ - 1) + 1;
+  if (height_ + 2 * padding_ < extent || width_ + 2 * padding_ < extent) {
+    LOG(ERROR) << "[" << config.name() << "] kernel of " << extent
+               << " pixels exceeds the padded image";
+    return false;
+  }
+  out_height_ = (height_ + 2 * padding_ - extent) / stride_ + 1;
+  out_width_ = (width_ + 2 * padding_ - extent) / stride_ + 1;
+  first_.resize(kernel_);
+  last_.resize(kernel_);
+  for (size_t kj = 0; kj < kernel_; ++kj) {
+    // Column ow reads ow * stride + offset.
+    const long offset = long(kj * dilation_) - long(padding_);
+    const long stride = stride_;
+    const long last = (long(width_) - offset + stride - 1) / stride;
+    last_[kj] = std::min<size_t>(std::max<long>(last, 0), out_width_);
+    first_[kj] = std::min<size_t>(
+        offset >= 0 ? 0 : (-offset + stride - 1) / stride, last_[kj]);
+  }
+
+  const size_t kk = kernel_ * kernel_;
+  w_.Fill(conv.weight(), {filters_, kk});
+  b_.Fill(conv.bias(), {filters_});
+  w_.set_name(config.name() + "w");
+  b_.set_name(config.name() + "b");
+  if (!w_.external() && w_.data().size() != filters_ * kk) {
+    LOG(ERROR) << "[" << config.name() << "] expects " << filters_ * kk
+               << " weights, got " << w_.data().size();
+    return false;
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  const size_t input_size = channels_ * height_ * width_;
+  const size_t output_size = filters_ * out_height_ * out_width_;
+  if ((config.input_size() && config.input_size() != input_size) ||
+      (config.output_size() && config.output_size() != output_size)) {
+    LOG(ERROR) << "[" << config.name() << "] sizes differ from the conv: "
+               << input_size << " -> " << output_size;
+    return false;
+  }
+  layer_config_.set_input_size(input_size);
+  layer_config_.set_output_size(output_size);
+  layer_config_.mutable_conv()->mutable_weight()->clear_data();
+  layer_config_.mutable_conv()->mutable_bias()->clear_data();
+  return true;
+}
+
+void DepthwiseConv2DLayer::Forward(const Context& ctx, const Variable& input,
+                                   Variable* output) const {
+  const auto& x = input.data();
+  const size_t m = x.shape(0);
+  const size_t pixels = out_height_ * out_width_;
+  const size_t multiplier = filters_ / channels_;
+  const size_t kk = kernel_ * kernel_;
+  const Float* w = w_.local_data().data();
+  const Float* b = b_.local_data().data();
+  auto* y = output->mutable_data();
+  y->Resize({m, filters_ * pixels});
+
+  // One output plane per task.
+  ParallelFor(0, m * filters_, GrainSize(pixels * kk), [&](size_t begin,
+                                                          size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const size_t n = i / filters_;
+      const size_t f = i % filters_;
+      const Float* plane =
+          x.data() + (n * channels_ + f / multiplier) * height_ * width_;
+      const Float* wf = w + f * kk;
+      Float* out = y->mutable_data() + i * pixels;
+      std::fill(out, out + pixels, b[f]);
+      for (size_t oh = 0; oh < out_height_; ++oh) {
+        Float* row = out + oh * out_width_;
+        for (size_t ki = 0; ki < kernel_; ++ki) {
+          const long iy = long(oh * stride_ + ki * dilation_) - long(padding_);
+          if (iy < 0 || iy >= long(height_)) {
+            continue;
+          }
+          const Float* src = plane + iy * width_;
+          for (size_t kj = 0; kj < kernel_; ++kj) {
+            const Float v = wf[ki * kernel_ + kj];
+            const long offset = long(kj * dilation_) - long(padding_);
+            for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+              row[ow] += v * src[long(ow * stride_) + offset];
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+void DepthwiseConv2DLayer::Backward(const Context& ctx, const Variable& output,
+                                    Variable* input) {
+  const auto& x = input->data();
+  const auto& dy = output.grad();
+  const size_t m = x.shape(0);
+  const size_t image = height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t multiplier = filters_ / channels_;
+  const size_t kk = kernel_ * kernel_;
+  const bool down = propagate_down(0);
+  const bool learn = trainable();
+  auto* dx = input->mutable_grad();
+  if (down) {
+    dx->Resize(x.shape());
+  }
+  const Float* w = w_.data().data();
+  // Weight gradients are summed until Optimizer::ZeroGrad.
+  Float* dw = learn ? w_.mutable_grad()->mutable_data() : nullptr;
+  Float* db = learn ? b_.mutable_grad()->mutable_data() : nullptr;
+
+  // The filters of a channel run on one thread, which owns their weight
+  // gradients and the input gradient of the channel.
+  const size_t cost = m * multiplier * pixels * kk;
+  ParallelFor(0, channels_, GrainSize(cost), [&](size_t begin, size_t end) {
+    for (size_t c = begin; c < end; ++c) {
+      for (size_t n = 0; n < m; ++n) {
+        const Float* plane = x.data() + (n * channels_ + c) * image;
+        Float* dplane =
+            down ? dx->mutable_data() + (n * channels_ + c) * image : nullptr;
+        if (down) {
+          std::fill(dplane, dplane + image, Float(0));
+        }
+        for (size_t f = c * multiplier; f < (c + 1) * multiplier; ++f) {
+          const Float* dout = dy.data() + (n * filters_ + f) * pixels;
+          if (learn) {
+            Float sum = 0;
+            for (size_t p = 0; p < pixels; ++p) {
+              sum += dout[p];
+            }
+            db[f] += sum;
+          }
+          for (size_t oh = 0; oh < out_height_; ++oh) {
+            const Float* drow = dout + oh * out_width_;
+            for (size_t ki = 0; ki < kernel_; ++ki) {
+              const long iy =
+                  long(oh * stride_ + ki * dilation_) - long(padding_);
+              if (iy < 0 || iy >= long(height_)) {
+                continue;
+              }
+              for (size_t kj = 0; kj < kernel_; ++kj) {
+                const size_t k = f * kk + ki * kernel_ + kj;
+                const long offset = long(kj * dilation_) - long(padding_);
+                if (learn) {
+                  const Float* src = plane + iy * width_;
+                  Float sum = 0;
+                  for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+                    sum += drow[ow] * src[long(ow * stride_) + offset];
+                  }
+                  dw[k] += sum;
+                }
+                if (down) {
+                  Float* dsrc = dplane + iy * width_;
+                  for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+                    dsrc[long(ow * stride_) + offset] += w[k] * drow[ow];
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+bool DepthwiseConv2DLayer::InferShape(const std::vector<Shape>& inputs,
+                                      Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " inputs, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], size_t(layer_config_.output_size())};
+  return true;
+}
+
+void DepthwiseConv2DLayer::Snapshot(LayerConfig* config) const {
+  *config = layer_config_;
+  Weight::SetData(w_.data(), config->mutable_conv()->mutable_weight());
+  Weight::SetData(b_.data(), config->mutable_conv()->mutable_bias());
+}
+
+REGISTER_LAYER(DepthwiseConv2D);
+
+}  // namespace cola
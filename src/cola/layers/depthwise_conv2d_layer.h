@@ -0,0 +1,69 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_DEPTHWISE_CONV2D_LAYER_H_
+#define COLA_LAYERS_DEPTHWISE_CONV2D_LAYER_H_
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// A convolution whose filters each see one channel, see ConvConfig. The
+// `filters` are a multiple of the `channels`, filter f reads channel
+// f / (filters / channels), and the weights are of filters x kernel x kernel.
+// `groups` is either 1 or the channels.
+//
+// Every filter adds its taps to whole rows of output pixels, the span of a
+// row that reads inside the image being computed at load, so the inner loop
+// has no bounds checks.
+class DepthwiseConv2DLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  std::vector<Weight*> GetWeights() override { return {&w_, &b_}; }
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  void Snapshot(LayerConfig* config) const override;
+
+ private:
+  size_t channels_;
+  size_t height_;
+  size_t width_;
+  size_t filters_;
+  size_t kernel_;
+  size_t stride_;
+  size_t padding_;
+  size_t dilation_;
+  size_t out_height_;
+  size_t out_width_;
+  // Output columns [first_[kj], last_[kj]) read inside the image at kernel
+  // column kj.
+  std::vector<size_t> first_;
+  std::vector<size_t> last_;
+
+  Weight w_;
+  Weight b_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_DEPTHWISE_CONV2D_LAYER_H_
@@ -0,0 +1,119 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/dropout_layer.h"
+
+#include <algorithm>
+#include <string>
+
+#include "cola/base/logging.h"
+#include "cola/base/random.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+// Values of a task, whose bits fill one call of Philox::Generate.
+static const size_t kChunk = 8 * random::Philox::kLanes;
+
+// FNV-1a of the bytes of `name`, the same on every platform so that a seed
+// draws the same masks everywhere.
+static uint32_t Hash(const std::string& name) {
+  uint32_t h = 0x811c9dc5u;
+  for (char c : name) {
+    h = (h ^ static_cast<uint8_t>(c)) * 0x01000193u;
+  }
+  return h;
+}
+
+bool DropoutLayer::Load(const LayerConfig& config) {
+  const Float rate = config.dropout().rate();
+  if (!(rate >= 0 && rate < 1)) {
+    LOG(ERROR) << "[" << config.name() << "] bad dropout rate: " << rate;
+    return false;
+  }
+  threshold_ = std::min<uint32_t>(uint32_t(rate * 65536 + 0.5), 65535);
+  scale_ = Float(65536) / (65536 - threshold_);
+  // Dropout layers of one seed draw different masks.
+  key_ = uint64_t(config.dropout().seed()) << 32 | Hash(config.name());
+  return Layer::Load(config);
+}
+
+void DropoutLayer::Forward(const Context& ctx, const Variable& input,
+                           Variable* output) const {
+  const auto& x = input.data();
+  if (ctx.session()->phase() != kTrain) {
+    *output->mutable_data() =
+        Tensor<Float>::Create(const_cast<Float*>(x.data()), x.shape());
+    return;
+  }
+  const size_t size = x.size();
+  auto* state = output->mutable_state();
+  if (state->size() < (size + 7) / 8) {
+    state->resize((size + 7) / 8);
+  }
+  auto* y = output->mutable_data();
+  y->Resize(x.shape());
+  const random::Philox philox(key_);
+  const uint64_t step = ctx.session()->step();
+  const size_t chunks = (size + kChunk - 1) / kChunk;
+  ParallelFor(0, chunks, GrainSize(kChunk), [&](size_t begin, size_t end) {
+    uint32_t words[kChunk / 2];
+    for (size_t c = begin; c < end; ++c) {
+      const size_t first = c * kChunk;
+      const size_t count = std::min(kChunk, size - first);
+      philox.Generate(first / 8, step, (count + 7) / 8, words);
+      const Float* src = x.data() + first;
+      Float* dst = y->mutable_data() + first;
+      uint8_t* mask = state->data() + first / 8;
+      for (size_t i = 0; i < count; i += 8) {
+        const size_t n = std::min<size_t>(8, count - i);
+        uint8_t bits = 0;
+        for (size_t j = 0; j < n; ++j) {
+          const uint32_t word = words[(i + j) / 2];
+          const uint32_t r = (j & 1 ? word >> 16 : word) & 0xFFFF;
+          const bool keep = r >= threshold_;
+          bits |= uint8_t(keep) << j;
+          dst[i + j] = src[i + j] * (keep ? scale_ : 0);
+        }
+        mask[i / 8] = bits;
+      }
+    }
+  });
+}
+
+void DropoutLayer::Backward(const Context& ctx, const Variable& output,
+                            Variable* input) {
+  const auto& dy = output.grad();
+  if (ctx.session()->phase() != kTrain) {
+    *input->mutable_grad() = dy;
+    return;
+  }
+  const size_t size = dy.size();
+  CHECK(output.state().size() >= (size + 7) / 8);
+  const uint8_t* mask = output.state().data();
+  auto* dx = input->mutable_grad();
+  dx->Resize(dy.shape());
+  ParallelFor(0, size, GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float keep = (mask[i / 8] >> (i % 8)) & 1;
+      dx->mutable_data()[i] = dy.data()[i] * keep * scale_;
+    }
+  });
+}
+
+REGISTER_LAYER(Dropout);
+
+}  // namespace cola
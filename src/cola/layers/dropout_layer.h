@@ -0,0 +1,51 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_DROPOUT_LAYER_H_
+#define COLA_LAYERS_DROPOUT_LAYER_H_
+
+#include <stdint.h>
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// See DropoutConfig. In the train phase every value draws 16 bits of a
+// Philox block, 8 values to a block, and is kept if they reach the rate.
+// The kept values are packed into bits in the state of the output for
+// Backward. The masks differ by Session::step().
+class DropoutLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  // At inference only, see Session::phase().
+  bool row_wise() const override { return true; }
+
+ private:
+  // Of the Philox generator.
+  uint64_t key_;
+  // Values whose bits are below it are dropped.
+  uint32_t threshold_;
+  Float scale_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_DROPOUT_LAYER_H_
@@ -0,0 +1,155 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/embedding_layer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool EmbeddingLayer::Load(const LayerConfig& config) {
+  const auto& embedding = config.embedding();
+  rows_ = embedding.rows();
+  dims_ = embedding.dims();
+  if (!rows_ || !dims_ || rows_ > (1 << 24) ||
+      (config.output_size() && config.input_size() &&
+       config.output_size() != config.input_size() * dims_)) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad embedding: " << embedding.ShortDebugString();
+    return false;
+  }
+  w_.set_sparse_grad(true);
+  w_.Fill(embedding.weight(), {rows_, dims_});
+  w_.set_name(config.name() + "w");
+  if (!w_.external() && w_.data().size() != rows_ * dims_) {
+    LOG(ERROR) << "[" << config.name() << "] expects " << rows_ * dims_
+               << " weights, got " << w_.data().size();
+    return false;
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  layer_config_.mutable_embedding()->mutable_weight()->clear_data();
+  return true;
+}
+
+size_t EmbeddingLayer::Row(Float x) const {
+  return x >= 0 && x < rows_ ? size_t(x) : rows_;
+}
+
+void EmbeddingLayer::Forward(const Context& ctx, const Variable& input,
+                             Variable* output) const {
+  const auto& x = input.data();
+  const size_t m = x.shape(0);
+  const size_t fields = x.count(1);
+  const Float* w = w_.local_data().data();
+  auto* y = output->mutable_data();
+  y->Resize({m, fields * dims_});
+  // Indices out of range fail the pass, their embeddings are zeros.
+  const Float* bad = std::find_if(
+      x.data(), x.data() + x.size(), [&](Float v) { return Row(v) == rows_; });
+  if (bad != x.data() + x.size()) {
+    std::ostringstream os;
+    os << "[" << layer_config_.name() << "] index " << *bad << " out of "
+       << rows_ << " rows";
+    ctx.session()->set_error(os.str());
+  }
+  ParallelFor(0, m * fields, GrainSize(dims_), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Float* dst = y->mutable_data() + i * dims_;
+      const size_t row = Row(x.data()[i]);
+      if (row == rows_) {
+        std::fill(dst, dst + dims_, Float(0));
+      } else {
+        memcpy(dst, w + row * dims_, dims_ * sizeof(Float));
+      }
+    }
+  });
+}
+
+void EmbeddingLayer::Backward(const Context& ctx, const Variable& output,
+                              Variable* input) {
+  const auto& x = input->data();
+  const auto& dy = output.grad();
+  if (propagate_down(0)) {
+    // Indices have no gradient.
+    auto* dx = input->mutable_grad();
+    dx->Resize(x.shape());
+    std::fill(dx->mutable_data(), dx->mutable_data() + dx->size(), Float(0));
+  }
+  if (!trainable()) {
+    return;
+  }
+  lookups_.clear();
+  lookups_.reserve(x.size());
+  for (size_t i = 0; i < x.size(); ++i) {
+    const size_t row = Row(x.data()[i]);
+    if (row != rows_) {
+      lookups_.push_back({row, i});
+    }
+  }
+  const size_t count = lookups_.size();
+  std::sort(lookups_.begin(), lookups_.end());
+  // Sized for every lookup hitting its own row, so batches of the same size
+  // never allocate.
+  grad_rows_.clear();
+  grad_rows_.reserve(count);
+  grad_values_.resize(count * dims_);
+  Float* dst = nullptr;
+  for (size_t i = 0; i < count; ++i) {
+    if (grad_rows_.empty() || grad_rows_.back() != lookups_[i].first) {
+      grad_rows_.push_back(lookups_[i].first);
+      dst = grad_values_.data() + (grad_rows_.size() - 1) * dims_;
+      std::fill(dst, dst + dims_, Float(0));
+    }
+    const Float* src = dy.data() + lookups_[i].second * dims_;
+    for (size_t j = 0; j < dims_; ++j) {
+      dst[j] += src[j];
+    }
+  }
+  // Summed with the gradients of other batches until Optimizer::ZeroGrad.
+  w_.AddSparseGrad(grad_rows_, grad_values_.data());
+}
+
+bool EmbeddingLayer::InferShape(const std::vector<Shape>& inputs,
+                                Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (input_size && inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " indices, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], inputs[0].count(1) * dims_};
+  return true;
+}
+
+void EmbeddingLayer::Snapshot(LayerConfig* config) const {
+  *config = layer_config_;
+  Weight::SetData(w_.data(), config->mutable_embedding()->mutable_weight());
+}
+
+REGISTER_LAYER(Embedding);
+
+}  // namespace cola
@@ -0,0 +1,63 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_EMBEDDING_LAYER_H_
+#define COLA_LAYERS_EMBEDDING_LAYER_H_
+
+#include <utility>
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// See EmbeddingConfig. Backward sorts the lookups of the batch by row to sum
+// the gradient of every row looked up, the table never having a dense
+// gradient.
+class EmbeddingLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  std::vector<Weight*> GetWeights() override { return {&w_}; }
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  bool row_wise() const override { return true; }
+
+  void Snapshot(LayerConfig* config) const override;
+
+ private:
+  // The row of input value `x`, rows_ if it is out of range.
+  size_t Row(Float x) const;
+
+  size_t rows_;
+  size_t dims_;
+  Weight w_;
+
+  // Row and position of every value of the batch in range.
+  std::vector<std::pair<size_t, size_t>> lookups_;
+  // The sparse gradient of the batch.
+  std::vector<size_t> grad_rows_;
+  std::vector<Float> grad_values_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_EMBEDDING_LAYER_H_
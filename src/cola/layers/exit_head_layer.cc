@@ -0,0 +1,101 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/exit_head_layer.h"
+
+#include <algorithm>
+
+#include "cola/base/logging.h"
+#include "cola/base/math_ops.h"
+#include "cola/base/registry.h"
+
+namespace cola {
+
+bool ExitHeadLayer::Load(const LayerConfig& config) {
+  if (config.affine().shards() > 1) {
+    LOG(ERROR) << "[ExitHead] shards are not supported";
+    return false;
+  }
+  return AffineLayer::Load(config);
+}
+
+void ExitHeadLayer::Probabilities(const Tensor<Float>& x,
+                                  Tensor<Float>* p) const {
+  const auto& w = w_.local_data();
+  const size_t m = x.shape(0);
+  const size_t n = w.shape(1);
+  const size_t k = x.count(1);
+  p->Resize({m, n});
+  MatrixMultiply(x.data(), w.data(), kNoTrans, m, n, k, p->mutable_data());
+  (*p) += b_.local_data();
+  Softmax(p->data(), p->mutable_data(), m, n);
+}
+
+void ExitHeadLayer::Forward(const Context& ctx, const Variable& input,
+                            Variable* output) const {
+  const auto& x = input.data();
+  *output->mutable_data() =
+      Tensor<Float>::Create(const_cast<Float*>(x.data()), x.shape());
+  const Float threshold = layer_config_.exit_head().threshold();
+  if (threshold <= 0) {
+    return;
+  }
+  auto* session = ctx.session();
+  auto* p = session->mutable_exit_output();
+  Probabilities(x, p);
+  const size_t n = p->count(1);
+  for (size_t i = 0; i < p->shape(0); ++i) {
+    const Float* row = p->data() + i * n;
+    if (*std::max_element(row, row + n) < threshold) {
+      return;
+    }
+  }
+  session->set_exit(layer_config_.name());
+}
+
+void ExitHeadLayer::Backward(const Context& ctx, const Variable& output,
+                             Variable* input) {
+  const auto& label = ctx.session()->label();
+  auto* delta = delta_.mutable_grad();
+  Probabilities(input->data(), delta);
+  CHECK(label.shape() == delta->shape());
+  *delta -= label;
+  *delta *= layer_config_.exit_head().loss_weight() *
+            ctx.session()->loss_scale() / ctx.batch_size();
+  // The gradient of the head, then that of the layers after it.
+  AffineLayer::Backward(ctx, delta_, input);
+  if (propagate_down(0)) {
+    *input->mutable_grad() += output.grad();
+  }
+}
+
+bool ExitHeadLayer::InferShape(const std::vector<Shape>& inputs,
+                               Shape* output) const {
+  Shape head;
+  if (!AffineLayer::InferShape(inputs, &head)) {
+    return false;
+  }
+  *output = inputs[0];
+  return true;
+}
+
+void ExitHeadLayer::Reserve(const std::vector<Shape>& inputs,
+                            const Shape& output) {
+  delta_.mutable_grad()->Reserve(output[0] * layer_config_.output_size());
+}
+
+REGISTER_LAYER(ExitHead);
+
+}  // namespace cola
@@ -0,0 +1,54 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_EXIT_HEAD_LAYER_H_
+#define COLA_LAYERS_EXIT_HEAD_LAYER_H_
+
+#include "cola/layers/affine_layer.h"
+
+namespace cola {
+
+// An auxiliary classifier on an intermediate output, see ExitHeadConfig. The
+// input passes through, the head adds the gradient of its softmax loss on
+// the labels of the session to the input gradient. At inference the head
+// ends the pass early once confident about every row of the batch.
+class ExitHeadLayer : public AffineLayer {
+ public:
+  // The exit is decided for the whole batch.
+  bool row_wise() const override { return false; }
+
+  bool Load(const LayerConfig& config) override;
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  void Reserve(const std::vector<Shape>& inputs, const Shape& output) override;
+
+ private:
+  // Computes the class probabilities of the head for `x`.
+  void Probabilities(const Tensor<Float>& x, Tensor<Float>* p) const;
+
+  // Gradient of the logits of the head.
+  Variable delta_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_EXIT_HEAD_LAYER_H_
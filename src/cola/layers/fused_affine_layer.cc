@@ -0,0 +1,97 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/fused_affine_layer.h"
+
+#include <cmath>
+
+#include "cola/base/logging.h"
+#include "cola/base/math_ops.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool FusedAffineLayer::Load(const LayerConfig& config) {
+  const auto& activation = config.affine().activation();
+  if (activation != "relu" && activation != "sigmoid") {
+    LOG(ERROR) << "[FusedAffine] unknown activation: " << activation;
+    return false;
+  }
+  if (config.affine().shards() > 1) {
+    LOG(ERROR) << "[FusedAffine] shards are not supported";
+    return false;
+  }
+  relu_ = activation == "relu";
+  return AffineLayer::Load(config);
+}
+
+void FusedAffineLayer::Forward(const Context& ctx, const Variable& input,
+                               Variable* output) const {
+  const auto& x = input.data();
+  const auto& w = w_.local_data();
+  const Float* b = b_.local_data().data();
+  auto* y = output->mutable_data();
+
+  size_t m = x.shape(0);
+  size_t n = w.shape(1);
+  size_t k = x.count(1);
+
+  y->Resize({m, n});
+  MatrixMultiply(x.data(), w.data(), kNoTrans, m, n, k, y->mutable_data());
+
+  Float* p = y->mutable_data();
+  ParallelFor(0, m, GrainSize(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Float* row = p + i * n;
+      for (size_t j = 0; j < n; ++j) {
+        Float v = row[j] + b[j];
+        if (relu_) {
+          row[j] = v > Float(0) ? v : Float(0);
+        } else {
+          row[j] = Float(1) / (Float(1) + std::exp(-v));
+        }
+      }
+    }
+  });
+}
+
+void FusedAffineLayer::Backward(const Context& ctx, const Variable& output,
+                                Variable* input) {
+  const auto& dout = output.grad();
+  const auto& out = output.data();
+  auto* delta = delta_.mutable_grad();
+  delta->Resize(dout.shape());
+  ParallelFor(0, out.size(), GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float y = out.data()[i];
+      if (relu_) {
+        delta->mutable_data()[i] = y > Float(0) ? dout.data()[i] : Float(0);
+      } else {
+        delta->mutable_data()[i] = dout.data()[i] * y * (1 - y);
+      }
+    }
+  });
+  AffineLayer::Backward(ctx, delta_, input);
+}
+
+void FusedAffineLayer::Reserve(const std::vector<Shape>& inputs,
+                               const Shape& output) {
+  delta_.mutable_grad()->Reserve(output.count());
+}
+
+REGISTER_LAYER(FusedAffine);
+
+}  // namespace cola
@@ -0,0 +1,107 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/grouped_affine_layer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "cola/base/logging.h"
+#include "cola/base/math_ops.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool GroupedAffineLayer::Load(const LayerConfig& config) {
+  activation_ = config.affine().activation();
+  if (!activation_.empty() && activation_ != "relu" &&
+      activation_ != "sigmoid") {
+    LOG(ERROR) << "[GroupedAffine] unknown activation: " << activation_;
+    return false;
+  }
+  if (config.affine().shards() > 1) {
+    LOG(ERROR) << "[GroupedAffine] shards are not supported";
+    return false;
+  }
+  if (!AffineLayer::Load(config)) {
+    return false;
+  }
+  const auto& shape = w_.data().shape();
+  if (shape.size() != 3 || shape[1] != config.input_size() ||
+      shape[2] != config.output_size() ||
+      b_.data().size() != shape[0] * config.output_size()) {
+    LOG(ERROR) << "[" << config.name()
+               << "] expects weights of [models, input_size, output_size], "
+               << "got " << shape.ToString();
+    return false;
+  }
+  num_models_ = shape[0];
+  // No gradients at inference.
+  *w_.mutable_grad() = Tensor<Float>();
+  *b_.mutable_grad() = Tensor<Float>();
+  return true;
+}
+
+void GroupedAffineLayer::Forward(const Context& ctx, const Variable& input,
+                                 Variable* output) const {
+  const auto& groups = ctx.session()->groups();
+  const auto& x = input.data();
+  const size_t m = x.shape(0);
+  const size_t k = x.count(1);
+  const size_t n = layer_config_.output_size();
+  CHECK_EQ(groups.size(), num_models_ + 1);
+  CHECK_EQ(groups.back(), m);
+
+  auto* y = output->mutable_data();
+  y->Resize({m, n});
+  GroupedMatrixMultiply(x.data(), w_.local_data().data(), groups.data(),
+                        num_models_, n, k, y->mutable_data());
+
+  const Float* bias = b_.local_data().data();
+  Float* p = y->mutable_data();
+  const bool relu = activation_ == "relu";
+  const bool sigmoid = activation_ == "sigmoid";
+  ParallelFor(0, m, GrainSize(n), [&](size_t begin, size_t end) {
+    size_t g = std::upper_bound(groups.begin(), groups.end(), begin) -
+               groups.begin() - 1;
+    for (size_t i = begin; i < end; ++i) {
+      while (i >= groups[g + 1]) {
+        ++g;
+      }
+      const Float* b = bias + g * n;
+      Float* row = p + i * n;
+      for (size_t j = 0; j < n; ++j) {
+        Float v = row[j] + b[j];
+        if (relu) {
+          v = v > Float(0) ? v : Float(0);
+        } else if (sigmoid) {
+          v = Float(1) / (Float(1) + std::exp(-v));
+        }
+        row[j] = v;
+      }
+    }
+  });
+}
+
+void GroupedAffineLayer::Backward(const Context& ctx, const Variable& output,
+                                  Variable* input) {
+  LOG(ERROR) << "[GroupedAffine] has no gradient";
+  CHECK(false);
+}
+
+REGISTER_LAYER(GroupedAffine);
+
+}  // namespace cola
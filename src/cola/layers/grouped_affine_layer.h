@@ -0,0 +1,48 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_GROUPED_AFFINE_LAYER_H_
+#define COLA_LAYERS_GROUPED_AFFINE_LAYER_H_
+
+#include "cola/layers/affine_layer.h"
+
+namespace cola {
+
+// The Affine layers of the models of a ModelGroup, whose weights are stacked
+// as [models, input_size, output_size] and biases as [models, output_size].
+// Rows of the batch use the weights of their model, see Session::groups().
+// The activation of FusedAffine is applied if set, infer phase only.
+class GroupedAffineLayer : public AffineLayer {
+ public:
+  // Tiles would cut across the groups.
+  bool row_wise() const override { return false; }
+
+  bool has_gradient() const override { return false; }
+
+  bool Load(const LayerConfig& config) override;
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+ private:
+  size_t num_models_;
+  std::string activation_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_GROUPED_AFFINE_LAYER_H_
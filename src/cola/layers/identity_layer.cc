@@ -0,0 +1,34 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/identity_layer.h"
+
+#include "cola/base/registry.h"
+
+namespace cola {
+
+void IdentityLayer::Forward(const Context& ctx, const Variable& input,
+                            Variable* output) const {
+  *output->mutable_data() = input.data();
+}
+
+void IdentityLayer::Backward(const Context& ctx, const Variable& output,
+                             Variable* input) {
+  *input->mutable_grad() = output.grad();
+}
+
+REGISTER_LAYER(Identity);
+
+}  // namespace cola
@@ -15,6 +15,8 @@
 
 #include "cola/layers/layer.h"
 
+#include "cola/base/logging.h"
+
 namespace cola {
 
 Layer::Layer() {}
@@ -25,4 +27,14 @@ bool Layer::Load(const LayerConfig& config) {
   return true;
 }
 
+bool Layer::InferShape(const std::vector<Shape>& inputs, Shape* output) const {
+  if (inputs.size() != 1) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] takes one input, got "
+               << inputs.size();
+    return false;
+  }
+  *output = inputs[0];
+  return true;
+}
+
 }  // namespace cola
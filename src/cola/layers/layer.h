@@ -40,12 +40,62 @@ class Layer {
   virtual void Backward(const Context& ctx, const Variable& output,
                         Variable* input) {}
 
+  // Layers with several inputs override these two, the inputs are ordered
+  // as the `inputs` field of the config, followed by the other producers in
+  // config order.
+  virtual void Forward(const Context& ctx,
+                       const std::vector<const Variable*>& inputs,
+                       Variable* output) const {
+    Forward(ctx, *inputs[0], output);
+  }
+  virtual void Backward(const Context& ctx, const Variable& output,
+                        const std::vector<Variable*>& inputs) {
+    Backward(ctx, output, inputs[0]);
+  }
+
+  // Infers the shape of the output from the shapes of the inputs, whose
+  // first dimension is the batch size. Logs and returns false if the inputs
+  // do not fit the layer. By default the layer keeps the shape of its only
+  // input.
+  virtual bool InferShape(const std::vector<Shape>& inputs,
+                          Shape* output) const;
+
+  // Preallocates the workspace of the layer for the largest shapes.
+  virtual void Reserve(const std::vector<Shape>& inputs, const Shape& output) {}
+
+  // Bytes of the state Forward keeps in its output for the largest shapes,
+  // reserved with the activations of an ExecutionContext.
+  virtual size_t StateSize(const std::vector<Shape>& inputs,
+                           const Shape& output) const {
+    return 0;
+  }
+
+  // Whether every output row depends only on the same input row, such
+  // layers may run on slices of the batch.
+  virtual bool row_wise() const { return false; }
+
+  // Whether Backward is implemented, Network::Load rejects the layers
+  // without it that the backward pass of the train phase reaches.
+  virtual bool has_gradient() const { return true; }
+
+  bool trainable() const { return layer_config_.trainable(); }
+
+  // Whether Backward computes the gradient of input `i`, it does not for
+  // inputs that are data or only depend on frozen layers.
+  bool propagate_down(size_t i) const {
+    return i >= propagate_down_.size() || propagate_down_[i];
+  }
+  void set_propagate_down(std::vector<bool> propagate_down) {
+    propagate_down_ = std::move(propagate_down);
+  }
+
   const LayerConfig& layer_config() const { return layer_config_; }
 
   virtual void Snapshot(LayerConfig* config) const { *config = layer_config_; }
 
  protected:
   LayerConfig layer_config_;
+  std::vector<bool> propagate_down_;
 };
 
 }  // namespace cola
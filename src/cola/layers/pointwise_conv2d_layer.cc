@@ -0,0 +1,160 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/pointwise_conv2d_layer.h"
+
+#include "cola/base/logging.h"
+#include "cola/base/math_ops.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+bool PointwiseConv2DLayer::Load(const LayerConfig& config) {
+  const auto& conv = config.conv();
+  channels_ = conv.channels();
+  pixels_ = conv.height() * conv.width();
+  filters_ = conv.filters();
+  if (!channels_ || !pixels_ || !filters_ || conv.kernel() > 1 ||
+      conv.stride() != 1 || conv.padding() || conv.groups() != 1) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad pointwise conv: " << conv.ShortDebugString();
+    return false;
+  }
+  w_.Fill(conv.weight(), {filters_, channels_});
+  b_.Fill(conv.bias(), {filters_});
+  w_.set_name(config.name() + "w");
+  b_.set_name(config.name() + "b");
+  if (!w_.external() && w_.data().size() != filters_ * channels_) {
+    LOG(ERROR) << "[" << config.name() << "] expects "
+               << filters_ * channels_ << " weights, got "
+               << w_.data().size();
+    return false;
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  const size_t input_size = channels_ * pixels_;
+  const size_t output_size = filters_ * pixels_;
+  if ((config.input_size() && config.input_size() != input_size) ||
+      (config.output_size() && config.output_size() != output_size)) {
+    LOG(ERROR) << "[" << config.name() << "] sizes differ from the conv: "
+               << input_size << " -> " << output_size;
+    return false;
+  }
+  layer_config_.set_input_size(input_size);
+  layer_config_.set_output_size(output_size);
+  layer_config_.mutable_conv()->mutable_weight()->clear_data();
+  layer_config_.mutable_conv()->mutable_bias()->clear_data();
+  return true;
+}
+
+void PointwiseConv2DLayer::Forward(const Context& ctx, const Variable& input,
+                                   Variable* output) const {
+  const auto& x = input.data();
+  const size_t m = x.shape(0);
+  const Float* w = w_.local_data().data();
+  const Float* b = b_.local_data().data();
+  auto* y = output->mutable_data();
+  y->Resize({m, filters_ * pixels_});
+
+  // Images run in parallel when there are enough of them to keep the threads
+  // busy, the rows of every product otherwise.
+  const size_t grain = m < ThreadPool::Default()->size() ? m : 1;
+  ParallelFor(0, m, grain, [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; ++n) {
+      const Float* xn = x.data() + n * channels_ * pixels_;
+      Float* yn = y->mutable_data() + n * filters_ * pixels_;
+      // (filters x channels) * (channels x pixels)
+      MatrixMultiply(w, xn, kNoTrans, filters_, pixels_, channels_, yn);
+      for (size_t f = 0; f < filters_; ++f) {
+        for (size_t p = 0; p < pixels_; ++p) {
+          yn[f * pixels_ + p] += b[f];
+        }
+      }
+    }
+  });
+}
+
+void PointwiseConv2DLayer::Backward(const Context& ctx, const Variable& output,
+                                    Variable* input) {
+  const auto& x = input->data();
+  const auto& dy = output.grad();
+  const size_t m = x.shape(0);
+  const bool down = propagate_down(0);
+  const bool learn = trainable();
+  auto* dx = input->mutable_grad();
+  if (down) {
+    dx->Resize(x.shape());
+  }
+  const Float* w = w_.data().data();
+  // Weight gradients are summed until Optimizer::ZeroGrad.
+  Float* dw = learn ? w_.mutable_grad()->mutable_data() : nullptr;
+  for (size_t n = 0; n < m; ++n) {
+    const Float* dyn = dy.data() + n * filters_ * pixels_;
+    if (learn) {
+      // (filters x pixels) * (channels x pixels)^T
+      MatrixMultiply(dyn, x.data() + n * channels_ * pixels_, kTransB,
+                     filters_, channels_, pixels_, dw, true);
+    }
+    if (down) {
+      // (filters x channels)^T * (filters x pixels)
+      MatrixMultiply(w, dyn, kTransA, channels_, pixels_, filters_,
+                     dx->mutable_data() + n * channels_ * pixels_);
+    }
+  }
+  if (!learn) {
+    return;
+  }
+  Float* db = b_.mutable_grad()->mutable_data();
+  ParallelFor(0, filters_, GrainSize(m * pixels_), [&](size_t begin,
+                                                       size_t end) {
+    for (size_t f = begin; f < end; ++f) {
+      Float sum = 0;
+      for (size_t n = 0; n < m; ++n) {
+        const Float* src = dy.data() + (n * filters_ + f) * pixels_;
+        for (size_t p = 0; p < pixels_; ++p) {
+          sum += src[p];
+        }
+      }
+      db[f] += sum;
+    }
+  });
+}
+
+bool PointwiseConv2DLayer::InferShape(const std::vector<Shape>& inputs,
+                                      Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " inputs, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], size_t(layer_config_.output_size())};
+  return true;
+}
+
+void PointwiseConv2DLayer::Snapshot(LayerConfig* config) const {
+  *config = layer_config_;
+  Weight::SetData(w_.data(), config->mutable_conv()->mutable_weight());
+  Weight::SetData(b_.data(), config->mutable_conv()->mutable_bias());
+}
+
+REGISTER_LAYER(PointwiseConv2D);
+
+}  // namespace cola
@@ -0,0 +1,53 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_POINTWISE_CONV2D_LAYER_H_
+#define COLA_LAYERS_POINTWISE_CONV2D_LAYER_H_
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// A 1 x 1 convolution of stride 1 without padding, see ConvConfig. The pixels
+// of an image are the columns of a channels x pixels matrix, which the
+// filters x channels weights multiply as they are.
+class PointwiseConv2DLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  std::vector<Weight*> GetWeights() override { return {&w_, &b_}; }
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  void Snapshot(LayerConfig* config) const override;
+
+ private:
+  size_t channels_;
+  size_t pixels_;
+  size_t filters_;
+
+  Weight w_;
+  Weight b_;
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_POINTWISE_CONV2D_LAYER_H_
@@ -0,0 +1,340 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/pool2d_layer.h"
+
+#include <algorithm>
+
+#include "cola/base/logging.h"
+#include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
+
+namespace cola {
+
+// Lanes of the partial sums of GlobalAvgPool2D.
+static const size_t kLanes = 8;
+
+bool Pool2DLayer::Load(const LayerConfig& config) {
+  const auto& pool = config.pool();
+  channels_ = pool.channels();
+  height_ = pool.height();
+  width_ = pool.width();
+  if (global()) {
+    kernel_height_ = height_;
+    kernel_width_ = width_;
+    stride_ = 1;
+    padding_ = 0;
+  } else {
+    kernel_height_ = pool.kernel();
+    kernel_width_ = pool.kernel();
+    stride_ = pool.stride() ? pool.stride() : pool.kernel();
+    padding_ = pool.padding();
+  }
+  if (!channels_ || !height_ || !width_ || !kernel_height_ ||
+      padding_ >= kernel_height_) {
+    LOG(ERROR) << "[" << config.name()
+               << "] bad pool: " << pool.ShortDebugString();
+    return false;
+  }
+  if (height_ + 2 * padding_ < kernel_height_ ||
+      width_ + 2 * padding_ < kernel_width_) {
+    LOG(ERROR) << "[" << config.name() << "] window of " << kernel_height_
+               << " pixels exceeds the padded image";
+    return false;
+  }
+  out_height_ = (height_ + 2 * padding_ - kernel_height_) / stride_ + 1;
+  out_width_ = (width_ + 2 * padding_ - kernel_width_) / stride_ + 1;
+  first_.resize(kernel_width_);
+  last_.resize(kernel_width_);
+  for (size_t kj = 0; kj < kernel_width_; ++kj) {
+    // Column ow reads ow * stride + offset.
+    const long offset = long(kj) - long(padding_);
+    const long stride = stride_;
+    const long last = (long(width_) - offset + stride - 1) / stride;
+    last_[kj] = std::min<size_t>(std::max<long>(last, 0), out_width_);
+    first_[kj] = std::min<size_t>(
+        offset >= 0 ? 0 : (-offset + stride - 1) / stride, last_[kj]);
+  }
+  if (!Layer::Load(config)) {
+    return false;
+  }
+  const size_t input_size = channels_ * height_ * width_;
+  const size_t output_size = channels_ * out_height_ * out_width_;
+  if ((config.input_size() && config.input_size() != input_size) ||
+      (config.output_size() && config.output_size() != output_size)) {
+    LOG(ERROR) << "[" << config.name() << "] sizes differ from the pool: "
+               << input_size << " -> " << output_size;
+    return false;
+  }
+  layer_config_.set_input_size(input_size);
+  layer_config_.set_output_size(output_size);
+  return true;
+}
+
+bool Pool2DLayer::InferShape(const std::vector<Shape>& inputs,
+                             Shape* output) const {
+  if (!Layer::InferShape(inputs, output)) {
+    return false;
+  }
+  const size_t input_size = layer_config_.input_size();
+  if (inputs[0].count(1) != input_size) {
+    LOG(ERROR) << "[" << layer_config_.name() << "] expects " << input_size
+               << " inputs, got " << inputs[0].ToString();
+    return false;
+  }
+  *output = {inputs[0][0], size_t(layer_config_.output_size())};
+  return true;
+}
+
+void Pool2DLayer::Rows(size_t oh, long* top, long* bottom) const {
+  const long y = long(oh * stride_) - long(padding_);
+  *top = std::max<long>(y, 0);
+  *bottom = std::min<long>(y + long(kernel_height_), long(height_));
+}
+
+bool MaxPool2DLayer::Load(const LayerConfig& config) {
+  if (!Pool2DLayer::Load(config)) {
+    return false;
+  }
+  const size_t window = kernel_height_ * kernel_width_;
+  if (window > 65536) {
+    LOG(ERROR) << "[" << config.name() << "] window of " << window
+               << " pixels exceeds 16-bit indices";
+    return false;
+  }
+  wide_ = window > 256;
+  return true;
+}
+
+template <typename Index>
+void MaxPool2DLayer::Pool(const Tensor<Float>& x, Float* y,
+                          Index* indices) const {
+  const size_t image = height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t planes = x.shape(0) * channels_;
+  const size_t cost = pixels * kernel_height_ * kernel_width_;
+  ParallelFor(0, planes, GrainSize(cost), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* plane = x.data() + i * image;
+      Float* out = y + i * pixels;
+      Index* index = indices + i * pixels;
+      for (size_t oh = 0; oh < out_height_; ++oh) {
+        Float* row = out + oh * out_width_;
+        Index* row_index = index + oh * out_width_;
+        const long y0 = long(oh * stride_) - long(padding_);
+        long top, bottom;
+        Rows(oh, &top, &bottom);
+        // Starts from the first pixel of the window inside the image, the
+        // first of equal maxima is kept.
+        for (size_t ow = 0; ow < out_width_; ++ow) {
+          const long x0 = long(ow * stride_) - long(padding_);
+          const long ix = std::max<long>(x0, 0);
+          row[ow] = plane[top * width_ + ix];
+          row_index[ow] = (top - y0) * kernel_width_ + (ix - x0);
+        }
+        for (long iy = top; iy < bottom; ++iy) {
+          const Float* src = plane + iy * width_;
+          for (size_t kj = 0; kj < kernel_width_; ++kj) {
+            const Index k = (iy - y0) * kernel_width_ + kj;
+            const long offset = long(kj) - long(padding_);
+            for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+              const Float v = src[long(ow * stride_) + offset];
+              if (v > row[ow]) {
+                row[ow] = v;
+                row_index[ow] = k;
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+template <typename Index>
+void MaxPool2DLayer::Unpool(const Tensor<Float>& dy, const Index* indices,
+                            Float* dx) const {
+  const size_t image = height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t planes = dy.shape(0) * channels_;
+  ParallelFor(0, planes, GrainSize(image), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* dout = dy.data() + i * pixels;
+      const Index* index = indices + i * pixels;
+      Float* dplane = dx + i * image;
+      std::fill(dplane, dplane + image, Float(0));
+      for (size_t p = 0; p < pixels; ++p) {
+        const size_t iy = p / out_width_ * stride_ +
+                          index[p] / kernel_width_ - padding_;
+        const size_t ix = p % out_width_ * stride_ +
+                          index[p] % kernel_width_ - padding_;
+        dplane[iy * width_ + ix] += dout[p];
+      }
+    }
+  });
+}
+
+void MaxPool2DLayer::Forward(const Context& ctx, const Variable& input,
+                             Variable* output) const {
+  const auto& x = input.data();
+  auto* y = output->mutable_data();
+  y->Resize({x.shape(0), size_t(layer_config_.output_size())});
+  auto* state = output->mutable_state();
+  const size_t bytes = y->size() * (wide_ ? sizeof(uint16_t) : 1);
+  if (state->size() < bytes) {
+    state->resize(bytes);
+  }
+  if (wide_) {
+    Pool(x, y->mutable_data(), reinterpret_cast<uint16_t*>(state->data()));
+  } else {
+    Pool(x, y->mutable_data(), state->data());
+  }
+}
+
+void MaxPool2DLayer::Backward(const Context& ctx, const Variable& output,
+                              Variable* input) {
+  if (!propagate_down(0)) {
+    return;
+  }
+  const auto& dy = output.grad();
+  const auto& state = output.state();
+  CHECK(state.size() >= dy.size() * (wide_ ? sizeof(uint16_t) : 1));
+  auto* dx = input->mutable_grad();
+  dx->Resize(input->data().shape());
+  if (wide_) {
+    Unpool(dy, reinterpret_cast<const uint16_t*>(state.data()),
+           dx->mutable_data());
+  } else {
+    Unpool(dy, state.data(), dx->mutable_data());
+  }
+}
+
+bool AvgPool2DLayer::Load(const LayerConfig& config) {
+  if (!Pool2DLayer::Load(config)) {
+    return false;
+  }
+  column_scales_.assign(out_width_, 0);
+  for (size_t kj = 0; kj < kernel_width_; ++kj) {
+    for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+      ++column_scales_[ow];
+    }
+  }
+  for (auto& scale : column_scales_) {
+    scale = 1 / scale;
+  }
+  return true;
+}
+
+void AvgPool2DLayer::Forward(const Context& ctx, const Variable& input,
+                             Variable* output) const {
+  const auto& x = input.data();
+  const size_t image = height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t planes = x.shape(0) * channels_;
+  auto* y = output->mutable_data();
+  y->Resize({x.shape(0), size_t(layer_config_.output_size())});
+  const size_t cost = pixels * kernel_height_ * kernel_width_;
+  ParallelFor(0, planes, GrainSize(cost), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* plane = x.data() + i * image;
+      Float* out = y->mutable_data() + i * pixels;
+      if (global()) {
+        // Independent lanes, so that the sum vectorizes.
+        Float sums[kLanes] = {0};
+        size_t p = 0;
+        for (; p + kLanes <= image; p += kLanes) {
+          for (size_t l = 0; l < kLanes; ++l) {
+            sums[l] += plane[p + l];
+          }
+        }
+        for (; p < image; ++p) {
+          sums[0] += plane[p];
+        }
+        Float sum = 0;
+        for (size_t l = 0; l < kLanes; ++l) {
+          sum += sums[l];
+        }
+        out[0] = sum / image;
+        continue;
+      }
+      std::fill(out, out + pixels, Float(0));
+      for (size_t oh = 0; oh < out_height_; ++oh) {
+        Float* row = out + oh * out_width_;
+        long top, bottom;
+        Rows(oh, &top, &bottom);
+        for (long iy = top; iy < bottom; ++iy) {
+          const Float* src = plane + iy * width_;
+          for (size_t kj = 0; kj < kernel_width_; ++kj) {
+            const long offset = long(kj) - long(padding_);
+            for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+              row[ow] += src[long(ow * stride_) + offset];
+            }
+          }
+        }
+        const Float scale = Float(1) / (bottom - top);
+        for (size_t ow = 0; ow < out_width_; ++ow) {
+          row[ow] *= scale * column_scales_[ow];
+        }
+      }
+    }
+  });
+}
+
+void AvgPool2DLayer::Backward(const Context& ctx, const Variable& output,
+                              Variable* input) {
+  if (!propagate_down(0)) {
+    return;
+  }
+  const auto& dy = output.grad();
+  const size_t image = height_ * width_;
+  const size_t pixels = out_height_ * out_width_;
+  const size_t planes = dy.shape(0) * channels_;
+  auto* dx = input->mutable_grad();
+  dx->Resize(input->data().shape());
+  const size_t cost = pixels * kernel_height_ * kernel_width_;
+  ParallelFor(0, planes, GrainSize(cost), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Float* dout = dy.data() + i * pixels;
+      Float* dplane = dx->mutable_data() + i * image;
+      if (global()) {
+        std::fill(dplane, dplane + image, dout[0] / image);
+        continue;
+      }
+      std::fill(dplane, dplane + image, Float(0));
+      for (size_t oh = 0; oh < out_height_; ++oh) {
+        const Float* drow = dout + oh * out_width_;
+        long top, bottom;
+        Rows(oh, &top, &bottom);
+        const Float scale = Float(1) / (bottom - top);
+        for (long iy = top; iy < bottom; ++iy) {
+          Float* dsrc = dplane + iy * width_;
+          for (size_t kj = 0; kj < kernel_width_; ++kj) {
+            const long offset = long(kj) - long(padding_);
+            for (size_t ow = first_[kj]; ow < last_[kj]; ++ow) {
+              dsrc[long(ow * stride_) + offset] +=
+                  drow[ow] * scale * column_scales_[ow];
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+REGISTER_LAYER(MaxPool2D);
+REGISTER_LAYER(AvgPool2D);
+REGISTER_LAYER(GlobalAvgPool2D);
+
+}  // namespace cola
@@ -0,0 +1,103 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COLA_LAYERS_POOL2D_LAYER_H_
+#define COLA_LAYERS_POOL2D_LAYER_H_
+
+#include "cola/layers/layer.h"
+
+namespace cola {
+
+// The shape of the pooling, see PoolConfig. Windows sweep whole rows of
+// output pixels, the span of a row that reads inside the image being
+// computed at load, so the inner loops have no bounds checks.
+class Pool2DLayer : public Layer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  bool InferShape(const std::vector<Shape>& inputs,
+                  Shape* output) const override;
+
+  bool row_wise() const override { return true; }
+
+ protected:
+  // Whether the window is the whole image, the config then only gives its
+  // shape.
+  virtual bool global() const { return false; }
+
+  // Input rows [top, bottom) of the window of output row `oh`.
+  void Rows(size_t oh, long* top, long* bottom) const;
+
+  size_t channels_;
+  size_t height_;
+  size_t width_;
+  size_t kernel_height_;
+  size_t kernel_width_;
+  size_t stride_;
+  size_t padding_;
+  size_t out_height_;
+  size_t out_width_;
+  // Output columns [first_[kj], last_[kj]) read inside the image at window
+  // column kj.
+  std::vector<size_t> first_;
+  std::vector<size_t> last_;
+};
+
+// Keeps the position of the maximum within its window for every output, as
+// uint8_t or as uint16_t for windows of more than 256 pixels, in the state of
+// the output variable.
+class MaxPool2DLayer : public Pool2DLayer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+ private:
+  template <typename Index>
+  void Pool(const Tensor<Float>& x, Float* y, Index* indices) const;
+
+  template <typename Index>
+  void Unpool(const Tensor<Float>& dy, const Index* indices, Float* dx) const;
+
+  bool wide_;
+};
+
+class AvgPool2DLayer : public Pool2DLayer {
+ public:
+  bool Load(const LayerConfig& config) override;
+
+  void Forward(const Context& ctx, const Variable& input,
+               Variable* output) const override;
+  void Backward(const Context& ctx, const Variable& output,
+                Variable* input) override;
+
+ private:
+  // Reciprocals of the in-image columns of the window of every output
+  // column.
+  std::vector<Float> column_scales_;
+};
+
+// AvgPool2D over the whole image, giving one value per channel.
+class GlobalAvgPool2DLayer : public AvgPool2DLayer {
+ protected:
+  bool global() const override { return true; }
+};
+
+}  // namespace cola
+
+#endif  // COLA_LAYERS_POOL2D_LAYER_H_
@@ -17,6 +17,7 @@
 #include "cola/layers/relu_layer.h"
 
 #include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
 
 namespace cola {
 
@@ -25,13 +26,15 @@ void ReluLayer::Forward(const Context& ctx, const Variable& input,
   const auto& x = input.data();
   auto* out = output->mutable_data();
   out->Resize(input.data().shape());
-  for (size_t i = 0; i < x.size(); ++i) {
-    if (x.data()[i] <= Float(0)) {
-      out->mutable_data()[i] = Float(0);
-    } else {
-      out->mutable_data()[i] = x.data()[i];
+  ParallelFor(0, x.size(), GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      if (x.data()[i] <= Float(0)) {
+        out->mutable_data()[i] = Float(0);
+      } else {
+        out->mutable_data()[i] = x.data()[i];
+      }
     }
-  }
+  });
 }
 
 void ReluLayer::Backward(const Context& ctx, const Variable& output,
@@ -40,13 +43,15 @@ void ReluLayer::Backward(const Context& ctx, const Variable& output,
   const auto& x = input->data();
   auto* dx = input->mutable_grad();
   dx->Resize(x.shape());
-  for (size_t i = 0; i < x.size(); ++i) {
-    if (x.data()[i] <= Float(0)) {
-      dx->mutable_data()[i] = Float(0);
-    } else {
-      dx->mutable_data()[i] = dout.data()[i];
+  ParallelFor(0, x.size(), GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      if (x.data()[i] <= Float(0)) {
+        dx->mutable_data()[i] = Float(0);
+      } else {
+        dx->mutable_data()[i] = dout.data()[i];
+      }
     }
-  }
+  });
 }
 
 REGISTER_LAYER(Relu);
@@ -17,6 +17,7 @@
 
 #include "cola/base/math_ops.h"
 #include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
 
 namespace cola {
 
@@ -34,10 +35,12 @@ void SigmoidLayer::Backward(const Context& ctx, const Variable& output,
   const auto& out = output.data();
   auto* dx = input->mutable_grad();
   dx->Resize(dout.shape());
-  for (size_t i = 0; i < out.size(); ++i) {
-    dx->mutable_data()[i] =
-        dout.data()[i] * out.data()[i] * (1 - out.data()[i]);
-  }
+  ParallelFor(0, out.size(), GrainSize(1), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      dx->mutable_data()[i] =
+          dout.data()[i] * out.data()[i] * (1 - out.data()[i]);
+    }
+  });
 }
 
 REGISTER_LAYER(Sigmoid);
@@ -17,6 +17,7 @@
 
 #include "cola/base/math_ops.h"
 #include "cola/base/registry.h"
+#include "cola/base/thread_pool.h"
 
 namespace cola {
 
@@ -36,20 +37,24 @@ void SoftmaxLayer::Backward(const Context& ctx, const Variable& output,
   dx->Resize(dout.shape());
   size_t batch_size = dout.shape(0);
   size_t count = dout.count(1);
-  for (size_t i = 0; i < batch_size; ++i) {
-    for (size_t j = 0; j < count; ++j) {
-      Float sum(0);
-      const Float softmax = -out.data()[i * count + j];
-      for (size_t k = 0; k < count; ++k) {
-        sum += dout.data()[i * count + k] * out.data()[i * count + k] * softmax;
+  const size_t grain = GrainSize(count * count);
+  ParallelFor(0, batch_size, grain, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      for (size_t j = 0; j < count; ++j) {
+        Float sum(0);
+        const Float softmax = -out.data()[i * count + j];
+        for (size_t k = 0; k < count; ++k) {
+          sum +=
+              dout.data()[i * count + k] * out.data()[i * count + k] * softmax;
+        }
+        dx->mutable_data()[i * count + j] = sum;
+      }
+      for (size_t j = 0; j < count; ++j) {
+        dx->mutable_data()[i * count + j] +=
+            out.data()[i * count + j] * dout.data()[i * count + j];
       }
-      dx->mutable_data()[i * count + j] = sum;
-    }
-    for (size_t j = 0; j < count; ++j) {
-      dx->mutable_data()[i * count + j] +=
-          out.data()[i * count + j] * dout.data()[i * count + j];
     }
-  }
+  });
 }
 
 REGISTER_LAYER(Softmax);
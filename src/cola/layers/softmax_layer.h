@@ -22,6 +22,8 @@ namespace cola {
 
 class SoftmaxLayer : public Layer {
  public:
+  bool row_wise() const override { return true; }
+
   void Forward(const Context& ctx, const Variable& input,
                Variable* output) const override;
 
@@ -54,7 +54,7 @@ void SoftmaxWithLossLayer::Backward(const Context& ctx, const Variable& output,
   auto* dx = input->mutable_grad();
   *dx = output.data();
   *dx -= ctx.session()->label();
-  *dx /= ctx.batch_size();
+  *dx *= ctx.session()->loss_scale() / ctx.batch_size();
 }
 
 void SoftmaxWithLossLayer::Snapshot(LayerConfig* config) const {
@@ -13,7 +13,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <errno.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <filesystem>
 #include <fstream>
@@ -23,6 +25,7 @@
 #include "cola/base/logging.h"
 #include "cola/base/tensor.h"
 #include "cola/base/types.h"
+#include "cola/core/compiler.h"
 #include "cola/predictor.h"
 #include "cola/proto/cola.pb.h"
 #include "cola/trainer.h"
@@ -32,6 +35,8 @@ struct Options {
   std::string config;
   std::string model;
   std::string input;
+  std::string output;
+  std::string layer;
 };
 
 static void Usage(const char* name, const char* msg, ...) {
@@ -45,12 +50,16 @@ static void Usage(const char* name, const char* msg, ...) {
     va_end(ap);
   }
   const char* fmt =
-      "Usage: %s [-p PHASE] [-c CONFIG] [-m MODEL] [-i INPUT]\n"
+      "Usage: %s [-p PHASE] [-c CONFIG] [-m MODEL] [-i INPUT] [-o OUTPUT]"
+      " [-l LAYER]\n"
       "Options:\n"
-      "   -p       phase: 'infer' or 'train'\n"
-      "   -c       config file path\n"
+      "   -p       phase: 'infer', 'train', 'compile' or 'extract'\n"
+      "   -c       config file path, optional at 'infer' and 'extract' phase\n"
       "   -m       model file path\n"
-      "   -i       input file path at 'infer' phase\n"
+      "   -i       input file path at 'infer' and 'extract' phase\n"
+      "   -o       C++ source path at 'compile' phase, output file path at\n"
+      "            'extract' phase\n"
+      "   -l       layer whose output is extracted, the last one if omitted\n"
       "   -h       show this help\n";
 
   fprintf(stderr, fmt, name);
@@ -81,6 +90,10 @@ static Options DoArgs(int argc, const char* argv[]) {
       options.input = parse(++i);
     } else if (std::string("-m") == argv[i]) {
       options.model = parse(++i);
+    } else if (std::string("-o") == argv[i]) {
+      options.output = parse(++i);
+    } else if (std::string("-l") == argv[i]) {
+      options.layer = parse(++i);
     } else if (std::string("-h") == argv[i]) {
       Usage(argv[0], nullptr);
     } else {
@@ -101,6 +114,16 @@ static Options DoArgs(int argc, const char* argv[]) {
     if (options.input.empty()) {
       Usage(argv[0], "required input path");
     }
+  } else if (options.phase == "compile" || options.phase == "extract") {
+    if (options.model.empty()) {
+      Usage(argv[0], "required model path");
+    }
+    if (options.phase == "extract" && options.input.empty()) {
+      Usage(argv[0], "required input path");
+    }
+    if (options.output.empty()) {
+      Usage(argv[0], "required output path");
+    }
   } else {
     Usage(argv[0], "unrecognized arg: %s", options.phase.c_str());
   }
@@ -119,9 +142,42 @@ int main(int argc, const char* argv[]) {
       return 1;
     }
     trainer.Train(options.model);
+  } else if (options.phase == "compile") {
+    cola::Compiler compiler;
+    if (!compiler.Load(options.model)) {
+      return 1;
+    }
+    std::ofstream ofs(options.output);
+    if (!ofs) {
+      LOG(ERROR) << "failed to open " << options.output << ": "
+                 << strerror(errno);
+      return 1;
+    }
+    if (!compiler.Emit("cola_model", &ofs) || !ofs.flush()) {
+      return 1;
+    }
+  } else if (options.phase == "extract") {
+    cola::Config config;
+    if (!options.config.empty() &&
+        !cola::ReadProtoTxt(options.config, &config)) {
+      return 1;
+    }
+    if (!options.layer.empty()) {
+      config.set_output_layer(options.layer);
+    }
+    cola::Predictor predictor;
+    if (!predictor.Load(options.model, config) ||
+        !predictor.Extract(options.input, options.output)) {
+      return 1;
+    }
   } else {
+    cola::Config config;
+    if (!options.config.empty() &&
+        !cola::ReadProtoTxt(options.config, &config)) {
+      return 1;
+    }
     cola::Predictor predictor;
-    if (!predictor.Load(options.model)) {
+    if (!predictor.Load(options.model, config)) {
       return 1;
     }
     std::string content;
@@ -135,7 +191,9 @@ int main(int argc, const char* argv[]) {
     }
     auto output = cola::Tensor<cola::Float>::Create({1, 10});
 
-    predictor.Predict(input, &output);
+    if (!predictor.Predict(input, &output)) {
+      return 1;
+    }
     for (size_t i = 0; i < output.size(); ++i) {
       std::cout << output.data()[i] << std::endl;
     }
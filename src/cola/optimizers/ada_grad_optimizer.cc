@@ -15,6 +15,8 @@
 
 #include "cola/optimizers/ada_grad_optimizer.h"
 
+#include <math.h>
+
 #include "cola/base/math_ops.h"
 
 namespace cola {
@@ -28,6 +30,10 @@ AdaGradOptimizer::AdaGradOptimizer(const std::vector<Weight*>& weights,
 void AdaGradOptimizer::Step() {
   for (size_t i = 0; i < weights_.size(); ++i) {
     auto* weight = weights_[i];
+    if (weight->sparse_grad()) {
+      SparseStep(weight, &square_sums_[i]);
+      continue;
+    }
     auto& temp = temps_[i];
     temp.Resize(weight->grad().shape(), 1);
     temp = weight->grad();
@@ -47,4 +53,23 @@ void AdaGradOptimizer::Step() {
   }
 }
 
+// Rows without gradient keep their sums and their values, so updating the
+// rows of the gradient alone is exact.
+void AdaGradOptimizer::SparseStep(Weight* weight, Tensor<Float>* square_sum) {
+  square_sum->Resize(weight->data().shape(), 0);
+  const size_t n = weight->data().count(1);
+  const auto& rows = weight->grad_rows();
+  const Float* grad = weight->grad().data();
+  Float* data = weight->mutable_data()->mutable_data();
+  for (size_t i = 0; i < rows.size(); ++i) {
+    Float* row = data + rows[i] * n;
+    Float* sum = square_sum->mutable_data() + rows[i] * n;
+    for (size_t j = 0; j < n; ++j) {
+      const Float g = grad[i * n + j];
+      sum[j] += g * g;
+      row[j] -= lr_ * g / (sqrt(sum[j]) + Float(1e-7));
+    }
+  }
+}
+
 }  // namespace cola
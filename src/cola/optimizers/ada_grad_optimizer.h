@@ -27,6 +27,8 @@ class AdaGradOptimizer : public Optimizer {
   void Step() override;
 
  private:
+  void SparseStep(Weight* weight, Tensor<Float>* square_sum);
+
   std::vector<Tensor<Float>> square_sums_;
   std::vector<Tensor<Float>> temps_;
 };
@@ -15,17 +15,26 @@
 
 #include "cola/optimizers/momentum_optimizer.h"
 
+#include <math.h>
+
 namespace cola {
 
 MomentumOptimizer::MomentumOptimizer(const std::vector<Weight*>& weights,
                                      Float lr, Float momentum)
     : Optimizer(weights, lr),
       momentum_(momentum),
-      velocities_(weights.size()) {}
+      velocities_(weights.size()),
+      steps_(0),
+      updated_(weights.size()) {}
 
 void MomentumOptimizer::Step() {
+  ++steps_;
   for (size_t i = 0; i < weights_.size(); ++i) {
     auto* weight = weights_[i];
+    if (weight->sparse_grad()) {
+      SparseStep(i);
+      continue;
+    }
     *weight->mutable_grad() *= lr_;
     auto& velocity = velocities_[i];
     velocity.Resize(weight->grad().shape(), 0);
@@ -35,4 +44,54 @@ void MomentumOptimizer::Step() {
   }
 }
 
+void MomentumOptimizer::SparseStep(size_t i) {
+  auto* weight = weights_[i];
+  auto& velocity = velocities_[i];
+  velocity.Resize(weight->data().shape(), 0);
+  updated_[i].resize(weight->data().shape(0), 0);
+  const size_t n = weight->data().count(1);
+  const auto& rows = weight->grad_rows();
+  const Float* grad = weight->grad().data();
+  Float* data = weight->mutable_data()->mutable_data();
+  for (size_t r = 0; r < rows.size(); ++r) {
+    CatchUp(i, rows[r], steps_ - 1);
+    Float* v = velocity.mutable_data() + rows[r] * n;
+    Float* w = data + rows[r] * n;
+    for (size_t j = 0; j < n; ++j) {
+      v[j] = v[j] * momentum_ - lr_ * grad[r * n + j];
+      w[j] += v[j];
+    }
+    updated_[i][rows[r]] = steps_;
+  }
+}
+
+void MomentumOptimizer::CatchUp(size_t i, size_t row, size_t step) {
+  const size_t skipped = step - updated_[i][row];
+  if (skipped == 0) {
+    return;
+  }
+  updated_[i][row] = step;
+  // Each skipped step scales the velocity by the momentum and adds it to
+  // the weight.
+  const Float decay = pow(momentum_, Float(skipped));
+  const Float sum = momentum_ == 1
+                        ? Float(skipped)
+                        : momentum_ * (1 - decay) / (1 - momentum_);
+  const size_t n = weights_[i]->data().count(1);
+  Float* v = velocities_[i].mutable_data() + row * n;
+  Float* w = weights_[i]->mutable_data()->mutable_data() + row * n;
+  for (size_t j = 0; j < n; ++j) {
+    w[j] += v[j] * sum;
+    v[j] *= decay;
+  }
+}
+
+void MomentumOptimizer::Flush() {
+  for (size_t i = 0; i < weights_.size(); ++i) {
+    for (size_t row = 0; row < updated_[i].size(); ++row) {
+      CatchUp(i, row, steps_);
+    }
+  }
+}
+
 }  // namespace cola
\ No newline at end of file
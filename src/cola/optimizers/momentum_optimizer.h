@@ -27,9 +27,20 @@ class MomentumOptimizer : public Optimizer {
 
   void Step() override;
 
+  void Flush() override;
+
  private:
+  void SparseStep(size_t i);
+
+  // Applies to `row` of weight `i` the steps from its last update to `step`,
+  // in which it had no gradient, all at once.
+  void CatchUp(size_t i, size_t row, size_t step);
+
   Float momentum_;
   std::vector<Tensor<Float>> velocities_;
+  size_t steps_;
+  // The step every row of a sparse weight was last updated at.
+  std::vector<std::vector<size_t>> updated_;
 };
 
 }  // namespace cola
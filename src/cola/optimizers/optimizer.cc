@@ -15,6 +15,8 @@
 
 #include "cola/optimizers/optimizer.h"
 
+#include <algorithm>
+
 #include "cola/base/logging.h"
 #include "cola/optimizers/ada_grad_optimizer.h"
 #include "cola/optimizers/momentum_optimizer.h"
@@ -27,6 +29,18 @@ Optimizer::Optimizer(const std::vector<Weight*>& weights, Float lr)
 
 Optimizer::~Optimizer() {}
 
+void Optimizer::ZeroGrad() {
+  for (auto* weight : weights_) {
+    if (weight->sparse_grad()) {
+      weight->ClearSparseGrad();
+      continue;
+    }
+    auto* grad = weight->mutable_grad();
+    std::fill(grad->mutable_data(), grad->mutable_data() + grad->size(),
+              Float(0));
+  }
+}
+
 Optimizer* Optimizer::Create(const OptimizerConfig& config,
                              const std::vector<Weight*>& weights) {
   if (config.type() == "sgd") {
@@ -30,8 +30,18 @@ class Optimizer {
 
   virtual ~Optimizer();
 
+  // Updates the weights by their gradients. Weights of sparse gradients, see
+  // Weight::sparse_grad(), only have the rows in the gradient updated, at a
+  // cost of the batch rather than of the weight.
   virtual void Step() = 0;
 
+  // Applies the updates Step deferred for the rows of sparse gradients it
+  // skipped, before the weights are read, e.g. tested or saved.
+  virtual void Flush() {}
+
+  // Clears the gradients, which layers add to in Backward.
+  void ZeroGrad();
+
   static Optimizer* Create(const OptimizerConfig& config,
                            const std::vector<Weight*>& weights);
 
@@ -22,6 +22,19 @@ SgdOptimizer::SgdOptimizer(const std::vector<Weight*>& weights, Float lr)
 
 void SgdOptimizer::Step() {
   for (auto* weight : weights_) {
+    if (weight->sparse_grad()) {
+      const size_t n = weight->data().count(1);
+      const auto& rows = weight->grad_rows();
+      const Float* grad = weight->grad().data();
+      Float* data = weight->mutable_data()->mutable_data();
+      for (size_t i = 0; i < rows.size(); ++i) {
+        Float* row = data + rows[i] * n;
+        for (size_t j = 0; j < n; ++j) {
+          row[j] -= lr_ * grad[i * n + j];
+        }
+      }
+      continue;
+    }
     *weight->mutable_grad() *= lr_;
     *weight->mutable_data() -= weight->grad();
   }
@@ -15,27 +15,242 @@
 
 #include "cola/predictor.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <fstream>
 
+#include "cola/base/logging.h"
+#include "cola/base/numa.h"
+#include "cola/base/thread_pool.h"
 #include "cola/proto/cola.pb.h"
 
 namespace cola {
 
-bool Predictor::Load(const std::string& model) {
+Predictor::~Predictor() {
+  if (!exits_.empty()) {
+    ReportExits();
+  }
+}
+
+bool Predictor::Load(const std::string& model, const Config& runtime) {
+  if (!numa::Init(runtime.numa())) {
+    return false;
+  }
+  numa::InitThread(0);
+  ThreadPool::Init(runtime.num_threads());
   NetworkConfig conf;
-  std::ifstream ifs(model, std::ios::binary);
-  return conf.ParseFromIstream(&ifs) && network_.Load(conf);
+  const bool stream = runtime.prefetch_depth() > 0;
+  // A cached plan is rewritten by the graph passes, the layer to extract
+  // may be gone from it.
+  if (!runtime.plan_cache().empty() && runtime.output_layer().empty()) {
+    plan_cache_.reset(new PlanCache(runtime.plan_cache()));
+    if (!plan_cache_->Open(model, &conf)) {
+      return false;
+    }
+  } else {
+    std::ifstream ifs(model, std::ios::binary);
+    if (!conf.ParseFromIstream(&ifs)) {
+      return false;
+    }
+  }
+  // The weights of a cached network are mapped unless streamed.
+  const bool hit = plan_cache_ && plan_cache_->hit();
+  conf.set_stream_weights(stream || hit);
+  conf.set_output_layer(runtime.output_layer());
+  extract_batch_size_ = std::max(runtime.extract_batch_size(), 1u);
+  // Extracted activations come from the requested layer only.
+  for (auto& layer : *conf.mutable_layer()) {
+    if (layer.type() != "ExitHead") {
+      continue;
+    }
+    auto* head = layer.mutable_exit_head();
+    if (!runtime.output_layer().empty()) {
+      head->set_threshold(0);
+    } else if (runtime.exit_threshold() > 0) {
+      head->set_threshold(runtime.exit_threshold());
+    }
+    if (head->threshold() > 0) {
+      exits_.emplace_back(layer.name(), 0);
+    }
+  }
+  if (!exits_.empty()) {
+    exits_.emplace_back("output", 0);
+  }
+  if (!network_.Load(conf)) {
+    return false;
+  }
+  if (hit && !stream) {
+    plan_cache_->Map(&network_);
+  } else if (plan_cache_ && !hit && !stream &&
+             runtime.output_layer().empty() &&
+             runtime.exit_threshold() <= 0) {
+    // Streamed weights are not in memory to be written, a rewritten network
+    // is not the plan of the model.
+    plan_cache_->Insert(&network_);
+  }
+  network_.Place(runtime.numa());
+  if (runtime.prefetch_depth() > 0) {
+    weight_stream_.reset(new WeightStream);
+    if (!weight_stream_->Open(&network_, runtime.prefetch_depth())) {
+      return false;
+    }
+    network_.set_weight_stream(weight_stream_.get());
+  }
+  return true;
 }
 
-void Predictor::Predict(const Tensor<Float>& input, Tensor<Float>* output) {
-  Context ctx;
+bool Predictor::Predict(const Tensor<Float>& input, Tensor<Float>* output) {
   Variable in;
   Float* input_data = const_cast<Float*>(input.data());
   *in.mutable_data() = Tensor<Float>::Create(input_data, input.shape());
   Variable out;
   Float* output_data = output->mutable_data();
   *out.mutable_data() = Tensor<Float>::Create(output_data, input.shape());
-  network_.Forward(ctx, in, &out);
+  if (!network_.Forward(ctx_, in, &out)) {
+    LOG(ERROR) << "[Predictor] " << ctx_.session()->error();
+    return false;
+  }
+  if (!exits_.empty()) {
+    const std::string& exit = ctx_.session()->exit();
+    for (auto& e : exits_) {
+      if (e.first == exit || &e == &exits_.back()) {
+        e.second += input.shape(0);
+        break;
+      }
+    }
+  }
+  // The output layer may produce fewer values than its input, e.g. Argmax.
+  const auto& y = out.data();
+  output->Resize(y.shape());
+  if (y.data() != output->data()) {
+    *output = y;
+  }
+  return true;
+}
+
+void Predictor::ReportExits() const {
+  size_t total = 0;
+  for (const auto& e : exits_) {
+    total += e.second;
+  }
+  std::string log;
+  char buf[128];
+  for (const auto& e : exits_) {
+    snprintf(buf, sizeof(buf), "%s%s: %zu rows (%.1f%%)",
+             log.empty() ? "" : ", ", e.first.c_str(), e.second,
+             total ? 100.0 * e.second / total : 0.0);
+    log += buf;
+  }
+  LOG(INFO) << "[EarlyExit] " << log;
+}
+
+bool Predictor::Extract(const std::string& input, const std::string& output) {
+  const size_t k = network_.input_size();
+  if (k == 0) {
+    LOG(ERROR) << "[Predictor] the input size of the network is unknown";
+    return false;
+  }
+  int in_fd = open(input.c_str(), O_RDONLY);
+  if (in_fd < 0) {
+    LOG(ERROR) << "[Predictor] failed to open " << input << ": "
+               << strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(in_fd, &st) != 0 || st.st_size % k != 0) {
+    LOG(ERROR) << "[Predictor] " << input << " is not made of rows of " << k
+               << " bytes";
+    close(in_fd);
+    return false;
+  }
+  const size_t rows = st.st_size / k;
+  const Byte* in = nullptr;
+  if (rows > 0) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (p == MAP_FAILED) {
+      LOG(ERROR) << "[Predictor] failed to map " << input << ": "
+                 << strerror(errno);
+      close(in_fd);
+      return false;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    in = static_cast<const Byte*>(p);
+  }
+  close(in_fd);
+  int out_fd = open(output.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    LOG(ERROR) << "[Predictor] failed to open " << output << ": "
+               << strerror(errno);
+    munmap(const_cast<Byte*>(in), st.st_size);
+    return false;
+  }
+
+  // The output rows are written in place once the first batch tells their
+  // width.
+  Float* out = nullptr;
+  size_t n = 0;
+  size_t out_bytes = 0;
+  bool ok = true;
+  Variable x;
+  Variable y;
+  for (size_t begin = 0; begin < rows && ok; begin += extract_batch_size_) {
+    const size_t m = std::min(extract_batch_size_, rows - begin);
+    auto* data = x.mutable_data();
+    data->Resize({m, k});
+    const Byte* src = in + begin * k;
+    Float* dst = data->mutable_data();
+    for (size_t i = 0; i < m * k; ++i) {
+      dst[i] = src[i];
+    }
+    if (out) {
+      *y.mutable_data() = Tensor<Float>::Create(out + begin * n, {m, n});
+    }
+    if (!network_.Forward(ctx_, x, &y)) {
+      LOG(ERROR) << "[Predictor] " << ctx_.session()->error();
+      ok = false;
+      break;
+    }
+    if (!out) {
+      n = y.data().count(1);
+      out_bytes = rows * n * sizeof(Float);
+      void* p = MAP_FAILED;
+      if (ftruncate(out_fd, out_bytes) == 0) {
+        p = mmap(nullptr, out_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 out_fd, 0);
+      }
+      if (p == MAP_FAILED) {
+        LOG(ERROR) << "[Predictor] failed to map " << output << ": "
+                   << strerror(errno);
+        ok = false;
+        break;
+      }
+      out = static_cast<Float*>(p);
+    }
+    CHECK_EQ(y.data().size(), m * n);
+    Float* rows_out = out + begin * n;
+    if (y.data().data() != rows_out) {
+      memcpy(rows_out, y.data().data(), m * n * sizeof(Float));
+    }
+  }
+  if (out) {
+    munmap(out, out_bytes);
+  }
+  close(out_fd);
+  if (in) {
+    munmap(const_cast<Byte*>(in), st.st_size);
+  }
+  if (ok) {
+    LOG(INFO) << "[Predictor] extracted " << rows << " rows of " << n
+              << " values to " << output;
+  }
+  return ok;
 }
 
 }  // namespace cola
@@ -16,22 +16,53 @@
 #ifndef COLA_PREDICTOR_H_
 #define COLA_PREDICTOR_H_
 
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "cola/base/tensor.h"
 #include "cola/base/types.h"
 #include "cola/core/network.h"
+#include "cola/core/plan_cache.h"
+#include "cola/core/weight_stream.h"
 
 namespace cola {
 
 class Predictor {
  public:
-  bool Load(const std::string& model);
+  ~Predictor();
 
-  void Predict(const Tensor<Float>& input, Tensor<Float>* output);
+  bool Load(const std::string& model, const Config& runtime = Config());
+
+  // Logs and returns false if the network failed on the batch.
+  bool Predict(const Tensor<Float>& input, Tensor<Float>* output);
+
+  // Runs the rows of bytes of file `input`, input_size() bytes each, through
+  // the network in batches and writes the rows of its output to file
+  // `output` through a shared mapping. With Config.output_layer these are
+  // the activations of that layer, e.g. embeddings.
+  bool Extract(const std::string& input, const std::string& output);
+
+  size_t input_size() const { return network_.input_size(); }
+
+  // Rows answered by every ExitHead, in the order of the model, and by the
+  // output of the network, last.
+  const std::vector<std::pair<std::string, size_t>>& exits() const {
+    return exits_;
+  }
+
+  // Logs the share of the rows answered at every exit.
+  void ReportExits() const;
 
  private:
+  Context ctx_;
+  // Declared first, the network may use the weights it maps.
+  std::unique_ptr<PlanCache> plan_cache_;
   Network network_;
+  std::unique_ptr<WeightStream> weight_stream_;
+  size_t extract_batch_size_ = 0;
+  std::vector<std::pair<std::string, size_t>> exits_;
 };
 
 }  // namespace cola
@@ -17,22 +17,61 @@
 
 #include <fstream>
 
+#include "cola/base/alloc_counter.h"
 #include "cola/base/io_util.h"
 #include "cola/base/logging.h"
+#include "cola/base/numa.h"
+#include "cola/base/thread_pool.h"
+#include "cola/core/weight_stream.h"
 #include "cola/optimizers/optimizer.h"
 
 namespace cola {
 
-Trainer::Trainer() : max_iter_(0), test_interval_(0), optimizer_(nullptr) {}
+Trainer::Trainer()
+    : max_iter_(0),
+      test_interval_(0),
+      accumulation_steps_(1),
+      alloc_check_warmup_(0),
+      optimizer_(nullptr) {}
 
 bool Trainer::Load(const Config& conf) {
+  if (!numa::Init(conf.numa())) {
+    return false;
+  }
+  numa::InitThread(0);
+  ThreadPool::Init(conf.num_threads());
   cola::NetworkConfig net_conf;
   if (!ReadProtoTxt(conf.network(), &net_conf) || !network_.Load(net_conf)) {
     return false;
   }
+  network_.Place(conf.numa());
 
   max_iter_ = conf.max_iter();
   test_interval_ = conf.test_interval();
+  accumulation_steps_ = conf.accumulation_steps();
+  if (accumulation_steps_ == 0) {
+    LOG(ERROR) << "accumulation_steps must be positive";
+    return false;
+  }
+  alloc_check_ = conf.alloc_check();
+  alloc_check_warmup_ = conf.alloc_check_warmup();
+  weight_file_ = conf.weight_file();
+  if (alloc_check_ != "off" && alloc_check_ != "log" &&
+      alloc_check_ != "fatal") {
+    LOG(ERROR) << "unknown alloc_check: " << alloc_check_;
+    return false;
+  }
+  if (alloc_check_ != "off" && !AllocCounting()) {
+    LOG(ERROR) << "alloc_check needs a build defining COLA_ALLOC_COUNTER";
+    return false;
+  }
+
+  if (conf.pipeline().stages() > 1) {
+    pipeline_.reset(new Pipeline(&network_));
+    if (!pipeline_->Load(conf.pipeline(), accumulation_steps_)) {
+      return false;
+    }
+  }
 
   std::vector<Weight*> weights = network_.GetWeights();
   optimizer_ = Optimizer::Create(conf.optimizer(), weights);
@@ -41,22 +80,55 @@ bool Trainer::Load(const Config& conf) {
 
 void Trainer::Train(const std::string& model) {
   Context ctx;
+  // The mean of the summed micro-batch gradients.
+  ctx.session()->set_loss_scale(Float(1) / accumulation_steps_);
   Variable input;
   Variable output;
   size_t epoch = 0;
+  optimizer_->ZeroGrad();
   for (size_t i = 0; i < max_iter_; ++i) {
-    network_.Forward(ctx, input, &output);
-    network_.Backward(ctx, output, &input);
+    AllocCounter counter;
+    if (pipeline_) {
+      if (!pipeline_->Run()) {
+        LOG(ERROR) << "[Trainer] iter: " << i
+                   << ", failed micro-batches skipped";
+      }
+    } else {
+      for (size_t j = 0; j < accumulation_steps_; ++j) {
+        ctx.session()->set_step(i * accumulation_steps_ + j);
+        // A micro-batch the network fails on adds no gradient.
+        if (!network_.Forward(ctx, input, &output)) {
+          LOG(ERROR) << "[Trainer] iter: " << i << ", "
+                     << ctx.session()->error();
+          continue;
+        }
+        network_.Backward(ctx, output, &input);
+      }
+    }
     optimizer_->Step();
+    optimizer_->ZeroGrad();
+    if (alloc_check_ != "off" && i >= alloc_check_warmup_) {
+      AllocStats stats = counter.Delta();
+      if (stats.count != 0) {
+        LOG(WARNING) << "iter: " << i << ", allocs: " << stats.count
+                     << ", bytes: " << stats.bytes;
+        CHECK(alloc_check_ != "fatal");
+      }
+    }
     if (i % test_interval_ == 0) {  // Epoch
       ++epoch;
+      optimizer_->Flush();
       Float acc = network_.Accuracy(ctx);
       LOG(INFO) << "iter: " << i << ", epoch: " << epoch << ", acc: " << acc;
     }
   }
 
+  optimizer_->Flush();
   NetworkConfig nc;
   network_.Snapshot(&nc);
+  if (!weight_file_.empty() && !WeightStream::Externalize(weight_file_, &nc)) {
+    return;
+  }
   std::ofstream os(model, std::ios::binary);
   nc.SerializeToOstream(&os);
 }
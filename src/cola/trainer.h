@@ -16,7 +16,10 @@
 #ifndef COLA_TRAINER_HPP_
 #define COLA_TRAINER_HPP_
 
+#include <memory>
+
 #include "cola/core/network.h"
+#include "cola/core/pipeline.h"
 #include "cola/core/variable.h"
 #include "cola/proto/cola.pb.h"
 
@@ -33,9 +36,14 @@ class Trainer {
  private:
   size_t max_iter_;
   size_t test_interval_;
+  size_t accumulation_steps_;
+  std::string alloc_check_;
+  size_t alloc_check_warmup_;
+  std::string weight_file_;
 
   Network network_;
   Optimizer* optimizer_;
+  std::unique_ptr<Pipeline> pipeline_;
 };
 
 }  // namespace cola
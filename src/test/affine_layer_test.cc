@@ -15,10 +15,15 @@
 
 #include "cola/layers/affine_layer.h"
 
+#include <math.h>
+
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 #include "cola/proto/cola.pb.h"
 #include "test/test.h"
+#include "test/test_util.h"
 
 namespace cola {
   #if 0
@@ -77,4 +82,124 @@ TEST(AffineTest, ForwardAndBackward) {
   std::cout << b.grad().ToString() << std::endl;
 }
 #endif
+
+class AffineLayerTest {};
+
+static LayerConfig CreateAffine(size_t input_size, size_t output_size) {
+  NetworkConfig conf;
+  return *test::AddAffine(&conf, "affine", input_size, output_size, "", 1, 1);
+}
+
+TEST(AffineLayerTest, Shards) {
+  const size_t k = 5;
+  const size_t n = 7;
+  for (const std::string axis : {"column", "row"}) {
+    LayerConfig config = CreateAffine(k, n);
+    AffineLayer whole;
+    ASSERT_TRUE(whole.Load(config));
+    config.mutable_affine()->set_shards(3);
+    config.mutable_affine()->set_shard_axis(axis);
+    AffineLayer sharded;
+    ASSERT_TRUE(sharded.Load(config));
+    ASSERT_EQ(sharded.GetWeights().size(), axis == "row" ? 4u : 6u);
+
+    Context ctx;
+    Variable x;
+    *x.mutable_data() = Tensor<Float>::Randn({4, k});
+    Variable y;
+    *y.mutable_data() = x.data();
+    Variable out1;
+    Variable out2;
+    whole.Forward(ctx, x, &out1);
+    sharded.Forward(ctx, y, &out2);
+    ASSERT_TRUE(out2.data().shape() == out1.data().shape());
+    for (size_t i = 0; i < out1.data().size(); ++i) {
+      ASSERT_LT(fabs(out1.data().data()[i] - out2.data().data()[i]), 1e-5);
+    }
+
+    for (auto* layer : {&whole, &sharded}) {
+      for (auto* weight : layer->GetWeights()) {
+        auto* grad = weight->mutable_grad();
+        std::fill(grad->mutable_data(), grad->mutable_data() + grad->size(),
+                  Float(0));
+      }
+    }
+    *out1.mutable_grad() = Tensor<Float>::Randn({4, n});
+    *out2.mutable_grad() = out1.grad();
+    whole.Backward(ctx, out1, &x);
+    sharded.Backward(ctx, out2, &y);
+    for (size_t i = 0; i < x.grad().size(); ++i) {
+      ASSERT_LT(fabs(x.grad().data()[i] - y.grad().data()[i]), 1e-5);
+    }
+
+    // Merged back, the shards and their gradients match the whole layer.
+    for (auto* weight : sharded.GetWeights()) {
+      *weight->mutable_data() = weight->grad();
+    }
+    for (auto* weight : whole.GetWeights()) {
+      *weight->mutable_data() = weight->grad();
+    }
+    LayerConfig grads1;
+    LayerConfig grads2;
+    whole.Snapshot(&grads1);
+    sharded.Snapshot(&grads2);
+    auto same = [](const WeightConfig& a, const WeightConfig& b) {
+      ASSERT_EQ(a.data().size(), b.data().size());
+      const Float* p = reinterpret_cast<const Float*>(a.data().data());
+      const Float* q = reinterpret_cast<const Float*>(b.data().data());
+      for (size_t i = 0; i < a.data().size() / sizeof(Float); ++i) {
+        ASSERT_LT(fabs(p[i] - q[i]), 1e-5);
+      }
+    };
+    same(grads1.affine().weight(), grads2.affine().weight());
+    same(grads1.affine().bias(), grads2.affine().bias());
+  }
+}
+
+// Concurrent requests on their own contexts share the layer.
+TEST(AffineLayerTest, ConcurrentShards) {
+  const size_t k = 6;
+  const size_t n = 5;
+  for (const std::string axis : {"column", "row"}) {
+    LayerConfig config = CreateAffine(k, n);
+    AffineLayer whole;
+    ASSERT_TRUE(whole.Load(config));
+    config.mutable_affine()->set_shards(2);
+    config.mutable_affine()->set_shard_axis(axis);
+    AffineLayer sharded;
+    ASSERT_TRUE(sharded.Load(config));
+
+    // The rows differ by thread, so that mixed up workspaces show.
+    std::vector<Variable> inputs(2);
+    std::vector<Variable> expected(2);
+    for (size_t t = 0; t < 2; ++t) {
+      *inputs[t].mutable_data() = Tensor<Float>::Randn({8 + t, k});
+      Context ctx;
+      whole.Forward(ctx, inputs[t], &expected[t]);
+    }
+    bool same[2] = {true, true};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 2; ++t) {
+      threads.emplace_back([&, t] {
+        Context ctx;
+        Variable output;
+        for (int iter = 0; iter < 200; ++iter) {
+          sharded.Forward(ctx, inputs[t], &output);
+          const auto& y = output.data();
+          const auto& z = expected[t].data();
+          same[t] = same[t] && y.size() == z.size();
+          for (size_t i = 0; same[t] && i < y.size(); ++i) {
+            same[t] = fabs(y.data()[i] - z.data()[i]) < 1e-5;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ASSERT_TRUE(same[0]);
+    ASSERT_TRUE(same[1]);
+  }
+}
+
 }  // namespace cola
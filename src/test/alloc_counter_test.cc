@@ -0,0 +1,147 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/alloc_counter.h"
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cola/core/network.h"
+#include "cola/optimizers/optimizer.h"
+#include "cola/proto/cola.pb.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class AllocCounterTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+using test::AddTrainPhase;
+using test::WriteFile;
+
+// Over-aligned, so allocated by the aligned operator new.
+struct alignas(64) CacheLine {
+  char bytes[64];
+};
+
+TEST(AllocCounterTest, CountAllocs) {
+  ASSERT_TRUE(AllocCounting());
+  AllocCounter counter;
+  std::vector<int>* v = new std::vector<int>(16);
+  AllocStats stats = counter.Delta();
+  ASSERT_TRUE(stats.count > 0);
+  ASSERT_GE(stats.bytes, sizeof(int) * 16);
+  delete v;
+
+  counter.Reset();
+  std::vector<CacheLine>* lines = new std::vector<CacheLine>(2);
+  ASSERT_TRUE(counter.Delta().count > 0);
+  ASSERT_GE(counter.Delta().bytes, 2 * sizeof(CacheLine));
+  delete lines;
+
+  counter.Reset();
+  int a[16] = {0};
+  a[1] = a[0] + 1;
+  ASSERT_EQ(counter.Delta().count, 0u);
+}
+
+TEST(AllocCounterTest, SteadyStateForward) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 8, 8, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 8, 8, "softmax");
+  AddLayer(&conf, "softmax", "Softmax", "");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Ones({4, 8});
+  Variable output;
+  network.Forward(ctx, input, &output);  // Warm-up.
+
+  AllocCounter counter;
+  for (int i = 0; i < 3; ++i) {
+    network.Forward(ctx, input, &output);
+  }
+  ASSERT_EQ(counter.Delta().count, 0u);
+}
+
+// A training iteration as the trainer runs it.
+TEST(AllocCounterTest, SteadyStateStep) {
+  const std::string data_path = "/tmp/cola_alloc_counter_test_data";
+  const std::string label_path = "/tmp/cola_alloc_counter_test_label";
+  std::string data;
+  std::string labels;
+  for (int i = 0; i < 12; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      data.push_back(char(i * 16 + j));
+    }
+    labels.push_back(char(i % 8));
+  }
+  WriteFile(data_path, 16, data);
+  WriteFile(label_path, 8, labels);
+
+  NetworkConfig conf;
+  conf.set_phase("train");
+  auto* data_layer = AddLayer(&conf, "data0", "Data", "affine1");
+  data_layer->clear_phases();
+  data_layer->add_phases("train");
+  auto* data_set = data_layer->mutable_data_set();
+  data_set->set_batch_size(4);
+  data_set->set_data_path(data_path);
+  data_set->set_data_block(8);
+  data_set->set_label_path(label_path);
+  data_set->set_label_block(1);
+  AddAffine(&conf, "affine1", 8, 8, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 8, 8, "loss");
+  AddLayer(&conf, "loss", "SoftmaxWithLoss", "");
+  AddTrainPhase(&conf);
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  for (const char* type : {"sgd", "momentum", "ada_grad"}) {
+    OptimizerConfig optimizer_conf;
+    optimizer_conf.set_type(type);
+    optimizer_conf.set_lr(0.1);
+    std::unique_ptr<Optimizer> optimizer(
+        Optimizer::Create(optimizer_conf, network.GetWeights()));
+    Context ctx;
+    Variable input;
+    Variable output;
+    optimizer->ZeroGrad();
+    for (int i = 0; i < 5; ++i) {
+      AllocCounter counter;
+      network.Forward(ctx, input, &output);
+      network.Backward(ctx, output, &input);
+      optimizer->Step();
+      optimizer->ZeroGrad();
+      // Warm-up.
+      if (i >= 2) {
+        ASSERT_EQ(counter.Delta().count, 0u);
+      }
+    }
+  }
+  remove(data_path.c_str());
+  remove(label_path.c_str());
+}
+
+}  // namespace cola
@@ -0,0 +1,152 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/batch_norm_layer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "cola/base/alloc_counter.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class BatchNormTest {};
+
+using test::SetValues;
+
+// Sum of the output weighted by `r`.
+static Float WeightedSum(const Variable& output, const Tensor<Float>& r) {
+  Float sum = 0;
+  for (size_t i = 0; i < r.size(); ++i) {
+    sum += output.data().data()[i] * r.data()[i];
+  }
+  return sum;
+}
+
+// 3 channels of 4 values per row.
+TEST(BatchNormTest, TrainAndInfer) {
+  const size_t C = 3, S = 4, M = 5;
+  const std::vector<Float> gamma = {1.5, 0.5, 2};
+  const std::vector<Float> beta = {0.1, -0.2, 0.3};
+  LayerConfig config;
+  config.set_name("bn");
+  config.set_type("BatchNorm");
+  config.set_input_size(C * S);
+  auto* bn = config.mutable_batch_norm();
+  bn->set_channels(C);
+  bn->set_momentum(0.5);
+  SetValues(bn->mutable_scale(), gamma);
+  SetValues(bn->mutable_shift(), beta);
+  BatchNormLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+
+  Context ctx;
+  ctx.session()->set_phase(kTrain);
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({M, C * S});
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  const Float* x = input.data().data();
+  const Float* y = output.data().data();
+  std::vector<Float> mean(C, 0), variance(C, 0);
+  for (size_t c = 0; c < C; ++c) {
+    Float sum = 0, squares = 0;
+    for (size_t i = 0; i < M; ++i) {
+      for (size_t s = 0; s < S; ++s) {
+        sum += x[i * C * S + c * S + s];
+      }
+    }
+    mean[c] = sum / (M * S);
+    for (size_t i = 0; i < M; ++i) {
+      for (size_t s = 0; s < S; ++s) {
+        const Float d = x[i * C * S + c * S + s] - mean[c];
+        squares += d * d;
+      }
+    }
+    variance[c] = squares / (M * S);
+    for (size_t i = 0; i < M; ++i) {
+      for (size_t s = 0; s < S; ++s) {
+        const size_t k = i * C * S + c * S + s;
+        const Float expected =
+            (x[k] - mean[c]) / sqrt(variance[c] + 1e-5) * gamma[c] + beta[c];
+        ASSERT_LT(fabs(y[k] - expected), 1e-4);
+      }
+    }
+  }
+
+  // Against the numeric gradient of a weighted sum of the output.
+  auto r = Tensor<Float>::Randn({M, C * S});
+  *output.mutable_grad() = r;
+  auto weights = layer.GetWeights();
+  *weights[0]->mutable_grad() = Tensor<Float>::Zeros({C});
+  *weights[1]->mutable_grad() = Tensor<Float>::Zeros({C});
+  layer.Backward(ctx, output, &input);
+  const Float h = 1e-2;
+  for (size_t k = 0; k < M * C * S; ++k) {
+    Variable plus, minus;
+    *plus.mutable_data() = input.data();
+    *minus.mutable_data() = input.data();
+    plus.mutable_data()->mutable_data()[k] += h;
+    minus.mutable_data()->mutable_data()[k] -= h;
+    Variable out;
+    layer.Forward(ctx, plus, &out);
+    const Float f1 = WeightedSum(out, r);
+    layer.Forward(ctx, minus, &out);
+    const Float f0 = WeightedSum(out, r);
+    ASSERT_LT(fabs((f1 - f0) / (2 * h) - input.grad().data()[k]), 1e-2);
+  }
+  for (size_t c = 0; c < C; ++c) {
+    Float dgamma = 0, dbeta = 0;
+    for (size_t i = 0; i < M; ++i) {
+      for (size_t s = 0; s < S; ++s) {
+        const size_t k = i * C * S + c * S + s;
+        dgamma += r.data()[k] * (x[k] - mean[c]) / sqrt(variance[c] + 1e-5);
+        dbeta += r.data()[k];
+      }
+    }
+    ASSERT_LT(fabs(weights[0]->grad().data()[c] - dgamma), 1e-3);
+    ASSERT_LT(fabs(weights[1]->grad().data()[c] - dbeta), 1e-3);
+  }
+
+  // At inference the running averages normalize, which were updated by
+  // every Forward above with the statistics of batches near this one.
+  LayerConfig saved;
+  layer.Snapshot(&saved);
+  std::vector<Float> running(2 * C);
+  memcpy(running.data(), saved.batch_norm().mean().data().data(),
+         C * sizeof(Float));
+  memcpy(running.data() + C, saved.batch_norm().variance().data().data(),
+         C * sizeof(Float));
+  for (size_t c = 0; c < C; ++c) {
+    ASSERT_LT(fabs(running[c] - mean[c]), 0.05);
+  }
+  ctx.session()->set_phase(kInfer);
+  layer.Forward(ctx, input, &output);
+  // The factors and offsets live in the output's state, so a second
+  // inference allocates nothing.
+  AllocCounter counter;
+  layer.Forward(ctx, input, &output);
+  ASSERT_EQ(counter.Delta().count, 0u);
+  for (size_t k = 0; k < M * C * S; ++k) {
+    const size_t c = k % (C * S) / S;
+    const Float expected =
+        (x[k] - running[c]) / sqrt(running[C + c] + 1e-5) * gamma[c] + beta[c];
+    ASSERT_LT(fabs(output.data().data()[k] - expected), 1e-4);
+  }
+}
+
+}  // namespace cola
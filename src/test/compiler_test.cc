@@ -0,0 +1,135 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/compiler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class CompilerTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+
+// Runs the generated model on the rows of argv[1] and writes the outputs to
+// argv[2].
+static const char kDriver[] = R"(
+#include <stdio.h>
+
+#include <vector>
+
+namespace cola_model {
+extern const size_t kInputSize, kOutputSize;
+void Infer(const float* input, size_t batch, float* output);
+}  // namespace cola_model
+
+int main(int argc, char* argv[]) {
+  using namespace cola_model;
+  FILE* in = fopen(argv[1], "rb");
+  std::vector<float> x;
+  float v;
+  while (fread(&v, sizeof(v), 1, in) == 1) {
+    x.push_back(v);
+  }
+  fclose(in);
+  const size_t batch = x.size() / kInputSize;
+  std::vector<float> y(batch * kOutputSize);
+  Infer(x.data(), batch, y.data());
+  FILE* out = fopen(argv[2], "wb");
+  fwrite(y.data(), sizeof(float), y.size(), out);
+  fclose(out);
+  return 0;
+}
+)";
+
+//   input -> affine1 -> relu1 -> add1 -> affine2 -> softmax1
+//                   \-> sigmoid1 -^
+TEST(CompilerTest, SameOutputs) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 6, "relu1");
+  conf.mutable_layer(0)->add_outputs("sigmoid1");
+  AddLayer(&conf, "relu1", "Relu", "add1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid", "add1");
+  AddLayer(&conf, "add1", "Add", "affine2");
+  AddAffine(&conf, "affine2", 6, 5, "softmax1");
+  AddLayer(&conf, "softmax1", "Softmax");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Compiler compiler;
+  ASSERT_TRUE(compiler.Load(conf));
+
+  const std::string prefix = "/tmp/cola_compiler_test";
+  const std::string model = prefix + "_model.cc";
+  const std::string driver = prefix + "_driver.cc";
+  const std::string binary = prefix + "_bin";
+  const std::string input_path = prefix + "_input";
+  const std::string output_path = prefix + "_output";
+  {
+    std::ofstream ofs(model);
+    ASSERT_TRUE(compiler.Emit("cola_model", &ofs));
+    std::ofstream(driver) << kDriver;
+  }
+  const char* cxx = getenv("CXX");
+  const std::string build = std::string(cxx ? cxx : "c++") +
+                            " -std=c++17 -o " + binary + " " + model + " " +
+                            driver;
+  ASSERT_EQ(system(build.c_str()), 0);
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({7, 4});
+  Variable expected;
+  network.Forward(ctx, input, &expected);
+  FILE* f = fopen(input_path.c_str(), "wb");
+  fwrite(input.data().data(), sizeof(Float), input.data().size(), f);
+  fclose(f);
+  const std::string run = binary + " " + input_path + " " + output_path;
+  ASSERT_EQ(system(run.c_str()), 0);
+  std::vector<Float> output(expected.data().size() + 1);
+  f = fopen(output_path.c_str(), "rb");
+  ASSERT_EQ(fread(output.data(), sizeof(Float), output.size(), f),
+            expected.data().size());
+  fclose(f);
+  for (size_t i = 0; i < expected.data().size(); ++i) {
+    ASSERT_LT(fabs(output[i] - expected.data().data()[i]), 1e-5);
+  }
+  for (const auto& path : {model, driver, binary, input_path, output_path}) {
+    remove(path.c_str());
+  }
+}
+
+TEST(CompilerTest, UnknownInputSize) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddLayer(&conf, "relu1", "Relu", "softmax1");
+  AddLayer(&conf, "softmax1", "Softmax");
+  Compiler compiler;
+  ASSERT_TRUE(compiler.Load(conf));
+  std::ofstream ofs("/dev/null");
+  ASSERT_TRUE(!compiler.Emit("cola_model", &ofs));
+}
+
+}  // namespace cola
@@ -0,0 +1,278 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/conv2d_layer.h"
+
+#include <math.h>
+
+#include "cola/base/alloc_counter.h"
+#include "cola/base/thread_pool.h"
+#include "cola/core/network.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class Conv2DTest {};
+
+using test::SetData;
+
+// 4 x 7 x 6 images, 6 filters of 3 x 3 dilated by 2, stride 2, padding 1
+// and 2 groups, giving 3 x 2 outputs. Tiles of 4 pixels, the last partial.
+TEST(Conv2DTest, SameAsDirect) {
+  const size_t C = 4, H = 7, W = 6, F = 6, K = 3, S = 2, P = 1, D = 2, G = 2;
+  const size_t OH = 3, OW = 2, M = 2;
+  LayerConfig config;
+  config.set_name("conv");
+  config.set_type("Conv2D");
+  auto* conv = config.mutable_conv();
+  conv->set_channels(C);
+  conv->set_height(H);
+  conv->set_width(W);
+  conv->set_filters(F);
+  conv->set_kernel(K);
+  conv->set_stride(S);
+  conv->set_padding(P);
+  conv->set_dilation(D);
+  conv->set_groups(G);
+  conv->set_tile_pixels(4);
+  const size_t cols = C / G * K * K;
+  SetData(conv->mutable_weight(), {F, cols}, 1);
+  SetData(conv->mutable_bias(), {F}, 2);
+  Conv2DLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+  ASSERT_EQ(layer.layer_config().input_size(), C * H * W);
+  ASSERT_EQ(layer.layer_config().output_size(), F * OH * OW);
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({M, C * H * W});
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().size(), M * F * OH * OW);
+  *output.mutable_grad() = Tensor<Float>::Randn(output.data().shape());
+  auto weights = layer.GetWeights();
+  *weights[0]->mutable_grad() = Tensor<Float>::Zeros({F, cols});
+  *weights[1]->mutable_grad() = Tensor<Float>::Zeros({F});
+  layer.Backward(ctx, output, &input);
+
+  const Float* x = input.data().data();
+  const Float* w = weights[0]->data().data();
+  const Float* b = weights[1]->data().data();
+  const Float* dy = output.grad().data();
+  std::vector<Float> y(M * F * OH * OW);
+  std::vector<Float> dx(M * C * H * W, 0);
+  std::vector<Float> dw(F * cols, 0);
+  std::vector<Float> db(F, 0);
+  for (size_t n = 0; n < M; ++n) {
+    for (size_t f = 0; f < F; ++f) {
+      const size_t g = f / (F / G);
+      for (size_t p = 0; p < OH * OW; ++p) {
+        const size_t o = (n * F + f) * OH * OW + p;
+        y[o] = b[f];
+        db[f] += dy[o];
+        for (size_t c = 0; c < C / G; ++c) {
+          for (size_t ki = 0; ki < K; ++ki) {
+            for (size_t kj = 0; kj < K; ++kj) {
+              const long i = long(p / OW * S + ki * D) - long(P);
+              const long j = long(p % OW * S + kj * D) - long(P);
+              if (i < 0 || i >= long(H) || j < 0 || j >= long(W)) {
+                continue;
+              }
+              const size_t xi = ((n * C + g * C / G + c) * H + i) * W + j;
+              const size_t wi = f * cols + (c * K + ki) * K + kj;
+              y[o] += w[wi] * x[xi];
+              dx[xi] += w[wi] * dy[o];
+              dw[wi] += x[xi] * dy[o];
+            }
+          }
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < y.size(); ++i) {
+    ASSERT_LT(fabs(y[i] - output.data().data()[i]), 1e-4);
+  }
+  for (size_t i = 0; i < dx.size(); ++i) {
+    ASSERT_LT(fabs(dx[i] - input.grad().data()[i]), 1e-4);
+  }
+  for (size_t i = 0; i < dw.size(); ++i) {
+    ASSERT_LT(fabs(dw[i] - weights[0]->grad().data()[i]), 1e-4);
+  }
+  for (size_t i = 0; i < db.size(); ++i) {
+    ASSERT_LT(fabs(db[i] - weights[1]->grad().data()[i]), 1e-4);
+  }
+}
+
+static LayerConfig CreateConv(size_t channels, size_t size, size_t filters,
+                              size_t kernel, size_t stride, size_t dilation,
+                              const std::string& algorithm) {
+  LayerConfig config;
+  config.set_name("conv");
+  config.set_type("Conv2D");
+  auto* conv = config.mutable_conv();
+  conv->set_channels(channels);
+  conv->set_height(size);
+  conv->set_width(size - 1);
+  conv->set_filters(filters);
+  conv->set_kernel(kernel);
+  conv->set_stride(stride);
+  conv->set_padding(1);
+  conv->set_dilation(dilation);
+  conv->set_algorithm(algorithm);
+  SetData(conv->mutable_weight(), {filters, channels * kernel * kernel}, 3);
+  SetData(conv->mutable_bias(), {filters}, 4);
+  return config;
+}
+
+static Tensor<Float> RunConv(const LayerConfig& config,
+                             const Tensor<Float>& x) {
+  Conv2DLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = x;
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  return output.data();
+}
+
+// The direct and Winograd kernels agree with im2col, also on odd output
+// sizes and channel counts that leave a partial block.
+TEST(Conv2DTest, AlgorithmsAgree) {
+  struct {
+    size_t kernel, stride, dilation;
+    const char* algorithm;
+  } cases[] = {{3, 1, 1, "winograd"}, {3, 1, 1, "direct"},
+               {5, 2, 1, "direct"},   {3, 2, 2, "direct"}};
+  for (const auto& c : cases) {
+    LayerConfig config = CreateConv(5, 9, 11, c.kernel, c.stride, c.dilation,
+                                    "im2col");
+    auto x = Tensor<Float>::Randn({3, size_t(5 * 9 * 8)});
+    auto expected = RunConv(config, x);
+    config.mutable_conv()->set_algorithm(c.algorithm);
+    auto y = RunConv(config, x);
+    ASSERT_EQ(y.size(), expected.size());
+    for (size_t i = 0; i < y.size(); ++i) {
+      ASSERT_LT(fabs(y.data()[i] - expected.data()[i]), 1e-4);
+    }
+  }
+}
+
+// Every thread computes in its own part of the workspace kept in the state
+// of the output, which later passes reuse.
+TEST(Conv2DTest, ThreadWorkspaces) {
+  ThreadPool pool(3);
+  for (const char* algorithm : {"im2col", "direct", "winograd"}) {
+    LayerConfig config = CreateConv(5, 9, 11, 3, 1, 1, algorithm);
+    config.mutable_conv()->set_tile_pixels(8);
+    auto x = Tensor<Float>::Randn({4, size_t(5 * 9 * 8)});
+    auto expected = RunConv(config, x);
+
+    ThreadPool::SetLocal(&pool);
+    Conv2DLayer layer;
+    ASSERT_TRUE(layer.Load(config));
+    Context ctx;
+    Variable input;
+    *input.mutable_data() = x;
+    Variable output;
+    layer.Forward(ctx, input, &output);
+    AllocCounter counter;
+    layer.Forward(ctx, input, &output);
+    ASSERT_EQ(counter.Delta().count, 0u);
+    ThreadPool::SetLocal(nullptr);
+    ASSERT_EQ(output.data().size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_LT(fabs(output.data().data()[i] - expected.data()[i]), 1e-4);
+    }
+  }
+}
+
+// Two convolutions exchanging channel-blocked images compute the same as
+// with plain ones.
+TEST(Conv2DTest, BlockedChain) {
+  LayerConfig first = CreateConv(3, 7, 10, 3, 1, 1, "winograd");
+  LayerConfig second = CreateConv(10, 7, 4, 3, 2, 1, "direct");
+  auto x = Tensor<Float>::Randn({2, size_t(3 * 7 * 6)});
+  auto expected = RunConv(second, RunConv(first, x));
+
+  first.mutable_conv()->set_blocked_output(true);
+  second.mutable_conv()->set_blocked_input(true);
+  auto blocked = RunConv(first, x);
+  ASSERT_EQ(blocked.count(1), size_t(16 * 7 * 6));
+  auto y = RunConv(second, blocked);
+  ASSERT_EQ(y.size(), expected.size());
+  for (size_t i = 0; i < y.size(); ++i) {
+    ASSERT_LT(fabs(y.data()[i] - expected.data()[i]), 1e-4);
+  }
+  // Im2col and training only take plain images.
+  second.mutable_conv()->set_algorithm("im2col");
+  Conv2DLayer layer;
+  ASSERT_TRUE(!layer.Load(second));
+}
+
+// The direct and Winograd kernels have no gradient, a train network only
+// takes them where its backward pass stops.
+TEST(Conv2DTest, InferOnlyKernels) {
+  for (const char* algorithm : {"direct", "winograd"}) {
+    NetworkConfig conf;
+    conf.set_phase("train");
+    LayerConfig* conv = conf.add_layer();
+    *conv = CreateConv(3, 6, 4, 3, 1, 1, algorithm);
+    conv->set_output("sigmoid1");
+    LayerConfig* sigmoid = conf.add_layer();
+    sigmoid->set_name("sigmoid1");
+    sigmoid->set_type("Sigmoid");
+    for (auto& layer : *conf.mutable_layer()) {
+      layer.add_phases("train");
+      layer.add_phases("infer");
+    }
+    Network network;
+    ASSERT_TRUE(!network.Load(conf));
+    conf.mutable_layer(0)->set_trainable(false);
+    Network frozen;
+    ASSERT_TRUE(frozen.Load(conf));
+  }
+}
+
+TEST(Conv2DTest, RejectBadConfig) {
+  LayerConfig config;
+  config.set_name("conv");
+  config.set_type("Conv2D");
+  auto* conv = config.mutable_conv();
+  conv->set_channels(3);
+  conv->set_height(4);
+  conv->set_width(4);
+  conv->set_filters(4);
+  conv->set_kernel(3);
+  conv->set_groups(2);  // 3 channels do not split in 2 groups.
+  conv->mutable_weight()->set_filler("zero");
+  conv->mutable_bias()->set_filler("zero");
+  Conv2DLayer layer;
+  ASSERT_TRUE(!layer.Load(config));
+  conv->set_groups(1);
+  conv->set_kernel(6);  // Larger than the image.
+  Conv2DLayer other;
+  ASSERT_TRUE(!other.Load(config));
+  conv->set_kernel(2);
+  conv->set_algorithm("winograd");  // Only 3 x 3 kernels.
+  Conv2DLayer winograd;
+  ASSERT_TRUE(!winograd.Load(config));
+  conv->set_algorithm("fft");
+  Conv2DLayer unknown;
+  ASSERT_TRUE(!unknown.Load(config));
+}
+
+}  // namespace cola
@@ -0,0 +1,91 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/depthwise_conv2d_layer.h"
+
+#include <math.h>
+
+#include "cola/layers/conv2d_layer.h"
+#include "test/test.h"
+
+namespace cola {
+
+class DepthwiseConv2DTest {};
+
+// The output and the input and weight gradients of `layer`.
+static std::vector<Tensor<Float>> RunDepthwise(Layer* layer,
+                                               const LayerConfig& config,
+                                               const Tensor<Float>& x,
+                                               const Tensor<Float>& dy) {
+  ASSERT_TRUE(layer->Load(config));
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = x;
+  Variable output;
+  layer->Forward(ctx, input, &output);
+  *output.mutable_grad() = dy;
+  auto weights = layer->GetWeights();
+  for (auto* weight : weights) {
+    *weight->mutable_grad() = Tensor<Float>::Zeros(weight->data().shape());
+  }
+  layer->Backward(ctx, output, &input);
+  return {output.data(), input.grad(), weights[0]->grad(),
+          weights[1]->grad()};
+}
+
+// 3 channels of 7 x 6 pixels, 2 filters per channel of 3 x 3 dilated by 2,
+// stride 2 and padding 2, against Conv2D with a group per channel.
+TEST(DepthwiseConv2DTest, SameAsGroupedConv) {
+  const size_t C = 3, H = 7, W = 6, F = 6, K = 3, M = 2;
+  LayerConfig config;
+  config.set_name("depthwise");
+  config.set_type("DepthwiseConv2D");
+  auto* conv = config.mutable_conv();
+  conv->set_channels(C);
+  conv->set_height(H);
+  conv->set_width(W);
+  conv->set_filters(F);
+  conv->set_kernel(K);
+  conv->set_stride(2);
+  conv->set_padding(2);
+  conv->set_dilation(2);
+  conv->mutable_weight()->set_filler("normal");
+  conv->mutable_bias()->set_filler("normal");
+  DepthwiseConv2DLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+  layer.Snapshot(&config);
+  const size_t out = layer.layer_config().output_size();
+  ASSERT_EQ(out, F * 4 * 3);
+
+  auto x = Tensor<Float>::Randn({M, C * H * W});
+  auto dy = Tensor<Float>::Randn({M, out});
+  DepthwiseConv2DLayer depthwise;
+  auto got = RunDepthwise(&depthwise, config, x, dy);
+  config.mutable_conv()->set_groups(C);
+  Conv2DLayer grouped;
+  auto expected = RunDepthwise(&grouped, config, x, dy);
+  for (size_t i = 0; i < got.size(); ++i) {
+    ASSERT_EQ(got[i].size(), expected[i].size());
+    for (size_t j = 0; j < got[i].size(); ++j) {
+      ASSERT_LT(fabs(got[i].data()[j] - expected[i].data()[j]), 1e-4);
+    }
+  }
+  // The filters are not a multiple of the channels.
+  config.mutable_conv()->set_filters(4);
+  DepthwiseConv2DLayer bad;
+  ASSERT_TRUE(!bad.Load(config));
+}
+
+}  // namespace cola
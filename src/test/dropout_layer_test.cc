@@ -0,0 +1,137 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/dropout_layer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "cola/base/random.h"
+#include "cola/base/thread_pool.h"
+#include "test/test.h"
+
+namespace cola {
+
+class DropoutTest {};
+
+// The known answers of the Random123 distribution.
+TEST(DropoutTest, Philox) {
+  uint32_t out[4];
+  random::Philox(0).Generate(0, 0, 1, out);
+  ASSERT_EQ(out[0], 0x6627e8d5u);
+  ASSERT_EQ(out[1], 0xe169c58du);
+  ASSERT_EQ(out[2], 0xbc57ac4cu);
+  ASSERT_EQ(out[3], 0x9b00dbd8u);
+  random::Philox(0x299f31d0a4093822).Generate(
+      0x85a308d3243f6a88, 0x0370734413198a2e, 1, out);
+  ASSERT_EQ(out[0], 0xd16cfe09u);
+  ASSERT_EQ(out[1], 0x94fdccebu);
+  ASSERT_EQ(out[2], 0x5001e420u);
+  ASSERT_EQ(out[3], 0x24126ea1u);
+
+  // Blocks do not depend on how many are generated at once.
+  std::vector<uint32_t> all(4 * 21), some(4 * 5);
+  random::Philox(7).Generate(3, 1, 21, all.data());
+  random::Philox(7).Generate(19, 1, 5, some.data());
+  ASSERT_EQ(memcmp(all.data() + 4 * 16, some.data(), some.size() * 4), 0);
+}
+
+TEST(DropoutTest, MasksAndInference) {
+  // Not a multiple of the values of a task.
+  const size_t M = 3000, N = 37;
+  const Float rate = 0.3;
+  LayerConfig config;
+  config.set_name("dropout");
+  config.set_type("Dropout");
+  config.mutable_dropout()->set_rate(rate);
+  DropoutLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+
+  Context ctx;
+  ctx.session()->set_phase(kTrain);
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({M, N});
+  Variable output;
+  ThreadPool pool(4);
+  ThreadPool::SetLocal(&pool);
+  layer.Forward(ctx, input, &output);
+  const Float* x = input.data().data();
+  const Float* y = output.data().data();
+  size_t dropped = 0;
+  for (size_t i = 0; i < M * N; ++i) {
+    if (y[i] == 0) {
+      ++dropped;
+    } else {
+      ASSERT_LT(fabs(y[i] - x[i] / (1 - rate)), 1e-4);
+    }
+  }
+  ASSERT_LT(fabs(Float(dropped) / (M * N) - rate), 0.02);
+
+  *output.mutable_grad() = Tensor<Float>::Randn({M, N});
+  layer.Backward(ctx, output, &input);
+  for (size_t i = 0; i < M * N; ++i) {
+    const Float expected = y[i] == 0 ? 0 : output.grad().data()[i] / (1 - rate);
+    ASSERT_LT(fabs(input.grad().data()[i] - expected), 1e-4);
+  }
+
+  // The next step draws another mask.
+  Variable next;
+  ctx.session()->set_step(1);
+  layer.Forward(ctx, input, &next);
+  ctx.session()->set_step(0);
+  ASSERT_NE(memcmp(y, next.data().data(), M * N * sizeof(Float)), 0);
+
+  // The masks of a step are the same on one thread.
+  DropoutLayer serial;
+  ASSERT_TRUE(serial.Load(config));
+  ThreadPool single(1);
+  ThreadPool::SetLocal(&single);
+  Variable serial_output;
+  serial.Forward(ctx, input, &serial_output);
+  ThreadPool::SetLocal(nullptr);
+  ASSERT_EQ(memcmp(y, serial_output.data().data(), M * N * sizeof(Float)), 0);
+
+  ctx.session()->set_phase(kInfer);
+  layer.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().data(), input.data().data());
+}
+
+// The key of the masks is the seed and the FNV-1a hash of the name, the
+// masks do not depend on the standard library.
+TEST(DropoutTest, FixedKey) {
+  const size_t N = 16;
+  LayerConfig config;
+  config.set_name("dropout");
+  config.set_type("Dropout");
+  config.mutable_dropout()->set_rate(0.5);
+  config.mutable_dropout()->set_seed(5);
+  DropoutLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+
+  Context ctx;
+  ctx.session()->set_phase(kTrain);
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Ones({1, N});
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  uint32_t words[N / 2];
+  random::Philox(uint64_t(5) << 32 | 0x2738a690u).Generate(0, 0, 2, words);
+  for (size_t i = 0; i < N; ++i) {
+    const uint32_t r = (i & 1 ? words[i / 2] >> 16 : words[i / 2]) & 0xFFFF;
+    ASSERT_EQ(output.data().data()[i], r >= 32768 ? 2 : 0);
+  }
+}
+
+}  // namespace cola
@@ -0,0 +1,183 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/embedding_layer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <memory>
+
+#include "cola/core/network.h"
+#include "cola/optimizers/optimizer.h"
+#include "test/test.h"
+
+namespace cola {
+
+class EmbeddingTest {};
+
+TEST(EmbeddingTest, LookupAndSparseGrad) {
+  const size_t R = 10, D = 3;
+  auto table = Tensor<Float>::Randn({R, D});
+  LayerConfig config;
+  config.set_name("embedding");
+  config.set_type("Embedding");
+  config.set_input_size(2);
+  auto* embedding = config.mutable_embedding();
+  embedding->set_rows(R);
+  embedding->set_dims(D);
+  Weight::SetData(table, embedding->mutable_weight());
+  EmbeddingLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+  Weight* w = layer.GetWeights()[0];
+  ASSERT_TRUE(w->sparse_grad());
+  ASSERT_EQ(w->grad().size(), 0u);
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Create({4, 1, 7, 4, 1, 1}, {3, 2});
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().shape(1), 2 * D);
+  for (size_t i = 0; i < 6; ++i) {
+    const size_t row = input.data().data()[i];
+    ASSERT_EQ(memcmp(output.data().data() + i * D, table.data() + row * D,
+                     D * sizeof(Float)),
+              0);
+  }
+
+  // The gradient of a row sums those of its lookups.
+  *output.mutable_grad() = Tensor<Float>::Randn({3, 2 * D});
+  layer.Backward(ctx, output, &input);
+  const Float* dy = output.grad().data();
+  ASSERT_TRUE(w->grad_rows() == std::vector<size_t>({1, 4, 7}));
+  for (size_t j = 0; j < D; ++j) {
+    const Float* g = w->grad().data();
+    ASSERT_LT(fabs(g[j] - (dy[D + j] + dy[4 * D + j] + dy[5 * D + j])), 1e-5);
+    ASSERT_LT(fabs(g[D + j] - (dy[j] + dy[3 * D + j])), 1e-5);
+    ASSERT_LT(fabs(g[2 * D + j] - dy[2 * D + j]), 1e-5);
+  }
+
+  // Another batch is merged in until the gradient is cleared.
+  Variable other;
+  *other.mutable_data() = Tensor<Float>::Create({9, 4, 0, 9}, {2, 2});
+  Variable other_output;
+  layer.Forward(ctx, other, &other_output);
+  *other_output.mutable_grad() = Tensor<Float>::Ones({2, 2 * D});
+  std::vector<Float> before(w->grad().data(), w->grad().data() + 3 * D);
+  layer.Backward(ctx, other_output, &other);
+  ASSERT_TRUE(w->grad_rows() == std::vector<size_t>({0, 1, 4, 7, 9}));
+  for (size_t j = 0; j < D; ++j) {
+    const Float* g = w->grad().data();
+    ASSERT_LT(fabs(g[j] - 1), 1e-5);
+    ASSERT_LT(fabs(g[D + j] - before[j]), 1e-5);
+    ASSERT_LT(fabs(g[2 * D + j] - (before[D + j] + 1)), 1e-5);
+    ASSERT_LT(fabs(g[3 * D + j] - before[2 * D + j]), 1e-5);
+    ASSERT_LT(fabs(g[4 * D + j] - 2), 1e-5);
+  }
+  w->ClearSparseGrad();
+  ASSERT_TRUE(w->grad_rows().empty());
+  ASSERT_EQ(w->grad().size(), 0u);
+}
+
+// Indices out of range fail the forward pass instead of aborting, they
+// have zero embeddings and no gradient.
+TEST(EmbeddingTest, BadIndex) {
+  const size_t R = 5, D = 2;
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  LayerConfig* config = conf.add_layer();
+  config->set_name("embedding");
+  config->set_type("Embedding");
+  config->set_input_size(2);
+  config->add_phases("infer");
+  auto* embedding = config->mutable_embedding();
+  embedding->set_rows(R);
+  embedding->set_dims(D);
+  Weight::SetData(Tensor<Float>::Randn({R, D}), embedding->mutable_weight());
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Create({1, 5}, {1, 2});
+  Variable output;
+  ASSERT_TRUE(!network.Forward(ctx, input, &output));
+  ASSERT_EQ(ctx.session()->error(), "[embedding] index 5 out of 5 rows");
+  *input.mutable_data() = Tensor<Float>::Create({1, 4}, {1, 2});
+  ASSERT_TRUE(network.Forward(ctx, input, &output));
+
+  EmbeddingLayer layer;
+  ASSERT_TRUE(layer.Load(*config));
+  *input.mutable_data() = Tensor<Float>::Create({3, -1}, {1, 2});
+  layer.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().data()[D], 0);
+  ASSERT_EQ(output.data().data()[D + 1], 0);
+  *output.mutable_grad() = Tensor<Float>::Ones({1, 2 * D});
+  layer.Backward(ctx, output, &input);
+  Weight* w = layer.GetWeights()[0];
+  ASSERT_TRUE(w->grad_rows() == std::vector<size_t>({3}));
+
+  // A first batch without a valid index adds no rows.
+  EmbeddingLayer fresh;
+  ASSERT_TRUE(fresh.Load(*config));
+  *input.mutable_data() = Tensor<Float>::Create({-1, 5}, {1, 2});
+  fresh.Forward(ctx, input, &output);
+  fresh.Backward(ctx, output, &input);
+  ASSERT_TRUE(fresh.GetWeights()[0]->grad_rows().empty());
+}
+
+// Updating the rows of sparse gradients gives the weights of the dense
+// updates by gradients that are zero elsewhere, rows skipping steps
+// included.
+TEST(EmbeddingTest, SparseOptimizers) {
+  const size_t R = 8, D = 4;
+  WeightConfig wc;
+  Weight::SetData(Tensor<Float>::Randn({R, D}), &wc);
+  for (const char* type : {"sgd", "momentum", "ada_grad"}) {
+    OptimizerConfig config;
+    config.set_type(type);
+    config.set_lr(0.1);
+    config.set_momentum(0.9);
+    Weight dense;
+    dense.Fill(wc, {});
+    Weight sparse;
+    sparse.set_sparse_grad(true);
+    sparse.Fill(wc, {});
+    std::unique_ptr<Optimizer> dense_optimizer(
+        Optimizer::Create(config, {&dense}));
+    std::unique_ptr<Optimizer> sparse_optimizer(
+        Optimizer::Create(config, {&sparse}));
+    for (size_t step = 0; step < 6; ++step) {
+      dense_optimizer->ZeroGrad();
+      sparse_optimizer->ZeroGrad();
+      // Row 5 at every step, rows 0 to 2 at every third one.
+      const std::vector<size_t> rows = {step % 3, 5};
+      auto values = Tensor<Float>::Randn({rows.size(), D});
+      sparse.AddSparseGrad(rows, values.data());
+      for (size_t i = 0; i < rows.size(); ++i) {
+        memcpy(dense.mutable_grad()->mutable_data() + rows[i] * D,
+               values.data() + i * D, D * sizeof(Float));
+      }
+      dense_optimizer->Step();
+      sparse_optimizer->Step();
+    }
+    sparse_optimizer->Flush();
+    for (size_t i = 0; i < R * D; ++i) {
+      ASSERT_LT(fabs(dense.data().data()[i] - sparse.data().data()[i]), 1e-5);
+    }
+  }
+}
+
+}  // namespace cola
@@ -0,0 +1,151 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/exit_head_layer.h"
+
+#include <math.h>
+
+#include "cola/core/network.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class ExitHeadTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+using test::Values;
+
+// The loss of the head plus the dot product of the passed through input
+// with `dout`, whose gradient is the input gradient of the layer.
+static Float Objective(const std::vector<Float>& x, const Tensor<Float>& dout,
+                       const std::vector<size_t>& labels, size_t m, size_t k,
+                       size_t n, Float loss_weight) {
+  auto w = Values(k * n, 1);
+  auto b = Values(n, 2);
+  Float f = 0;
+  for (size_t i = 0; i < m; ++i) {
+    std::vector<Float> z(b);
+    for (size_t j = 0; j < n; ++j) {
+      for (size_t l = 0; l < k; ++l) {
+        z[j] += x[i * k + l] * w[l * n + j];
+      }
+    }
+    Float sum = 0;
+    for (size_t j = 0; j < n; ++j) {
+      sum += exp(z[j]);
+    }
+    f -= loss_weight * log(exp(z[labels[i]]) / sum) / m;
+    for (size_t l = 0; l < k; ++l) {
+      f += x[i * k + l] * dout.data()[i * k + l];
+    }
+  }
+  return f;
+}
+
+TEST(ExitHeadTest, Gradient) {
+  const size_t m = 3, k = 4, n = 3;
+  NetworkConfig conf;
+  LayerConfig* config = AddAffine(&conf, "head", k, n, "");
+  config->set_type("ExitHead");
+  config->mutable_exit_head()->set_loss_weight(0.5);
+  ExitHeadLayer layer;
+  ASSERT_TRUE(layer.Load(*config));
+
+  const std::vector<size_t> labels = {2, 0, 1};
+  Context ctx;
+  ctx.session()->set_batch_size(m);
+  auto* label = ctx.session()->mutable_label();
+  *label = Tensor<Float>::Zeros({m, n});
+  for (size_t i = 0; i < m; ++i) {
+    label->mutable_data()[i * n + labels[i]] = 1;
+  }
+  std::vector<Float> x = Values(m * k, 3);
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Create(x.data(), {m, k});
+  Variable output;
+  layer.Forward(ctx, input, &output);
+  ASSERT_TRUE(output.data().shape() == input.data().shape());
+  ASSERT_EQ(output.data().data(), input.data().data());
+  *output.mutable_grad() = Tensor<Float>::Randn({m, k});
+  layer.Backward(ctx, output, &input);
+
+  const Float eps = 1e-2;
+  for (size_t i = 0; i < m * k; ++i) {
+    std::vector<Float> hi(x);
+    std::vector<Float> lo(x);
+    hi[i] += eps;
+    lo[i] -= eps;
+    const Float numeric =
+        (Objective(hi, output.grad(), labels, m, k, n, 0.5) -
+         Objective(lo, output.grad(), labels, m, k, n, 0.5)) /
+        (2 * eps);
+    ASSERT_LT(fabs(numeric - input.grad().data()[i]), 1e-3);
+  }
+}
+
+//   affine1 -> head (2 classes) -> affine2 -> softmax (3 classes)
+TEST(ExitHeadTest, EarlyExit) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 6, "head");
+  AddAffine(&conf, "head", 6, 2, "affine2")->set_type("ExitHead");
+  AddAffine(&conf, "affine2", 6, 3, "softmax");
+  AddLayer(&conf, "softmax", "Softmax", "");
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({5, 4});
+  {
+    // Never confident enough.
+    conf.mutable_layer(1)->mutable_exit_head()->set_threshold(1.5);
+    Network network;
+    ASSERT_TRUE(network.Load(conf));
+    Variable y;
+    network.Forward(ctx, input, &y);
+    ASSERT_EQ(y.data().count(1), 3u);
+    ASSERT_TRUE(ctx.session()->exit().empty());
+  }
+  // Always confident, the head answers.
+  conf.mutable_layer(1)->mutable_exit_head()->set_threshold(0.01);
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Variable y;
+  network.Forward(ctx, input, &y);
+  ASSERT_EQ(ctx.session()->exit(), "head");
+  ASSERT_EQ(y.data().shape(0), 5u);
+  ASSERT_EQ(y.data().count(1), 2u);
+  for (size_t i = 0; i < 5; ++i) {
+    ASSERT_LT(fabs(y.data().data()[2 * i] + y.data().data()[2 * i + 1] - 1),
+              1e-5);
+  }
+
+  // The head answers with the class index like the network would.
+  conf.set_infer_output("argmax");
+  Network argmax;
+  ASSERT_TRUE(argmax.Load(conf));
+  Variable z;
+  ASSERT_TRUE(argmax.Forward(ctx, input, &z));
+  ASSERT_EQ(ctx.session()->exit(), "head");
+  ASSERT_EQ(z.data().shape(0), 5u);
+  ASSERT_EQ(z.data().count(1), 1u);
+  for (size_t i = 0; i < 5; ++i) {
+    const Float* p = y.data().data() + 2 * i;
+    ASSERT_EQ(z.data().data()[i], p[1] > p[0] ? 1 : 0);
+  }
+}
+
+}  // namespace cola
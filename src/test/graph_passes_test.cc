@@ -0,0 +1,327 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/graph_passes.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "cola/core/network.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class GraphPassesTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+using test::SetData;
+using test::SetValues;
+
+//   affine1 -> relu1 -> identity1 -> dropout1 -> affine2 -> sigmoid1
+//         \-> relu2 (dead)                                   -> softmax1
+static NetworkConfig CreateConfig() {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 6, "relu1")->add_outputs("relu2");
+  AddLayer(&conf, "relu1", "Relu", "identity1");
+  AddLayer(&conf, "relu2", "Relu");
+  AddLayer(&conf, "identity1", "Identity", "dropout1");
+  AddLayer(&conf, "dropout1", "Dropout", "affine2");
+  AddAffine(&conf, "affine2", 6, 3, "sigmoid1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid", "softmax1");
+  AddLayer(&conf, "softmax1", "Softmax");
+  return conf;
+}
+
+TEST(GraphPassesTest, Rewrite) {
+  NetworkConfig conf = CreateConfig();
+  OptimizeGraph(&conf);
+  ASSERT_EQ(conf.layer_size(), 3);
+  // relu2 is dead, so affine1 feeds relu1 only and both can be fused.
+  ASSERT_EQ(conf.layer(0).name(), "affine1");
+  ASSERT_EQ(conf.layer(0).type(), "FusedAffine");
+  ASSERT_EQ(conf.layer(0).affine().activation(), "relu");
+  ASSERT_EQ(conf.layer(0).output(), "affine2");
+  ASSERT_EQ(conf.layer(0).outputs_size(), 0);
+  ASSERT_EQ(conf.layer(1).type(), "FusedAffine");
+  ASSERT_EQ(conf.layer(1).affine().activation(), "sigmoid");
+  ASSERT_EQ(conf.layer(1).output(), "softmax1");
+  ASSERT_EQ(conf.layer(2).type(), "Softmax");
+}
+
+TEST(GraphPassesTest, SplitLoss) {
+  NetworkConfig conf;
+  conf.set_phase("train");
+  conf.set_infer_output("argmax");
+  AddAffine(&conf, "affine1", 4, 3, "loss")->add_phases("train");
+  AddLayer(&conf, "loss", "SoftmaxWithLoss")->add_phases("train");
+  OptimizeGraph(&conf);
+  ASSERT_EQ(conf.layer_size(), 3);
+  ASSERT_EQ(conf.layer(1).type(), "SoftmaxWithLoss");
+  ASSERT_EQ(conf.layer(1).phases_size(), 1);
+  ASSERT_EQ(conf.layer(1).phases(0), "train");
+  ASSERT_EQ(conf.layer(2).name(), "loss");
+  ASSERT_EQ(conf.layer(2).type(), "Argmax");
+  ASSERT_EQ(conf.layer(2).phases_size(), 1);
+  ASSERT_EQ(conf.layer(2).phases(0), "infer");
+}
+
+TEST(GraphPassesTest, Truncate) {
+  NetworkConfig conf = CreateConfig();
+  ASSERT_TRUE(!TruncateGraph("missing", &conf));
+  ASSERT_TRUE(TruncateGraph("identity1", &conf));
+  ASSERT_EQ(conf.layer_size(), 3);
+  ASSERT_EQ(conf.layer(2).name(), "identity1");
+  ASSERT_EQ(conf.layer(2).output(), "");
+  OptimizeGraph(&conf);
+  ASSERT_EQ(conf.layer_size(), 1);
+  ASSERT_EQ(conf.layer(0).type(), "FusedAffine");
+
+  // The network outputs the activations of the layer.
+  conf = CreateConfig();
+  conf.set_output_layer("relu1");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  ASSERT_EQ(network.input_size(), 4u);
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({5, 4});
+  Variable y;
+  network.Forward(ctx, input, &y);
+  ASSERT_EQ(y.data().shape(0), 5u);
+  ASSERT_EQ(y.data().count(1), 6u);
+  for (size_t i = 0; i < y.data().size(); ++i) {
+    ASSERT_TRUE(y.data().data()[i] >= 0);
+  }
+}
+
+static LayerConfig* AddConv(NetworkConfig* conf, const std::string& name,
+                            size_t channels, size_t filters, size_t stride,
+                            const std::string& output) {
+  LayerConfig* layer = AddLayer(conf, name, "Conv2D", output);
+  auto* conv = layer->mutable_conv();
+  conv->set_channels(channels);
+  conv->set_height(6);
+  conv->set_width(6);
+  conv->set_filters(filters);
+  conv->set_kernel(3);
+  conv->set_stride(stride);
+  conv->set_padding(1);
+  SetData(conv->mutable_weight(), {filters, channels * 9});
+  SetData(conv->mutable_bias(), {filters});
+  return layer;
+}
+
+// conv1 (winograd) -> relu1 -> conv2 (direct), the image between the two
+// is channel-blocked.
+TEST(GraphPassesTest, BlockConvolutions) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddConv(&conf, "conv1", 2, 9, 1, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "conv2");
+  AddConv(&conf, "conv2", 9, 3, 2, "");
+  NetworkConfig optimized = conf;
+  OptimizeGraph(&optimized);
+  ASSERT_EQ(optimized.layer(0).conv().algorithm(), "winograd");
+  ASSERT_TRUE(optimized.layer(0).conv().blocked_output());
+  ASSERT_TRUE(!optimized.layer(0).conv().blocked_input());
+  ASSERT_TRUE(optimized.layer(2).conv().blocked_input());
+  ASSERT_TRUE(!optimized.layer(2).conv().blocked_output());
+
+  // Separable convolutions get their own layers.
+  NetworkConfig separable;
+  separable.set_phase("infer");
+  AddConv(&separable, "conv3", 4, 8, 1, "conv4")->mutable_conv()->set_groups(4);
+  AddConv(&separable, "conv4", 8, 8, 1, "")->mutable_conv()->set_kernel(1);
+  separable.mutable_layer(1)->mutable_conv()->set_padding(0);
+  OptimizeGraph(&separable);
+  ASSERT_EQ(separable.layer(0).type(), "DepthwiseConv2D");
+  ASSERT_EQ(separable.layer(1).type(), "PointwiseConv2D");
+
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  conf.set_optimize(false);
+  Network origin;
+  ASSERT_TRUE(origin.Load(conf));
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({3, 2 * 6 * 6});
+  Variable x;
+  *x.mutable_data() = input.data();
+  Variable y;
+  Variable z;
+  network.Forward(ctx, input, &y);
+  origin.Forward(ctx, x, &z);
+  ASSERT_EQ(y.data().size(), z.data().size());
+  for (size_t i = 0; i < y.data().size(); ++i) {
+    ASSERT_LT(fabs(y.data().data()[i] - z.data().data()[i]), 1e-4);
+  }
+
+  // Sizes declared for plain images, 9 filters leaving a partial block.
+  const size_t sizes[][2] = {{72, 324}, {324, 324}, {324, 27}};
+  for (int i = 0; i < 3; ++i) {
+    conf.mutable_layer(i)->set_input_size(sizes[i][0]);
+    conf.mutable_layer(i)->set_output_size(sizes[i][1]);
+  }
+  Network declared;
+  ASSERT_TRUE(declared.Load(conf));
+  conf.set_optimize(true);
+  Network blocked;
+  ASSERT_TRUE(blocked.Load(conf));
+  declared.Forward(ctx, input, &y);
+  blocked.Forward(ctx, input, &z);
+  ASSERT_EQ(y.data().size(), z.data().size());
+  for (size_t i = 0; i < y.data().size(); ++i) {
+    ASSERT_LT(fabs(y.data().data()[i] - z.data().data()[i]), 1e-4);
+  }
+}
+
+//   affine1 -> bn1 -> relu1 -> affine2, folded into FusedAffine by the
+// passes and into Affine by Snapshot.
+TEST(GraphPassesTest, FoldBatchNorm) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 6, "bn1");
+  auto* bn = AddLayer(&conf, "bn1", "BatchNorm", "relu1")->mutable_batch_norm();
+  bn->set_channels(6);
+  SetData(bn->mutable_scale(), {6});
+  SetData(bn->mutable_shift(), {6});
+  SetData(bn->mutable_mean(), {6});
+  SetValues(bn->mutable_variance(), {0.5, 1, 2, 0.25, 4, 1.5});
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 6, 3, "");
+  NetworkConfig optimized = conf;
+  OptimizeGraph(&optimized);
+  ASSERT_EQ(optimized.layer_size(), 2);
+  ASSERT_EQ(optimized.layer(0).type(), "FusedAffine");
+
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  conf.set_optimize(false);
+  Network origin;
+  ASSERT_TRUE(origin.Load(conf));
+  NetworkConfig snapshot;
+  origin.Snapshot(&snapshot);
+  ASSERT_EQ(snapshot.layer_size(), 3);
+  for (const auto& layer : snapshot.layer()) {
+    ASSERT_TRUE(layer.type() != "BatchNorm");
+  }
+  snapshot.set_optimize(false);
+  Network folded;
+  ASSERT_TRUE(folded.Load(snapshot));
+
+  Context ctx;
+  auto x = Tensor<Float>::Randn({5, 4});
+  Variable expected;
+  Variable input;
+  *input.mutable_data() = x;
+  origin.Forward(ctx, input, &expected);
+  for (Network* net : {&network, &folded}) {
+    Variable y;
+    *input.mutable_data() = x;
+    net->Forward(ctx, input, &y);
+    ASSERT_EQ(y.data().size(), expected.data().size());
+    for (size_t i = 0; i < y.data().size(); ++i) {
+      ASSERT_LT(fabs(y.data().data()[i] - expected.data().data()[i]), 1e-4);
+    }
+  }
+}
+
+// The optimized network computes the same outputs and gradients.
+TEST(GraphPassesTest, SameResults) {
+  NetworkConfig conf = CreateConfig();
+  Network optimized;
+  ASSERT_TRUE(optimized.Load(conf));
+  conf.set_optimize(false);
+  conf.mutable_layer(0)->clear_outputs();  // Two outputs otherwise.
+  conf.mutable_layer()->DeleteSubrange(2, 1);
+  Network origin;
+  ASSERT_TRUE(origin.Load(conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({5, 4});
+  Variable x;
+  *x.mutable_data() = input.data();
+  Variable y;
+  Variable z;
+  optimized.Forward(ctx, input, &y);
+  origin.Forward(ctx, x, &z);
+  ASSERT_EQ(y.data().size(), z.data().size());
+  for (size_t i = 0; i < y.data().size(); ++i) {
+    ASSERT_LT(fabs(y.data().data()[i] - z.data().data()[i]), 1e-5);
+  }
+
+  Tensor<Float> dout = Tensor<Float>::Randn(y.data().shape());
+  *y.mutable_grad() = dout;
+  *z.mutable_grad() = dout;
+  optimized.Backward(ctx, y, &input);
+  origin.Backward(ctx, z, &x);
+  for (size_t i = 0; i < input.grad().size(); ++i) {
+    ASSERT_LT(fabs(input.grad().data()[i] - x.grad().data()[i]), 1e-5);
+  }
+}
+
+// A single class, the accuracy is decided by the output mode rather than the
+// width of the output.
+TEST(GraphPassesTest, AccuracyByOutputMode) {
+  const std::string data_path = "/tmp/cola_graph_passes_test_data";
+  const std::string label_path = "/tmp/cola_graph_passes_test_label";
+  FILE* f = fopen(data_path.c_str(), "wb");
+  for (int i = 0; i < 16 + 4 * 4; ++i) {
+    fputc(i < 16 ? 0 : i, f);
+  }
+  fclose(f);
+  f = fopen(label_path.c_str(), "wb");
+  for (int i = 0; i < 8 + 4; ++i) {
+    fputc(0, f);
+  }
+  fclose(f);
+
+  for (const char* infer_output : {"softmax", "argmax"}) {
+    NetworkConfig conf;
+    conf.set_phase("train");
+    conf.set_infer_output(infer_output);
+    // Accuracy is measured on the data of the infer phase.
+    for (const char* phase : {"train", "infer"}) {
+      auto* data_layer =
+          AddLayer(&conf, std::string("data_") + phase, "Data", "affine1");
+      data_layer->clear_phases();
+      data_layer->add_phases(phase);
+      auto* data_set = data_layer->mutable_data_set();
+      data_set->set_batch_size(4);
+      data_set->set_data_path(data_path);
+      data_set->set_data_block(4);
+      data_set->set_label_path(label_path);
+      data_set->set_label_block(1);
+    }
+    AddAffine(&conf, "affine1", 4, 1, "loss")->add_phases("train");
+    AddLayer(&conf, "loss", "SoftmaxWithLoss")->add_phases("train");
+    Network network;
+    ASSERT_TRUE(network.Load(conf));
+
+    Context ctx;
+    Variable input;
+    Variable output;
+    network.Forward(ctx, input, &output);
+    ASSERT_EQ(network.Accuracy(ctx), Float(1));
+  }
+  remove(data_path.c_str());
+  remove(label_path.c_str());
+}
+
+}  // namespace cola
@@ -87,4 +87,36 @@ TEST(MatrixMultiplyTest, mulitply) {
   std::cout << dout.ToString() << std::endl;
   std::cout << "---------" << dw.ToString() << std::endl;
 }
+
+// Wide enough for every row to be a range of its own, the ranges then cut
+// the groups, one of which is empty.
+TEST(MatrixMultiplyTest, Grouped) {
+  const size_t n = 96;
+  const size_t k = 200;
+  const std::vector<size_t> offsets = {0, 3, 3, 10, 16};
+  const size_t groups = offsets.size() - 1;
+  const size_t m = offsets.back();
+  Tensor<int> a = Tensor<int>::Create({m, k});
+  Tensor<int> b = Tensor<int>::Create({groups, k, n});
+  for (size_t i = 0; i < a.size(); ++i) {
+    a.mutable_data()[i] = int(i % 7) - 3;
+  }
+  for (size_t i = 0; i < b.size(); ++i) {
+    b.mutable_data()[i] = int(i % 5) - 2;
+  }
+  Tensor<int> c = Tensor<int>::Create({m, n});
+  GroupedMatrixMultiply(a.data(), b.data(), offsets.data(), groups, n, k,
+                        c.mutable_data());
+  for (size_t g = 0; g < groups; ++g) {
+    for (size_t i = offsets[g]; i < offsets[g + 1]; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        int v = 0;
+        for (size_t l = 0; l < k; ++l) {
+          v += a.data()[i * k + l] * b.data()[(g * k + l) * n + j];
+        }
+        ASSERT_EQ(c.data()[i * n + j], v);
+      }
+    }
+  }
+}
 }  // namespace cola
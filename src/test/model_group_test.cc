@@ -0,0 +1,89 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/model_group.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "cola/base/alloc_counter.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class ModelGroupTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+
+static NetworkConfig Model(Float seed) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 6, 5, "relu", seed);
+  AddLayer(&conf, "relu", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 5, 3, "softmax", seed + 1);
+  AddLayer(&conf, "softmax", "SoftmaxWithLoss", "");
+  return conf;
+}
+
+TEST(ModelGroupTest, SameAsSeparate) {
+  std::vector<NetworkConfig> models = {Model(1), Model(2), Model(3)};
+  ModelGroup group;
+  ASSERT_TRUE(group.Load(models));
+  ASSERT_EQ(group.size(), 3u);
+
+  // Model 1 gets no rows.
+  const std::vector<size_t> ids = {2, 0, 2, 0, 0, 2, 2};
+  auto input = Tensor<Float>::Randn({ids.size(), 6});
+  Tensor<Float> output;
+  ASSERT_TRUE(group.Predict(input, ids, &output));
+  ASSERT_EQ(output.shape(0), ids.size());
+  ASSERT_EQ(output.count(1), 3u);
+
+  Context ctx;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    Network network;
+    ASSERT_TRUE(network.Load(models[ids[i]]));
+    Variable x;
+    *x.mutable_data() = Tensor<Float>::Create({1, 6});
+    memcpy(x.mutable_data()->mutable_data(), input.data() + i * 6,
+           6 * sizeof(Float));
+    Variable y;
+    network.Forward(ctx, x, &y);
+    for (size_t j = 0; j < 3; ++j) {
+      ASSERT_TRUE(fabs(y.data().data()[j] - output.data()[i * 3 + j]) <
+                  1e-5);
+    }
+  }
+
+  // Batches of the same size run without allocating.
+  AllocCounter counter;
+  ASSERT_TRUE(group.Predict(input, ids, &output));
+  ASSERT_EQ(counter.Delta().count, 0u);
+
+  // A model out of range fails the request.
+  ASSERT_TRUE(!group.Predict(input, {2, 0, 2, 3, 0, 2, 2}, &output));
+  ASSERT_TRUE(!group.Predict(input, {2, 0}, &output));
+}
+
+TEST(ModelGroupTest, RejectMismatch) {
+  std::vector<NetworkConfig> models = {Model(1), Model(2)};
+  models[1].mutable_layer(1)->set_type("Sigmoid");
+  ModelGroup group;
+  ASSERT_TRUE(!group.Load(models));
+}
+
+}  // namespace cola
@@ -0,0 +1,333 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/network.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "cola/base/alloc_counter.h"
+#include "cola/proto/cola.pb.h"
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class NetworkTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+
+static Float Sum(const Tensor<Float>& t) {
+  Float s = 0;
+  for (size_t i = 0; i < t.size(); ++i) {
+    s += t.data()[i];
+  }
+  return s;
+}
+
+//   input -> affine1 -> sigmoid1 -> affine2 -> add1 -> concat1
+//         |          \---------------------------^        ^
+//         \-> affine3 ----------------------------------/
+TEST(NetworkTest, DagGradient) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 3, 3, "sigmoid1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid", "affine2");
+  AddAffine(&conf, "affine2", 3, 3, "");
+  AddAffine(&conf, "affine3", 3, 2, "concat1");
+  auto* add = AddLayer(&conf, "add1", "Add");
+  add->add_inputs("affine1");
+  add->add_inputs("affine2");
+  add->set_output("concat1");
+  AddLayer(&conf, "concat1", "Concat");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({4, 3});
+  Variable output;
+  network.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().shape(0), 4u);
+  ASSERT_EQ(output.data().shape(1), 5u);
+
+  // d(sum(output)) / d(input), compared against finite differences.
+  *output.mutable_grad() = Tensor<Float>::Ones(output.data().shape());
+  network.Backward(ctx, output, &input);
+  Tensor<Float> grad = input.grad();
+  const Float eps = 1e-2;
+  for (size_t i = 0; i < input.data().size(); ++i) {
+    Float* x = input.mutable_data()->mutable_data() + i;
+    const Float origin = *x;
+    *x = origin + eps;
+    network.Forward(ctx, input, &output);
+    Float plus = Sum(output.data());
+    *x = origin - eps;
+    network.Forward(ctx, input, &output);
+    Float minus = Sum(output.data());
+    *x = origin;
+    ASSERT_LT(fabs((plus - minus) / (2 * eps) - grad.data()[i]), 1e-2);
+  }
+}
+
+TEST(NetworkTest, RejectCycle) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddLayer(&conf, "a", "Relu", "b");
+  AddLayer(&conf, "b", "Relu", "c");
+  AddLayer(&conf, "c", "Relu", "b");
+  AddLayer(&conf, "d", "Relu");
+  Network network;
+  ASSERT_TRUE(!network.Load(conf));
+}
+
+TEST(NetworkTest, RejectUnknownLayer) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddLayer(&conf, "a", "Relu", "b");
+  AddLayer(&conf, "b", "Relu")->add_inputs("x");
+  Network network;
+  ASSERT_TRUE(!network.Load(conf));
+}
+
+TEST(NetworkTest, RejectBadShapes) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 3, 4, "affine2");
+  AddAffine(&conf, "affine2", 5, 2, "");
+  Network network;
+  ASSERT_TRUE(!network.Load(conf));
+}
+
+TEST(NetworkTest, Preallocate) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  conf.set_max_batch_size(8);
+  AddAffine(&conf, "affine1", 3, 4, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 4, 2, "softmax1");
+  AddLayer(&conf, "softmax1", "Softmax");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  Context ctx;
+  auto exec = network.CreateExecutionContext();
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Ones({8, 3});
+  Variable output;
+  output.mutable_data()->Reserve(8 * 2);
+  // Warms up on a single row, so one-time setup is not counted while growing
+  // to larger batches still is.
+  input.mutable_data()->Resize({1, 3});
+  network.Forward(ctx, exec.get(), input, &output);
+  AllocCounter counter;
+  // A smaller batch first, the buffers must not shrink.
+  input.mutable_data()->Resize({2, 3});
+  network.Forward(ctx, exec.get(), input, &output);
+  input.mutable_data()->Resize({8, 3});
+  network.Forward(ctx, exec.get(), input, &output);
+  ASSERT_EQ(counter.Delta().count, 0u);
+  ASSERT_EQ(output.data().shape(0), 8u);
+}
+
+TEST(NetworkTest, Tiling) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 3, 6, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 6, 4, "softmax1");
+  AddLayer(&conf, "softmax1", "Softmax");
+  conf.set_optimize(false);
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  NetworkConfig tiled_conf;
+  network.Snapshot(&tiled_conf);
+  tiled_conf.set_phase("infer");
+  tiled_conf.set_tiling(true);
+  tiled_conf.set_tile_rows(3);
+  Network tiled;
+  ASSERT_TRUE(tiled.Load(tiled_conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({10, 3});
+  Variable expected;
+  network.Forward(ctx, input, &expected);
+  Variable output;
+  tiled.Forward(ctx, input, &output);
+  ASSERT_EQ(output.data().shape(0), 10u);
+  ASSERT_EQ(output.data().shape(1), 4u);
+  for (size_t i = 0; i < output.data().size(); ++i) {
+    ASSERT_LT(fabs(output.data().data()[i] - expected.data().data()[i]), 1e-6);
+  }
+}
+
+// Dropout passes its input through at inference, rebinding its output, yet
+// the tiles it ends still land in the output.
+TEST(NetworkTest, TilingPassThrough) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 3, 6, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "dropout1");
+  AddLayer(&conf, "dropout1", "Dropout")->mutable_dropout()->set_rate(0.5);
+  conf.set_optimize(false);
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  NetworkConfig tiled_conf;
+  network.Snapshot(&tiled_conf);
+  tiled_conf.set_phase("infer");
+  tiled_conf.set_tiling(true);
+  tiled_conf.set_tile_rows(3);
+  // Else the dropout is dropped.
+  tiled_conf.set_optimize(false);
+  Network tiled;
+  ASSERT_TRUE(tiled.Load(tiled_conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({10, 3});
+  Variable expected;
+  ASSERT_TRUE(network.Forward(ctx, input, &expected));
+  Variable output;
+  ASSERT_TRUE(tiled.Forward(ctx, input, &output));
+  ASSERT_EQ(output.data().size(), 60u);
+  for (size_t i = 0; i < output.data().size(); ++i) {
+    ASSERT_LT(fabs(output.data().data()[i] - expected.data().data()[i]), 1e-6);
+  }
+}
+
+// Only affine2 learns, so neither affine1 nor relu1 pass gradients down.
+TEST(NetworkTest, FrozenLayers) {
+  for (bool frozen : {false, true}) {
+    NetworkConfig conf;
+    conf.set_phase("train");
+    auto* affine1 = AddAffine(&conf, "affine1", 3, 4, "relu1");
+    affine1->set_trainable(!frozen);
+    AddLayer(&conf, "relu1", "Relu", "affine2");
+    AddAffine(&conf, "affine2", 4, 2, "sigmoid1");
+    AddLayer(&conf, "sigmoid1", "Sigmoid");
+    for (auto& layer : *conf.mutable_layer()) {
+      layer.add_phases("train");
+    }
+    Network network;
+    ASSERT_TRUE(network.Load(conf));
+    auto weights = network.GetWeights();
+    ASSERT_EQ(weights.size(), frozen ? 2u : 4u);
+
+    Context ctx;
+    Variable input;
+    *input.mutable_data() = Tensor<Float>::Randn({5, 3});
+    Variable output;
+    network.Forward(ctx, input, &output);
+    *output.mutable_grad() = Tensor<Float>::Ones(output.data().shape());
+    network.Backward(ctx, output, &input);
+    // The input of a train phase network is data.
+    ASSERT_TRUE(input.grad().empty());
+    for (auto* weight : weights) {
+      ASSERT_GT(Sum(weight->grad()) * Sum(weight->grad()), 0);
+    }
+  }
+}
+
+// Weight gradients of several backward passes are summed.
+TEST(NetworkTest, AccumulateGrads) {
+  NetworkConfig conf;
+  conf.set_phase("train");
+  AddAffine(&conf, "affine1", 3, 2, "sigmoid1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid");
+  for (auto& layer : *conf.mutable_layer()) {
+    layer.add_phases("train");
+  }
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({4, 3});
+  Variable output;
+  network.Forward(ctx, input, &output);
+  *output.mutable_grad() = Tensor<Float>::Ones(output.data().shape());
+  network.Backward(ctx, output, &input);
+  std::vector<Float> once;
+  for (auto* weight : network.GetWeights()) {
+    once.push_back(Sum(weight->grad()));
+  }
+  network.Backward(ctx, output, &input);
+  auto weights = network.GetWeights();
+  for (size_t i = 0; i < weights.size(); ++i) {
+    ASSERT_LT(fabs(Sum(weights[i]->grad()) - 2 * once[i]), 1e-5);
+  }
+}
+
+TEST(NetworkTest, ExecutionContextPool) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 3, 4, "sigmoid1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid");
+  conf.set_optimize(false);  // Keeps an intermediate variable.
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({2, 3});
+  Variable expected;
+  network.Forward(ctx, input, &expected);
+
+  ExecutionContextPool pool(&network, 2);
+  std::vector<std::thread> threads;
+  std::vector<int> same(4, 0);
+  for (size_t t = 0; t < same.size(); ++t) {
+    threads.emplace_back([&, t] {
+      Context ctx;
+      auto exec = pool.Acquire();
+      Variable output;
+      for (int i = 0; i < 10; ++i) {
+        network.Forward(ctx, exec.get(), input, &output);
+      }
+      const auto& y = output.data();
+      same[t] = y.size() == expected.data().size() &&
+                std::equal(y.data(), y.data() + y.size(),
+                           expected.data().data());
+      pool.Release(std::move(exec));
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int s : same) {
+    ASSERT_TRUE(s);
+  }
+  ASSERT_LE(pool.idle(), 2u);
+
+  auto exec = pool.Acquire();
+  Variable output;
+  network.Forward(ctx, exec.get(), input, &output);
+  const size_t bytes = exec->bytes();
+  ASSERT_GT(bytes, 0u);
+  // A smaller batch keeps the buffers.
+  input.mutable_data()->Resize({1, 3});
+  network.Forward(ctx, exec.get(), input, &output);
+  ASSERT_EQ(exec->bytes(), bytes);
+  exec->Shrink();
+  ASSERT_EQ(exec->bytes(), 0u);
+}
+
+}  // namespace cola
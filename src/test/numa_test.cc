@@ -0,0 +1,50 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/numa.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "test/test.h"
+
+namespace cola {
+
+class NumaTest {};
+
+TEST(NumaTest, RejectBadPolicy) {
+  NumaConfig conf;
+  conf.set_affinity("socket");
+  ASSERT_TRUE(!numa::Init(conf));
+  conf.set_affinity("none");
+  conf.set_memory("spread");
+  ASSERT_TRUE(!numa::Init(conf));
+  conf.set_memory("first_touch");
+  ASSERT_TRUE(numa::Init(conf));
+}
+
+TEST(NumaTest, PlaceWholePages) {
+  const uintptr_t page = ::sysconf(_SC_PAGESIZE);
+  auto t = numa::CreatePlaced({3, 5}, 0);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(t.data()) % page, 0u);
+  for (size_t i = 0; i < t.size(); ++i) {
+    ASSERT_EQ(t.data()[i], 0);
+  }
+  ASSERT_TRUE(numa::InterleaveMemory(t.mutable_data(), page));
+  // The page of a buffer not starting it may hold other objects.
+  ASSERT_TRUE(!numa::BindMemory(t.mutable_data() + 1, sizeof(Float), 0));
+}
+
+}  // namespace cola
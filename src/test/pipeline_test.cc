@@ -0,0 +1,228 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/pipeline.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class PipelineTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+using test::AddTrainPhase;
+using test::SetData;
+using test::WriteFile;
+
+static const char kDataPath[] = "/tmp/cola_pipeline_test_data";
+static const char kLabelPath[] = "/tmp/cola_pipeline_test_label";
+
+// Batches of 4 rows sampled from 12 with a fixed seed, so that a network
+// loaded from the config reads the same sequence of distinct batches.
+static NetworkConfig CreateConfig() {
+  std::string data;
+  std::string labels;
+  for (int i = 0; i < 12; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      data.push_back(char(i * 20 + j * 10));
+    }
+    labels.push_back(char(i % 3));
+  }
+  WriteFile(kDataPath, 16, data);
+  WriteFile(kLabelPath, 8, labels);
+
+  NetworkConfig conf;
+  conf.set_phase("train");
+  auto* data_layer = AddLayer(&conf, "data0", "Data", "affine1");
+  data_layer->clear_phases();
+  data_layer->add_phases("train");
+  auto* data_set = data_layer->mutable_data_set();
+  data_set->set_batch_size(4);
+  data_set->set_data_path(kDataPath);
+  data_set->set_data_block(4);
+  data_set->set_label_path(kLabelPath);
+  data_set->set_label_block(1);
+  data_set->set_seed(7);
+  AddAffine(&conf, "affine1", 4, 5, "sigmoid1");
+  AddLayer(&conf, "sigmoid1", "Sigmoid", "affine2");
+  AddAffine(&conf, "affine2", 5, 4, "relu1");
+  AddLayer(&conf, "relu1", "Relu", "affine3");
+  AddAffine(&conf, "affine3", 4, 3, "loss");
+  AddLayer(&conf, "loss", "SoftmaxWithLoss", "");
+  AddTrainPhase(&conf);
+  return conf;
+}
+
+// The data is read when the network is loaded.
+static void RemoveFiles() {
+  remove(kDataPath);
+  remove(kLabelPath);
+}
+
+static std::vector<Float> Grads(const Network& network) {
+  std::vector<Float> grads;
+  for (auto* weight : network.GetWeights()) {
+    const auto& grad = weight->grad();
+    grads.insert(grads.end(), grad.data(), grad.data() + grad.size());
+  }
+  return grads;
+}
+
+// The gradients summed over distinct micro-batches match sequential
+// gradient accumulation over the same batches.
+TEST(PipelineTest, SameGradients) {
+  const size_t micro_batches = 3;
+  NetworkConfig conf = CreateConfig();
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Context ctx;
+  ctx.session()->set_loss_scale(Float(1) / micro_batches);
+  Variable input;
+  Variable output;
+  // The gradient each micro-batch adds.
+  std::vector<Float> added[micro_batches];
+  std::vector<Float> expected = Grads(network);
+  for (size_t i = 0; i < micro_batches; ++i) {
+    network.Forward(ctx, input, &output);
+    network.Backward(ctx, output, &input);
+    std::vector<Float> grads = Grads(network);
+    for (size_t j = 0; j < grads.size(); ++j) {
+      added[i].push_back(grads[j] - expected[j]);
+    }
+    expected = grads;
+  }
+  for (size_t i = 1; i < micro_batches; ++i) {
+    Float diff = 0;
+    for (size_t j = 0; j < expected.size(); ++j) {
+      diff += fabs(added[i][j] - added[i - 1][j]);
+    }
+    ASSERT_GT(diff, 1e-4);
+  }
+
+  const std::vector<std::vector<std::string>> boundaries = {
+      {"affine3"}, {"affine2", "affine3"}, {"affine1", "affine2", "affine3"}};
+  for (const char* schedule : {"gpipe", "1f1b"}) {
+    for (const auto& names : boundaries) {
+      PipelineConfig pipeline_conf;
+      pipeline_conf.set_stages(names.size() + 1);
+      pipeline_conf.set_schedule(schedule);
+      // Measuring the costs would read batches, so the stages are given.
+      for (const auto& name : names) {
+        pipeline_conf.add_boundaries(name);
+      }
+      Network pipelined;
+      ASSERT_TRUE(pipelined.Load(conf));
+      Pipeline pipeline(&pipelined);
+      ASSERT_TRUE(pipeline.Load(pipeline_conf, micro_batches));
+      pipeline.Run();
+      std::vector<Float> grads = Grads(pipelined);
+      ASSERT_EQ(grads.size(), expected.size());
+      for (size_t i = 0; i < grads.size(); ++i) {
+        ASSERT_LT(fabs(grads[i] - expected[i]), 1e-5);
+      }
+    }
+  }
+
+  // The stages are balanced by the measured costs.
+  PipelineConfig pipeline_conf;
+  pipeline_conf.set_stages(3);
+  Network measured;
+  ASSERT_TRUE(measured.Load(conf));
+  Pipeline pipeline(&measured);
+  ASSERT_TRUE(pipeline.Load(pipeline_conf, micro_batches));
+  RemoveFiles();
+}
+
+// Micro-batches with an embedding index out of range fail forward, the
+// pipeline skips their backward pass like sequential training does.
+TEST(PipelineTest, SkipFailedMicroBatches) {
+  const size_t micro_batches = 4;
+  NetworkConfig conf = CreateConfig();
+  // Values of 255 read as 1, out of an embedding of one row.
+  std::string data;
+  for (int i = 0; i < 12; ++i) {
+    data += std::string(4, i < 9 ? '\0' : '\xff');
+  }
+  WriteFile(kDataPath, 16, data);
+  conf.mutable_layer(0)->set_output("embedding");
+  while (conf.layer_size() > 1) {
+    conf.mutable_layer()->RemoveLast();
+  }
+  auto* embedding = AddLayer(&conf, "embedding", "Embedding", "affine1");
+  embedding->set_input_size(4);
+  embedding->mutable_embedding()->set_rows(1);
+  embedding->mutable_embedding()->set_dims(2);
+  SetData(embedding->mutable_embedding()->mutable_weight(), {1, 2});
+  AddAffine(&conf, "affine1", 8, 3, "loss");
+  AddLayer(&conf, "loss", "SoftmaxWithLoss", "");
+  AddTrainPhase(&conf);
+
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Context ctx;
+  ctx.session()->set_loss_scale(Float(1) / micro_batches);
+  Variable input;
+  Variable output;
+  size_t failed = 0;
+  for (size_t i = 0; i < micro_batches; ++i) {
+    if (network.Forward(ctx, input, &output)) {
+      network.Backward(ctx, output, &input);
+    } else {
+      ++failed;
+    }
+  }
+  // Both kinds are sampled.
+  ASSERT_GT(failed, 0u);
+  ASSERT_LT(failed, micro_batches);
+  std::vector<Float> expected = Grads(network);
+
+  for (const char* schedule : {"gpipe", "1f1b"}) {
+    PipelineConfig pipeline_conf;
+    pipeline_conf.set_stages(2);
+    pipeline_conf.set_schedule(schedule);
+    pipeline_conf.add_boundaries("affine1");
+    Network pipelined;
+    ASSERT_TRUE(pipelined.Load(conf));
+    Pipeline pipeline(&pipelined);
+    ASSERT_TRUE(pipeline.Load(pipeline_conf, micro_batches));
+    ASSERT_TRUE(!pipeline.Run());
+    std::vector<Float> grads = Grads(pipelined);
+    ASSERT_EQ(grads.size(), expected.size());
+    for (size_t i = 0; i < grads.size(); ++i) {
+      ASSERT_LT(fabs(grads[i] - expected[i]), 1e-5);
+    }
+  }
+  RemoveFiles();
+}
+
+TEST(PipelineTest, BadConfig) {
+  Network network;
+  ASSERT_TRUE(network.Load(CreateConfig()));
+  PipelineConfig conf;
+  conf.set_stages(2);
+  conf.add_boundaries("missing");
+  Pipeline pipeline(&network);
+  ASSERT_TRUE(!pipeline.Load(conf, 2));
+  RemoveFiles();
+}
+
+}  // namespace cola
@@ -0,0 +1,95 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/plan_cache.h"
+
+#include <stdio.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class PlanCacheTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+
+static void WriteModel(const NetworkConfig& conf, const std::string& path) {
+  std::ofstream os(path, std::ios::binary);
+  conf.SerializeToOstream(&os);
+}
+
+TEST(PlanCacheTest, HitAfterMiss) {
+  const std::string dir = "/tmp/cola_plan_cache_test";
+  const std::string model = dir + ".model";
+  std::filesystem::remove_all(dir);
+  NetworkConfig conf;
+  AddAffine(&conf, "affine1", 6, 5, "relu");
+  AddLayer(&conf, "relu", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 5, 3, "softmax");
+  AddLayer(&conf, "softmax", "SoftmaxWithLoss", "");
+  WriteModel(conf, model);
+
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({4, 6});
+  Context ctx;
+  Variable y;
+  {
+    PlanCache cache(dir);
+    NetworkConfig loaded;
+    ASSERT_TRUE(cache.Open(model, &loaded));
+    ASSERT_TRUE(!cache.hit());
+    Network network;
+    ASSERT_TRUE(network.Load(loaded));
+    ASSERT_TRUE(cache.Insert(&network));
+    network.Forward(ctx, input, &y);
+  }
+
+  PlanCache cache(dir);
+  NetworkConfig loaded;
+  ASSERT_TRUE(cache.Open(model, &loaded));
+  ASSERT_TRUE(cache.hit());
+  // The cached layers are the fused ones, with their weights in the file.
+  ASSERT_EQ(loaded.layer_size(), 3);
+  ASSERT_EQ(loaded.layer(0).type(), "FusedAffine");
+  ASSERT_EQ(loaded.layer(0).affine().weight().filler(), "file");
+  ASSERT_TRUE(!loaded.optimize());
+  loaded.set_stream_weights(true);
+  Network network;
+  ASSERT_TRUE(network.Load(loaded));
+  cache.Map(&network);
+  Variable z;
+  network.Forward(ctx, input, &z);
+  ASSERT_EQ(y.data().size(), z.data().size());
+  for (size_t i = 0; i < y.data().size(); ++i) {
+    ASSERT_EQ(y.data().data()[i], z.data().data()[i]);
+  }
+
+  // Another model misses.
+  auto* bias = conf.mutable_layer(0)->mutable_affine()->mutable_bias();
+  (*bias->mutable_data())[0] ^= 1;
+  WriteModel(conf, model);
+  PlanCache other(dir);
+  ASSERT_TRUE(other.Open(model, &loaded));
+  ASSERT_TRUE(!other.hit());
+  std::filesystem::remove_all(dir);
+  remove(model.c_str());
+}
+
+}  // namespace cola
@@ -0,0 +1,84 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/pointwise_conv2d_layer.h"
+
+#include <math.h>
+
+#include "cola/layers/conv2d_layer.h"
+#include "test/test.h"
+
+namespace cola {
+
+class PointwiseConv2DTest {};
+
+// The output and the input and weight gradients of `layer`.
+static std::vector<Tensor<Float>> RunPointwise(Layer* layer,
+                                               const LayerConfig& config,
+                                               const Tensor<Float>& x,
+                                               const Tensor<Float>& dy) {
+  ASSERT_TRUE(layer->Load(config));
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = x;
+  Variable output;
+  layer->Forward(ctx, input, &output);
+  *output.mutable_grad() = dy;
+  auto weights = layer->GetWeights();
+  for (auto* weight : weights) {
+    *weight->mutable_grad() = Tensor<Float>::Zeros(weight->data().shape());
+  }
+  layer->Backward(ctx, output, &input);
+  return {output.data(), input.grad(), weights[0]->grad(),
+          weights[1]->grad()};
+}
+
+TEST(PointwiseConv2DTest, SameAsConv) {
+  const size_t C = 5, H = 4, W = 3, F = 7, M = 3;
+  LayerConfig config;
+  config.set_name("pointwise");
+  config.set_type("PointwiseConv2D");
+  auto* conv = config.mutable_conv();
+  conv->set_channels(C);
+  conv->set_height(H);
+  conv->set_width(W);
+  conv->set_filters(F);
+  conv->set_kernel(1);
+  conv->mutable_weight()->set_filler("normal");
+  conv->mutable_bias()->set_filler("normal");
+  PointwiseConv2DLayer layer;
+  ASSERT_TRUE(layer.Load(config));
+  layer.Snapshot(&config);
+  ASSERT_EQ(layer.layer_config().output_size(), F * H * W);
+
+  auto x = Tensor<Float>::Randn({M, C * H * W});
+  auto dy = Tensor<Float>::Randn({M, F * H * W});
+  PointwiseConv2DLayer pointwise;
+  auto got = RunPointwise(&pointwise, config, x, dy);
+  Conv2DLayer im2col;
+  auto expected = RunPointwise(&im2col, config, x, dy);
+  for (size_t i = 0; i < got.size(); ++i) {
+    ASSERT_EQ(got[i].size(), expected[i].size());
+    for (size_t j = 0; j < got[i].size(); ++j) {
+      ASSERT_LT(fabs(got[i].data()[j] - expected[i].data()[j]), 1e-4);
+    }
+  }
+  // Only 1 x 1 kernels of stride 1.
+  config.mutable_conv()->set_stride(2);
+  PointwiseConv2DLayer strided;
+  ASSERT_TRUE(!strided.Load(config));
+}
+
+}  // namespace cola
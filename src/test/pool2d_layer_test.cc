@@ -0,0 +1,137 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/layers/pool2d_layer.h"
+
+#include <math.h>
+
+#include "test/test.h"
+
+namespace cola {
+
+class Pool2DTest {};
+
+// Pools `config` with `layer` and checks the output and the input gradient
+// against a direct computation over every window.
+static void CheckPool(Layer* layer, const LayerConfig& config, bool max,
+                      size_t kernel, size_t stride, size_t padding) {
+  const auto& pool = config.pool();
+  const size_t C = pool.channels(), H = pool.height(), W = pool.width();
+  const size_t OH = (H + 2 * padding - kernel) / stride + 1;
+  const size_t OW = (W + 2 * padding - kernel) / stride + 1;
+  const size_t M = 2;
+  ASSERT_TRUE(layer->Load(config));
+  ASSERT_EQ(layer->layer_config().output_size(), C * OH * OW);
+
+  Context ctx;
+  Variable input;
+  *input.mutable_data() = Tensor<Float>::Randn({M, C * H * W});
+  Variable output;
+  layer->Forward(ctx, input, &output);
+  *output.mutable_grad() = Tensor<Float>::Randn(output.data().shape());
+  layer->Backward(ctx, output, &input);
+
+  const Float* x = input.data().data();
+  const Float* dy = output.grad().data();
+  std::vector<Float> dx(M * C * H * W, 0);
+  for (size_t i = 0; i < M * C; ++i) {
+    for (size_t p = 0; p < OH * OW; ++p) {
+      Float y = 0;
+      long arg = -1;
+      size_t count = 0;
+      for (size_t ki = 0; ki < kernel; ++ki) {
+        for (size_t kj = 0; kj < kernel; ++kj) {
+          const long r = long(p / OW * stride + ki) - long(padding);
+          const long c = long(p % OW * stride + kj) - long(padding);
+          if (r < 0 || r >= long(H) || c < 0 || c >= long(W)) {
+            continue;
+          }
+          const long xi = (i * H + r) * W + c;
+          if (!max) {
+            y += x[xi];
+          } else if (arg < 0 || x[xi] > y) {
+            y = x[xi];
+            arg = xi;
+          }
+          ++count;
+        }
+      }
+      const size_t o = i * OH * OW + p;
+      if (max) {
+        dx[arg] += dy[o];
+      } else {
+        y /= count;
+        for (size_t ki = 0; ki < kernel; ++ki) {
+          for (size_t kj = 0; kj < kernel; ++kj) {
+            const long r = long(p / OW * stride + ki) - long(padding);
+            const long c = long(p % OW * stride + kj) - long(padding);
+            if (r >= 0 && r < long(H) && c >= 0 && c < long(W)) {
+              dx[(i * H + r) * W + c] += dy[o] / count;
+            }
+          }
+        }
+      }
+      ASSERT_LT(fabs(y - output.data().data()[o]), 1e-5);
+    }
+  }
+  for (size_t i = 0; i < dx.size(); ++i) {
+    ASSERT_LT(fabs(dx[i] - input.grad().data()[i]), 1e-5);
+  }
+}
+
+static LayerConfig CreatePool(const std::string& type, size_t channels,
+                              size_t height, size_t width, size_t kernel,
+                              size_t stride, size_t padding) {
+  LayerConfig config;
+  config.set_name("pool");
+  config.set_type(type);
+  auto* pool = config.mutable_pool();
+  pool->set_channels(channels);
+  pool->set_height(height);
+  pool->set_width(width);
+  pool->set_kernel(kernel);
+  pool->set_stride(stride);
+  pool->set_padding(padding);
+  return config;
+}
+
+TEST(Pool2DTest, MaxPool) {
+  MaxPool2DLayer layer;
+  CheckPool(&layer, CreatePool("MaxPool2D", 3, 7, 6, 3, 2, 1), true, 3, 2,
+            1);
+  // Windows of more than 256 pixels keep 16-bit indices.
+  MaxPool2DLayer wide;
+  CheckPool(&wide, CreatePool("MaxPool2D", 2, 20, 19, 17, 2, 0), true, 17,
+            2, 0);
+  // The stride defaults to the kernel.
+  MaxPool2DLayer tiled;
+  CheckPool(&tiled, CreatePool("MaxPool2D", 2, 8, 8, 2, 0, 0), true, 2, 2,
+            0);
+}
+
+TEST(Pool2DTest, AvgPool) {
+  AvgPool2DLayer layer;
+  CheckPool(&layer, CreatePool("AvgPool2D", 3, 7, 6, 3, 2, 1), false, 3, 2,
+            1);
+  // Of 25 pixels, summed by the lanes and the rest.
+  GlobalAvgPool2DLayer global;
+  CheckPool(&global, CreatePool("GlobalAvgPool2D", 4, 5, 5, 0, 0, 0), false,
+            5, 1, 0);
+  // Padding as large as the window.
+  AvgPool2DLayer bad;
+  ASSERT_TRUE(!bad.Load(CreatePool("AvgPool2D", 3, 7, 6, 3, 1, 3)));
+}
+
+}  // namespace cola
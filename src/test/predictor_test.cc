@@ -0,0 +1,117 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/predictor.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class PredictorTest {};
+
+using test::AddAffine;
+using test::AddLayer;
+
+// Extracts the activations of relu1 from rows of 6 bytes, in batches of 3
+// rows, the last one partial, and from a model whose plan is cached, which
+// holds affine1 and relu1 fused.
+TEST(PredictorTest, ExtractActivations) {
+  const std::string prefix = "/tmp/cola_predictor_test";
+  const std::string model = prefix + ".model";
+  const std::string input = prefix + ".input";
+  const std::string output = prefix + ".output";
+  const std::string cache = prefix + "_plans";
+  std::filesystem::remove_all(cache);
+  NetworkConfig conf;
+  AddAffine(&conf, "affine1", 6, 5, "relu1", 1, Float(1) / 64);
+  AddLayer(&conf, "relu1", "Relu", "affine2");
+  AddAffine(&conf, "affine2", 5, 3, "softmax", 3, Float(1) / 64);
+  AddLayer(&conf, "softmax", "Softmax", "");
+  {
+    std::ofstream os(model, std::ios::binary);
+    conf.SerializeToOstream(&os);
+  }
+  const size_t rows = 7;
+  std::string bytes;
+  for (size_t i = 0; i < rows * 6; ++i) {
+    bytes.push_back(char(i * 37 % 251));
+  }
+  {
+    std::ofstream os(input, std::ios::binary);
+    os << bytes;
+  }
+
+  conf.set_phase("infer");
+  conf.set_output_layer("relu1");
+  Network network;
+  ASSERT_TRUE(network.Load(conf));
+  Variable x;
+  *x.mutable_data() = Tensor<Float>::Create({rows, 6});
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    x.mutable_data()->mutable_data()[i] = Byte(bytes[i]);
+  }
+  Context ctx;
+  Variable expected;
+  ASSERT_TRUE(network.Forward(ctx, x, &expected));
+  ASSERT_EQ(expected.data().count(1), 5u);
+
+  for (int cached = 0; cached < 2; ++cached) {
+    Config runtime;
+    if (cached) {
+      runtime.set_plan_cache(cache);
+      Predictor warm;
+      ASSERT_TRUE(warm.Load(model, runtime));
+    }
+    runtime.set_output_layer("relu1");
+    runtime.set_extract_batch_size(3);
+    Predictor predictor;
+    ASSERT_TRUE(predictor.Load(model, runtime));
+    ASSERT_TRUE(predictor.Extract(input, output));
+
+    std::ifstream is(output, std::ios::binary);
+    std::vector<Float> y(expected.data().size());
+    is.read(reinterpret_cast<char*>(y.data()), y.size() * sizeof(Float));
+    ASSERT_EQ(size_t(is.gcount()), y.size() * sizeof(Float));
+    ASSERT_TRUE(is.peek() == EOF);
+    for (size_t i = 0; i < y.size(); ++i) {
+      ASSERT_LT(fabs(y[i] - expected.data().data()[i]), 1e-5);
+    }
+  }
+  ASSERT_TRUE(!std::filesystem::is_empty(cache));
+
+  // Rows of another width are rejected.
+  {
+    std::ofstream os(input, std::ios::binary);
+    os << "12345678";
+  }
+  Predictor predictor;
+  ASSERT_TRUE(predictor.Load(model, Config()));
+  ASSERT_TRUE(!predictor.Extract(input, output));
+  std::filesystem::remove_all(cache);
+  for (const auto& path : {model, input, output}) {
+    remove(path.c_str());
+  }
+}
+
+}  // namespace cola
@@ -0,0 +1,94 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "test/test_util.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace cola {
+namespace test {
+
+std::vector<Float> Values(size_t count, Float seed, Float scale) {
+  std::vector<Float> data(count);
+  for (size_t i = 0; i < count; ++i) {
+    data[i] = cos(seed * Float(i + 1)) * scale;
+  }
+  return data;
+}
+
+void SetData(WeightConfig* wc, const std::vector<size_t>& shape, Float seed,
+             Float scale) {
+  size_t count = 1;
+  for (size_t dim : shape) {
+    wc->mutable_shape()->add_dims(dim);
+    count *= dim;
+  }
+  auto data = Values(count, seed, scale);
+  wc->set_filler("data");
+  wc->set_data(data.data(), count * sizeof(Float));
+}
+
+void SetValues(WeightConfig* wc, const std::vector<Float>& values) {
+  wc->mutable_shape()->add_dims(values.size());
+  wc->set_filler("data");
+  wc->set_data(values.data(), values.size() * sizeof(Float));
+}
+
+LayerConfig* AddLayer(NetworkConfig* conf, const std::string& name,
+                      const std::string& type, const std::string& output) {
+  LayerConfig* layer = conf->add_layer();
+  layer->set_name(name);
+  layer->set_type(type);
+  layer->set_output(output);
+  layer->add_phases("infer");
+  return layer;
+}
+
+LayerConfig* AddAffine(NetworkConfig* conf, const std::string& name,
+                       size_t input_size, size_t output_size,
+                       const std::string& output, Float seed, Float scale) {
+  LayerConfig* layer = AddLayer(conf, name, "Affine", output);
+  layer->set_input_size(input_size);
+  layer->set_output_size(output_size);
+  SetData(layer->mutable_affine()->mutable_weight(),
+          {input_size, output_size}, seed, scale);
+  SetData(layer->mutable_affine()->mutable_bias(), {output_size}, seed + 1,
+          scale);
+  return layer;
+}
+
+void AddTrainPhase(NetworkConfig* conf) {
+  for (auto& layer : *conf->mutable_layer()) {
+    const auto& phases = layer.phases();
+    if (std::find(phases.begin(), phases.end(), "train") == phases.end()) {
+      layer.add_phases("train");
+    }
+  }
+}
+
+void WriteFile(const std::string& path, size_t header,
+               const std::string& bytes) {
+  std::string data(header, '\0');
+  data += bytes;
+  FILE* f = fopen(path.c_str(), "wb");
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+}
+
+}  // namespace test
+}  // namespace cola
@@ -0,0 +1,61 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TEST_TEST_UTIL_H_
+#define TEST_TEST_UTIL_H_
+
+#include <string>
+#include <vector>
+
+#include "cola/base/types.h"
+#include "cola/proto/cola.pb.h"
+
+namespace cola {
+namespace test {
+
+// Returns cos(seed * (i + 1)) * scale for i < count, deterministic values
+// for weights and inputs.
+std::vector<Float> Values(size_t count, Float seed = 1, Float scale = 0.5);
+
+// Fills wc with Values of the given shape.
+void SetData(WeightConfig* wc, const std::vector<size_t>& shape,
+             Float seed = 1, Float scale = 0.5);
+
+// Fills wc with `values`, a vector of their count.
+void SetValues(WeightConfig* wc, const std::vector<Float>& values);
+
+// Appends a layer of the infer phase to conf.
+LayerConfig* AddLayer(NetworkConfig* conf, const std::string& name,
+                      const std::string& type,
+                      const std::string& output = "");
+
+// Appends an Affine layer whose weight holds the Values of seed and whose
+// bias holds those of seed + 1.
+LayerConfig* AddAffine(NetworkConfig* conf, const std::string& name,
+                       size_t input_size, size_t output_size,
+                       const std::string& output, Float seed = 1,
+                       Float scale = 0.5);
+
+// Adds the train phase to the layers of conf without it.
+void AddTrainPhase(NetworkConfig* conf);
+
+// Writes `header` zero bytes followed by `bytes` to path.
+void WriteFile(const std::string& path, size_t header,
+               const std::string& bytes);
+
+}  // namespace test
+}  // namespace cola
+
+#endif  // TEST_TEST_UTIL_H_
@@ -0,0 +1,85 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/base/thread_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "cola/base/alloc_counter.h"
+#include "test/test.h"
+
+namespace cola {
+
+class ThreadPoolTest {};
+
+TEST(ThreadPoolTest, ParallelFor) {
+  ThreadPool pool(4);
+  std::vector<int> hits(100000, 0);
+  for (size_t grain : {1, 7, 1000, 200000}) {
+    pool.ParallelFor(0, hits.size(), grain, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        ++hits[i];
+      }
+    });
+  }
+  for (int h : hits) {
+    ASSERT_EQ(h, 4);
+  }
+}
+
+TEST(ThreadPoolTest, ParallelReduce) {
+  ThreadPool pool(4);
+  auto sum = [&](size_t grain) {
+    return pool.ParallelReduce(
+        0, 100001, grain, size_t(0),
+        [](size_t begin, size_t end) {
+          size_t s = 0;
+          for (size_t i = begin; i < end; ++i) {
+            s += i;
+          }
+          return s;
+        },
+        [](size_t a, size_t b) { return a + b; });
+  };
+  ASSERT_EQ(sum(3), size_t(5000050000));
+  ASSERT_EQ(sum(100), size_t(5000050000));
+  ASSERT_EQ(sum(1000000), size_t(5000050000));
+}
+
+TEST(ThreadPoolTest, Nested) {
+  ThreadPool pool(4);
+  std::atomic<size_t> n(0);
+  pool.ParallelFor(0, 64, 1, [&](size_t begin, size_t end) {
+    pool.ParallelFor(0, 64, 1, [&](size_t b, size_t e) { n += e - b; });
+  });
+  ASSERT_EQ(n.load(), 64u * 64u);
+}
+
+TEST(ThreadPoolTest, NoAllocs) {
+  ThreadPool pool(4);
+  std::vector<float> v(1 << 16, 1.f);
+  auto scale = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      v[i] *= 2.f;
+    }
+  };
+  pool.ParallelFor(0, v.size(), 64, scale);
+  AllocCounter counter;
+  pool.ParallelFor(0, v.size(), 64, scale);
+  ASSERT_EQ(counter.Delta().count, 0u);
+}
+
+}  // namespace cola
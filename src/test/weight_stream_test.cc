@@ -0,0 +1,109 @@
+//
+// Copyright 2020 Zacharier
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0//
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cola/core/weight_stream.h"
+
+#include <unistd.h>
+
+#include "test/test.h"
+#include "test/test_util.h"
+
+namespace cola {
+
+class WeightStreamTest {};
+
+using test::AddAffine;
+
+TEST(WeightStreamTest, StreamedForward) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 8, "relu");
+  LayerConfig* relu = conf.add_layer();
+  relu->set_name("relu");
+  relu->set_type("Relu");
+  relu->set_output("affine2");
+  relu->add_phases("infer");
+  AddAffine(&conf, "affine2", 8, 3, "");
+  Network origin;
+  ASSERT_TRUE(origin.Load(conf));
+
+  const std::string path = "/tmp/cola_weight_stream_test.bin";
+  ASSERT_TRUE(WeightStream::Externalize(path, &conf));
+  ASSERT_EQ(conf.layer(0).affine().weight().filler(), "file");
+  ASSERT_TRUE(conf.layer(2).affine().bias().data().empty());
+  ASSERT_EQ(conf.layer(2).affine().weight().offset() % 4096, 0u);
+  Network eager;
+  ASSERT_TRUE(eager.Load(conf));
+  conf.set_stream_weights(true);
+
+  const size_t bytes = (4 * 8 + 8 + 8 * 3 + 3) * sizeof(Float);
+  for (size_t depth = 1; depth <= 3; ++depth) {
+    Network streamed;
+    ASSERT_TRUE(streamed.Load(conf));
+    WeightStream stream;
+    ASSERT_TRUE(stream.Open(&streamed, depth));
+    streamed.set_weight_stream(&stream);
+    Context ctx;
+    for (size_t iter = 0; iter < 3; ++iter) {
+      Variable input;
+      *input.mutable_data() = Tensor<Float>::Randn({5, 4});
+      Variable y;
+      Variable z;
+      Variable w;
+      origin.Forward(ctx, input, &y);
+      eager.Forward(ctx, input, &z);
+      ASSERT_TRUE(streamed.Forward(ctx, input, &w));
+      ASSERT_EQ(y.data().size(), w.data().size());
+      for (size_t i = 0; i < y.data().size(); ++i) {
+        ASSERT_EQ(y.data().data()[i], z.data().data()[i]);
+        ASSERT_EQ(y.data().data()[i], w.data().data()[i]);
+      }
+    }
+    ASSERT_GE(stream.stats().bytes, 3 * bytes);
+  }
+  remove(path.c_str());
+}
+
+// Weights missing from the file fail Forward instead of the process.
+TEST(WeightStreamTest, ReadError) {
+  NetworkConfig conf;
+  conf.set_phase("infer");
+  AddAffine(&conf, "affine1", 4, 8, "affine2");
+  AddAffine(&conf, "affine2", 8, 3, "");
+  const std::string path = "/tmp/cola_weight_stream_test_truncated.bin";
+  ASSERT_TRUE(WeightStream::Externalize(path, &conf));
+  conf.set_stream_weights(true);
+  Network streamed;
+  ASSERT_TRUE(streamed.Load(conf));
+  WeightStream stream;
+  ASSERT_TRUE(stream.Open(&streamed, 1));
+  // The weights of affine2 start at the second page, which is read once
+  // the buffer of affine1 is released.
+  ASSERT_EQ(truncate(path.c_str(), 4096), 0);
+  streamed.set_weight_stream(&stream);
+  Context ctx;
+  // The stream stops reading at the error.
+  for (const char* layer : {"affine2", "affine1"}) {
+    Variable input;
+    *input.mutable_data() = Tensor<Float>::Randn({5, 4});
+    Variable output;
+    ASSERT_TRUE(!streamed.Forward(ctx, input, &output));
+    ASSERT_EQ(ctx.session()->error(),
+              std::string("[WeightStream] weights of ") + layer + " not read");
+  }
+  remove(path.c_str());
+}
+
+}  // namespace cola